@@ -0,0 +1,516 @@
+#ifndef HRSC_ASYNC_IO_H
+#define HRSC_ASYNC_IO_H
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <deque>
+#include <set>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <opencv2/opencv.hpp>
+#ifdef HRSC_USE_IO_URING
+  #include <liburing.h>
+#endif
+
+#include <boost/shared_ptr.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <HrscFileIo.h>
+#include <HrscImageIo.h>
+
+
+//=========================================================================================
+// Asynchronous file reads
+
+// Tools which read many input files can start all of the reads at once and decode each
+// file as soon as it arrives instead of blocking on every read in turn.
+// - Built with HRSC_USE_IO_URING the reads of a batch are handed to an io_uring with one
+//   system call.  Files which fit are read in to buffers registered with the ring so their
+//   pages are not mapped again for every read.
+// - Otherwise, or if the ring can not be created, the reads are done with pread on the
+//   worker threads.
+// - If waiting on the ring fails, the reads in flight fail and later reads use pread.
+// - Completion callbacks run on the worker threads so decoding happens in parallel.  The
+//   data passed to a callback is only valid until it returns, and a callback must not
+//   wait on the reader.
+
+/// Called with the contents of a file, or with success false if it could not be read.
+typedef boost::function<void (bool success, const char* data, size_t size)> FileReadCallback;
+
+class AsyncFileReader
+{
+public:
+
+  /// - queueDepth is the largest number of reads in flight at once.
+  /// - Files up to registeredBufferSize bytes are read in to one of the registered
+  ///   buffers when one is free, otherwise in to their own buffer.
+  AsyncFileReader(const int numThreads=2, const int queueDepth=32,
+                  const int numRegisteredBuffers=0, const size_t registeredBufferSize=0)
+    : _queueDepth(queueDepth), _bufferSize(registeredBufferSize),
+      _buffers(numRegisteredBuffers*registeredBufferSize), _outstanding(0), _stopping(false)
+  {
+    for (int i=0; i<numRegisteredBuffers; ++i)
+      _freeBuffers.push_back(i);
+#ifdef HRSC_USE_IO_URING
+    _inFlight          = 0;
+    _ringFailed        = false;
+    _buffersRegistered = false;
+    _ringOpen          = (io_uring_queue_init(queueDepth, &_ring, 0) == 0);
+    if (_ringOpen)
+    {
+      if (numRegisteredBuffers > 0)
+      {
+        std::vector<struct iovec> buffers(numRegisteredBuffers);
+        for (int i=0; i<numRegisteredBuffers; ++i)
+        {
+          buffers[i].iov_base = &_buffers[i*_bufferSize];
+          buffers[i].iov_len  = _bufferSize;
+        }
+        // This fails if the memory lock limit is too low, the buffers are still used
+        _buffersRegistered = (io_uring_register_buffers(&_ring, &buffers[0], numRegisteredBuffers) == 0);
+      }
+      _reaper = boost::thread(boost::bind(&AsyncFileReader::reapCompletions, this));
+    }
+#endif
+    for (int i=0; i<std::max(numThreads, 1); ++i)
+      _threads.create_thread(boost::bind(&AsyncFileReader::runTasks, this));
+  }
+
+  ~AsyncFileReader()
+  {
+    wait();
+#ifdef HRSC_USE_IO_URING
+    if (_ringOpen)
+    {
+      // A read with no request tells the reaper to stop
+      {
+        boost::mutex::scoped_lock lock(_ringMutex);
+        struct io_uring_sqe *sqe = getSubmissionEntry();
+        io_uring_prep_nop(sqe);
+        io_uring_sqe_set_data(sqe, NULL);
+        io_uring_submit(&_ring);
+      }
+      _reaper.join();
+      if (_buffersRegistered)
+        io_uring_unregister_buffers(&_ring);
+      io_uring_queue_exit(&_ring);
+    }
+#endif
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      _stopping = true;
+    }
+    _taskCondition.notify_all();
+    _threads.join_all();
+  }
+
+  /// Returns true if reads go through io_uring
+  bool usingIoUring() const
+  {
+#ifdef HRSC_USE_IO_URING
+    return _ringOpen;
+#else
+    return false;
+#endif
+  }
+
+  /// Queue a read of a whole file, nothing is read until submit is called.
+  void read(const std::string &path, const FileReadCallback &callback)
+  {
+    Request *request = new Request();
+    request->path        = path;
+    request->callback    = callback;
+    request->fd          = -1;
+    request->size        = 0;
+    request->done        = 0;
+    request->data        = NULL;
+    request->bufferIndex = -1;
+    boost::mutex::scoped_lock lock(_mutex);
+    ++_outstanding;
+    _queued.push_back(request);
+  }
+
+  /// Start all of the queued reads.
+  void submit()
+  {
+    std::vector<Request*> requests;
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      requests.swap(_queued);
+    }
+#ifdef HRSC_USE_IO_URING
+    size_t first = 0;
+    if (_ringOpen)
+    {
+      boost::mutex::scoped_lock lock(_ringMutex);
+      for (; (first<requests.size()) && !_ringFailed; ++first)
+      {
+        Request *request = requests[first];
+        while ((_inFlight >= _queueDepth) && !_ringFailed)
+        {
+          io_uring_submit(&_ring);
+          _ringCondition.wait(lock);
+        }
+        if (_ringFailed)
+          break;
+        const bool opened = openRequest(request);
+        if (!opened || (request->size == 0))
+        {
+          pushTask(boost::bind(&AsyncFileReader::finishRequest, this, request, opened));
+          continue;
+        }
+        queueRingRead(request);
+      }
+      io_uring_submit(&_ring);
+    }
+    // Any reads the ring did not take are done with pread
+    for (size_t i=first; i<requests.size(); ++i)
+      pushTask(boost::bind(&AsyncFileReader::readFile, this, requests[i]));
+#else
+    for (size_t i=0; i<requests.size(); ++i)
+      pushTask(boost::bind(&AsyncFileReader::readFile, this, requests[i]));
+#endif
+  }
+
+  /// Run a task on the worker threads, such as reading an image which is not a plain file.
+  void post(const boost::function<void ()> &task)
+  {
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      ++_outstanding;
+    }
+    pushTask(task);
+  }
+
+  /// Submit any queued reads and wait until all of the reads and tasks have finished.
+  void wait()
+  {
+    submit();
+    boost::mutex::scoped_lock lock(_mutex);
+    while (_outstanding > 0)
+      _idleCondition.wait(lock);
+  }
+
+private:
+
+  struct Request
+  {
+    std::string       path;
+    FileReadCallback  callback;
+    int               fd;
+    size_t            size;
+    size_t            done;
+    char*             data;
+    std::vector<char> ownData;     ///< Used when no registered buffer is free
+    int               bufferIndex; ///< The registered buffer, or -1
+  };
+
+  const int    _queueDepth;
+  const size_t _bufferSize;
+  std::vector<char> _buffers;
+  std::vector<int>  _freeBuffers;
+
+  boost::thread_group       _threads;
+  boost::mutex              _mutex;
+  boost::condition_variable _taskCondition;
+  boost::condition_variable _idleCondition;
+  std::deque<boost::function<void ()> > _tasks;
+  std::vector<Request*> _queued;
+  int  _outstanding; ///< Reads and tasks which have not finished
+  bool _stopping;
+
+#ifdef HRSC_USE_IO_URING
+  struct io_uring           _ring;
+  bool                      _ringOpen;
+  bool                      _buffersRegistered;
+  boost::mutex              _ringMutex; ///< Guards the submission queue
+  boost::condition_variable _ringCondition;
+  int                       _inFlight;
+  std::set<Request*>        _ringRequests; ///< Reads queued on the ring
+  bool                      _ringFailed;   ///< Set if waiting on the ring failed
+  boost::thread             _reaper;
+#endif
+
+  void pushTask(const boost::function<void ()> &task)
+  {
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      _tasks.push_back(task);
+    }
+    _taskCondition.notify_one();
+  }
+
+  void runTasks()
+  {
+    while (true)
+    {
+      boost::function<void ()> task;
+      {
+        boost::mutex::scoped_lock lock(_mutex);
+        while (_tasks.empty() && !_stopping)
+          _taskCondition.wait(lock);
+        if (_tasks.empty())
+          return;
+        task = _tasks.front();
+        _tasks.pop_front();
+      }
+      task();
+      boost::mutex::scoped_lock lock(_mutex);
+      if (--_outstanding == 0)
+        _idleCondition.notify_all();
+    }
+  }
+
+  /// Open the file and pick the buffer to read it in to.
+  bool openRequest(Request *request)
+  {
+    request->fd = open(request->path.c_str(), O_RDONLY);
+    struct stat info;
+    if ((request->fd < 0) || (fstat(request->fd, &info) != 0))
+      return false;
+    request->size = info.st_size;
+    posix_fadvise(request->fd, 0, 0, POSIX_FADV_SEQUENTIAL); // Whole files, read ahead further
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      if ((request->size <= _bufferSize) && !_freeBuffers.empty())
+      {
+        request->bufferIndex = _freeBuffers.back();
+        _freeBuffers.pop_back();
+        request->data = &_buffers[request->bufferIndex*_bufferSize];
+        return true;
+      }
+    }
+    request->ownData.resize(request->size);
+    request->data = request->ownData.empty() ? NULL : &request->ownData[0];
+    return true;
+  }
+
+  /// Read a file with pread when there is no ring.
+  void readFile(Request *request)
+  {
+    bool success = openRequest(request);
+    while (success && (request->done < request->size))
+    {
+      const ssize_t count = pread(request->fd, request->data + request->done,
+                                  request->size - request->done, request->done);
+      success = (count > 0);
+      if (success)
+        request->done += count;
+    }
+    finishRequest(request, success);
+  }
+
+  /// Pass the data to the callback and release the request.
+  void finishRequest(Request *request, const bool success)
+  {
+    if (!success)
+      printf("Failed to read file %s\n", request->path.c_str());
+    request->callback(success, success ? request->data : NULL, success ? request->size : 0);
+    if (request->fd >= 0)
+      ::close(request->fd);
+    if (request->bufferIndex >= 0)
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      _freeBuffers.push_back(request->bufferIndex);
+    }
+    delete request;
+  }
+
+#ifdef HRSC_USE_IO_URING
+  /// Get a free submission entry, the ring mutex must be held.
+  struct io_uring_sqe* getSubmissionEntry()
+  {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&_ring);
+    while (!sqe)
+    {
+      io_uring_submit(&_ring);
+      sqe = io_uring_get_sqe(&_ring);
+    }
+    return sqe;
+  }
+
+  /// Queue a read of the rest of a file, the ring mutex must be held.
+  void queueRingRead(Request *request)
+  {
+    const size_t MAX_READ_SIZE = 1 << 30; // Reads return at most about 2 GB
+    const size_t length = std::min(request->size - request->done, MAX_READ_SIZE);
+    struct io_uring_sqe *sqe = getSubmissionEntry();
+    if (_buffersRegistered && (request->bufferIndex >= 0))
+      io_uring_prep_read_fixed(sqe, request->fd, request->data + request->done, length,
+                               request->done, request->bufferIndex);
+    else
+      io_uring_prep_read(sqe, request->fd, request->data + request->done, length, request->done);
+    io_uring_sqe_set_data(sqe, request);
+    _ringRequests.insert(request);
+    ++_inFlight;
+  }
+
+  /// Fail every read still on the ring and send later reads to pread.
+  void failRingRequests(const int error)
+  {
+    printf("Failed to wait on io_uring: %s\n", strerror(-error));
+    boost::mutex::scoped_lock lock(_ringMutex);
+    _ringFailed = true;
+    for (std::set<Request*>::iterator iter=_ringRequests.begin(); iter!=_ringRequests.end(); ++iter)
+      pushTask(boost::bind(&AsyncFileReader::finishRequest, this, *iter, false));
+    _ringRequests.clear();
+    _inFlight = 0;
+    _ringCondition.notify_all();
+  }
+
+  /// Hand each finished read to the worker threads, re-queueing short reads.
+  void reapCompletions()
+  {
+    while (true)
+    {
+      struct io_uring_cqe *cqe;
+      const int status = io_uring_wait_cqe(&_ring, &cqe);
+      if (status == -EINTR)
+        continue;
+      if (status != 0)
+      {
+        failRingRequests(status);
+        return;
+      }
+      Request   *request = static_cast<Request*>(io_uring_cqe_get_data(cqe));
+      const int  result  = cqe->res;
+      io_uring_cqe_seen(&_ring, cqe);
+      if (!request)
+        return;
+
+      boost::mutex::scoped_lock lock(_ringMutex);
+      --_inFlight;
+      _ringRequests.erase(request);
+      if (result > 0)
+        request->done += result;
+      if ((result > 0) && (request->done < request->size))
+      {
+        queueRingRead(request);
+        io_uring_submit(&_ring);
+        continue;
+      }
+      _ringCondition.notify_all();
+      lock.unlock();
+      pushTask(boost::bind(&AsyncFileReader::finishRequest, this, request,
+                           (result >= 0) && (request->done == request->size)));
+    }
+  }
+#endif
+};
+
+/// Reads and decodes images on an AsyncFileReader so they are ready when they are needed.
+/// - Images are read with the same rules as readOpenCvImage.
+class AsyncImageLoader
+{
+public:
+
+  AsyncImageLoader(AsyncFileReader &reader) : _reader(reader) {}
+
+  ~AsyncImageLoader()
+  {
+    // The callbacks refer to this object
+    _reader.submit();
+    boost::mutex::scoped_lock lock(_mutex);
+    for (size_t i=0; i<_slots.size(); ++i)
+      while (!_slots[i]->done)
+        _condition.wait(lock);
+  }
+
+  /// Queue an image to load and return its index, nothing is read until submit is called.
+  size_t load(const std::string &imagePath, const int imageType)
+  {
+    boost::shared_ptr<Slot> slot(new Slot());
+    slot->path      = imagePath;
+    slot->imageType = imageType;
+    slot->done      = false;
+    slot->success   = false;
+    size_t index;
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      index = _slots.size();
+      _slots.push_back(slot);
+    }
+    // Mapped and intermediate images are not decoded from a whole file
+    if (isContainerPath(imagePath) || isBasemapCropPath(imagePath) || isIntermediateImagePath(imagePath))
+      _reader.post(boost::bind(&AsyncImageLoader::readImage, this, slot));
+    else
+      _reader.read(imagePath, boost::bind(&AsyncImageLoader::decodeImage, this, slot, _1, _2, _3));
+    return index;
+  }
+
+  /// Start reading all of the queued images.
+  void submit()
+  {
+    _reader.submit();
+  }
+
+  /// Wait for an image and take it, returns false if it could not be loaded.
+  bool get(const size_t index, cv::Mat &image)
+  {
+    _reader.submit();
+    boost::mutex::scoped_lock lock(_mutex);
+    boost::shared_ptr<Slot> slot = _slots[index];
+    while (!slot->done)
+      _condition.wait(lock);
+    image = slot->image;
+    slot->image.release();
+    return slot->success;
+  }
+
+private:
+
+  struct Slot
+  {
+    std::string path;
+    int         imageType;
+    bool        done;
+    bool        success;
+    cv::Mat     image;
+  };
+
+  AsyncFileReader &_reader;
+  boost::mutex              _mutex;
+  boost::condition_variable _condition;
+  std::vector<boost::shared_ptr<Slot> > _slots;
+
+  void decodeImage(boost::shared_ptr<Slot> slot, const bool success, const char* data, const size_t size)
+  {
+    cv::Mat image;
+    if (success && (size > 0))
+      image = cv::imdecode(cv::Mat(1, size, CV_8UC1, const_cast<char*>(data)),
+                           slot->imageType | CV_LOAD_IMAGE_ANYDEPTH);
+    if (!image.data)
+      printf("Failed to load image %s!\n", slot->path.c_str());
+    finish(slot, image);
+  }
+
+  void readImage(boost::shared_ptr<Slot> slot)
+  {
+    cv::Mat image;
+    readOpenCvImage(slot->path, image, slot->imageType);
+    finish(slot, image);
+  }
+
+  void finish(boost::shared_ptr<Slot> slot, const cv::Mat &image)
+  {
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      slot->image   = image;
+      slot->success = (image.data != NULL);
+      slot->done    = true;
+      // Notify with the lock held, the destructor can return once done is seen
+      _condition.notify_all();
+    }
+  }
+};
+
+
+#endif // HRSC_ASYNC_IO_H
@@ -0,0 +1,359 @@
+#include <HrscColor.h>
+
+
+//=========================================================================================
+// Brightness correction
+
+bool replaceValue(const cv::Mat &baseImageRgb, const cv::Mat &spatialTransform, const cv::Mat &nadir, cv::Mat &outputImage)
+{
+  printf("Converting image...\n");
+  
+  // Convert the input image to HSV
+  cv::Mat hsvImage;
+  cv::cvtColor(baseImageRgb, hsvImage, cv::COLOR_BGR2HSV);
+ 
+  printf("Replacing value channel...\n");
+ 
+  // TODO: There must be a better way to do this using OpenCV!
+  // Replace the value channel
+  //cv::Mat outputMask;
+  bool gotValue;
+  for (int r=0; r<baseImageRgb.rows; ++r)
+  {
+    for (int c=0; c<baseImageRgb.cols; ++c)
+    {     
+      float matchX = c*spatialTransform.at<float>(0,0) + r*spatialTransform.at<float>(0,1) + spatialTransform.at<float>(0,2);
+      float matchY = c*spatialTransform.at<float>(1,0) + r*spatialTransform.at<float>(1,1) + spatialTransform.at<float>(1,2);
+      
+      unsigned char newVal = interpPixel<unsigned char>(nadir, nadir, matchX, matchY, gotValue);
+      //hsvImage.at<unsigned char>(r,c, 2) = newVal;
+      if (gotValue)
+        hsvImage.at<cv::Vec3b>(r,c)[2] = newVal;
+    }
+  }
+  cv::cvtColor(hsvImage, outputImage, cv::COLOR_HSV2BGR);
+  
+  cv::imwrite("value_replaced_image.jpeg", outputImage);
+  
+  //cv::namedWindow("Display Image", cv::WINDOW_AUTOSIZE );
+  //cv::imshow("Display Image", outputImage);
+  //cv::waitKey(0);
+  
+  printf("Finished replacing value\n");
+  return true;
+
+}
+
+cv::Vec3b rgb2ycbcr(cv::Vec3b rgb)
+{
+  // Convert
+  double temp[3];
+  temp[0] =         0.299   *rgb[0] + 0.587   *rgb[1] + 0.114   *rgb[2];
+  temp[1] = 128.0 - 0.168736*rgb[0] - 0.331264*rgb[1] + 0.5     *rgb[2];
+  temp[2] = 128.0 + 0.5     *rgb[0] - 0.418688*rgb[1] - 0.081312*rgb[2];
+  // Copy and constrain
+  cv::Vec3b ycbcr;
+  for (int i=0; i<3; ++i)
+  {
+    ycbcr[i] = temp[i];
+    if (temp[i] < 0.0  ) ycbcr[i] = 0;
+    if (temp[i] > 255.0) ycbcr[i] = 255;
+  }
+  return ycbcr;
+}
+
+cv::Vec3b ycbcr2rgb(cv::Vec3b ycbcr)
+{
+  double temp[3];
+  temp[0] = ycbcr[0]                                + 1.402   * (ycbcr[2] - 128.0);
+  temp[1] = ycbcr[0] - 0.34414 * (ycbcr[1] - 128.0) - 0.71414 * (ycbcr[2] - 128.0);
+  temp[2] = ycbcr[0] + 1.772   * (ycbcr[1] - 128.0);
+  
+  // Copy and constrain
+  cv::Vec3b rgb;
+  for (int i=0; i<3; ++i)
+  {
+    rgb[i] = temp[i];
+    if (temp[i] < 0.0  ) rgb[i] = 0;
+    if (temp[i] > 255.0) rgb[i] = 255;
+  }
+  return rgb;
+}
+
+
+//=========================================================================================
+// HRSC color transformation
+
+
+cv::Vec3b transformPixelYCC(const std::vector<unsigned char> &hrscPixel, const cv::Mat &colorTransform)
+{
+  // First apply the HRSC --> RGB transform
+  cv::Vec3b outputPixel;
+  for (int j=0; j<NUM_BASE_CHANNELS; ++j)
+  {
+    outputPixel[j] = 0;
+    float temp = 0.0;
+    for (int i=0; i<NUM_HRSC_CHANNELS; ++i)
+    {
+      temp += static_cast<float>(hrscPixel[i])*colorTransform.at<float>(i,j);
+    }
+    if (temp < 0.0) // Clamp output to legal range.
+      temp = 0;
+    if (temp > 255.0)
+      temp = 255.0;
+    outputPixel[j] = static_cast<unsigned char>(temp);
+  }
+
+  // Convert RGB --> YCbCr
+  cv::Vec3b ycbcrPixel = rgb2ycbcr(outputPixel);
+  
+  // Replace the image intensity with the scaled NADIR channel.
+  const int Y     = 0;
+  const int NADIR = 4;
+  float temp2 = static_cast<float>(hrscPixel[NADIR]) * colorTransform.at<float>(NUM_HRSC_CHANNELS, 0);
+  if (temp2 < 0.0) // Clamp output to legal range.
+    temp2 = 0.0;
+  if (temp2 > 255.0)
+    temp2 = 255.0;  
+  ycbcrPixel[Y] = static_cast<unsigned char>(temp2);
+
+  // Convert back from YCbCr to RGB
+  return ycbcr2rgb(ycbcrPixel);
+}
+
+double distWeightingFunction(const double distance)
+{
+  const double MAX_WEIGHT = 1.0;
+  const double MIN_WEIGHT = 0.0;
+  
+  // Using the max tile size makes this reach just to the center of diagonal tiles
+  // - If this is not set right the tiles will be clearly visible in the output mosaic,
+  //   or if it is way too small the output mosaic will be made up of isolated circles!
+  // TODO: This needs to correspond with the HRSC tile size!
+  const double MAX_TILE_SIZE = 5792; // Tile size 4096
+  const double MAX_DIST = MAX_TILE_SIZE;
+
+  // Simple linear drop
+  double weight = (MAX_DIST - distance) / MAX_DIST;
+  if (weight < MIN_WEIGHT)
+    weight = MIN_WEIGHT;
+  return weight;
+}
+
+bool determineBlendedPixel(int height, int width, int row, int col,
+                           const cv::Vec3b &mainPixel,  double mainWeightIn, // The main pixel
+                           const std::vector<cv::Vec3b> &pixels,     // All the other pixels
+                           const std::vector<cv::Vec2i> &offsets,    // Offset in tiles for the other pixels
+                           const std::vector<double   > &weightsIn,  //
+                           cv::Vec3b &outputPixel)
+{
+  // Each pixel is influenced by the main tile and each adjacent tile
+  const size_t numOtherTiles = pixels.size();
+  const size_t numInfluences = pixels.size() + 1;
+  std::vector<double> influences(numInfluences);
+  
+  // The influence is a combination of tile size (weight) and distance to the tile.
+  // - The squared distance is used to assess the penalty.  This is important because
+  //   the influence of a tile needs to be about zero by the edge of adjacent tiles!
+  double tileCenterY = static_cast<double>(height) / 2.0;
+  double tileCenterX = static_cast<double>(width)  / 2.0;
+  double mainDistY   = (double)row-tileCenterY;
+  double mainDistX   = (double)col-tileCenterX;
+  double mainDist    = sqrt(mainDistX*mainDistX + mainDistY*mainDistY);
+  if (mainDist < 0.1) // Avoid divide by zero at center pixel
+  {
+    outputPixel = mainPixel;
+    return true;
+  }
+  influences[0] = mainWeightIn * distWeightingFunction(mainDist);
+  double influenceSum = influences[0];
+
+  for (size_t i=0; i<numOtherTiles; ++i)
+  {
+    // Tile distance is computed from the center of the other tile
+    double thisTileCenterY = tileCenterY + offsets[i][1]*height;
+    double thisTileCenterX = tileCenterX + offsets[i][0]*width;
+    double tileDistY   = (double)row-thisTileCenterY;
+    double tileDistX   = (double)col-thisTileCenterX;
+    double tileDist    = sqrt(tileDistX*tileDistX + tileDistY*tileDistY); // Don't need to check divide by zero here!
+    influences[i+1] = weightsIn[i] * distWeightingFunction(tileDist);
+    influenceSum += influences[i+1];
+  }
+
+  // Now normalize all the influences so they total up to 1.0
+  for (size_t i=0; i<numInfluences; ++i)
+    influences[i] /= influenceSum;
+
+  // Compute the final value
+  const size_t NUM_RGB_CHANNELS = 3;
+  for (size_t c=0; c<NUM_RGB_CHANNELS; ++c)
+  {
+    // Accumulate the output pixel over all influences
+    outputPixel[c] = influences[0]*mainPixel[c];
+    for (size_t i=0; i<numOtherTiles; ++i)
+    {
+      outputPixel[c] += pixels[i][c] * influences[i+1]; // Incorporate input weights
+    }    
+  }
+  
+  return true;
+}
+
+bool transformHrscColor(const std::vector<cv::Mat>   &hrscChannels, const cv::Mat &hrscMask,
+                        const BrightnessCorrector &corrector, cv::Mat &outputImage,
+                        const cv::Mat                &colorTransform,        double mainWeight,
+                        const std::vector<cv::Mat>   &otherColorTransforms,  const std::vector<double> &otherWeights,
+                        const std::vector<cv::Vec2i> &otherOffsets)
+{
+    
+  const size_t numOtherTiles = otherOffsets.size();
+    
+  // Initialize the output image
+  const size_t numRows = hrscMask.rows; // The mask is the smallest of the input images
+  const size_t numCols = hrscMask.cols;
+  outputImage = cv::Mat(numRows, numCols, CV_8UC3);
+
+  // Iterate over the pixels of the HRSC image
+  cv::Vec3b mainPixel, outputPixel;
+  std::vector<unsigned char> hrscPixel(NUM_HRSC_CHANNELS);
+  for (int r=0; r<numRows; r+=1)
+  {
+    for (int c=0; c<numCols; c+=1)
+    {
+      // Handle masked pixels
+      if (hrscMask.at<MASK_DATA_TYPE>(r, c) == 0)
+      {
+        outputImage.at<cv::Vec3b>(r, c) = cv::Vec3b(0,0,0);
+        continue;
+      }
+
+      // Build the HRSC pixel from the seperate channels with brightness correction
+      for (int i=0; i<NUM_HRSC_CHANNELS; ++i)
+        hrscPixel[i] = corrector.correctPixel(hrscChannels[i].at<unsigned char>(r,c), r);
+
+      // Compute the main pixel transform
+      mainPixel = transformPixelYCC(hrscPixel, colorTransform);
+
+      // Compute pixel transforms from all the adjacent tiles
+      std::vector<cv::Vec3b> otherPixels(numOtherTiles);
+      for (size_t i=0; i<numOtherTiles; ++i)
+        otherPixels[i] = transformPixelYCC(hrscPixel, otherColorTransforms[i]);
+
+      // Compute a blended composition of the different color transforms.
+      determineBlendedPixel(numRows, numCols, r, c,
+                            mainPixel,   mainWeight,
+                            otherPixels, otherOffsets, otherWeights,
+                            outputPixel);
+
+      // Store the result in output image
+      outputImage.at<cv::Vec3b>(r, c) = outputPixel;
+
+    } // End col loop
+  } // End row loop
+
+  return true;
+}
+
+size_t sampleColorPairs(const cv::Mat &basemapImage, const cv::Mat &spatialTransform,
+                        const BrightnessCorrector &corrector,
+                        const std::vector<cv::Mat> &hrscChannels, const cv::Mat &hrscMask,
+                        std::vector<HrscColorPair> &pairs,
+                        const int sampleDist, const int rowOffset)
+{
+  pairs.clear();
+  bool gotValue;
+  HrscColorPair pair;
+  for (int r=0; r<hrscMask.rows; r+=sampleDist)
+  {
+    for (int c=0; c<hrscMask.cols; c+=sampleDist)
+    {
+      // Skip masked out HRSC pixels
+      if (hrscMask.at<MASK_DATA_TYPE>(r,c) == 0)
+        continue;
+
+      // Compute the equivalent location in the basemap image
+      float baseX, baseY;
+      affineTransform(spatialTransform, c, r, baseX, baseY);
+      pair.base = interpPixelRgb(basemapImage, baseX, baseY, gotValue);
+      if (!gotValue)
+        continue; // Failed to interpolate a value here
+
+      // The HRSC values have a brightness correction applied
+      for (size_t i=0; i<NUM_HRSC_CHANNELS; ++i)
+        pair.hrsc[i] = corrector.correctPixel(hrscChannels[i].at<unsigned char>(r,c), r+rowOffset);
+      pairs.push_back(pair);
+    }
+  }
+  return pairs.size();
+}
+
+size_t collectColorPairs(const cv::Mat &basemapImage, const cv::Mat &spatialTransform,
+                         const BrightnessCorrector &corrector,
+                         const std::vector<cv::Mat> &hrscChannels, const cv::Mat &hrscMask,
+                         std::vector<HrscColorPair> &pairs, const int rowOffset,
+                         const size_t minPairs)
+{
+  int sampleDist = 64;
+  while (sampleDist > 0)
+  {
+    if (sampleColorPairs(basemapImage, spatialTransform, corrector, hrscChannels, hrscMask,
+                         pairs, sampleDist, rowOffset) >= minPairs)
+      break;
+    sampleDist /= 4;
+  }
+  return pairs.size();
+}
+
+bool writeColorPairsFile(const std::string &outputPath, const std::vector<HrscColorPair> &pairs)
+{
+  std::ostringstream outputFile;
+  for (size_t p=0; p<pairs.size(); ++p)
+  {
+    for (size_t i=0; i<NUM_BASE_CHANNELS; ++i)
+    {
+      outputFile << static_cast<int>(pairs[p].base[i]) <<", "; // Cast to int so we don't print ASCII
+    }
+    for (size_t i=0; i<NUM_HRSC_CHANNELS-1; ++i)
+    {
+      outputFile << static_cast<int>(pairs[p].hrsc[i]) <<", ";
+    }
+    outputFile << static_cast<int>(pairs[p].hrsc[NUM_HRSC_CHANNELS-1]) << std::endl;
+  }
+  return writeFileData(outputPath, outputFile.str());
+}
+
+bool solveColorTransform(const std::vector<HrscColorPair> &pairs, cv::Mat &transform)
+{
+  const int numPairs = static_cast<int>(pairs.size());
+  if (numPairs == 0)
+    return false;
+
+  cv::Mat inputs (numPairs, NUM_HRSC_CHANNELS, CV_64FC1);
+  cv::Mat targets(numPairs, NUM_BASE_CHANNELS, CV_64FC1);
+  double sumXY = 0, sumXX = 0;
+  for (int i=0; i<numPairs; ++i)
+  {
+    const HrscColorPair &pair = pairs[i];
+    for (size_t c=0; c<NUM_HRSC_CHANNELS; ++c)
+      inputs.at<double>(i,c) = pair.hrsc[c];
+    for (size_t c=0; c<NUM_BASE_CHANNELS; ++c)
+      targets.at<double>(i,c) = pair.base[c];
+
+    // The Y scaling maps the NADIR channel to the basemap intensity
+    const double y     = 0.299*pair.base[0] + 0.587*pair.base[1] + 0.114*pair.base[2];
+    const double nadir = pair.hrsc[NUM_HRSC_CHANNELS-1];
+    sumXY += nadir*y;
+    sumXX += nadir*nadir;
+  }
+  if (sumXX == 0)
+    return false;
+
+  cv::Mat solution;
+  if (!cv::solve(inputs, targets, solution, cv::DECOMP_SVD))
+    return false;
+
+  transform = cv::Mat::zeros(NUM_HRSC_CHANNELS+1, NUM_BASE_CHANNELS, CV_32FC1);
+  solution.convertTo(transform.rowRange(0, NUM_HRSC_CHANNELS), CV_32FC1);
+  transform.at<float>(NUM_HRSC_CHANNELS, 0) = static_cast<float>(sumXY / sumXX);
+  return true;
+}
@@ -0,0 +1,212 @@
+#ifndef HRSC_COLOR_H
+#define HRSC_COLOR_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <opencv2/opencv.hpp>
+
+#include <HrscCore.h>
+#include <HrscFileIo.h>
+#include <HrscMatrixIo.h>
+
+
+//=========================================================================================
+// Brightness correction
+
+/// Helper class for working with brightness information
+class BrightnessCorrector
+{
+public:
+
+  /// Data loading options
+  BrightnessCorrector() {}
+  BrightnessCorrector(cv::Mat &gain, cv::Mat &offset) : _gain(gain), _offset(offset) { }
+  void set(cv::Mat &gain, cv::Mat &offset) { _gain = gain; _offset = offset; }
+
+  /// Write a gain/offset pair to a CSV file, or a binary file for a .hrm path
+  bool writeProfileCorrection(const std::string &outputPath) const
+  {
+    if (isBinaryMatrixPath(outputPath))
+    {
+      cv::Mat profile;
+      cv::hconcat(_gain, _offset, profile);
+      return writeBinaryMatrix(outputPath, MATRIX_KIND_PROFILE, profile);
+    }
+
+    std::ostringstream file;
+    file << _gain.rows << std::endl;
+    for (size_t r=0; r<_gain.rows; ++r)
+    {
+      file << _gain.at<float>(r,0) << ", " << _offset.at<float>(r,0) << std::endl;
+    }
+    return writeFileData(outputPath, file.str());
+  }
+
+  /// Read a gain/offset pair from a CSV file, or a binary file for a .hrm path
+  bool readProfileCorrection(const std::string &inputPath)
+  {
+    if (isBinaryMatrixPath(inputPath))
+    {
+      BinaryMatrixKind kind;
+      cv::Mat profile;
+      if (!readBinaryMatrix(inputPath, kind, profile) || (profile.cols != 2))
+      {
+        std::cout << "Failed to load profile correction: " << inputPath << std::endl;
+        return false;
+      }
+      _gain   = profile.col(0).clone();
+      _offset = profile.col(1).clone();
+      return true;
+    }
+
+    //std::cout << "Reading profile correction: " << inputPath << std::endl;
+    MappedFileData data;
+    if (!data.open(inputPath))
+    {
+      std::cout << "Failed to load profile correction: " << inputPath << std::endl;
+      return false;
+    }
+    MappedFileStream file(data.data(), data.size());
+    {
+      char   comma;
+      size_t numRows;
+      file >> numRows;
+      _gain.create(numRows, 1, CV_32FC1);
+      _offset.create(numRows, 1, CV_32FC1);
+      for (size_t r=0; r<numRows; ++r)
+      {
+        file >> _gain.at<float>(r,0) >> comma >> _offset.at<float>(r,0);
+      }
+    }
+    if (file.fail())
+    {
+      std::cout << "Failed to load profile correction: " << inputPath << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  /// Resample the correction to a new number of rows.
+  /// - New row r gets the linearly interpolated value at input row r*scale, clamped to the ends.
+  void resample(double scale, int numRows)
+  {
+    cv::Mat newGain  (numRows, 1, CV_32FC1);
+    cv::Mat newOffset(numRows, 1, CV_32FC1);
+    const int lastRow = _gain.rows - 1;
+    for (int r=0; r<numRows; ++r)
+    {
+      const double inputRow = std::min(std::max(r*scale, 0.0), static_cast<double>(lastRow));
+      const int    lowRow   = static_cast<int>(inputRow);
+      const int    highRow  = std::min(lowRow+1, lastRow);
+      const float  frac     = static_cast<float>(inputRow - lowRow);
+      newGain.at<float>(r,0)   = (1.0f-frac)*_gain.at<float>(lowRow,0)   + frac*_gain.at<float>(highRow,0);
+      newOffset.at<float>(r,0) = (1.0f-frac)*_offset.at<float>(lowRow,0) + frac*_offset.at<float>(highRow,0);
+    }
+    _gain   = newGain;
+    _offset = newOffset;
+  }
+
+  const cv::Mat& gain  () const { return _gain;   }
+  const cv::Mat& offset() const { return _offset; }
+
+  /// Get the corrected value of a single pixel
+  unsigned char correctPixel(unsigned char inputPixel, int row) const
+  {
+    float result = static_cast<float>(inputPixel) * _gain.at<float>(row,0);
+    if (result <   0.0) result = 0.0;  // Clamp the output value
+    if (result > 255.0) result = 255.0;
+    return static_cast<unsigned char>(result);
+  }
+  
+private:
+
+  cv::Mat _gain;
+  cv::Mat _offset;
+};
+
+
+
+
+
+/// Replace the Value channel of the input HSV image
+bool replaceValue(const cv::Mat &baseImageRgb, const cv::Mat &spatialTransform, const cv::Mat &nadir, cv::Mat &outputImage);
+
+
+/// Converts a single RGB pixel to YCbCr
+cv::Vec3b rgb2ycbcr(cv::Vec3b rgb);
+    
+/// Converts a single YCbCr pixel to RGB
+cv::Vec3b ycbcr2rgb(cv::Vec3b ycbcr);
+
+
+//=========================================================================================
+// HRSC color transformation
+
+/// Applies our color transform to a pixel
+/// - This updated function applies the transform computed in "solveHrscColor.py".
+///   See that file for a better description of the transform.
+cv::Vec3b transformPixelYCC(const std::vector<unsigned char> &hrscPixel, const cv::Mat &colorTransform);
+
+
+/// Given the squared distance, compute a smoothly decreasing weight.
+double distWeightingFunction(const double distance);
+
+/// Generate weighted blend of input pixels
+/// - Each adjacent tile (4-connectivity) has a fixed weight.
+/// - Absent tiles have zero weight.
+/// - There is also a positional weight based on distance.
+bool determineBlendedPixel(int height, int width, int row, int col,
+                           const cv::Vec3b &mainPixel,  double mainWeightIn, // The main pixel
+                           const std::vector<cv::Vec3b> &pixels,     // All the other pixels
+                           const std::vector<cv::Vec2i> &offsets,    // Offset in tiles for the other pixels
+                           const std::vector<double   > &weightsIn,  //
+                           cv::Vec3b &outputPixel);
+
+/// Apply a color transform matrix to the HRSC bands.
+/// - This is a 5x3 matrix.
+bool transformHrscColor(const std::vector<cv::Mat>   &hrscChannels, const cv::Mat &hrscMask,
+                        const BrightnessCorrector &corrector, cv::Mat &outputImage,
+                        const cv::Mat                &colorTransform,        double mainWeight,
+                        const std::vector<cv::Mat>   &otherColorTransforms,  const std::vector<double> &otherWeights,
+                        const std::vector<cv::Vec2i> &otherOffsets);
+
+//============================================================================
+
+
+/// One sampled pair of basemap and brightness corrected HRSC pixel values
+struct HrscColorPair
+{
+  cv::Vec3b     base; // In the order stored by the basemap image
+  unsigned char hrsc[NUM_HRSC_CHANNELS];
+};
+
+/// Sample color pairs between an HRSC tile and the low resolution basemap on a regular grid.
+/// - rowOffset is added to the tile row before looking up the brightness correction.
+/// - Returns the number of pairs found.
+size_t sampleColorPairs(const cv::Mat &basemapImage, const cv::Mat &spatialTransform,
+                        const BrightnessCorrector &corrector,
+                        const std::vector<cv::Mat> &hrscChannels, const cv::Mat &hrscMask,
+                        std::vector<HrscColorPair> &pairs,
+                        const int sampleDist = 25, const int rowOffset = 0);
+
+/// Sample color pairs, reducing the sample distance until enough pairs are found.
+/// - Returns the number of pairs found, which may be less than minPairs.
+size_t collectColorPairs(const cv::Mat &basemapImage, const cv::Mat &spatialTransform,
+                         const BrightnessCorrector &corrector,
+                         const std::vector<cv::Mat> &hrscChannels, const cv::Mat &hrscMask,
+                         std::vector<HrscColorPair> &pairs, const int rowOffset = 0,
+                         const size_t minPairs = 80);
+
+/// Write color pairs to a CSV file in the format solveHrscColor.py reads
+bool writeColorPairsFile(const std::string &outputPath, const std::vector<HrscColorPair> &pairs);
+
+/// Solve for the HRSC -> RGB color transform from a set of color pairs.
+/// - This is the same least squares solution that solveHrscColor.py computes, the
+///   output is a 6x3 matrix with the Y scaling stored in the first column of the last row.
+bool solveColorTransform(const std::vector<HrscColorPair> &pairs, cv::Mat &transform);
+
+
+#endif // HRSC_COLOR_H
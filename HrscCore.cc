@@ -0,0 +1,122 @@
+#include <HrscCore.h>
+
+
+bool constrainCvRoi(cv::Rect &roi, const int imageWidth, const int imageHeight)
+{
+  //std::cout << "roi    = " << roi << std::endl;
+  //std::cout << "width  = " << imageWidth << std::endl;
+  //std::cout << "height = " << imageHeight << std::endl;
+  cv::Rect imageRoi(0, 0, imageWidth, imageHeight);
+  roi &= imageRoi;
+  return (roi.area() > 0);
+}
+
+bool constrainMatchedCvRois(cv::Rect &roi, const int imageWidth, const int imageHeight,
+                            cv::Rect &roi2)
+{
+  // Constrain the first ROI
+  cv::Rect roiIn = roi;
+  if (!constrainCvRoi(roi, imageWidth, imageHeight))
+    return false;
+  // Detect the changes
+  cv::Point tlDiff = roi.tl()   - roiIn.tl(); // TL corner can only have increased
+  //cv::Point brDiff = roiIn.br() - roi.br();
+  
+  //std::cout << "tlDiff  = " << tlDiff << std::endl;
+  
+  roi2 = cv::Rect(roi2.tl() + tlDiff, roi.size()); // Use the new size
+  //std::cout << "roi2  = " << roi2<< std::endl;
+  return true;
+}
+
+std::string itoa(const int i)
+{
+  std::stringstream s;
+  s << i;
+  return s.str();
+}
+
+void affineTransform(const cv::Mat &transform, float xIn, float yIn, float &xOut, float &yOut)
+{
+  xOut = xIn*transform.at<float>(0,0) + yIn*transform.at<float>(0,1) + transform.at<float>(0,2);
+  yOut = xIn*transform.at<float>(1,0) + yIn*transform.at<float>(1,1) + transform.at<float>(1,2);
+}
+
+cv::Vec3b interpPixelRgb(const cv::Mat& img, float xF, float yF, bool &gotValue)
+{
+  const size_t NUM_RGB_CHANNELS = 3;
+  const int    BORDER_SIZE      = 1; // Stay away from border artifacts
+
+  gotValue = false;
+  int x = (int)xF;
+  int y = (int)yF;
+
+  // Get the bordering pixel coordinates, replacing out of bounds with zero.
+  int minX = BORDER_SIZE;
+  int minY = BORDER_SIZE;
+  int maxX = img.cols-BORDER_SIZE;
+  int maxY = img.rows-BORDER_SIZE;
+  int x0 = x;
+  int x1 = x+1;
+  int y0 = y;
+  int y1 = y+1;
+  if ((x0 < minX) || (x0 >= maxX)) return 0;
+  if ((x1 < minX) || (x1 >= maxX)) return 0;
+  if ((y0 < minY) || (y0 >= maxY)) return 0;
+  if ((y1 < minY) || (y1 >= maxY)) return 0;
+
+  // Now interpolate each pixel channel
+
+  float a = xF - (float)x;
+  float c = yF - (float)y;
+  
+  cv::Vec3b outputPixel;
+  for (size_t i=0; i<NUM_RGB_CHANNELS; ++i)
+  {
+    float v00 = static_cast<float>(img.at<cv::Vec3b>(y0, x0)[i]);
+    float v01 = static_cast<float>(img.at<cv::Vec3b>(y0, x1)[i]);
+    float v10 = static_cast<float>(img.at<cv::Vec3b>(y1, x0)[i]);
+    float v11 = static_cast<float>(img.at<cv::Vec3b>(y1, x1)[i]);
+
+    outputPixel[i] = static_cast<unsigned char>( v00*(1-a)*(1-c)  + v10*a*(1-c) + v01*(1-a)*c + v11*a*c );
+
+  }
+
+  gotValue = true;
+  return outputPixel;
+}
+
+cv::Rect_<int> getboundsInOtherImage(const cv::Mat &imageA, const cv::Mat &imageB, const cv::Mat &transB_to_A)
+{
+  // Transform the four corners of imageB
+  float x[4], y[4];
+  affineTransform(transB_to_A, 0,             0,             x[0], y[0]);
+  affineTransform(transB_to_A, imageB.cols-1, 0,             x[1], y[1]);
+  affineTransform(transB_to_A, imageB.cols-1, imageB.rows-1, x[2], y[2]);
+  affineTransform(transB_to_A, 0,             imageB.rows-1, x[3], y[3]);
+  
+  // Get the bounding box of the transformed points
+  float xMin = x[0];
+  float xMax = x[0];
+  float yMin = y[0];
+  float yMax = y[0];
+  for (size_t i=0; i<4; ++i)
+  {
+    if (x[i] < xMin) xMin = x[i];
+    if (x[i] > xMax) xMax = x[i];
+    if (y[i] < yMin) yMin = y[i];
+    if (y[i] > yMax) yMax = y[i];
+  }
+  
+  if (xMin < 0) xMin = 0;
+  if (yMin < 0) yMin = 0;
+  if (xMax > imageA.cols-1) xMax = imageA.cols-1;
+  if (yMax > imageA.rows-1) yMax = imageA.rows-1;
+
+  // Return the results expanded to the nearest integer
+  cv::Rect_<int> boundsInA(static_cast<int>(floor(xMin)), 
+                           static_cast<int>(floor(yMin)),
+                           static_cast<int>(ceil(xMax-xMin)), 
+                           static_cast<int>(ceil(yMax-yMin)));
+  return boundsInA;
+}
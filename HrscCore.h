@@ -0,0 +1,146 @@
+#ifndef HRSC_CORE_H
+#define HRSC_CORE_H
+
+#include <string>
+#include <sstream>
+#include <opencv2/opencv.hpp>
+
+
+const size_t NUM_HRSC_CHANNELS = 5;
+const size_t NUM_BASE_CHANNELS = 3;
+
+typedef unsigned short MASK_DATA_TYPE;
+typedef unsigned char  BINARY_MASK_DATA_TYPE;
+
+//const unsigned char MASK_MAX = 255; // UINT8
+const unsigned short MASK_MAX = 1023; // UINT16 - This is equal to the grassfire distance!
+
+
+
+/// Constrain an OpenCV ROI to lie within an image
+/// - Returns false if there is no overlap
+bool constrainCvRoi(cv::Rect &roi, const int imageWidth, const int imageHeight);
+
+/// As constrainCvRoi, but also resizes roi2 to match the changes to roi1.
+bool constrainMatchedCvRois(cv::Rect &roi, const int imageWidth, const int imageHeight,
+                            cv::Rect &roi2);
+
+
+std::string itoa(const int i);
+
+void affineTransform(const cv::Mat &transform, float xIn, float yIn, float &xOut, float &yOut);
+
+/// Single channel image interpolation
+template <typename T>
+T interpPixel(const cv::Mat& img, const cv::Mat& mask, float xF, float yF, bool &gotValue)
+{
+  const int BORDER_SIZE = 1; // Stay away from border artifacts
+
+  gotValue = false;
+  int x = (int)xF;
+  int y = (int)yF;
+
+  // Get the bordering pixel coordinates, replacing out of bounds with zero.
+  int minX = BORDER_SIZE; // Max legal pixel boundaries with the specified border.
+  int minY = BORDER_SIZE;
+  int maxX = img.cols-BORDER_SIZE;
+  int maxY = img.rows-BORDER_SIZE;
+  int x0 = x;   // The coordinates of the four bordering pixels
+  int x1 = x+1;
+  int y0 = y;
+  int y1 = y+1;
+  if ((x0 < minX) || (x0 >= maxX)) return 0; // Quit if we exceed any of the borders.
+  if ((x1 < minX) || (x1 >= maxX)) return 0;
+  if ((y0 < minY) || (y0 >= maxY)) return 0;
+  if ((y1 < minY) || (y1 >= maxY)) return 0;
+  
+  // - Don't interpolate if any mask inputs are zero, this might indicate 
+  //    that we are at a projection border.
+  unsigned char i00 = mask.at<MASK_DATA_TYPE>(y0, x0);
+  unsigned char i01 = mask.at<MASK_DATA_TYPE>(y0, x1);
+  unsigned char i10 = mask.at<MASK_DATA_TYPE>(y1, x0);
+  unsigned char i11 = mask.at<MASK_DATA_TYPE>(y1, x1);
+  if ((i00 == 0) || (i01 == 0) || (i10 == 0) || (i11 == 0))
+    return 0;
+
+
+  float a = xF - (float)x;
+  float c = yF - (float)y;
+  
+  float v00 = static_cast<float>(img.at<T>(y0, x0));
+  float v01 = static_cast<float>(img.at<T>(y0, x1));
+  float v10 = static_cast<float>(img.at<T>(y1, x0));
+  float v11 = static_cast<float>(img.at<T>(y1, x1));
+
+  T val = static_cast<T>( v00*(1-a)*(1-c)  + v10*a*(1-c) + v01*(1-a)*c + v11*a*c );
+
+  gotValue = true;
+  return val;
+}
+
+/// As interpPixel but specialized for RGB
+cv::Vec3b interpPixelRgb(const cv::Mat& img, float xF, float yF, bool &gotValue);
+
+/// As interpPixelRgb but with pixels near the edges handled by mirroring
+template <typename MASK_T>
+cv::Vec3b interpPixelMirrorRgb(const cv::Mat& img,  const cv::Mat& mask,
+                               float xF, float yF, bool &gotValue)
+{
+  const size_t NUM_RGB_CHANNELS = 3;
+
+  // Get the bounding pixel coordinates
+  gotValue = false;
+  int x = (int)xF;
+  int y = (int)yF;
+  int x0 = x;
+  int x1 = x+1;
+  int y0 = y;
+  int y1 = y+1;
+  /*
+  // Mirror a border of one by adjusting the bounding coordinates
+  if (x0 == -1)       x0 = 0;
+  if (y0 == -1)       y0 = 0;
+  if (x1 == img.cols) x1 = img.cols-1;
+  if (y1 == img.rows) y1 = img.rows-1;
+  */
+  // Pixels past the border are still rejected
+  if ((x0 < 0) || (x0 >= img.cols)) return 0;
+  if ((x1 < 0) || (x1 >= img.cols)) return 0;
+  if ((y0 < 0) || (y0 >= img.rows)) return 0;
+  if ((y1 < 0) || (y1 >= img.rows)) return 0;
+
+  // Check the mask
+  // - Don't interpolate if any mask inputs are zero, this might indicate 
+  //    that we are at a projection border.
+  unsigned char i00 = mask.at<MASK_T>(y0, x0);
+  unsigned char i01 = mask.at<MASK_T>(y0, x1);
+  unsigned char i10 = mask.at<MASK_T>(y1, x0);
+  unsigned char i11 = mask.at<MASK_T>(y1, x1);
+  if ((i00 == 0) || (i01 == 0) || (i10 == 0) || (i11 == 0))
+    return 0;
+  
+  // Now interpolate each pixel channel
+
+  float a = xF - (float)x;
+  float c = yF - (float)y;
+  
+  cv::Vec3b outputPixel;
+  for (size_t i=0; i<NUM_RGB_CHANNELS; ++i)
+  {
+    float v00 = static_cast<float>(img.at<cv::Vec3b>(y0, x0)[i]);
+    float v01 = static_cast<float>(img.at<cv::Vec3b>(y0, x1)[i]);
+    float v10 = static_cast<float>(img.at<cv::Vec3b>(y1, x0)[i]);
+    float v11 = static_cast<float>(img.at<cv::Vec3b>(y1, x1)[i]);  
+    outputPixel[i] = static_cast<unsigned char>( v00*(1.0f-a)*(1.0f-c)  + v10*a*(1.0f-c) + v01*(1.0f-a)*c + v11*a*c );
+  }
+  
+  gotValue = true;
+  return outputPixel;
+}
+
+
+/// Computes the ROI of one image in another given the transform with bounds checking.
+cv::Rect_<int> getboundsInOtherImage(const cv::Mat &imageA, const cv::Mat &imageB, const cv::Mat &transB_to_A);
+
+
+#endif // HRSC_CORE_H
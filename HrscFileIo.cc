@@ -0,0 +1,287 @@
+#include <HrscFileIo.h>
+
+
+//=========================================================================================
+// File containers
+
+
+bool splitContainerPath(const std::string &path, std::string &containerPath, std::string &key)
+{
+  const size_t split = path.find(CONTAINER_KEY_SEPARATOR);
+  if (split == std::string::npos)
+    return false;
+  containerPath = path.substr(0, split);
+  key           = path.substr(split + CONTAINER_KEY_SEPARATOR.size());
+  return true;
+}
+
+bool isContainerPath(const std::string &path)
+{
+  return (path.find(CONTAINER_KEY_SEPARATOR) != std::string::npos);
+}
+
+std::string getContainerFilePath(const std::string &path)
+{
+  return path.substr(0, path.find(CONTAINER_KEY_SEPARATOR));
+}
+
+std::string getTileProductPath(const std::string &containerPath, const std::string &tilePrefix,
+                               const std::string &product)
+{
+  return containerPath + CONTAINER_KEY_SEPARATOR + tilePrefix + "/" + product;
+}
+
+size_t indexContainerRecords(const char* data, const size_t size,
+                             std::map<std::string, std::pair<size_t, size_t> > &index)
+{
+  size_t position = 0;
+  ContainerRecordHeader header;
+  while (position + sizeof(header) <= size)
+  {
+    memcpy(&header, data+position, sizeof(header));
+    const size_t dataStart = position + sizeof(header) + header.keyLength;
+    if ((memcmp(header.magic, CONTAINER_RECORD_MAGIC, sizeof(header.magic)) != 0) ||
+        (dataStart > size) || (header.dataLength > size - dataStart))
+      break;
+    const std::string key(data+position+sizeof(header), header.keyLength);
+    index[key] = std::make_pair(dataStart, static_cast<size_t>(header.dataLength));
+    position = dataStart + header.dataLength;
+  }
+  return position;
+}
+
+int openContainerForAppend(const std::string &containerPath)
+{
+  while (true)
+  {
+    const int fd = open(containerPath.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0)
+      return -1;
+    flock(fd, LOCK_EX);
+
+    // A compaction may have replaced the file while we waited for the lock
+    struct stat fileInfo, pathInfo;
+    if ((fstat(fd, &fileInfo) != 0) || (stat(containerPath.c_str(), &pathInfo) != 0) ||
+        (fileInfo.st_ino != pathInfo.st_ino) || (fileInfo.st_dev != pathInfo.st_dev))
+    {
+      flock(fd, LOCK_UN);
+      close(fd);
+      continue;
+    }
+    if (fileInfo.st_size == 0)
+      return fd;
+
+    const size_t fileSize = fileInfo.st_size;
+    void* mapping = mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+      close(fd);
+      return -1;
+    }
+    std::map<std::string, std::pair<size_t, size_t> > index;
+    const size_t end = indexContainerRecords(static_cast<const char*>(mapping), fileSize, index);
+    munmap(mapping, fileSize);
+    if (end < fileSize)
+    {
+      printf("Removing a partial record from the end of container %s\n", containerPath.c_str());
+      if (ftruncate(fd, end) != 0)
+      {
+        close(fd);
+        return -1;
+      }
+    }
+    return fd;
+  }
+}
+
+bool appendContainerRecord(const std::string &containerPath, const std::string &key,
+                           const char* data, const size_t size)
+{
+  ContainerRecordHeader header;
+  memcpy(header.magic, CONTAINER_RECORD_MAGIC, sizeof(header.magic));
+  header.keyLength  = key.size();
+  header.reserved   = 0;
+  header.dataLength = size;
+
+  const int fd = openContainerForAppend(containerPath);
+  if (fd < 0)
+  {
+    printf("Failed to open container %s\n", containerPath.c_str());
+    return false;
+  }
+  const char*  pieces[3] = {reinterpret_cast<const char*>(&header), key.data(), data};
+  const size_t sizes [3] = {sizeof(header), key.size(), size};
+  bool success = true;
+  for (int i=0; (i<3) && success; ++i)
+  {
+    size_t written = 0;
+    while (success && (written < sizes[i]))
+    {
+      const ssize_t count = write(fd, pieces[i]+written, sizes[i]-written);
+      success  = (count > 0);
+      written += (count > 0) ? count : 0;
+    }
+  }
+  flock(fd, LOCK_UN);
+  close(fd);
+  if (!success)
+    printf("Failed to write %s to container %s\n", key.c_str(), containerPath.c_str());
+  return success;
+}
+
+boost::shared_ptr<const FileContainer> getFileContainer(const std::string &containerPath)
+{
+  static boost::mutex cacheMutex;
+  static std::map<std::string, boost::shared_ptr<const FileContainer> > cache;
+
+  struct stat info;
+  if (stat(containerPath.c_str(), &info) != 0)
+    return boost::shared_ptr<const FileContainer>();
+
+  boost::mutex::scoped_lock lock(cacheMutex);
+  boost::shared_ptr<const FileContainer> &cached = cache[containerPath];
+  if (!cached || (cached->fileSize() != static_cast<size_t>(info.st_size)) ||
+      (cached->fileInode() != info.st_ino))
+  {
+    boost::shared_ptr<FileContainer> container(new FileContainer());
+    if (!container->open(containerPath))
+      return boost::shared_ptr<const FileContainer>();
+    cached = container;
+  }
+  return cached;
+}
+
+bool writeFileData(const std::string &path, const char* data, const size_t size)
+{
+  std::string containerPath, key;
+  if (splitContainerPath(path, containerPath, key))
+    return appendContainerRecord(containerPath, key, data, size);
+
+  std::ofstream file(path.c_str(), std::ios::binary);
+  file.write(data, size);
+  file.close();
+  return !file.fail();
+}
+
+bool writeFileData(const std::string &path, const std::string &data)
+{
+  return writeFileData(path, data.data(), data.size());
+}
+
+
+//=========================================================================================
+// Direct writes
+
+
+DirectIoBufferPool& getDirectIoBufferPool()
+{
+  static DirectIoBufferPool pool;
+  return pool;
+}
+
+bool dropFileFromCache(const std::string &path)
+{
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  const bool success = (fdatasync(fd) == 0) && (posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0);
+  close(fd);
+  return success;
+}
+
+bool writeFileDirect(const std::string &path, const char* data, const size_t size)
+{
+  int  fd       = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+  bool isDirect = (fd >= 0);
+  if (!isDirect)
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  char* buffer = getDirectIoBufferPool().acquire();
+  if ((fd < 0) || !buffer)
+  {
+    printf("Failed to create %s\n", path.c_str());
+    if (fd >= 0)
+      close(fd);
+    if (buffer)
+      getDirectIoBufferPool().release(buffer);
+    return false;
+  }
+
+  bool success = true;
+  for (size_t done=0; success && (done<size); )
+  {
+    const size_t length = std::min(size-done, DIRECT_IO_BUFFER_SIZE);
+    size_t writeLength  = length;
+    memcpy(buffer, data+done, length);
+    if (isDirect && (length % DIRECT_IO_ALIGNMENT != 0))
+    {
+      writeLength = (length/DIRECT_IO_ALIGNMENT + 1)*DIRECT_IO_ALIGNMENT;
+      memset(buffer+length, 0, writeLength-length);
+    }
+    const ssize_t written = write(fd, buffer, writeLength);
+
+    // Some file systems accept O_DIRECT when the file is opened and then reject the writes
+    if ((written < 0) && (errno == EINVAL) && isDirect && (done == 0))
+    {
+      close(fd);
+      fd       = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+      isDirect = false;
+      success  = (fd >= 0);
+      continue;
+    }
+    success = (written == static_cast<ssize_t>(writeLength));
+    done += length;
+  }
+  getDirectIoBufferPool().release(buffer);
+
+  // Cut off the padding of the last block, then make sure the size is on disk
+  if (isDirect)
+    success = success && (ftruncate(fd, size) == 0);
+  success = success && (fsync(fd) == 0);
+  if (!isDirect && (fd >= 0))
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  if (fd >= 0)
+    close(fd);
+  if (!success)
+    printf("Failed to write %s\n", path.c_str());
+  return success;
+}
+
+
+//=========================================================================================
+// File helpers
+
+bool fileExists(const std::string &path)
+{
+  std::string containerPath, key;
+  if (splitContainerPath(path, containerPath, key))
+  {
+    boost::shared_ptr<const FileContainer> container = getFileContainer(containerPath);
+    const char* data;
+    size_t      size;
+    return container && container->find(key, data, size);
+  }
+  struct stat info;
+  return (stat(path.c_str(), &info) == 0);
+}
+
+bool isSymbolicLink(const std::string &path)
+{
+  struct stat info;
+  return (lstat(path.c_str(), &info) == 0) && S_ISLNK(info.st_mode);
+}
+
+bool syncPath(const std::string &path)
+{
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  const bool success = (fsync(fd) == 0);
+  close(fd);
+  return success;
+}
+
+bool syncParentFolder(const std::string &path)
+{
+  const size_t slash = path.rfind('/');
+  return syncPath((slash == std::string::npos) ? "." : path.substr(0, slash+1));
+}
@@ -0,0 +1,270 @@
+#ifndef HRSC_FILE_IO_H
+#define HRSC_FILE_IO_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/stream.hpp>
+
+
+//=========================================================================================
+// File containers
+
+// All of the tile products of one HRSC image can be stored in a single container file
+// instead of thousands of small files.  A product in a container is addressed with a
+// path of the form "<container path>::<key>" and every function in these headers which
+// reads or writes a file accepts either kind of path.
+// - A container is a sequence of records, each one a header, the key, and the data.
+// - Records are only appended, a later record replaces an earlier one with the same key.
+// - Appends hold an exclusive lock on the file so that many threads and processes can
+//   write to one container.
+// - Readers memory map the container and index the record offsets by key, so the data
+//   of a product is read in place without copying it.
+// - A record cut short by a crash ends the index.  The next append truncates the file to
+//   the end of the last complete record while it holds the lock, so later records are found.
+// - compactContainer in MosaicUtilities.py rewrites a container with only the latest record
+//   of each key and renames it over the old file.  An append which locked the old file
+//   opens the container again.
+
+const std::string CONTAINER_KEY_SEPARATOR = "::";
+
+/// Header in front of every record in a container file.
+struct ContainerRecordHeader
+{
+  char     magic[8];   // "HRSCREC1"
+  uint32_t keyLength;
+  uint32_t reserved;
+  uint64_t dataLength;
+};
+const char CONTAINER_RECORD_MAGIC[8] = {'H','R','S','C','R','E','C','1'};
+
+/// Split a container path into the container file and the key.
+/// - Returns false if the path is a plain file path.
+bool splitContainerPath(const std::string &path, std::string &containerPath, std::string &key);
+
+bool isContainerPath(const std::string &path);
+
+/// Returns the file on disk which holds the data for a path.
+std::string getContainerFilePath(const std::string &path);
+
+/// Returns the path of a tile product in a container, matches getTileProductPath in MosaicUtilities.py
+std::string getTileProductPath(const std::string &containerPath, const std::string &tilePrefix,
+                               const std::string &product);
+
+/// Index the complete records in the contents of a container and return the offset where they end.
+/// - Index entries are the data offset and size of the latest record for each key.
+size_t indexContainerRecords(const char* data, const size_t size,
+                             std::map<std::string, std::pair<size_t, size_t> > &index);
+
+/// Open and lock a container for appending, with any partial record at the end removed.
+/// - Returns -1 on failure.
+int openContainerForAppend(const std::string &containerPath);
+
+/// Append one record to a container file, creating the file if needed.
+/// - A partial record left at the end of the file by a crash is removed first.
+bool appendContainerRecord(const std::string &containerPath, const std::string &key,
+                           const char* data, const size_t size);
+
+/// Read only, memory mapped view of a container file and the index of its records.
+class FileContainer
+{
+public:
+
+  /// Map the file and index all of the complete records in it.
+  bool open(const std::string &containerPath)
+  {
+    struct stat info;
+    if (stat(containerPath.c_str(), &info) != 0)
+      return false;
+    _fileSize  = info.st_size;
+    _fileInode = info.st_ino;
+    if (_fileSize == 0)
+      return true;
+    try
+    {
+      _file.open(containerPath);
+    }
+    catch (const std::exception &)
+    {
+      return false;
+    }
+    _fileSize = _file.size();
+    indexContainerRecords(_file.data(), _fileSize, _index);
+    return true;
+  }
+
+  /// Find the data for a key.
+  bool find(const std::string &key, const char* &data, size_t &size) const
+  {
+    std::map<std::string, std::pair<size_t, size_t> >::const_iterator iter = _index.find(key);
+    if (iter == _index.end())
+      return false;
+    data = _file.data() + iter->second.first;
+    size = iter->second.second;
+    return true;
+  }
+
+  size_t fileSize () const { return _fileSize;  }
+  ino_t  fileInode() const { return _fileInode; }
+
+  /// Get the keys of all the records in the container.
+  void getKeys(std::vector<std::string> &keys) const
+  {
+    keys.clear();
+    std::map<std::string, std::pair<size_t, size_t> >::const_iterator iter;
+    for (iter=_index.begin(); iter!=_index.end(); ++iter)
+      keys.push_back(iter->first);
+  }
+
+private:
+  boost::iostreams::mapped_file_source _file;
+  size_t _fileSize;
+  ino_t  _fileInode;
+  std::map<std::string, std::pair<size_t, size_t> > _index;
+};
+
+/// Returns a shared container for the file, the index is only rebuilt when the file has
+/// changed size or been replaced by a compaction.
+boost::shared_ptr<const FileContainer> getFileContainer(const std::string &containerPath);
+
+/// Read only view of the contents of a plain file or a container record.
+class MappedFileData
+{
+public:
+  MappedFileData() : _data(0), _size(0) {}
+
+  bool open(const std::string &path)
+  {
+    std::string containerPath, key;
+    if (splitContainerPath(path, containerPath, key))
+    {
+      _container = getFileContainer(containerPath);
+      return _container && _container->find(key, _data, _size);
+    }
+
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+      return false;
+    if (info.st_size == 0) // Empty files cannot be mapped
+      return true;
+    try
+    {
+      _file.open(path);
+    }
+    catch (const std::exception &)
+    {
+      return false;
+    }
+    _data = _file.data();
+    _size = _file.size();
+    return true;
+  }
+
+  const char* data() const { return _data; }
+  size_t      size() const { return _size; }
+
+private:
+  boost::shared_ptr<const FileContainer> _container;
+  boost::iostreams::mapped_file_source   _file;
+  const char* _data;
+  size_t      _size;
+};
+
+typedef boost::iostreams::stream<boost::iostreams::array_source> MappedFileStream;
+
+/// Write data to a plain file or append it to a container.
+bool writeFileData(const std::string &path, const char* data, const size_t size);
+
+bool writeFileData(const std::string &path, const std::string &data);
+
+
+//=========================================================================================
+// Direct writes
+
+// Final products can be written with O_DIRECT so terabytes of output do not push the
+// basemap crops, masks and HRSC tiles out of the page cache, and so writeback of them
+// does not stall other processes.
+// - Data is copied through a process wide pool of aligned buffers.  The last block is
+//   padded out to the alignment and the file is then truncated to its real size.
+// - File systems without O_DIRECT, such as tmpfs, are written normally and the pages
+//   are dropped from the cache once they are on disk.
+
+const size_t DIRECT_IO_ALIGNMENT   = 4096;
+const size_t DIRECT_IO_BUFFER_SIZE = 4*1024*1024;
+
+/// Aligned buffers for O_DIRECT writes, they are kept until the process exits.
+class DirectIoBufferPool
+{
+public:
+  char* acquire()
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    if (!_free.empty())
+    {
+      char* buffer = _free.back();
+      _free.pop_back();
+      return buffer;
+    }
+    void* buffer = NULL;
+    if (posix_memalign(&buffer, DIRECT_IO_ALIGNMENT, DIRECT_IO_BUFFER_SIZE) != 0)
+      return NULL;
+    return static_cast<char*>(buffer);
+  }
+
+  void release(char* buffer)
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    _free.push_back(buffer);
+  }
+
+private:
+  boost::mutex       _mutex;
+  std::vector<char*> _free;
+};
+
+DirectIoBufferPool& getDirectIoBufferPool();
+
+/// Flush a file to disk and drop its pages from the page cache.
+bool dropFileFromCache(const std::string &path);
+
+/// Write data to a new file without leaving it in the page cache, and sync it.
+/// - Falls back to buffered writes if the file system does not support O_DIRECT, either
+///   when the file is opened or on the first write.
+bool writeFileDirect(const std::string &path, const char* data, const size_t size);
+
+
+//=========================================================================================
+// File helpers
+
+/// Returns true if a plain file or a container record exists
+bool fileExists(const std::string &path);
+
+/// Returns true if the path is a symbolic link, such as an output tile linked to its backup.
+bool isSymbolicLink(const std::string &path);
+
+/// Flush a file or folder to disk
+bool syncPath(const std::string &path);
+
+/// Flush the folder containing a file so that a rename of the file is on disk
+bool syncParentFolder(const std::string &path);
+
+
+#endif // HRSC_FILE_IO_H
@@ -0,0 +1,116 @@
+#include <HrscGeoTiff.h>
+
+
+//=========================================================================================
+// GeoTIFF writing
+
+
+void reduceImageByHalf(const cv::Mat &image, cv::Mat &reduced)
+{
+  cv::Mat even = image;
+  if ((image.rows % 2 != 0) || (image.cols % 2 != 0))
+    cv::copyMakeBorder(image, even, 0, image.rows % 2, 0, image.cols % 2, cv::BORDER_REPLICATE);
+  cv::resize(even, reduced, cv::Size(even.cols/2, even.rows/2), 0, 0, cv::INTER_AREA);
+}
+
+bool writeGdalBandsRegion(const std::vector<GDALRasterBandH> &bands, const cv::Point &origin, const cv::Mat &pixels)
+{
+  const int numChannels = pixels.channels();
+  for (size_t b=0; b<bands.size(); ++b)
+  {
+    // Band 1 is red, which is the last OpenCV channel
+    const int channel = (numChannels == 3) ? (2 - static_cast<int>(b)) : 0;
+    if (GDALRasterIO(bands[b], GF_Write, origin.x, origin.y, pixels.cols, pixels.rows,
+                     const_cast<unsigned char*>(pixels.ptr<unsigned char>()) + channel,
+                     pixels.cols, pixels.rows, GDT_Byte, numChannels, static_cast<int>(pixels.step[0])) != CE_None)
+      return false;
+  }
+  return true;
+}
+
+std::vector<std::vector<GDALRasterBandH> > getGdalLevelBands(GDALDatasetH dataset)
+{
+  const int numBands     = GDALGetRasterCount(dataset);
+  const int numOverviews = GDALGetOverviewCount(GDALGetRasterBand(dataset, 1));
+  std::vector<std::vector<GDALRasterBandH> > levelBands(numOverviews+1);
+  for (int b=1; b<=numBands; ++b)
+  {
+    GDALRasterBandH band = GDALGetRasterBand(dataset, b);
+    levelBands[0].push_back(band);
+    for (int i=0; i<numOverviews; ++i)
+      levelBands[i+1].push_back(GDALGetOverview(band, i));
+  }
+  return levelBands;
+}
+
+bool updateGdalOverviewRegion(GDALDatasetH dataset, const cv::Rect &region, const cv::Mat &pixels)
+{
+  const std::vector<std::vector<GDALRasterBandH> > levelBands = getGdalLevelBands(dataset);
+  cv::Mat   levelPixels = pixels;
+  cv::Point origin      = region.tl();
+  for (size_t level=1; level<levelBands.size(); ++level)
+  {
+    cv::Mat reduced;
+    reduceImageByHalf(levelPixels, reduced);
+    origin.x /= 2;
+    origin.y /= 2;
+    // Clip to the overview size, which GDAL may round differently at the edges
+    cv::Rect levelRect(origin, reduced.size());
+    constrainCvRoi(levelRect, GDALGetRasterBandXSize(levelBands[level][0]),
+                              GDALGetRasterBandYSize(levelBands[level][0]));
+    if (levelRect.area() <= 0)
+      break;
+    levelPixels = reduced(cv::Rect(0, 0, levelRect.width, levelRect.height));
+    if (!writeGdalBandsRegion(levelBands[level], origin, levelPixels))
+      return false;
+  }
+  return true;
+}
+
+bool writeGeoTiff(const std::string &outputPath, const cv::Mat &image, const GeoTiffOptions &options,
+                  const double *geoTransform, const std::string &projection)
+{
+  GeoTiffWriter writer;
+  if (!writer.open(outputPath, image.size(), image.channels(), options, geoTransform, projection))
+    return false;
+  for (int r=0; r<image.rows; r+=options.blockSize)
+  {
+    if (!writer.writeRows(image.rowRange(r, std::min(r+options.blockSize, image.rows))))
+      return false;
+  }
+  return writer.close();
+}
+
+bool readGeoTiffGeoreference(const std::string &path, double geoTransform[6], std::string &projection)
+{
+  GDALAllRegister();
+  GDALDatasetH dataset = GDALOpen(path.c_str(), GA_ReadOnly);
+  if (!dataset)
+    return false;
+  const bool found = (GDALGetGeoTransform(dataset, geoTransform) == CE_None);
+  projection = GDALGetProjectionRef(dataset);
+  GDALClose(dataset);
+  return found;
+}
+
+GeoTiffOptions getOutputTileGeoTiffOptions()
+{
+  const char* directIoString = getenv(OUTPUT_TILE_DIRECT_IO_ENV.c_str());
+  const bool  directIo       = !directIoString || (std::string(directIoString) != "0");
+  return GeoTiffOptions(512, "DEFLATE", true, 6, 0, directIo);
+}
+
+bool writeOutputTile(const std::string &outputPath, const cv::Mat &image, const std::string &georefSourcePath)
+{
+  const GeoTiffOptions options = getOutputTileGeoTiffOptions();
+  const bool isTiff = (outputPath.size() > 4) && (outputPath.substr(outputPath.size()-4) == ".tif");
+  if (!isTiff || isContainerPath(outputPath) || (image.depth() != CV_8U))
+    return writeOpenCvImageAtomic(outputPath, image, options.directIo);
+
+  double      geoTransform[6];
+  std::string projection;
+  const bool  hasGeoref = !isContainerPath(georefSourcePath) && !isBasemapCropPath(georefSourcePath) &&
+                          readGeoTiffGeoreference(georefSourcePath, geoTransform, projection);
+  return writeGeoTiff(outputPath, image, options,
+                      hasGeoref ? geoTransform : NULL, projection);
+}
@@ -0,0 +1,280 @@
+#ifndef HRSC_GEO_TIFF_H
+#define HRSC_GEO_TIFF_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include <opencv2/opencv.hpp>
+#include <gdal.h>
+#include <cpl_string.h>
+#include <cpl_vsi.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <HrscCore.h>
+#include <HrscFileIo.h>
+#include <HrscImageIo.h>
+
+
+//=========================================================================================
+// GeoTIFF writing
+
+// Output tiles are written as tiled, compressed GeoTIFFs with internal overviews so that a
+// region or a low resolution preview can be read without decoding the whole file.
+// - The image is written one strip of blocks at a time and each overview is reduced from
+//   the level below it as the strip goes by, so nothing is read back from the file the way
+//   gdaladdo does it.
+// - Overviews are added until the smallest one fits in a single block.
+// - Blocks are compressed on GDAL's worker thread pool and written to the file in order,
+//   so encoding a large tile is not a serial tail.  The pool is shared by every file a
+//   process writes, so concurrent writers do not start more threads than it has.
+// - The file is written next to the output path and renamed in to place.
+// - Products with directIo set are built in GDAL's /vsimem/ file system and then copied
+//   out with writeFileDirect, so they never pass through the page cache.  Files which GDAL
+//   or Vision Workbench update in place, such as a tile a journal is applied to, can not be
+//   written with O_DIRECT, so with directIo they are synced and dropped from the cache.
+
+/// How a GeoTIFF product is stored.
+struct GeoTiffOptions
+{
+  int         blockSize;   ///< Width and height of the file blocks, a multiple of 16.
+  std::string compression; ///< GDAL COMPRESS value: NONE, LZW, DEFLATE, ZSTD, or JPEG
+  bool        overviews;   ///< Write internal overviews
+  int         level;       ///< DEFLATE or ZSTD level, or JPEG quality.  -1 uses the codec default.
+  int         numThreads;  ///< Threads compressing blocks, 0 uses all of the CPUs.
+  bool        directIo;    ///< Keep the written file out of the page cache
+
+  GeoTiffOptions(const int blockSize_=1024, const std::string &compression_="NONE",
+                 const bool overviews_=false, const int level_=-1, const int numThreads_=0,
+                 const bool directIo_=false)
+    : blockSize(blockSize_), compression(compression_), overviews(overviews_),
+      level(level_), numThreads(numThreads_), directIo(directIo_) {}
+
+  /// Get the GDAL NUM_THREADS value
+  std::string getNumThreadsString() const
+  {
+    return (numThreads > 0) ? boost::lexical_cast<std::string>(numThreads) : "ALL_CPUS";
+  }
+
+  /// Get the name of the GDAL option which sets the codec level, or an empty string.
+  std::string getLevelOptionName() const
+  {
+    if (level < 0)
+      return "";
+    if (compression == "DEFLATE")
+      return "ZLEVEL";
+    if (compression == "ZSTD")
+      return "ZSTD_LEVEL";
+    if (compression == "JPEG")
+      return "JPEG_QUALITY";
+    return "";
+  }
+
+  /// Get the GDAL creation options, the caller must free them with CSLDestroy.
+  char** getCreationOptions(const int numChannels) const
+  {
+    const std::string blockString = boost::lexical_cast<std::string>(blockSize);
+    char **options = NULL;
+    options = CSLSetNameValue(options, "TILED",      "YES");
+    options = CSLSetNameValue(options, "BLOCKXSIZE", blockString.c_str());
+    options = CSLSetNameValue(options, "BLOCKYSIZE", blockString.c_str());
+    options = CSLSetNameValue(options, "BIGTIFF",    "IF_SAFER");
+    options = CSLSetNameValue(options, "COMPRESS",   compression.c_str());
+    if (compression == "NONE")
+      return options;
+    options = CSLSetNameValue(options, "NUM_THREADS", getNumThreadsString().c_str());
+    const std::string levelName = getLevelOptionName();
+    if (!levelName.empty())
+      options = CSLSetNameValue(options, levelName.c_str(), boost::lexical_cast<std::string>(level).c_str());
+    if ((compression == "LZW") || (compression == "DEFLATE") || (compression == "ZSTD"))
+      options = CSLSetNameValue(options, "PREDICTOR", "2");
+    if ((compression == "JPEG") && (numChannels == 3))
+      options = CSLSetNameValue(options, "PHOTOMETRIC", "YCBCR");
+    return options;
+  }
+};
+
+/// Setting this environment variable to 0 lets output tiles use the page cache.
+const std::string OUTPUT_TILE_DIRECT_IO_ENV = "HRSC_OUTPUT_TILE_DIRECT_IO";
+
+/// Get the options output tiles are stored with.
+/// - Output tiles are updated many times, so they use a lossless codec.
+/// - They are only read again when they are next updated, so by default they are kept out
+///   of the cache.  This is worse on file systems which do not support O_DIRECT, or when the
+///   tiles are read back soon after, see OUTPUT_TILE_DIRECT_IO_ENV.
+GeoTiffOptions getOutputTileGeoTiffOptions();
+
+/// Halve the resolution of an image with a 2x2 box filter.
+/// - An odd last row or column is averaged with itself.
+void reduceImageByHalf(const cv::Mat &image, cv::Mat &reduced);
+
+/// Write an 8 bit BGR or gray image in to one resolution level of a GeoTIFF.
+bool writeGdalBandsRegion(const std::vector<GDALRasterBandH> &bands, const cv::Point &origin, const cv::Mat &pixels);
+
+/// Get the bands of the full resolution image followed by the bands of each overview.
+std::vector<std::vector<GDALRasterBandH> > getGdalLevelBands(GDALDatasetH dataset);
+
+/// Recompute the overviews above one region of the full resolution image from its new pixels.
+/// - The region must start on a multiple of two to the power of the number of overviews,
+///   which is true of any file block.
+bool updateGdalOverviewRegion(GDALDatasetH dataset, const cv::Rect &region, const cv::Mat &pixels);
+
+/// Writes an 8 bit image to a GeoTIFF one strip of rows at a time, filling in the
+/// internal overviews as it goes.
+class GeoTiffWriter
+{
+public:
+
+  GeoTiffWriter() : _dataset(NULL) {}
+  ~GeoTiffWriter()
+  {
+    if (_dataset) // Never closed, throw away the partial file
+    {
+      GDALClose(_dataset);
+      if (_memoryPath.empty())
+        remove(_partialPath.c_str());
+      else
+        VSIUnlink(_memoryPath.c_str());
+    }
+  }
+
+  /// Create the file, the geo transform and projection are optional.
+  bool open(const std::string &outputPath, const cv::Size &size, const int numChannels,
+            const GeoTiffOptions &options, const double *geoTransform=NULL,
+            const std::string &projection="")
+  {
+    _outputPath  = outputPath;
+    _partialPath = outputPath + "_partial";
+    _memoryPath  = options.directIo ? "/vsimem/" + _partialPath : "";
+    GDALAllRegister();
+    GDALDriverH driver = GDALGetDriverByName("GTiff");
+    char **creationOptions = options.getCreationOptions(numChannels);
+    _dataset = GDALCreate(driver, getDatasetPath().c_str(), size.width, size.height, numChannels,
+                          GDT_Byte, creationOptions);
+    CSLDestroy(creationOptions);
+    if (!_dataset)
+    {
+      printf("Failed to create GeoTIFF %s\n", getDatasetPath().c_str());
+      return false;
+    }
+    if (geoTransform)
+      GDALSetGeoTransform(_dataset, const_cast<double*>(geoTransform));
+    if (!projection.empty())
+      GDALSetProjection(_dataset, projection.c_str());
+
+    if (options.overviews)
+    {
+      // Only lay out the overviews, their pixels are written along with the image
+      // - GDAL rounds each overview size up, the same as halving repeatedly.
+      std::vector<int> factors;
+      int levelWidth  = size.width;
+      int levelHeight = size.height;
+      for (int f=2; (levelWidth > options.blockSize) || (levelHeight > options.blockSize); f*=2)
+      {
+        factors.push_back(f);
+        levelWidth  = (levelWidth +1)/2;
+        levelHeight = (levelHeight+1)/2;
+      }
+      if (!factors.empty() &&
+          (GDALBuildOverviews(_dataset, "NONE", static_cast<int>(factors.size()), &factors[0],
+                              0, NULL, NULL, NULL) != CE_None))
+      {
+        printf("Failed to add overviews to %s\n", getDatasetPath().c_str());
+        return false;
+      }
+    }
+    _levelBands = getGdalLevelBands(_dataset);
+    _nextRow.assign(_levelBands.size(), 0);
+    _pendingRow.assign(_levelBands.size(), cv::Mat());
+    return true;
+  }
+
+  /// Write the next rows of the full resolution image, ideally a multiple of the block size.
+  bool writeRows(const cv::Mat &rows)
+  {
+    return writeLevelRows(0, rows);
+  }
+
+  /// Flush the file and move it in to place.
+  bool close()
+  {
+    bool complete = (_nextRow[0] == GDALGetRasterYSize(_dataset));
+    GDALClose(_dataset);
+    _dataset = NULL;
+    if (!_memoryPath.empty()) // Copy the finished file out of memory
+    {
+      vsi_l_offset size = 0;
+      GByte *data = VSIGetMemFileBuffer(_memoryPath.c_str(), &size, FALSE);
+      complete = complete && data &&
+                 writeFileDirect(_partialPath, reinterpret_cast<const char*>(data), static_cast<size_t>(size));
+      VSIUnlink(_memoryPath.c_str());
+    }
+    if (!complete || (rename(_partialPath.c_str(), _outputPath.c_str()) != 0))
+    {
+      printf("Failed to write GeoTIFF %s\n", _outputPath.c_str());
+      remove(_partialPath.c_str());
+      return false;
+    }
+    return true;
+  }
+
+private:
+
+  GDALDatasetH _dataset;
+  std::string  _outputPath;
+  std::string  _partialPath;
+  std::string  _memoryPath; ///< The file is built here with directIo
+  std::vector<std::vector<GDALRasterBandH> > _levelBands;
+  std::vector<int>     _nextRow;    ///< The next row to write at each level
+  std::vector<cv::Mat> _pendingRow; ///< An odd row at each level waiting for its pair
+
+  std::string getDatasetPath() const
+  {
+    return _memoryPath.empty() ? _partialPath : _memoryPath;
+  }
+
+  bool writeLevelRows(const size_t level, const cv::Mat &rows)
+  {
+    const int levelHeight = GDALGetRasterBandYSize(_levelBands[level][0]);
+    if (!writeGdalBandsRegion(_levelBands[level], cv::Point(0, _nextRow[level]), rows))
+      return false;
+    _nextRow[level] += rows.rows;
+    if (level+1 == _levelBands.size())
+      return true;
+
+    // Reduce all complete pairs of rows, an odd last row of the level is paired with itself
+    cv::Mat toReduce = rows;
+    if (!_pendingRow[level].empty())
+      cv::vconcat(_pendingRow[level], rows, toReduce);
+    _pendingRow[level] = cv::Mat();
+    if ((toReduce.rows % 2 != 0) && (_nextRow[level] < levelHeight))
+    {
+      _pendingRow[level] = toReduce.row(toReduce.rows-1).clone();
+      toReduce = toReduce.rowRange(0, toReduce.rows-1);
+    }
+    if (toReduce.rows == 0)
+      return true;
+    cv::Mat reduced;
+    reduceImageByHalf(toReduce, reduced);
+    const int width = std::min(reduced.cols, GDALGetRasterBandXSize(_levelBands[level+1][0]));
+    return writeLevelRows(level+1, reduced.colRange(0, width));
+  }
+};
+
+/// Write a whole 8 bit image as a GeoTIFF.
+bool writeGeoTiff(const std::string &outputPath, const cv::Mat &image, const GeoTiffOptions &options,
+                  const double *geoTransform=NULL, const std::string &projection="");
+
+/// Read the geo transform and projection of an image, returns false if it has none.
+bool readGeoTiffGeoreference(const std::string &path, double geoTransform[6], std::string &projection);
+
+/// Write an output tile, copying the georeference of the tile it was made from.
+/// - Plain .tif paths are written as GeoTIFFs with getOutputTileGeoTiffOptions.
+/// - Other formats and container paths are written with writeOpenCvImageAtomic.
+bool writeOutputTile(const std::string &outputPath, const cv::Mat &image, const std::string &georefSourcePath);
+
+
+#endif // HRSC_GEO_TIFF_H
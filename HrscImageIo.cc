@@ -0,0 +1,422 @@
+#include <HrscImageIo.h>
+
+
+//=========================================================================================
+// Intermediate images
+
+
+bool isIntermediateImagePath(const std::string &path)
+{
+  const size_t extLength = INTERMEDIATE_IMAGE_EXTENSION.size();
+  return (path.size() > extLength) &&
+         (path.compare(path.size()-extLength, extLength, INTERMEDIATE_IMAGE_EXTENSION) == 0);
+}
+
+// The offset table is written as zeros and filled in once all of the chunks are written.
+bool writeIntermediateChunks(std::ostream &stream, const cv::Mat &image)
+{
+  IntermediateImageHeader header;
+  memcpy(header.magic, INTERMEDIATE_IMAGE_MAGIC, sizeof(header.magic));
+  header.version      = INTERMEDIATE_IMAGE_VERSION;
+  header.rows         = image.rows;
+  header.cols         = image.cols;
+  header.type         = image.type();
+#ifdef HRSC_USE_LZ4
+  header.codec        = INTERMEDIATE_CODEC_LZ4;
+#else
+  header.codec        = INTERMEDIATE_CODEC_RAW;
+#endif
+  header.rowsPerChunk = INTERMEDIATE_ROWS_PER_CHUNK;
+
+  const size_t rowBytes  = image.cols*image.elemSize();
+  const size_t numChunks = (header.rows + header.rowsPerChunk - 1) / header.rowsPerChunk;
+  std::vector<uint64_t> offsets(numChunks+1, 0);
+  stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  stream.write(reinterpret_cast<const char*>(&offsets[0]), offsets.size()*sizeof(uint64_t));
+
+  uint64_t position = sizeof(header) + offsets.size()*sizeof(uint64_t);
+  std::vector<char> chunk(header.rowsPerChunk*rowBytes);
+#ifdef HRSC_USE_LZ4
+  std::vector<char> compressed(LZ4_compressBound(static_cast<int>(chunk.size())));
+#endif
+  for (size_t i=0; stream && (i<numChunks); ++i)
+  {
+    const int startRow = i*header.rowsPerChunk;
+    const int numRows  = std::min(static_cast<int>(header.rowsPerChunk), image.rows - startRow);
+    for (int r=0; r<numRows; ++r)
+      memcpy(&chunk[r*rowBytes], image.ptr(startRow+r), rowBytes);
+    int chunkSize = numRows*rowBytes;
+#ifdef HRSC_USE_LZ4
+    chunkSize = LZ4_compress_default(&chunk[0], &compressed[0], chunkSize, static_cast<int>(compressed.size()));
+    if (chunkSize <= 0)
+      return false;
+    stream.write(&compressed[0], chunkSize);
+#else
+    stream.write(&chunk[0], chunkSize);
+#endif
+    offsets[i] = position;
+    position  += chunkSize;
+  }
+  offsets[numChunks] = position;
+  stream.seekp(sizeof(header));
+  stream.write(reinterpret_cast<const char*>(&offsets[0]), offsets.size()*sizeof(uint64_t));
+  return !stream.fail();
+}
+
+bool writeIntermediateImage(const std::string &outputPath, const cv::Mat &image)
+{
+  // A container record is appended in one piece, so it is built in memory first.
+  bool success = false;
+  if (isContainerPath(outputPath))
+  {
+    std::ostringstream record(std::ios::binary);
+    success = writeIntermediateChunks(record, image) && writeFileData(outputPath, record.str());
+  }
+  else
+  {
+    std::ofstream file(outputPath.c_str(), std::ios::binary | std::ios::trunc);
+    success = file && writeIntermediateChunks(file, image);
+    file.close();
+    success = success && !file.fail();
+  }
+  if (!success)
+  {
+    printf("Failed to write image %s\n", outputPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool readIntermediateImage(const std::string &inputPath, cv::Mat &image,
+                           const int startRow, int numRows)
+{
+  MappedFileData file;
+  if (!file.open(inputPath))
+  {
+    printf("Failed to load image %s!\n", inputPath.c_str());
+    return false;
+  }
+  IntermediateImageHeader header;
+  if (file.size() >= sizeof(header))
+    memcpy(&header, file.data(), sizeof(header));
+  if ((file.size() < sizeof(header)) || (header.version != INTERMEDIATE_IMAGE_VERSION) ||
+      (memcmp(header.magic, INTERMEDIATE_IMAGE_MAGIC, sizeof(header.magic)) != 0) ||
+      ((header.codec != INTERMEDIATE_CODEC_RAW) && (header.codec != INTERMEDIATE_CODEC_LZ4)) ||
+      (header.rowsPerChunk == 0) || (header.type != CV_MAT_TYPE(header.type)))
+  {
+    printf("Invalid image file %s!\n", inputPath.c_str());
+    return false;
+  }
+#ifndef HRSC_USE_LZ4
+  if (header.codec == INTERMEDIATE_CODEC_LZ4)
+  {
+    printf("Reading %s requires building with LZ4 support!\n", inputPath.c_str());
+    return false;
+  }
+#endif
+
+  if (numRows < 0)
+    numRows = static_cast<int>(header.rows) - startRow;
+  const size_t numChunks = (header.rows + header.rowsPerChunk - 1) / header.rowsPerChunk;
+  const uint64_t *offsets = reinterpret_cast<const uint64_t*>(file.data() + sizeof(header));
+  const size_t tableEnd = sizeof(header) + (numChunks+1)*sizeof(uint64_t);
+  if ((startRow < 0) || (numRows < 0) || (startRow + numRows > static_cast<int>(header.rows)) ||
+      (file.size() < tableEnd) || (offsets[numChunks] > file.size()))
+  {
+    printf("Invalid row range or file size reading %s!\n", inputPath.c_str());
+    return false;
+  }
+  // Every chunk must start after the table and end where the next one starts
+  for (size_t i=0; i<numChunks; ++i)
+  {
+    if ((offsets[i] < tableEnd) || (offsets[i+1] < offsets[i]))
+    {
+      printf("Corrupt image file %s!\n", inputPath.c_str());
+      return false;
+    }
+  }
+
+  image.create(numRows, header.cols, header.type);
+  if (numRows == 0)
+    return true;
+  const size_t rowBytes = header.cols*image.elemSize();
+  std::vector<char> chunk;
+  const size_t firstChunk = startRow / header.rowsPerChunk;
+  const size_t lastChunk  = (startRow + numRows - 1) / header.rowsPerChunk;
+  for (size_t i=firstChunk; i<=lastChunk; ++i)
+  {
+    const int    chunkStart = i*header.rowsPerChunk;
+    const int    chunkRows  = std::min(static_cast<int>(header.rowsPerChunk), static_cast<int>(header.rows) - chunkStart);
+    const size_t chunkBytes = chunkRows*rowBytes;
+    const char*  source     = file.data() + offsets[i];
+    const size_t sourceSize = offsets[i+1] - offsets[i];
+
+    const char* rowData = source;
+    if (header.codec == INTERMEDIATE_CODEC_RAW)
+    {
+      if (sourceSize != chunkBytes)
+      {
+        printf("Corrupt image file %s!\n", inputPath.c_str());
+        return false;
+      }
+    }
+#ifdef HRSC_USE_LZ4
+    else
+    {
+      chunk.resize(chunkBytes);
+      if (LZ4_decompress_safe(source, &chunk[0], static_cast<int>(sourceSize), static_cast<int>(chunkBytes))
+          != static_cast<int>(chunkBytes))
+      {
+        printf("Corrupt image file %s!\n", inputPath.c_str());
+        return false;
+      }
+      rowData = &chunk[0];
+    }
+#endif
+
+    // Copy out the rows of this chunk that were requested
+    const int firstRow = std::max(startRow, chunkStart);
+    const int stopRow  = std::min(startRow + numRows, chunkStart + chunkRows);
+    for (int r=firstRow; r<stopRow; ++r)
+      memcpy(image.ptr(r - startRow), rowData + (r - chunkStart)*rowBytes, rowBytes);
+  }
+  return true;
+}
+
+
+//=========================================================================================
+// Mapped basemap crops
+
+
+bool parseBasemapCropPath(const std::string &path, std::string &basemapPath, cv::Rect &roi, bool &isGray)
+{
+  const size_t split = path.rfind(BASEMAP_CROP_SEPARATOR);
+  if (split == std::string::npos)
+    return false;
+  char band[8] = "";
+  const int count = sscanf(path.c_str()+split+BASEMAP_CROP_SEPARATOR.size(), "%d,%d,%d,%d,%7s",
+                           &roi.x, &roi.y, &roi.width, &roi.height, band);
+  if ((count < 4) || (roi.width <= 0) || (roi.height <= 0))
+    return false;
+  isGray = (count == 5) && (strcmp(band, "gray") == 0);
+  if ((count == 5) && !isGray)
+    return false;
+  basemapPath = path.substr(0, split + MAPPED_BASEMAP_EXTENSION.size());
+  return true;
+}
+
+bool isBasemapCropPath(const std::string &path)
+{
+  std::string basemapPath;
+  cv::Rect    roi;
+  bool        isGray;
+  return parseBasemapCropPath(path, basemapPath, roi, isGray);
+}
+
+bool writeMappedBasemap(const std::string &outputPath, const cv::Mat &basemap)
+{
+  if (basemap.type() != CV_8UC3)
+  {
+    printf("The basemap must be an 8 bit color image!\n");
+    return false;
+  }
+  MappedBasemapHeader header;
+  memcpy(header.magic, MAPPED_BASEMAP_MAGIC, sizeof(header.magic));
+  header.version  = MAPPED_BASEMAP_VERSION;
+  header.rows     = basemap.rows;
+  header.cols     = basemap.cols;
+  header.reserved = 0;
+
+  cv::Mat gray;
+  cv::extractChannel(basemap, gray, 2);
+
+  const std::string partialPath = outputPath + "_partial";
+  std::ofstream file(partialPath.c_str(), std::ios::binary);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (int r=0; r<basemap.rows; ++r)
+    file.write(basemap.ptr<char>(r), basemap.cols*basemap.elemSize());
+  for (int r=0; r<gray.rows; ++r)
+    file.write(gray.ptr<char>(r), gray.cols);
+  file.close();
+  if (file.fail() || (rename(partialPath.c_str(), outputPath.c_str()) != 0))
+  {
+    printf("Failed to write mapped basemap %s\n", outputPath.c_str());
+    remove(partialPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+boost::shared_ptr<const MappedBasemap> getMappedBasemap(const std::string &path)
+{
+  static boost::mutex cacheMutex;
+  static std::map<std::string, boost::shared_ptr<const MappedBasemap> > cache;
+
+  boost::mutex::scoped_lock lock(cacheMutex);
+  boost::shared_ptr<const MappedBasemap> &cached = cache[path];
+  if (!cached)
+  {
+    boost::shared_ptr<MappedBasemap> basemap(new MappedBasemap());
+    if (!basemap->open(path))
+      return boost::shared_ptr<const MappedBasemap>();
+    cached = basemap;
+  }
+  return cached;
+}
+
+void matchImageType(cv::Mat &image, const int imageType)
+{
+  if ((imageType == 0) && (image.channels() == 3))
+    cv::cvtColor(image, image, CV_BGR2GRAY);
+  else if ((imageType == 1) && (image.channels() == 1))
+    cv::cvtColor(image, image, CV_GRAY2BGR);
+}
+
+bool readOpenCvImage(const std::string &imagePath, cv::Mat &image, const int imageType)
+{
+  std::string basemapPath;
+  cv::Rect    cropRoi;
+  bool        cropIsGray;
+  if (parseBasemapCropPath(imagePath, basemapPath, cropRoi, cropIsGray))
+  {
+    boost::shared_ptr<const MappedBasemap> basemap = getMappedBasemap(basemapPath);
+    if (!basemap)
+    {
+      printf("Failed to load image %s!\n", imagePath.c_str());
+      return false;
+    }
+    basemap->getCrop(cropRoi, cropIsGray, image);
+    matchImageType(image, imageType);
+    return true;
+  }
+
+  if (isIntermediateImagePath(imagePath))
+  {
+    if (!readIntermediateImage(imagePath, image))
+      return false;
+    matchImageType(image, imageType);
+    return true;
+  }
+
+  //printf("Reading image file: %s\n", imagePath.c_str());
+  if (isContainerPath(imagePath))
+  {
+    // Decode straight from the mapped container
+    MappedFileData data;
+    if (data.open(imagePath) && (data.size() > 0))
+      image = cv::imdecode(cv::Mat(1, data.size(), CV_8UC1, const_cast<char*>(data.data())),
+                           imageType | CV_LOAD_IMAGE_ANYDEPTH);
+  }
+  else
+    image = cv::imread(imagePath, imageType | CV_LOAD_IMAGE_ANYDEPTH);
+  if (!image.data)
+  {
+    printf("Failed to load image %s!\n", imagePath.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool readOpenCvImageRegion(const std::string &imagePath, cv::Rect &roi, cv::Mat &image, const int imageType)
+{
+  GDALDatasetH dataset = NULL;
+  if (!isContainerPath(imagePath) && !isBasemapCropPath(imagePath) && !isIntermediateImagePath(imagePath))
+  {
+    GDALAllRegister();
+    dataset = GDALOpen(imagePath.c_str(), GA_ReadOnly);
+  }
+  if (!dataset || (GDALGetRasterDataType(GDALGetRasterBand(dataset, 1)) != GDT_Byte))
+  {
+    if (dataset)
+      GDALClose(dataset);
+    cv::Mat full;
+    if (!readOpenCvImage(imagePath, full, imageType))
+      return false;
+    if (!constrainCvRoi(roi, full.cols, full.rows))
+    {
+      printf("Region is outside of image %s!\n", imagePath.c_str());
+      return false;
+    }
+    image = full(roi).clone();
+    return true;
+  }
+
+  if (!constrainCvRoi(roi, GDALGetRasterXSize(dataset), GDALGetRasterYSize(dataset)))
+  {
+    printf("Region is outside of image %s!\n", imagePath.c_str());
+    GDALClose(dataset);
+    return false;
+  }
+  // Color files are read in OpenCV's BGR order, gray files from band 1
+  const int numChannels = (GDALGetRasterCount(dataset) >= 3) ? 3 : 1;
+  int bandMap[3] = {3, 2, 1};
+  if (numChannels == 1)
+    bandMap[0] = 1;
+  image.create(roi.height, roi.width, CV_8UC(numChannels));
+  const bool success = (GDALDatasetRasterIO(dataset, GF_Read, roi.x, roi.y, roi.width, roi.height,
+                                            image.data, roi.width, roi.height, GDT_Byte,
+                                            numChannels, bandMap, numChannels,
+                                            static_cast<int>(image.step[0]), 1) == CE_None);
+  GDALClose(dataset);
+  if (!success)
+  {
+    printf("Failed to load image %s!\n", imagePath.c_str());
+    return false;
+  }
+  matchImageType(image, imageType);
+  return true;
+}
+
+bool writeOpenCvImage(const std::string &outputPath, const cv::Mat &image)
+{
+  if (isIntermediateImagePath(outputPath))
+    return writeIntermediateImage(outputPath, image);
+  if (!isContainerPath(outputPath))
+    return cv::imwrite(outputPath, image);
+
+  // Encode to the format given by the key extension and append to the container
+  std::vector<unsigned char> buffer;
+  const size_t dot = outputPath.rfind('.');
+  if ((dot == std::string::npos) || !cv::imencode(outputPath.substr(dot), image, buffer))
+    return false;
+  return writeFileData(outputPath, reinterpret_cast<const char*>(&buffer[0]), buffer.size());
+}
+
+bool writeOpenCvImageAtomic(const std::string &outputPath, const cv::Mat &image, const bool directIo)
+{
+  // Container records are never visible until they are complete
+  if (isContainerPath(outputPath))
+    return writeOpenCvImage(outputPath, image);
+
+  // Keep the extension so OpenCV writes the same format
+  const size_t dot   = outputPath.rfind('.');
+  const size_t slash = outputPath.rfind('/');
+  std::string partialPath = outputPath + "_partial";
+  if ((dot != std::string::npos) && ((slash == std::string::npos) || (dot > slash)))
+    partialPath = outputPath.substr(0, dot) + "_partial" + outputPath.substr(dot);
+
+  if (directIo && !isIntermediateImagePath(outputPath))
+  {
+    std::vector<unsigned char> buffer;
+    if ((dot == std::string::npos) || !cv::imencode(outputPath.substr(dot), image, buffer) ||
+        !writeFileDirect(partialPath, reinterpret_cast<const char*>(&buffer[0]), buffer.size()))
+    {
+      printf("Failed to write image %s!\n", partialPath.c_str());
+      remove(partialPath.c_str());
+      return false;
+    }
+  }
+  else if (!writeOpenCvImage(partialPath, image))
+  {
+    printf("Failed to write image %s!\n", partialPath.c_str());
+    remove(partialPath.c_str());
+    return false;
+  }
+  if (rename(partialPath.c_str(), outputPath.c_str()) != 0)
+  {
+    printf("Failed to move %s to %s!\n", partialPath.c_str(), outputPath.c_str());
+    remove(partialPath.c_str());
+    return false;
+  }
+  return true;
+}
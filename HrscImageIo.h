@@ -0,0 +1,206 @@
+#ifndef HRSC_IMAGE_IO_H
+#define HRSC_IMAGE_IO_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <unistd.h>
+#include <opencv2/opencv.hpp>
+#include <gdal.h>
+#include <cpl_string.h>
+#include <cpl_vsi.h>
+#ifdef HRSC_USE_LZ4
+  #include <lz4.h>
+#endif
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/stream.hpp>
+
+#include <HrscCore.h>
+#include <HrscFileIo.h>
+
+
+//=========================================================================================
+// Intermediate images
+
+// Images which are only passed between the pipeline tools can be stored in a raw
+// format which is much faster to write and read than compressed TIFF.
+// - A file is a header, a table of chunk offsets, and then the chunks.
+// - Each chunk holds a fixed number of rows so that a range of rows can be read
+//   without decoding the whole image.
+// - Chunks are LZ4 compressed when built with HRSC_USE_LZ4, otherwise they are raw.  They are
+//   written to the file as they are compressed and the offset table is filled in at the end.
+// - Files are read through a memory map.  The codec and chunk offsets are checked first so a
+//   damaged file fails to load instead of reading outside of the mapping.
+// - The per-tile new color images use this format, see NEW_COLOR_TILE_EXTENSION in
+//   hrscImageManager.py.
+
+/// Images with this extension are stored in the intermediate format
+const std::string INTERMEDIATE_IMAGE_EXTENSION = ".hrt";
+
+/// Header at the start of every intermediate image file, followed by the chunk offsets.
+struct IntermediateImageHeader
+{
+  char     magic[8];     // "HRSCIMG1"
+  uint32_t version;
+  uint32_t rows;
+  uint32_t cols;
+  int32_t  type;         // OpenCV pixel type
+  uint32_t codec;
+  uint32_t rowsPerChunk;
+};
+const char     INTERMEDIATE_IMAGE_MAGIC[8]   = {'H','R','S','C','I','M','G','1'};
+const uint32_t INTERMEDIATE_IMAGE_VERSION    = 1;
+const uint32_t INTERMEDIATE_CODEC_RAW        = 0;
+const uint32_t INTERMEDIATE_CODEC_LZ4        = 1;
+const uint32_t INTERMEDIATE_ROWS_PER_CHUNK   = 64;
+
+/// Returns true if the path refers to an intermediate format image
+bool isIntermediateImagePath(const std::string &path);
+
+/// Write an intermediate format image to a stream which supports seeking.
+bool writeIntermediateChunks(std::ostream &stream, const cv::Mat &image);
+
+/// Write an image of any OpenCV type in the intermediate format
+bool writeIntermediateImage(const std::string &outputPath, const cv::Mat &image);
+
+/// Read all or part of an intermediate format image.
+/// - If numRows is negative all the rows from startRow to the end are read.
+bool readIntermediateImage(const std::string &inputPath, cv::Mat &image,
+                           const int startRow=0, int numRows=-1);
+
+//=========================================================================================
+// Mapped basemap crops
+
+// The low resolution basemap can be converted once in to a raw file, normally in /dev/shm,
+// which every tool maps in to memory.  A crop of it is addressed with a path of the form
+// "<mapped basemap>.hrb@<col>,<row>,<width>,<height>", plus ",gray" for the gray band, and is
+// read without running gdal_translate or decoding an image.  Only the ".hrb@" marker starts a
+// crop, so other paths which contain '@' are read as plain files.
+// - The file holds the BGR pixels followed by the gray band, both stored by row, so a crop
+//   inside the basemap is a cv::Mat header pointing in to the mapping.  These crops are not
+//   continuous in memory.
+// - The mapping is private so a tool which writes to a crop only changes its own copy.
+// - Crops which extend past the basemap are copied and padded with zeros, like gdal_translate.
+// - The gray band is the red channel, matching gdal_translate -b 1.
+
+/// Mapped basemap files must have this extension
+const std::string MAPPED_BASEMAP_EXTENSION = ".hrb";
+const std::string BASEMAP_CROP_SEPARATOR   = MAPPED_BASEMAP_EXTENSION + "@";
+
+/// Header at the start of a mapped basemap file
+struct MappedBasemapHeader
+{
+  char     magic[8]; // "HRSCBASE"
+  uint32_t version;
+  uint32_t rows;
+  uint32_t cols;
+  uint32_t reserved;
+};
+const char     MAPPED_BASEMAP_MAGIC[8] = {'H','R','S','C','B','A','S','E'};
+const uint32_t MAPPED_BASEMAP_VERSION  = 1;
+
+/// Split a basemap crop path in to its parts, returns false if it is not a crop path.
+bool parseBasemapCropPath(const std::string &path, std::string &basemapPath, cv::Rect &roi, bool &isGray);
+
+bool isBasemapCropPath(const std::string &path);
+
+/// Write a BGR basemap image as a mapped basemap file.
+/// - The file is written next to the output path and renamed in to place.
+bool writeMappedBasemap(const std::string &outputPath, const cv::Mat &basemap);
+
+/// A mapped basemap file which crops are taken from.
+class MappedBasemap
+{
+public:
+
+  bool open(const std::string &path)
+  {
+    boost::iostreams::mapped_file_params params(path);
+    params.flags = boost::iostreams::mapped_file::priv;
+    try
+    {
+      _file.open(params);
+    }
+    catch (const std::exception &)
+    {
+      printf("Failed to map basemap %s\n", path.c_str());
+      return false;
+    }
+    MappedBasemapHeader header;
+    if (_file.size() >= sizeof(header))
+      memcpy(&header, _file.const_data(), sizeof(header));
+    const size_t numPixels = static_cast<size_t>(header.rows)*header.cols;
+    if ((_file.size() < sizeof(header)) || (header.version != MAPPED_BASEMAP_VERSION) ||
+        (memcmp(header.magic, MAPPED_BASEMAP_MAGIC, sizeof(header.magic)) != 0) ||
+        (_file.size() != sizeof(header) + 4*numPixels))
+    {
+      printf("Invalid mapped basemap %s\n", path.c_str());
+      return false;
+    }
+    _color = cv::Mat(header.rows, header.cols, CV_8UC3, _file.data() + sizeof(header));
+    _gray  = cv::Mat(header.rows, header.cols, CV_8UC1, _file.data() + sizeof(header) + 3*numPixels);
+    return true;
+  }
+
+  /// Get a crop of the color or gray basemap, without copying if it is inside the basemap.
+  void getCrop(const cv::Rect &roi, const bool isGray, cv::Mat &crop) const
+  {
+    const cv::Mat &source = isGray ? _gray : _color;
+    const cv::Rect inside = roi & cv::Rect(0, 0, source.cols, source.rows);
+    if (inside == roi)
+    {
+      crop = source(roi);
+      return;
+    }
+    crop = cv::Mat::zeros(roi.height, roi.width, source.type());
+    if (inside.area() > 0)
+      source(inside).copyTo(crop(cv::Rect(inside.x-roi.x, inside.y-roi.y, inside.width, inside.height)));
+  }
+
+private:
+  boost::iostreams::mapped_file _file;
+  cv::Mat _color;
+  cv::Mat _gray;
+};
+
+/// Returns the process wide mapping of a basemap file.
+/// - Basemaps stay mapped until the process exits so crops of them remain valid.
+boost::shared_ptr<const MappedBasemap> getMappedBasemap(const std::string &path);
+
+/// Convert an image to the channel count that imread would produce for an image type
+void matchImageType(cv::Mat &image, const int imageType);
+
+/// Try to load the image and then make sure we got valid data.
+/// - The type must by 0 (gray) or 1 (RGB)
+bool readOpenCvImage(const std::string &imagePath, cv::Mat &image, const int imageType);
+
+/// Read the part of an 8 bit image inside roi, which is clipped to the image bounds.
+/// - Plain image files are read with GDAL so only the file blocks overlapping the region
+///   are decoded.  Other paths are loaded with readOpenCvImage and then cropped.
+/// - The type must by 0 (gray) or 1 (RGB)
+bool readOpenCvImageRegion(const std::string &imagePath, cv::Rect &roi, cv::Mat &image, const int imageType);
+
+/// Write an image with OpenCV or in the intermediate format, depending on the extension.
+bool writeOpenCvImage(const std::string &outputPath, const cv::Mat &image);
+
+/// Write an image to a temporary file next to the output path and then rename it in to place.
+/// - Readers never see a partially written file and a symlink at the output path is replaced
+///   instead of having its target overwritten.
+/// - Container paths are appended to directly.
+/// - With directIo the encoded image is written with writeFileDirect.
+bool writeOpenCvImageAtomic(const std::string &outputPath, const cv::Mat &image, const bool directIo=false);
+
+
+#endif // HRSC_IMAGE_IO_H
@@ -0,0 +1,120 @@
+#include <HrscImageViews.h>
+
+
+//=========================================================================================
+// Vision Workbench image views
+
+
+void computeAndMaskStrip(const std::vector<vw::ImageViewRef<vw::PixelGray<vw::uint8> > > &images,
+                         const vw::BBox2i &roi, vw::ImageView<vw::PixelGray<vw::uint8> > &mask)
+{
+  mask.set_size(roi.width(), roi.height());
+  vw::fill(mask, vw::PixelGray<vw::uint8>(255));
+  for (size_t i=0; i<images.size(); ++i)
+  {
+    // Each strip is read with multiple threads
+    vw::ImageView<vw::PixelGray<vw::uint8> > strip =
+        vw::crop(vw::block_rasterize(images[i], vw::Vector2i(1024, 1024), 0), roi);
+    for (int r=0; r<roi.height(); ++r)
+      for (int c=0; c<roi.width(); ++c)
+        if (strip(c, r)[0] == 0)
+          mask(c, r) = 0;
+  }
+}
+
+vw::Vector2i getCommonImageSize(const std::vector<vw::ImageViewRef<vw::PixelGray<vw::uint8> > > &images)
+{
+  VW_ASSERT( !images.empty(), vw::ArgumentErr() << "getCommonImageSize: One or more images required!" );
+  vw::Vector2i size(images[0].cols(), images[0].rows());
+  for (size_t i=1; i<images.size(); ++i)
+  {
+    size[0] = std::min(size[0], images[i].cols());
+    size[1] = std::min(size[1], images[i].rows());
+  }
+  return size;
+}
+
+bool writeAndMaskImages(const std::vector<vw::ImageViewRef<vw::PixelGray<vw::uint8> > > &images,
+                        const vw::cartography::GeoReference &georef,
+                        const std::string &binaryMaskPath, const std::string &grassfirePath,
+                        MaskStatistics &stats,
+                        const vw::ProgressCallback &progress)
+{
+  typedef vw::PixelGray<vw::uint8>      PixelT;
+  typedef vw::PixelGray<MASK_DATA_TYPE> MaskPixelT;
+  const int STRIP_HEIGHT = 1024;
+
+  const vw::Vector2i size = getCommonImageSize(images);
+  const int numCols = size[0];
+  const int numRows = size[1];
+  stats.reset(numRows, numCols, stats.tileSize());
+
+  // Set up the outputs, the GDAL images are written one strip at a time.
+  const bool packed = !binaryMaskPath.empty() && isPackedMaskPath(binaryMaskPath);
+  std::ofstream packedFile;
+  std::vector<PackedBinaryMask::WordType> packedRow;
+  boost::scoped_ptr<vw::DiskImageResourceGDAL> binaryRsrc, grassfireRsrc;
+  if (packed)
+  {
+    packedFile.open(binaryMaskPath.c_str(), std::ios::binary);
+    PackedBinaryMask::writeHeader(packedFile, numRows, numCols);
+    packedRow.resize((numCols + PackedBinaryMask::BITS_PER_WORD - 1) / PackedBinaryMask::BITS_PER_WORD);
+  }
+  else if (!binaryMaskPath.empty())
+  {
+    binaryRsrc.reset(build_gdal_rsrc(binaryMaskPath, vw::constant_view(PixelT(), numCols, numRows)));
+    vw::cartography::write_georeference(*binaryRsrc, georef);
+  }
+  if (!grassfirePath.empty())
+  {
+    grassfireRsrc.reset(build_gdal_rsrc(grassfirePath, vw::constant_view(MaskPixelT(), numCols, numRows)));
+    vw::cartography::write_georeference(*grassfireRsrc, georef);
+  }
+
+  // Grassfire rows finish about two strips behind the mask rows
+  GrassfireRowStream grassfire(numRows, numCols);
+  vw::ImageView<PixelT>     maskStrip;
+  vw::ImageView<MaskPixelT> grassfireStrip(numCols, STRIP_HEIGHT);
+  int numGrassfireRows = 0;
+  for (int startRow=0; startRow<numRows; startRow+=STRIP_HEIGHT)
+  {
+    const int stripHeight = std::min(STRIP_HEIGHT, numRows-startRow);
+    computeAndMaskStrip(images, vw::BBox2i(0, startRow, numCols, stripHeight), maskStrip);
+
+    for (int r=0; r<stripHeight; ++r)
+    {
+      const unsigned char* maskRow = reinterpret_cast<const unsigned char*>(&maskStrip(0, r));
+      stats.addRow(maskRow, numCols, startRow+r);
+      if (packed)
+      {
+        PackedBinaryMask::packRow(maskRow, numCols, &packedRow[0]);
+        packedFile.write(reinterpret_cast<const char*>(&packedRow[0]),
+                         packedRow.size()*sizeof(PackedBinaryMask::WordType));
+      }
+      if (!grassfireRsrc)
+        continue;
+
+      // Write out each grassfire strip as soon as it is full
+      grassfire.addRow(maskRow);
+      while (grassfire.getNextRow(reinterpret_cast<MASK_DATA_TYPE*>(&grassfireStrip(0, numGrassfireRows % STRIP_HEIGHT))))
+      {
+        ++numGrassfireRows;
+        if ((numGrassfireRows % STRIP_HEIGHT != 0) && (numGrassfireRows != numRows))
+          continue;
+        const int writeStart = ((numGrassfireRows-1) / STRIP_HEIGHT) * STRIP_HEIGHT;
+        vw::ImageBuffer buffer = grassfireStrip.buffer();
+        buffer.format.rows = numGrassfireRows - writeStart;
+        grassfireRsrc->write(buffer, vw::BBox2i(0, writeStart, numCols, buffer.format.rows));
+      }
+    }
+    if (binaryRsrc)
+      binaryRsrc->write(maskStrip.buffer(), vw::BBox2i(0, startRow, numCols, stripHeight));
+    progress.report_fractional_progress(startRow+stripHeight, numRows);
+  }
+  progress.report_finished();
+
+  if (!packed)
+    return true;
+  packedFile.close();
+  return !packedFile.fail();
+}
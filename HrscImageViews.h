@@ -0,0 +1,414 @@
+#ifndef HRSC_IMAGE_VIEWS_H
+#define HRSC_IMAGE_VIEWS_H
+
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <unistd.h>
+#include <opencv2/opencv.hpp>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/stream.hpp>
+
+#include <vw/Image/Algorithms.h>
+#include <vw/Image/BlockRasterize.h>
+#include <vw/Image/PixelMath.h>
+#include <vw/Image/Statistics.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/UtilityViews.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/FileIO/DiskImageResourceGDAL.h>
+#include <vw/FileIO/DiskImageUtils.h>
+#include <vw/Cartography/GeoReference.h>
+
+#include <HrscCore.h>
+#include <HrscFileIo.h>
+#include <HrscImageIo.h>
+#include <HrscMasks.h>
+#include <HrscColor.h>
+#include <HrscGeoTiff.h>
+
+
+//=========================================================================================
+// Functions copied from ASP
+// - Maybe these functions should live in Vision Workbench?
+
+template <class ImageT>
+vw::DiskImageResourceGDAL*
+build_gdal_rsrc( const std::string &filename,
+               vw::ImageViewBase<ImageT> const& image,
+               GeoTiffOptions const& options = GeoTiffOptions()) 
+{
+  vw::DiskImageResourceGDAL::Options gdal_options;
+
+  // If the image is big, make sure we write bigtiff format.
+  //if ( (disk_image.cows() > 30000) && (disk_image.rows() > 15000))
+  gdal_options["BIGTIFF"] = "IF_SAFER";//"YES";
+  if (options.compression != "NONE")
+  {
+    gdal_options["COMPRESS"]    = options.compression;
+    gdal_options["NUM_THREADS"] = options.getNumThreadsString();
+    if (!options.getLevelOptionName().empty())
+      gdal_options[options.getLevelOptionName()] = boost::lexical_cast<std::string>(options.level);
+  }
+
+  // The tile size defaults to a good number!
+  vw::Vector2i raster_tile_size(options.blockSize, options.blockSize);
+  return new vw::DiskImageResourceGDAL(filename, image.impl().format(), raster_tile_size, gdal_options);
+}
+
+
+// Block write image with georef and keywords to geoheader.
+template <class ImageT>
+void block_write_gdal_image( const std::string &filename,
+                             vw::ImageViewBase<ImageT> const& image,
+                             vw::cartography::GeoReference const& georef,
+                             vw::ProgressCallback const& progress_callback =                     
+                                               vw::ProgressCallback::dummy_instance(),
+                             std::map<std::string, std::string> keywords =
+                                               std::map<std::string, std::string>(),
+                             GeoTiffOptions const& options = GeoTiffOptions()
+                           ) 
+{
+  boost::scoped_ptr<vw::DiskImageResourceGDAL> rsrc( build_gdal_rsrc( filename, image, options ) );
+  for (std::map<std::string, std::string>::iterator i = keywords.begin(); i != keywords.end(); i++)
+  {
+    vw::cartography::write_header_string(*rsrc, i->first, i->second);
+  }
+  vw::cartography::write_georeference(*rsrc, georef);
+  vw::block_write_image( *rsrc, image.impl(), progress_callback );
+
+  // Vision Workbench writes through the page cache, so drop the file once it is on disk
+  if (options.directIo)
+  {
+    rsrc.reset();
+    dropFileFromCache(filename);
+  }
+}
+
+/// Rasterize an 8 bit RGB image in blocks and write it through writeOpenCvImageAtomic, for
+/// images which are only read back by the OpenCV tools and can use the intermediate format.
+template <class ImageT>
+bool write_opencv_rgb_image(const std::string &filename, vw::ImageViewBase<ImageT> const& image)
+{
+  vw::ImageView<vw::PixelRGB<vw::uint8> > pixels = vw::block_rasterize(image.impl(), vw::Vector2i(256, 256), 0);
+  cv::Mat rgb(pixels.rows(), pixels.cols(), CV_8UC3, pixels.data()), bgr;
+  cv::cvtColor(rgb, bgr, cv::COLOR_RGB2BGR);
+  return writeOpenCvImageAtomic(filename, bgr);
+}
+
+
+//=========================================================================================
+// Vision Workbench image views
+
+/// Rasterize one strip of rows from each image and compute their AND mask.
+/// - Output pixels are 255 where all of the images are nonzero.
+/// - The strip must lie inside all of the images, which may have different sizes.
+void computeAndMaskStrip(const std::vector<vw::ImageViewRef<vw::PixelGray<vw::uint8> > > &images,
+                         const vw::BBox2i &roi, vw::ImageView<vw::PixelGray<vw::uint8> > &mask);
+
+/// Return the largest size which is inside all of the images
+vw::Vector2i getCommonImageSize(const std::vector<vw::ImageViewRef<vw::PixelGray<vw::uint8> > > &images);
+
+/// Reads the grassfire weights of the AND mask of a set of images one strip of rows at a time.
+/// - The AND mask is computed in strips as the grassfire stream needs them, so neither
+///   full size image is ever held in memory.
+/// - The mask is the size of the smallest input image.
+class AndMaskGrassfireReader
+{
+public:
+  typedef vw::PixelGray<vw::uint8>      PixelT;
+  typedef vw::PixelGray<MASK_DATA_TYPE> MaskPixelT;
+
+  AndMaskGrassfireReader(const std::vector<vw::ImageViewRef<PixelT> > &images)
+    : m_images(images), m_size(getCommonImageSize(images)),
+      m_stream(m_size[1], m_size[0]), m_maskStripStart(0), m_nextMaskRow(0) {}
+
+  int rows() const { return m_size[1]; }
+  int cols() const { return m_size[0]; }
+
+  /// Read the grassfire weights of the next numRows rows
+  void readStrip(int numRows, vw::ImageView<MaskPixelT> &grassfire)
+  {
+    grassfire.set_size(cols(), numRows);
+    int row = 0;
+    while (row < numRows)
+    {
+      // Only add mask rows once all of the finished rows have been taken
+      if (m_stream.getNextRow(reinterpret_cast<MASK_DATA_TYPE*>(&grassfire(0, row))))
+      {
+        ++row;
+        continue;
+      }
+      if (m_nextMaskRow == m_maskStripStart + m_maskStrip.rows())
+      {
+        m_maskStripStart = m_nextMaskRow;
+        const int stripHeight = std::min(static_cast<int>(MASK_MAX)+1, rows()-m_maskStripStart);
+        computeAndMaskStrip(m_images, vw::BBox2i(0, m_maskStripStart, cols(), stripHeight), m_maskStrip);
+      }
+      m_stream.addRow(reinterpret_cast<const unsigned char*>(&m_maskStrip(0, m_nextMaskRow-m_maskStripStart)));
+      ++m_nextMaskRow;
+    }
+  }
+
+private:
+  std::vector<vw::ImageViewRef<PixelT> > m_images;
+  vw::Vector2i          m_size;
+  GrassfireRowStream    m_stream;
+  vw::ImageView<PixelT> m_maskStrip;
+  int                   m_maskStripStart;
+  int                   m_nextMaskRow;
+};
+
+/// Write the AND mask of a set of images and/or its grassfire weights one strip of rows at a time.
+/// - Either output path may be empty.  A binary mask path ending in .pmask is written packed.
+/// - The valid pixels of the mask, which the grassfire image shares, are recorded in stats.
+/// - The outputs are the size of the smallest input image.
+bool writeAndMaskImages(const std::vector<vw::ImageViewRef<vw::PixelGray<vw::uint8> > > &images,
+                        const vw::cartography::GeoReference &georef,
+                        const std::string &binaryMaskPath, const std::string &grassfirePath,
+                        MaskStatistics &stats,
+                        const vw::ProgressCallback &progress = vw::ProgressCallback::dummy_instance());
+
+
+/// Color transform information for one HRSC tile
+struct HrscTileColorInfo
+{
+  HrscTileColorInfo() : valid(false), percentValid(0) {}
+  bool    valid;
+  double  percentValid;
+  cv::Mat colorTransform;
+};
+
+/// Image view which applies the per-tile HRSC color transforms to an entire HRSC image.
+/// - Each pixel is a distance weighted blend of the transforms from its tile and the
+///   adjacent tiles, weighted by valid pixel percentage the same way
+///   hrscImageManager.py sets up each transformHrscImageColor call.
+/// - Pixels in tiles without a color transform are black.
+class HrscColorTransformView : public vw::ImageViewBase<HrscColorTransformView>
+{
+public:
+  typedef vw::PixelRGB<vw::uint8> pixel_type;
+  typedef pixel_type              result_type;
+
+  typedef vw::ImageViewRef<vw::PixelGray<vw::uint8     > > ChannelViewT;
+  typedef vw::ImageViewRef<vw::PixelGray<MASK_DATA_TYPE> > MaskViewT;
+
+  HrscColorTransformView(const std::vector<ChannelViewT> &channels, const MaskViewT &mask,
+                         const BrightnessCorrector &corrector,
+                         const std::vector<std::vector<HrscTileColorInfo> > &tiles, int tileSize)
+    : m_channels(channels), m_mask(mask), m_corrector(corrector), m_tile_size(tileSize)
+  {
+    VW_ASSERT( (channels.size() == NUM_HRSC_CHANNELS),
+               vw::ArgumentErr() << "HrscColorTransformView: Wrong number of input channels!" );
+
+    // Precompute the blending setup for each tile
+    const int numTileRows = tiles.size();
+    m_blends.resize(numTileRows);
+    for (int tr=0; tr<numTileRows; ++tr)
+    {
+      const int numTileCols = tiles[tr].size();
+      m_blends[tr].resize(numTileCols);
+      for (int tc=0; tc<numTileCols; ++tc)
+      {
+        const HrscTileColorInfo &tile = tiles[tr][tc];
+        TileBlend &blend = m_blends[tr][tc];
+        blend.valid = tile.valid && (tile.percentValid > 0);
+        if (!blend.valid)
+          continue;
+        blend.mainTransform = tile.colorTransform;
+        blend.height = std::min(tileSize, mask.rows() - tr*tileSize);
+        blend.width  = std::min(tileSize, mask.cols() - tc*tileSize);
+
+        // The main tile is the reference so it starts with weight 1
+        double totalWeight = 1.0;
+        for (int r=-1; r<=1; ++r)
+        {
+          for (int c=-1; c<=1; ++c)
+          {
+            if ((r == 0) && (c == 0))
+              continue;
+            if ((tr+r < 0) || (tr+r >= numTileRows) || (tc+c < 0) || (tc+c >= static_cast<int>(tiles[tr+r].size())))
+              continue;
+            const HrscTileColorInfo &other = tiles[tr+r][tc+c];
+            if (!other.valid)
+              continue;
+            const double weight = other.percentValid / tile.percentValid;
+            blend.otherTransforms.push_back(other.colorTransform);
+            blend.otherWeights.push_back(weight);
+            blend.otherOffsets.push_back(cv::Vec2i(c, r));
+            totalWeight += weight;
+          }
+        }
+        for (size_t i=0; i<blend.otherWeights.size(); ++i)
+          blend.otherWeights[i] /= totalWeight;
+        blend.mainWeight = 1.0 / totalWeight;
+      }
+    }
+  }
+
+  inline vw::int32 cols  () const { return m_mask.cols(); }
+  inline vw::int32 rows  () const { return m_mask.rows(); }
+  inline vw::int32 planes() const { return 1; }
+
+  inline result_type operator()( vw::int32 i, vw::int32 j, vw::int32 p=0 ) const
+  {
+    return 0; // NOT IMPLEMENTED!
+  }
+
+  typedef vw::ProceduralPixelAccessor<HrscColorTransformView> pixel_accessor;
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  typedef vw::CropView<vw::ImageView<result_type> > prerasterize_type;
+  inline prerasterize_type prerasterize( vw::BBox2i const& bbox ) const
+  {
+    // Pull in all of the input data for this tile
+    std::vector<vw::ImageView<vw::PixelGray<vw::uint8> > > channel_tiles(NUM_HRSC_CHANNELS);
+    for (size_t i=0; i<NUM_HRSC_CHANNELS; ++i)
+      channel_tiles[i] = vw::crop(m_channels[i], bbox);
+    vw::ImageView<vw::PixelGray<MASK_DATA_TYPE> > mask_tile = vw::crop(m_mask, bbox);
+
+    vw::ImageView<result_type> tile(bbox.width(), bbox.height());
+    std::vector<unsigned char> hrscPixel(NUM_HRSC_CHANNELS);
+    std::vector<cv::Vec3b> otherPixels;
+    cv::Vec3b mainPixel, outputPixel;
+    for (int r=0; r<bbox.height(); ++r)
+    {
+      const int row     = r + bbox.min().y();
+      const int tileRow = row / m_tile_size;
+      for (int c=0; c<bbox.width(); ++c)
+      {
+        const int col     = c + bbox.min().x();
+        const int tileCol = col / m_tile_size;
+        const TileBlend &blend = m_blends[tileRow][tileCol];
+        if ((mask_tile(c, r)[0] == 0) || !blend.valid)
+        {
+          tile(c, r) = result_type(0, 0, 0);
+          continue;
+        }
+
+        for (size_t i=0; i<NUM_HRSC_CHANNELS; ++i)
+          hrscPixel[i] = m_corrector.correctPixel(channel_tiles[i](c, r)[0], row);
+
+        mainPixel = transformPixelYCC(hrscPixel, blend.mainTransform);
+        otherPixels.resize(blend.otherTransforms.size());
+        for (size_t i=0; i<otherPixels.size(); ++i)
+          otherPixels[i] = transformPixelYCC(hrscPixel, blend.otherTransforms[i]);
+
+        determineBlendedPixel(blend.height, blend.width,
+                              row - tileRow*m_tile_size, col - tileCol*m_tile_size,
+                              mainPixel,   blend.mainWeight,
+                              otherPixels, blend.otherOffsets, blend.otherWeights,
+                              outputPixel);
+
+        // The color transforms produce pixels in OpenCV's BGR order
+        tile(c, r) = result_type(outputPixel[2], outputPixel[1], outputPixel[0]);
+      }
+    }
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
+  }
+
+  template <class DestT> inline void rasterize( DestT const& dest, vw::BBox2i const& bbox ) const
+  {
+    vw::rasterize( prerasterize(bbox), dest, bbox );
+  }
+
+private:
+
+  /// Blending setup for one tile
+  struct TileBlend
+  {
+    TileBlend() : valid(false), mainWeight(0), height(0), width(0) {}
+    bool                   valid;
+    cv::Mat                mainTransform;
+    double                 mainWeight;
+    std::vector<cv::Mat>   otherTransforms;
+    std::vector<double>    otherWeights;
+    std::vector<cv::Vec2i> otherOffsets;
+    int                    height, width;
+  };
+
+  std::vector<ChannelViewT> m_channels;
+  MaskViewT                 m_mask;
+  BrightnessCorrector       m_corrector;
+  int                       m_tile_size;
+  std::vector<std::vector<TileBlend> > m_blends;
+};
+
+
+/// Read-only image view of a packed mask file.
+/// - The file is memory mapped and only the rows needed for each tile are unpacked.
+/// - Valid pixels are returned as 255.
+class PackedMaskView : public vw::ImageViewBase<PackedMaskView>
+{
+public:
+  typedef vw::PixelGray<vw::uint8> pixel_type;
+  typedef pixel_type               result_type;
+
+  PackedMaskView(const std::string &path)
+    : m_file(new boost::iostreams::mapped_file_source(path))
+  {
+    const PackedMaskHeader* header = reinterpret_cast<const PackedMaskHeader*>(m_file->data());
+    VW_ASSERT( (m_file->size() >= sizeof(PackedMaskHeader)) &&
+               (memcmp(header->magic, PACKED_MASK_MAGIC, sizeof(header->magic)) == 0) &&
+               (header->version == PACKED_MASK_VERSION),
+               vw::IOErr() << "PackedMaskView: Invalid packed mask file " << path );
+    m_num_rows      = header->rows;
+    m_num_cols      = header->cols;
+    m_words_per_row = header->wordsPerRow;
+    m_words = reinterpret_cast<const PackedBinaryMask::WordType*>(m_file->data() + sizeof(PackedMaskHeader));
+  }
+
+  inline vw::int32 cols  () const { return m_num_cols; }
+  inline vw::int32 rows  () const { return m_num_rows; }
+  inline vw::int32 planes() const { return 1; }
+
+  inline result_type operator()( vw::int32 i, vw::int32 j, vw::int32 p=0 ) const
+  {
+    const int bitsPerWord = PackedBinaryMask::BITS_PER_WORD;
+    const PackedBinaryMask::WordType word = m_words[static_cast<size_t>(j)*m_words_per_row + i/bitsPerWord];
+    return ((word >> (i%bitsPerWord)) & 1) ? result_type(255) : result_type(0);
+  }
+
+  typedef vw::ProceduralPixelAccessor<PackedMaskView> pixel_accessor;
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  typedef vw::CropView<vw::ImageView<result_type> > prerasterize_type;
+  inline prerasterize_type prerasterize( vw::BBox2i const& bbox ) const
+  {
+    const int bitsPerWord = PackedBinaryMask::BITS_PER_WORD;
+    vw::ImageView<result_type> tile(bbox.width(), bbox.height());
+    for (int r=0; r<bbox.height(); ++r)
+    {
+      const PackedBinaryMask::WordType* row = m_words + static_cast<size_t>(r+bbox.min().y())*m_words_per_row;
+      for (int c=0; c<bbox.width(); ++c)
+      {
+        const int col = c + bbox.min().x();
+        tile(c, r) = ((row[col/bitsPerWord] >> (col%bitsPerWord)) & 1) ? 255 : 0;
+      }
+    }
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
+  }
+
+  template <class DestT> inline void rasterize( DestT const& dest, vw::BBox2i const& bbox ) const
+  {
+    vw::rasterize( prerasterize(bbox), dest, bbox );
+  }
+
+private:
+  boost::shared_ptr<boost::iostreams::mapped_file_source> m_file;
+  const PackedBinaryMask::WordType* m_words;
+  int    m_num_rows;
+  int    m_num_cols;
+  size_t m_words_per_row;
+};
+
+
+#endif // HRSC_IMAGE_VIEWS_H
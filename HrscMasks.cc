@@ -0,0 +1,43 @@
+#include <HrscMasks.h>
+
+
+const int PackedBinaryMask::BITS_PER_WORD;
+const int GrassfireRowStream::CAP;
+const int GrassfireRowStream::BUFFER_ROWS;
+
+
+//=========================================================================================
+// Bit packed binary masks
+
+
+bool isPackedMaskPath(const std::string &path)
+{
+  const size_t extLength = PACKED_MASK_EXTENSION.size();
+  return (path.size() > extLength) &&
+         (path.compare(path.size()-extLength, extLength, PACKED_MASK_EXTENSION) == 0);
+}
+
+bool readBinaryMask(const std::string &maskPath, cv::Mat &mask,
+                    int packedType, double validValue)
+{
+  if (!isPackedMaskPath(maskPath))
+  {
+    const int LOAD_GRAY = 0;
+    return readOpenCvImage(maskPath, mask, LOAD_GRAY);
+  }
+  PackedBinaryMask packed;
+  if (!packed.read(maskPath))
+    return false;
+  packed.toMat(mask, packedType, validValue);
+  return true;
+}
+
+
+//=========================================================================================
+// Mask statistics
+
+
+std::string getMaskStatisticsPath(const std::string &maskPath)
+{
+  return maskPath + ".stats.json";
+}
@@ -0,0 +1,587 @@
+#ifndef HRSC_MASKS_H
+#define HRSC_MASKS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <opencv2/opencv.hpp>
+
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <HrscCore.h>
+#include <HrscFileIo.h>
+#include <HrscImageIo.h>
+
+
+//=========================================================================================
+// Bit packed binary masks
+
+/// Masks with this extension are stored in the raw bit packed format
+const std::string PACKED_MASK_EXTENSION = ".pmask";
+
+/// Returns true if the path refers to a bit packed mask file
+bool isPackedMaskPath(const std::string &path);
+
+/// Header at the start of every packed mask file, followed immediately by the row data.
+struct PackedMaskHeader
+{
+  char     magic[8];    // "HRSCPMSK"
+  uint32_t version;
+  uint32_t rows;
+  uint32_t cols;
+  uint32_t wordsPerRow;
+};
+const char     PACKED_MASK_MAGIC[8]  = {'H','R','S','C','P','M','S','K'};
+const uint32_t PACKED_MASK_VERSION   = 1;
+
+/// Binary mask stored with one bit per pixel.
+/// - Each row is padded out to a whole number of 64 bit words so that rows can
+///   be combined and counted a word at a time.
+/// - Bit i of word w in a row holds column w*64 + i.  Padding bits are always zero.
+class PackedBinaryMask
+{
+public:
+  typedef uint64_t WordType;
+  static const int BITS_PER_WORD = 64;
+
+  PackedBinaryMask() : _rows(0), _cols(0), _wordsPerRow(0) {}
+  PackedBinaryMask(int rows, int cols, bool value=false) { create(rows, cols, value); }
+
+  /// Allocate the mask with all pixels set to the given value
+  void create(int rows, int cols, bool value=false)
+  {
+    _rows        = rows;
+    _cols        = cols;
+    _wordsPerRow = (cols + BITS_PER_WORD - 1) / BITS_PER_WORD;
+    _data.assign(static_cast<size_t>(_rows)*_wordsPerRow, value ? ~WordType(0) : WordType(0));
+    if (value)
+      clearPadding();
+  }
+
+  int    rows       () const { return _rows; }
+  int    cols       () const { return _cols; }
+  size_t wordsPerRow() const { return _wordsPerRow; }
+  bool   empty      () const { return _data.empty(); }
+
+        WordType* rowPtr(int row)       { return &_data[static_cast<size_t>(row)*_wordsPerRow]; }
+  const WordType* rowPtr(int row) const { return &_data[static_cast<size_t>(row)*_wordsPerRow]; }
+
+  bool get(int row, int col) const
+  {
+    return (rowPtr(row)[col / BITS_PER_WORD] >> (col % BITS_PER_WORD)) & 1;
+  }
+  void set(int row, int col, bool value)
+  {
+    WordType &word = rowPtr(row)[col / BITS_PER_WORD];
+    const WordType bit = WordType(1) << (col % BITS_PER_WORD);
+    if (value)
+      word |= bit;
+    else
+      word &= ~bit;
+  }
+
+  /// Word-wise AND with another mask of the same size
+  bool andWith(const PackedBinaryMask &other)
+  {
+    if ((other._rows != _rows) || (other._cols != _cols))
+      return false;
+    for (size_t i=0; i<_data.size(); ++i)
+      _data[i] &= other._data[i];
+    return true;
+  }
+
+  /// Word-wise OR with another mask of the same size
+  bool orWith(const PackedBinaryMask &other)
+  {
+    if ((other._rows != _rows) || (other._cols != _cols))
+      return false;
+    for (size_t i=0; i<_data.size(); ++i)
+      _data[i] |= other._data[i];
+    return true;
+  }
+
+  /// Count the valid pixels in one row
+  size_t countValidInRow(int row) const
+  {
+    size_t count = 0;
+    const WordType* ptr = rowPtr(row);
+    for (size_t w=0; w<_wordsPerRow; ++w)
+      count += __builtin_popcountll(ptr[w]);
+    return count;
+  }
+
+  /// Count all of the valid pixels in the mask
+  size_t countValid() const
+  {
+    size_t count = 0;
+    for (size_t i=0; i<_data.size(); ++i)
+      count += __builtin_popcountll(_data[i]);
+    return count;
+  }
+
+  /// Set from an 8 or 16 bit single channel image, any nonzero pixel is valid.
+  /// - The mask is reallocated to the size of the image.
+  void fromMat(const cv::Mat &image)
+  {
+    create(image.rows, image.cols, false);
+    for (int r=0; r<_rows; ++r)
+    {
+      WordType* rowData = rowPtr(r);
+      if (image.depth() == CV_16U)
+        packRow(image.ptr<unsigned short>(r), _cols, rowData);
+      else
+        packRow(image.ptr<unsigned char>(r), _cols, rowData);
+    }
+  }
+
+  /// Word-wise AND in an 8 or 16 bit image, where any nonzero pixel is valid.
+  /// - If the image is smaller than the mask, pixels outside the image are cleared.
+  void andWithMat(const cv::Mat &image)
+  {
+    std::vector<WordType> temp(_wordsPerRow);
+    for (int r=0; r<_rows; ++r)
+    {
+      WordType* rowData = rowPtr(r);
+      std::fill(temp.begin(), temp.end(), WordType(0));
+      if (r < image.rows)
+      {
+        const int numCols = std::min(_cols, image.cols);
+        if (image.depth() == CV_16U)
+          packRow(image.ptr<unsigned short>(r), numCols, &temp[0]);
+        else
+          packRow(image.ptr<unsigned char>(r), numCols, &temp[0]);
+      }
+      for (size_t w=0; w<_wordsPerRow; ++w)
+        rowData[w] &= temp[w];
+    }
+  }
+
+  /// Expand into an image where valid pixels are set to validValue.
+  void toMat(cv::Mat &image, int type=CV_8UC1, double validValue=255) const
+  {
+    image = cv::Mat::zeros(_rows, _cols, type);
+    for (int r=0; r<_rows; ++r)
+    {
+      if (image.depth() == CV_16U)
+        unpackRow(rowPtr(r), _cols, static_cast<unsigned short>(validValue), image.ptr<unsigned short>(r));
+      else
+        unpackRow(rowPtr(r), _cols, static_cast<unsigned char>(validValue), image.ptr<unsigned char>(r));
+    }
+  }
+
+  /// Pack a row of pixels, nonzero pixels are valid.  The output must be pre-cleared.
+  template <typename T>
+  static void packRow(const T* pixels, int numCols, WordType* output)
+  {
+    for (int w=0; w*BITS_PER_WORD<numCols; ++w)
+    {
+      const int start = w*BITS_PER_WORD;
+      const int stop  = std::min(start+BITS_PER_WORD, numCols);
+      WordType word = 0;
+      for (int c=start; c<stop; ++c)
+        word |= static_cast<WordType>(pixels[c] != 0) << (c-start);
+      output[w] = word;
+    }
+  }
+
+  /// Set the valid pixels of a row to validValue, the other pixels are not touched.
+  /// - Only the set bits of each word are visited, so empty words cost one test.
+  template <typename T>
+  static void unpackRow(const WordType* words, int numCols, T validValue, T* pixels)
+  {
+    for (int w=0; w*BITS_PER_WORD<numCols; ++w)
+    {
+      const int start = w*BITS_PER_WORD;
+      for (WordType word=words[w]; word!=0; word&=word-1)
+        pixels[start + __builtin_ctzll(word)] = validValue;
+    }
+  }
+
+  /// Write the mask to a raw packed file
+  bool write(const std::string &outputPath) const
+  {
+    std::ostringstream file(std::ios::binary);
+    writeHeader(file, _rows, _cols);
+    if (!_data.empty())
+      file.write(reinterpret_cast<const char*>(&_data[0]), _data.size()*sizeof(WordType));
+    if (!writeFileData(outputPath, file.str()))
+    {
+      printf("Failed to write packed mask %s\n", outputPath.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  /// Read the mask from a raw packed file
+  bool read(const std::string &inputPath)
+  {
+    MappedFileData data;
+    if (!data.open(inputPath))
+    {
+      printf("Failed to load packed mask %s!\n", inputPath.c_str());
+      return false;
+    }
+    MappedFileStream file(data.data(), data.size());
+    PackedMaskHeader header;
+    if (!readHeader(file, header))
+    {
+      printf("Failed to load packed mask %s!\n", inputPath.c_str());
+      return false;
+    }
+    create(header.rows, header.cols, false);
+    if (!_data.empty())
+      file.read(reinterpret_cast<char*>(&_data[0]), _data.size()*sizeof(WordType));
+    if (file.fail())
+    {
+      printf("Failed to load packed mask %s!\n", inputPath.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  /// Write the file header for a mask of the given size
+  static void writeHeader(std::ostream &stream, int rows, int cols)
+  {
+    PackedMaskHeader header;
+    memcpy(header.magic, PACKED_MASK_MAGIC, sizeof(header.magic));
+    header.version     = PACKED_MASK_VERSION;
+    header.rows        = rows;
+    header.cols        = cols;
+    header.wordsPerRow = (cols + BITS_PER_WORD - 1) / BITS_PER_WORD;
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  }
+
+  /// Read and verify a file header
+  static bool readHeader(std::istream &stream, PackedMaskHeader &header)
+  {
+    stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (stream.fail() || (memcmp(header.magic, PACKED_MASK_MAGIC, sizeof(header.magic)) != 0))
+      return false;
+    return (header.version == PACKED_MASK_VERSION);
+  }
+
+private:
+
+  /// Zero out the bits past the last column in each row
+  void clearPadding()
+  {
+    const int usedBits = _cols % BITS_PER_WORD;
+    if (usedBits == 0)
+      return;
+    const WordType lastWordMask = (WordType(1) << usedBits) - 1;
+    for (int r=0; r<_rows; ++r)
+      rowPtr(r)[_wordsPerRow-1] &= lastWordMask;
+  }
+
+  int    _rows;
+  int    _cols;
+  size_t _wordsPerRow;
+  std::vector<WordType> _data;
+};
+
+/// Load a binary mask from either a normal image file or a packed mask file.
+/// - Packed masks are expanded so that valid pixels equal validValue in the output type.
+bool readBinaryMask(const std::string &maskPath, cv::Mat &mask,
+                    int packedType=CV_8UC1, double validValue=255);
+
+
+//=========================================================================================
+// Mask statistics
+
+/// Default tile size for per-tile mask statistics, matches HRSC_HIGH_RES_TILE_SIZE in the Python code.
+const int MASK_STATS_TILE_SIZE = 4096;
+
+/// Returns the path of the statistics sidecar file written next to a mask file
+std::string getMaskStatisticsPath(const std::string &maskPath);
+
+/// Accumulates valid pixel counts, the valid pixel bounding box, and per-tile
+///  valid pixel counts for a mask while it is being generated.
+/// - Any nonzero mask pixel is valid.
+/// - The add functions are not thread safe.  Threads should fill in their own
+///   local copy and then call merge(), which is.
+class MaskStatistics
+{
+public:
+  MaskStatistics(int rows=0, int cols=0, int tileSize=MASK_STATS_TILE_SIZE)
+  {
+    reset(rows, cols, tileSize);
+  }
+
+  /// Clear all statistics for a mask of the given size
+  void reset(int rows, int cols, int tileSize=MASK_STATS_TILE_SIZE)
+  {
+    m_rows       = rows;
+    m_cols       = cols;
+    m_tileSize   = tileSize;
+    m_numTileRows = (rows + tileSize - 1) / tileSize;
+    m_numTileCols = (cols + tileSize - 1) / tileSize;
+    m_tileCounts.assign(static_cast<size_t>(m_numTileRows)*m_numTileCols, 0);
+    m_validCount = 0;
+    m_minRow = rows;
+    m_minCol = cols;
+    m_maxRow = -1;
+    m_maxCol = -1;
+  }
+
+  int    rows      () const { return m_rows;        }
+  int    cols      () const { return m_cols;        }
+  int    tileSize  () const { return m_tileSize;    }
+  size_t validCount() const { return m_validCount;  }
+
+  /// Record a run of valid pixels in one row
+  void addValidSpan(int row, int startCol, int numCols)
+  {
+    if (numCols <= 0)
+      return;
+    m_validCount += numCols;
+    if (row      < m_minRow) m_minRow = row;
+    if (row      > m_maxRow) m_maxRow = row;
+    if (startCol < m_minCol) m_minCol = startCol;
+    if (startCol+numCols-1 > m_maxCol) m_maxCol = startCol+numCols-1;
+
+    // The span can cross tile boundaries
+    const size_t tileRowStart = static_cast<size_t>(row / m_tileSize)*m_numTileCols;
+    int col = startCol;
+    const int stopCol = startCol + numCols;
+    while (col < stopCol)
+    {
+      const int tileCol    = col / m_tileSize;
+      const int tileEndCol = std::min((tileCol+1)*m_tileSize, stopCol);
+      m_tileCounts[tileRowStart + tileCol] += tileEndCol - col;
+      col = tileEndCol;
+    }
+  }
+
+  /// Record a single valid pixel
+  void addValidPixel(int row, int col)
+  {
+    addValidSpan(row, col, 1);
+  }
+
+  /// Record all the nonzero pixels in an 8 or 16 bit mask section placed at the given offset
+  void addMat(const cv::Mat &mask, int rowOffset=0, int colOffset=0)
+  {
+    for (int r=0; r<mask.rows; ++r)
+    {
+      if (mask.depth() == CV_16U)
+        addRow(mask.ptr<unsigned short>(r), mask.cols, r+rowOffset, colOffset);
+      else
+        addRow(mask.ptr<unsigned char>(r), mask.cols, r+rowOffset, colOffset);
+    }
+  }
+
+  /// Record a row of pixels, adding spans of nonzero values at once
+  template <typename T>
+  void addRow(const T* pixels, int numCols, int row, int colOffset=0)
+  {
+    int c = 0;
+    while (c < numCols)
+    {
+      while ((c < numCols) && (pixels[c] == 0))
+        ++c;
+      const int start = c;
+      while ((c < numCols) && (pixels[c] != 0))
+        ++c;
+      addValidSpan(row, start+colOffset, c-start);
+    }
+  }
+
+  /// Record all the valid pixels in a packed mask
+  void addPackedMask(const PackedBinaryMask &mask)
+  {
+    for (int r=0; r<mask.rows(); ++r)
+    {
+      int c = 0;
+      while (c < mask.cols())
+      {
+        while ((c < mask.cols()) && !mask.get(r, c))
+          ++c;
+        const int start = c;
+        while ((c < mask.cols()) && mask.get(r, c))
+          ++c;
+        addValidSpan(r, start, c-start);
+      }
+    }
+  }
+
+  /// Add in the statistics from another accumulator covering the same image.
+  /// - This is safe to call from multiple threads.
+  void merge(const MaskStatistics &other)
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    for (size_t i=0; i<m_tileCounts.size(); ++i)
+      m_tileCounts[i] += other.m_tileCounts[i];
+    m_validCount += other.m_validCount;
+    if (other.m_minRow < m_minRow) m_minRow = other.m_minRow;
+    if (other.m_minCol < m_minCol) m_minCol = other.m_minCol;
+    if (other.m_maxRow > m_maxRow) m_maxRow = other.m_maxRow;
+    if (other.m_maxCol > m_maxCol) m_maxCol = other.m_maxCol;
+  }
+
+  /// Return the fraction of valid pixels in a tile, accounting for smaller edge tiles.
+  double tilePercentValid(int tileRow, int tileCol) const
+  {
+    const int height = std::min(m_tileSize, m_rows - tileRow*m_tileSize);
+    const int width  = std::min(m_tileSize, m_cols - tileCol*m_tileSize);
+    if ((height <= 0) || (width <= 0))
+      return 0;
+    const size_t count = m_tileCounts[static_cast<size_t>(tileRow)*m_numTileCols + tileCol];
+    return static_cast<double>(count) / (static_cast<double>(height)*static_cast<double>(width));
+  }
+
+  /// Write the statistics to a JSON file that the Python code can load.
+  bool writeJson(const std::string &outputPath) const
+  {
+    std::ostringstream file;
+    file << "{\"rows\": " << m_rows << ", \"cols\": " << m_cols
+         << ", \"tileSize\": " << m_tileSize << ", \"validCount\": " << m_validCount
+         << ",\n \"bbox\": ";
+    if (m_validCount > 0) // Inclusive pixel bounds: minCol, minRow, maxCol, maxRow
+      file << "[" << m_minCol << ", " << m_minRow << ", " << m_maxCol << ", " << m_maxRow << "]";
+    else
+      file << "null";
+    file << ",\n \"tilePercentValid\": [";
+    file.precision(8);
+    for (int r=0; r<m_numTileRows; ++r)
+    {
+      file << (r > 0 ? ",\n  [" : "\n  [");
+      for (int c=0; c<m_numTileCols; ++c)
+        file << (c > 0 ? ", " : "") << tilePercentValid(r, c);
+      file << "]";
+    }
+    file << "]}\n";
+    if (!writeFileData(outputPath, file.str()))
+    {
+      printf("Failed to write mask statistics file %s\n", outputPath.c_str());
+      return false;
+    }
+    return true;
+  }
+
+private:
+  int    m_rows, m_cols, m_tileSize;
+  int    m_numTileRows, m_numTileCols;
+  std::vector<size_t> m_tileCounts;
+  size_t m_validCount;
+  int    m_minRow, m_minCol, m_maxRow, m_maxCol;
+  boost::mutex m_mutex;
+};
+
+/// Computes the grassfire distance image of a binary mask one row at a time.
+/// - Gives the same result as vw::grassfire clamped to MASK_MAX-1: the city block
+///   distance from each valid pixel to the nearest invalid pixel or the image edge.
+/// - Rows are added top to bottom.  A row is finished once the MASK_MAX rows below it
+///   are known, so only a rolling buffer of about two MASK_MAX row strips is kept.
+/// - After each addRow() call, call getNextRow() until it returns false.
+class GrassfireRowStream
+{
+public:
+  GrassfireRowStream(int rows, int cols)
+    : _rows(rows), _cols(cols), _numAdded(0), _numFinished(0), _numOutput(0),
+      _buffer(static_cast<size_t>(BUFFER_ROWS)*cols), _previous(cols, 0), _down(cols) {}
+
+  int rows() const { return _rows; }
+  int cols() const { return _cols; }
+
+  /// Add the next row of the mask, nonzero pixels are valid.
+  void addRow(const unsigned char* mask)
+  {
+    if ((_numAdded >= _rows) || (_numAdded - _numOutput >= BUFFER_ROWS))
+      throw std::runtime_error("GrassfireRowStream: Finished rows must be read before adding more!");
+
+    // Store the horizontal distance to the nearest invalid pixel in the row.
+    // - Values are capped at CAP+1 so they fit and still clamp to CAP at the end.
+    MASK_DATA_TYPE* row = bufferRow(_numAdded);
+    int run = 0;
+    for (int c=0; c<_cols; ++c)
+    {
+      run = (mask[c] == 0) ? 0 : std::min(run+1, CAP+1);
+      row[c] = run;
+    }
+    run = 0;
+    for (int c=_cols-1; c>=0; --c)
+    {
+      run = (mask[c] == 0) ? 0 : std::min(run+1, CAP+1);
+      if (run < row[c])
+        row[c] = run;
+    }
+    ++_numAdded;
+
+    if ((_numAdded == _rows) || (_numAdded - _numFinished > 2*CAP))
+      finishRows();
+  }
+
+  /// Copy the next finished row to output, returns false if no row is ready yet.
+  bool getNextRow(MASK_DATA_TYPE* output)
+  {
+    if (_numOutput >= _numFinished)
+      return false;
+    const MASK_DATA_TYPE* row = bufferRow(_numOutput);
+    for (int c=0; c<_cols; ++c)
+      output[c] = std::min(row[c], static_cast<MASK_DATA_TYPE>(CAP));
+    ++_numOutput;
+    return true;
+  }
+
+private:
+
+  /// Output values are clamped to this
+  static const int CAP = MASK_MAX - 1;
+  /// Enough rows for the unfinished rows plus the rows waiting to be read
+  static const int BUFFER_ROWS = 2*MASK_MAX;
+
+  MASK_DATA_TYPE* bufferRow(int row)
+  {
+    return &_buffer[static_cast<size_t>(row % BUFFER_ROWS)*_cols];
+  }
+
+  /// Finish every row which is more than CAP rows above the last added row.
+  /// - A bottom to top pass gives the distance to invalid pixels at or below each row,
+  ///   then a top to bottom pass combines it with the distance from the rows above.
+  void finishRows()
+  {
+    const int  lastRow    = _numAdded - 1;
+    const bool atEnd      = (_numAdded == _rows);
+    const int  lastFinish = atEnd ? lastRow : lastRow - CAP;
+
+    // Past the bottom of the image counts as invalid, otherwise nothing below the
+    //  buffer can be within CAP of a row being finished.
+    std::fill(_down.begin(), _down.end(), atEnd ? 0 : CAP+1);
+    for (int r=lastRow; r>=_numFinished; --r)
+    {
+      MASK_DATA_TYPE* row = bufferRow(r);
+      for (int c=0; c<_cols; ++c)
+        _down[c] = std::min<int>(row[c], _down[c]+1);
+      if (r <= lastFinish) // The rows after this still need their horizontal distances
+        std::copy(_down.begin(), _down.end(), row);
+    }
+
+    // The distance only changes by one per row, so the previous finished row carries
+    //  all the information from the rows above.  Above the image counts as invalid.
+    for (int r=_numFinished; r<=lastFinish; ++r)
+    {
+      MASK_DATA_TYPE* row = bufferRow(r);
+      for (int c=0; c<_cols; ++c)
+      {
+        row[c] = std::min<int>(row[c], _previous[c]+1);
+        _previous[c] = row[c];
+      }
+    }
+    _numFinished = lastFinish + 1;
+  }
+
+  int _rows, _cols;
+  int _numAdded, _numFinished, _numOutput;
+  std::vector<MASK_DATA_TYPE> _buffer;
+  std::vector<MASK_DATA_TYPE> _previous;
+  std::vector<MASK_DATA_TYPE> _down;
+};
+
+
+#endif // HRSC_MASKS_H
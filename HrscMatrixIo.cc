@@ -0,0 +1,119 @@
+#include <HrscMatrixIo.h>
+
+
+//=========================================================================================
+// Binary matrices
+
+
+bool isBinaryMatrixPath(const std::string &path)
+{
+  const size_t extLength = BINARY_MATRIX_EXTENSION.size();
+  return (path.size() > extLength) &&
+         (path.compare(path.size()-extLength, extLength, BINARY_MATRIX_EXTENSION) == 0);
+}
+
+std::string getTransformStorePath(const std::string &storePath, const std::string &tilePrefix,
+                                  const std::string &product)
+{
+  return storePath + CONTAINER_KEY_SEPARATOR + tilePrefix + "/" + product + BINARY_MATRIX_EXTENSION;
+}
+
+bool writeBinaryMatrix(const std::string &outputPath, const BinaryMatrixKind kind, const cv::Mat &matrix)
+{
+  BinaryMatrixHeader header;
+  memcpy(header.magic, BINARY_MATRIX_MAGIC, sizeof(header.magic));
+  header.kind     = kind;
+  header.rows     = matrix.rows;
+  header.cols     = matrix.cols;
+  header.reserved = 0;
+
+  std::string data(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (int r=0; r<matrix.rows; ++r)
+    data.append(matrix.ptr<char>(r), matrix.cols*sizeof(float));
+  if (!writeFileData(outputPath, data))
+  {
+    printf("Failed to write matrix file %s\n", outputPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool readBinaryMatrix(const std::string &inputPath, BinaryMatrixKind &kind, cv::Mat &matrix)
+{
+  MappedFileData data;
+  BinaryMatrixHeader header;
+  if (!data.open(inputPath) || (data.size() < sizeof(header)))
+  {
+    printf("Failed to load matrix file %s\n", inputPath.c_str());
+    return false;
+  }
+  memcpy(&header, data.data(), sizeof(header));
+  if ((memcmp(header.magic, BINARY_MATRIX_MAGIC, sizeof(header.magic)) != 0) ||
+      (data.size() != sizeof(header) + static_cast<size_t>(header.rows)*header.cols*sizeof(float)))
+  {
+    printf("Invalid matrix file %s\n", inputPath.c_str());
+    return false;
+  }
+  kind = static_cast<BinaryMatrixKind>(header.kind);
+  matrix.create(header.rows, header.cols, CV_32FC1);
+  if (!matrix.empty())
+    memcpy(matrix.data, data.data()+sizeof(header), matrix.total()*sizeof(float));
+  return true;
+}
+
+bool writeTransform(const std::string &outputPath, const cv::Mat &transform)
+{
+  if (isBinaryMatrixPath(outputPath))
+    return writeBinaryMatrix(outputPath, MATRIX_KIND_TRANSFORM, transform);
+
+  std::ostringstream file;
+  file << transform.rows << ", " << transform.cols << std::endl;
+  for (size_t r=0; r<transform.rows; ++r)
+  {
+    for (size_t c=0; c<transform.cols-1; ++c)
+    {
+      file << transform.at<float>(r,c) << ", ";
+    }
+    file << transform.at<float>(r,transform.cols-1) << std::endl;
+  }
+  
+  return writeFileData(outputPath, file.str());
+}
+
+bool readTransform(const std::string &inputPath, cv::Mat &transform)
+{
+  if (isBinaryMatrixPath(inputPath))
+  {
+    BinaryMatrixKind kind;
+    return readBinaryMatrix(inputPath, kind, transform);
+  }
+
+  //printf("Reading transform: %s\n", inputPath.c_str());
+  MappedFileData data;
+  if (!data.open(inputPath))
+  {
+    std::cout << "Failed to load transform file: " << inputPath << std::endl;
+    return false;
+  }
+  MappedFileStream file(data.data(), data.size());
+  {
+    char   comma;
+    size_t numRows, numCols;
+    file >> numRows >> comma >> numCols;
+    transform.create(numRows, numCols, CV_32FC1);
+    for (size_t r=0; r<transform.rows; ++r)
+    {
+      for (size_t c=0; c<transform.cols-1; ++c)
+      {
+        file >> transform.at<float>(r,c) >> comma;
+      }
+      file >> transform.at<float>(r,transform.cols-1);
+    }
+  }
+  if (file.fail())
+  {
+    std::cout << "Failed to load transform file: " << inputPath << std::endl;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,64 @@
+#ifndef HRSC_MATRIX_IO_H
+#define HRSC_MATRIX_IO_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <sstream>
+#include <opencv2/opencv.hpp>
+
+#include <HrscFileIo.h>
+
+
+//=========================================================================================
+// Binary matrices
+
+// Transforms and brightness profiles can be stored as small binary records instead of
+// text.  Paths ending in .hrm use this format.  They normally point in to a transform
+// store, a container with one file per HRSC image keyed by tile prefix and product, so
+// a tile and all its neighbors load their transforms from one mapped file without
+// parsing any text.
+// - All other extensions still use the text formats, exportTransformStore writes the
+//   contents of a store out as text files.
+
+const std::string BINARY_MATRIX_EXTENSION = ".hrm";
+
+/// What a binary matrix holds, so it can be exported in the right text format.
+enum BinaryMatrixKind
+{
+  MATRIX_KIND_TRANSFORM = 0,
+  MATRIX_KIND_PROFILE   = 1  // Brightness gain and offset columns
+};
+
+/// Header of a binary matrix, followed by the float values in row major order.
+struct BinaryMatrixHeader
+{
+  char     magic[8]; // "HRSCMAT1"
+  uint32_t kind;
+  uint32_t rows;
+  uint32_t cols;
+  uint32_t reserved;
+};
+const char BINARY_MATRIX_MAGIC[8] = {'H','R','S','C','M','A','T','1'};
+
+bool isBinaryMatrixPath(const std::string &path);
+
+/// Returns the path of a tile product in a transform store, matches getTransformStorePath in MosaicUtilities.py
+std::string getTransformStorePath(const std::string &storePath, const std::string &tilePrefix,
+                                  const std::string &product);
+
+/// Write a CV_32FC1 matrix in the binary format
+bool writeBinaryMatrix(const std::string &outputPath, const BinaryMatrixKind kind, const cv::Mat &matrix);
+
+/// Read a binary matrix in to a CV_32FC1 matrix
+bool readBinaryMatrix(const std::string &inputPath, BinaryMatrixKind &kind, cv::Mat &matrix);
+
+/// Write a small matrix to a text file, or a binary file for a .hrm path
+bool writeTransform(const std::string &outputPath, const cv::Mat &transform);
+
+// Read a small matrix from a text file, or a binary file for a .hrm path
+bool readTransform(const std::string &inputPath, cv::Mat &transform);
+
+
+#endif // HRSC_MATRIX_IO_H
@@ -0,0 +1,205 @@
+#include <HrscMosaic.h>
+
+
+//=========================================================================================
+// Output tile mosaics
+
+bool useSimplePaste(const std::string &outputPath)
+{
+  return FORCE_SIMPLE_PASTE || (outputPath.find("debug") != std::string::npos);
+}
+
+void getPasteBoundingBox(const cv::Mat &outputImage, const cv::Mat imageToAdd, const cv::Mat &spatialTransform,
+                         int &minX, int &minY, int &maxX, int &maxY)
+{
+  // Init the bounds
+  maxX = 0;
+  maxY = 0;
+  minX = outputImage.cols-1;
+  minY = outputImage.rows-1;
+  
+  // Compute the four corners
+  const int NUM_CORNERS = 4;
+  float interpX[NUM_CORNERS], interpY[NUM_CORNERS];
+  affineTransform(spatialTransform, 0,               0,               interpX[0], interpY[0]);
+  affineTransform(spatialTransform, 0,               imageToAdd.rows, interpX[1], interpY[1]);
+  affineTransform(spatialTransform, imageToAdd.cols, 0,               interpX[2], interpY[2]);
+  affineTransform(spatialTransform, imageToAdd.cols, imageToAdd.rows, interpX[3], interpY[3]);
+  
+  // Adjust the bounds to match the corners
+  for (int i=0; i<NUM_CORNERS; ++i)
+  {
+    if (floor(interpX[i]) < minX) minX = interpX[i];
+    if (ceil( interpX[i]) > maxX) maxX = interpX[i];
+    if (floor(interpY[i]) < minY) minY = interpY[i];
+    if (ceil( interpY[i]) > maxY) maxY = interpY[i];
+  }
+}
+
+bool pasteImage(cv::Mat &outputImage,
+                const cv::Mat &imageToAdd, const cv::Mat &imageMask, const cv::Mat &spatialTransform)
+{
+  // Estimate the bounds of the new image so we do not have to iterate over the entire output image
+  int minCol, minRow, maxCol, maxRow;
+  cv::Mat newToOutput;
+  cv::invert(spatialTransform, newToOutput);
+  getPasteBoundingBox(outputImage, imageToAdd, newToOutput, minCol, minRow, maxCol, maxRow);
+  
+  // Restrict the paste ROI to valid bounds --> Should use a class function!
+  if (minCol < 0)                minCol = 0;
+  if (maxCol > outputImage.cols) maxCol = outputImage.cols;
+  if (minRow < 0)                minRow = 0;
+  if (maxRow > outputImage.rows) maxRow = outputImage.rows;
+  //printf("minCol = %d, minRow = %d, maxCol = %d, maxRow = %d\n", minCol, minRow, maxCol, maxRow);
+  
+  // Iterate over the pixels of the output image
+  bool gotValue;
+  cv::Vec3b pastePixel;
+  float interpX, interpY;
+  for (int r=minRow; r<maxRow; r++)
+  {
+    for (int c=minCol; c<maxCol; c++)
+    {        
+      // Compute the equivalent location in the added image
+      affineTransform(spatialTransform, c, r, interpX, interpY);
+      //printf("c = %d, r = %d, interpX = %f, interpY = %f\n", c, r, interpX, interpY);
+      
+      // Extract all of the basemap values at that location.
+      // - Call the mirror version of the function so we retain all edges.
+      pastePixel = interpPixelMirrorRgb<BINARY_MASK_DATA_TYPE>(imageToAdd, imageMask, interpX, interpY, gotValue);      
+      
+      // Skip masked pixels and out of bounds pixels
+      if (!gotValue)
+      {
+        //printf("SKIP\n");
+        continue;
+      }
+      
+      // If the interpolated pixel is good just overwrite the current value in the output image
+      outputImage.at<cv::Vec3b>(r, c) = pastePixel;
+
+    } // End col loop
+  } // End row loop
+
+  return true;
+}
+
+/// Start reading the HRSC image and mask of one input while earlier inputs are pasted.
+/// - They get loader indices 2*imageToLoad and 2*imageToLoad+1, so call this in order.
+void prefetchMosaicInput(const std::vector<HrscMosaicInput> &inputs, AsyncImageLoader &loader,
+                         const size_t imageToLoad)
+{
+  const int LOAD_GRAY = 0;
+  const int LOAD_RGB  = 1;
+  loader.load(inputs[imageToLoad].imagePath, LOAD_RGB);
+  loader.load(inputs[imageToLoad].maskPath,  LOAD_GRAY);
+  loader.submit();
+}
+
+/// Load one of the HRSC images, which must have been requested with prefetchMosaicInput.
+bool loadMosaicInput(const std::vector<HrscMosaicInput> &inputs, AsyncImageLoader &loader,
+                     const TransformReader &transformReader, const size_t imageToLoad,
+                     cv::Mat &hrscImage, cv::Mat &hrscMask, cv::Mat &spatialTransform)
+{
+  const size_t i = imageToLoad;
+  if (!loader.get(2*i, hrscImage))
+    return false;
+  if (!loader.get(2*i+1, hrscMask))
+  {
+    printf("Mask read error!\n");
+    return false;
+  }
+
+  cv::Mat tempTransform;
+  if (!transformReader(inputs[i].transformPath, tempTransform))
+  {
+    printf("Failed to load HRSC spatial transform: %s\n", inputs[i].transformPath.c_str());
+    return false;
+  }
+  // Each transform is read in HRSC_to_basemap but we want basemap_to_HRSC so invert.
+  cv::invert(tempTransform, spatialTransform);
+  return true;
+}
+
+bool mosaicHrscTile(const std::string &basePath, const std::string &outputPath,
+                    const std::vector<HrscMosaicInput> &inputs,
+                    const std::string &dirtyListPath, const bool simplePaste,
+                    const TransformReader &transformReader)
+{
+  const int LOAD_RGB = 1;
+  const TransformReader readInputTransform = transformReader.empty() ? TransformReader(readTransform)
+                                                                     : transformReader;
+
+  // An existing tile is updated in place, but a link to a backup tile is replaced with a new file
+  // and a tile in a container gets a new record.
+  const bool updateInPlace = (basePath == outputPath) && !isSymbolicLink(basePath)
+                             && !isContainerPath(basePath);
+  if (updateInPlace && !recoverTileJournal(basePath))
+    return false;
+
+  // Read the first HRSC image while the base image loads, then each next image while
+  //  the current one is pasted.
+  AsyncFileReader  reader;
+  AsyncImageLoader loader(reader);
+  if (!inputs.empty())
+    prefetchMosaicInput(inputs, loader, 0);
+
+  cv::Mat outputImage;
+  if (!readOpenCvImage(basePath, outputImage, LOAD_RGB))
+    return false;
+
+  cv::Mat hrscImage, hrscMask, spatialTransform;
+  std::vector<cv::Rect> pastedRegions;
+  for (size_t i=0; i<inputs.size(); ++i)
+  {
+    if (i+1 < inputs.size())
+      prefetchMosaicInput(inputs, loader, i+1);
+
+    // Load the inputs for this single image
+    if (!loadMosaicInput(inputs, loader, readInputTransform, i, hrscImage, hrscMask, spatialTransform))
+      return false;
+
+    if (simplePaste)
+    {
+      pasteImage(outputImage, hrscImage, hrscMask, spatialTransform);
+
+      // Record the bounds of the pasted image, the extra pixel covers the rounding
+      int minCol, minRow, maxCol, maxRow;
+      cv::Mat hrscToOutput;
+      cv::invert(spatialTransform, hrscToOutput);
+      getPasteBoundingBox(outputImage, hrscImage, hrscToOutput, minCol, minRow, maxCol, maxRow);
+      if ((maxCol >= minCol) && (maxRow >= minRow))
+        pastedRegions.push_back(cv::Rect(minCol, minRow, maxCol-minCol+1, maxRow-minRow+1));
+      continue;
+    }
+
+    // Blending based on the weighted input masks
+    // - The transform goes from the tile to the HRSC image, so the image is pasted at minus its offset.
+    int colOffset = static_cast<int>(spatialTransform.at<float>(0, 2));
+    int rowOffset = static_cast<int>(spatialTransform.at<float>(1, 2));
+    pasteMaskWeightedImage(outputImage, hrscImage, hrscMask, colOffset, rowOffset);
+    pastedRegions.push_back(cv::Rect(-colOffset, -rowOffset, hrscImage.cols, hrscImage.rows));
+  }
+
+  if (!dirtyListPath.empty() &&
+      !appendDirtyTileRegions(dirtyListPath, basePath, pastedRegions, outputImage.size()))
+    return false;
+
+  // Only rewrite the file blocks that the HRSC images touched
+  if (!simplePaste && updateInPlace)
+  {
+    int blockWidth, blockHeight;
+    if (!getImageBlockSize(outputPath, blockWidth, blockHeight))
+      return false;
+    std::vector<cv::Rect> blocks = getOverlappingBlocks(pastedRegions, outputImage.size(),
+                                                        blockWidth, blockHeight);
+    printf("Updating %d blocks of output file %s...\n", static_cast<int>(blocks.size()), outputPath.c_str());
+    return writeTileJournal(outputPath, outputImage, blocks) && applyTileJournal(outputPath);
+  }
+  printf("Writing output file %s...\n", outputPath.c_str());
+
+  // Write the output image
+  // - The output is renamed in to place so an existing file is never left half written.
+  // - A new tile keeps the georeference of the tile it was pasted on to.
+  return writeOutputTile(outputPath, outputImage, basePath);
+}
@@ -0,0 +1,69 @@
+#ifndef HRSC_MOSAIC_H
+#define HRSC_MOSAIC_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include <boost/function.hpp>
+
+#include <HrscCore.h>
+#include <HrscFileIo.h>
+#include <HrscMatrixIo.h>
+#include <HrscImageIo.h>
+#include <HrscAsyncIo.h>
+#include <HrscTiles.h>
+#include <HrscGeoTiff.h>
+#include <HrscTileJournal.h>
+
+
+//=========================================================================================
+// Output tile mosaics
+
+// Set this to use the simple, no blending mosaic method.
+const bool FORCE_SIMPLE_PASTE = false;
+
+/// Returns true if images are pasted on to a tile without blending.
+/// - An ugly hack to use the simple 8 bit mask paste with debug images!
+bool useSimplePaste(const std::string &outputPath);
+
+/// Compute the bounding box in the output image of an image pasted with a transform
+void getPasteBoundingBox(const cv::Mat &outputImage, const cv::Mat imageToAdd, const cv::Mat &spatialTransform,
+                         int &minX, int &minY, int &maxX, int &maxY);
+
+/// Just do a simple paste of one image on to another.
+/// - This is not a pretty looking as a blended image paste but it is
+///   simple, faster, and good for testing.
+bool pasteImage(cv::Mat &outputImage,
+                const cv::Mat &imageToAdd, const cv::Mat &imageMask, const cv::Mat &spatialTransform);
+
+/// One HRSC image to paste on to an output tile
+struct HrscMosaicInput
+{
+  std::string imagePath;
+  std::string maskPath;
+  std::string transformPath; ///< Transform from the HRSC image to the tile
+};
+
+/// Reads a spatial transform, lets a caller such as hrscWorkerDaemon supply a cache.
+typedef boost::function<bool (const std::string&, cv::Mat&)> TransformReader;
+
+/// Paste HRSC images on to a tile and write out the result, this is what hrscMosaic does.
+/// - If the base and output paths are the same, and the tile is neither a link to a backup
+///   tile nor in a container, the tile is updated in place through a journal which rewrites
+///   only the file blocks the HRSC images touched.  An interrupted earlier update is
+///   finished or discarded first.
+/// - Otherwise the output is written to a new file which is renamed in to place, and keeps
+///   the georeference of the base tile.
+/// - With simplePaste the images are pasted without blending, as for the debug images.
+/// - If dirtyListPath is not empty the regions of the tile which changed are appended to it.
+/// - Each HRSC image is read while the one before it is pasted.
+/// - The transforms are read with readTransform unless a transform reader is passed in.
+bool mosaicHrscTile(const std::string &basePath, const std::string &outputPath,
+                    const std::vector<HrscMosaicInput> &inputs,
+                    const std::string &dirtyListPath="", const bool simplePaste=false,
+                    const TransformReader &transformReader=TransformReader());
+
+
+#endif // HRSC_MOSAIC_H
@@ -0,0 +1,56 @@
+#ifndef HRSC_REGISTRATION_H
+#define HRSC_REGISTRATION_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include <opencv2/features2d.hpp>
+
+#include <vw/Math/Geometry.h>
+#include <vw/Math/RANSAC.h>
+#include <vw/InterestPoint/InterestData.h>
+
+#include <HrscCore.h>
+
+
+//=========================================================================================
+// HRSC registration
+
+enum DetectorType {DETECTOR_TYPE_BRISK = 0, 
+                   DETECTOR_TYPE_ORB   = 1};
+
+/// Compute an affine transform for the given feature points using
+///  the Vision Workbench RANSAC implementation
+bool vwRansacAffine(const std::vector<cv::Point2f> &keypointsA, 
+                    const std::vector<cv::Point2f> &keypointsB,
+                    cv::Mat &transformMatrix,
+                    std::vector<int> &inlierIndices);
+
+/// Convenience function for applying a transform to one point
+cv::Point2f transformPoint(const cv::Point2f &pointIn, const cv::Mat &transform);
+
+/// Returns the number of inliers
+/// - An image of the matches is written to the debug folder unless it is empty.
+int computeImageTransform(const cv::Mat &refImageIn, const cv::Mat &matchImageIn,
+                          const cv::Mat &estimatedTransform, cv::Mat &transform,
+                          const std::string debugFolder,
+                          const int          kernelSize  =5, 
+                          const DetectorType detectorType=DETECTOR_TYPE_ORB);
+
+/// Calls computImageTransform with multiple parameters until one succeeds
+int computeImageTransformRobust(const cv::Mat &refImageIn, const cv::Mat &matchImageIn,
+                                const std::string &debugFolder,
+                                const cv::Mat &estimatedTransform, cv::Mat &transform);
+
+/// Compute the transform from an HRSC image to the basemap, this is what RegisterHrsc does.
+/// - The estimated transform is also from the HRSC image to the basemap.
+/// - The translation of the output transform is multiplied by outputScale so that it
+///   applies to the higher resolution images.
+/// - Returns the number of inliers, or zero if no acceptable transform was found.
+int registerHrscImage(const cv::Mat &basemapImage, const cv::Mat &hrscImage,
+                      const cv::Mat &estimatedTransform, const double outputScale,
+                      const std::string &debugFolder, cv::Mat &transform);
+
+
+#endif // HRSC_REGISTRATION_H
@@ -0,0 +1,198 @@
+#ifndef HRSC_TASK_GRAPH_H
+#define HRSC_TASK_GRAPH_H
+
+#include <stdio.h>
+#include <vector>
+#include <deque>
+#include <stdexcept>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+
+//=========================================================================================
+// Task graphs
+
+/// Runs a graph of tasks on a pool of threads where each task starts as soon as
+/// all of the tasks it depends on have finished.
+/// - Each thread takes the newest task from its own queue of ready tasks.  When the
+///   queue is empty it steals the oldest task from another thread's queue.
+/// - If a task fails, every task that depends on it is skipped.
+class TaskGraphExecutor
+{
+public:
+
+  /// Tasks return false on failure.
+  typedef boost::function<bool()> TaskFunction;
+
+  /// Add a task and return its index.  The dependencies must already have been added.
+  size_t addTask(const TaskFunction &function, const std::vector<size_t> &dependencies)
+  {
+    const size_t index = _tasks.size();
+    _tasks.push_back(Task());
+    Task &task = _tasks.back();
+    task.function   = function;
+    task.numWaiting = dependencies.size();
+    task.failed     = false;
+    task.succeeded  = false;
+    for (size_t i=0; i<dependencies.size(); ++i)
+    {
+      if (dependencies[i] >= index)
+        throw std::runtime_error("Task dependencies must be added before the task!");
+      _tasks[dependencies[i]].dependents.push_back(index);
+    }
+    return index;
+  }
+
+  size_t numTasks() const {return _tasks.size();}
+
+  /// After run, returns true if the task ran and did not fail.
+  bool taskSucceeded(const size_t index) const {return _tasks[index].succeeded;}
+
+  /// Run all of the tasks, returns the number of tasks which failed or were skipped.
+  size_t run(int numThreads)
+  {
+    if (numThreads < 1)
+      numThreads = 1;
+    _queues.clear();
+    for (int i=0; i<numThreads; ++i)
+      _queues.push_back(boost::shared_ptr<WorkerQueue>(new WorkerQueue()));
+    _numRemaining = _tasks.size();
+    _numReady     = 0;
+    _numFailed    = 0;
+
+    // Spread the tasks with no dependencies across the threads
+    for (size_t i=0; i<_tasks.size(); ++i)
+    {
+      if (_tasks[i].numWaiting == 0)
+      {
+        _queues[_numReady % numThreads]->tasks.push_back(i);
+        ++_numReady;
+      }
+    }
+
+    boost::thread_group threads;
+    for (int i=0; i<numThreads; ++i)
+      threads.create_thread(boost::bind(&TaskGraphExecutor::workerLoop, this, i));
+    threads.join_all();
+    return _numFailed;
+  }
+
+private:
+
+  struct Task
+  {
+    TaskFunction        function;
+    std::vector<size_t> dependents;
+    size_t              numWaiting; ///< Number of dependencies which have not finished
+    bool                failed;     ///< Set if any dependency failed
+    bool                succeeded;
+  };
+
+  struct WorkerQueue
+  {
+    boost::mutex       mutex;
+    std::deque<size_t> tasks;
+  };
+
+  /// Take a task from this worker's queue or steal one from another worker.
+  bool takeTask(const size_t worker, size_t &index)
+  {
+    {
+      WorkerQueue &queue = *_queues[worker];
+      boost::mutex::scoped_lock lock(queue.mutex);
+      if (!queue.tasks.empty())
+      {
+        index = queue.tasks.back();
+        queue.tasks.pop_back();
+        return true;
+      }
+    }
+    for (size_t i=1; i<_queues.size(); ++i)
+    {
+      WorkerQueue &queue = *_queues[(worker + i) % _queues.size()];
+      boost::mutex::scoped_lock lock(queue.mutex);
+      if (!queue.tasks.empty())
+      {
+        index = queue.tasks.front();
+        queue.tasks.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// Release the tasks which were waiting on this one on to the worker's queue.
+  void finishTask(const size_t worker, const size_t index, const bool success)
+  {
+    boost::mutex::scoped_lock lock(_stateMutex);
+    Task &task = _tasks[index];
+    task.succeeded = success;
+    if (!success)
+      ++_numFailed;
+    for (size_t i=0; i<task.dependents.size(); ++i)
+    {
+      Task &dependent = _tasks[task.dependents[i]];
+      if (!success)
+        dependent.failed = true;
+      if (--dependent.numWaiting > 0)
+        continue;
+      WorkerQueue &queue = *_queues[worker];
+      boost::mutex::scoped_lock queueLock(queue.mutex);
+      queue.tasks.push_back(task.dependents[i]);
+      ++_numReady;
+    }
+    --_numRemaining;
+    _readyCondition.notify_all();
+  }
+
+  void workerLoop(const size_t worker)
+  {
+    while (true)
+    {
+      size_t index;
+      if (!takeTask(worker, index))
+      {
+        boost::mutex::scoped_lock lock(_stateMutex);
+        if (_numRemaining == 0)
+          return;
+        if (_numReady == 0)
+          _readyCondition.wait(lock);
+        continue;
+      }
+      {
+        boost::mutex::scoped_lock lock(_stateMutex);
+        --_numReady;
+      }
+
+      bool success = false;
+      if (!_tasks[index].failed)
+      {
+        try
+        {
+          success = _tasks[index].function();
+        }
+        catch (const std::exception &e)
+        {
+          printf("Task %d threw an exception: %s\n", static_cast<int>(index), e.what());
+        }
+      }
+      finishTask(worker, index, success);
+    }
+  }
+
+  std::vector<Task> _tasks;
+  std::vector<boost::shared_ptr<WorkerQueue> > _queues;
+
+  boost::mutex              _stateMutex;
+  boost::condition_variable _readyCondition;
+  size_t _numRemaining; ///< Tasks which have not finished
+  size_t _numReady;     ///< Tasks sitting in the queues
+  size_t _numFailed;
+};
+
+
+#endif // HRSC_TASK_GRAPH_H
@@ -0,0 +1,239 @@
+#include <HrscTileJournal.h>
+
+
+//=========================================================================================
+// Tile journals
+
+
+std::string getTileJournalPath(const std::string &tilePath)
+{
+  return tilePath + ".journal";
+}
+
+std::string getPartialTileJournalPath(const std::string &tilePath)
+{
+  return tilePath + ".journal_partial";
+}
+
+bool getImageBlockSize(const std::string &path, int &blockWidth, int &blockHeight)
+{
+  GDALAllRegister();
+  GDALDatasetH dataset = GDALOpen(path.c_str(), GA_ReadOnly);
+  if (!dataset)
+  {
+    printf("Failed to open %s with GDAL!\n", path.c_str());
+    return false;
+  }
+  GDALGetBlockSize(GDALGetRasterBand(dataset, 1), &blockWidth, &blockHeight);
+  GDALClose(dataset);
+  return true;
+}
+
+std::vector<cv::Rect> getOverlappingBlocks(const std::vector<cv::Rect> &regions, const cv::Size &imageSize,
+                                           const int blockWidth, const int blockHeight)
+{
+  std::vector<cv::Rect> blocks;
+  for (int r=0; r<imageSize.height; r+=blockHeight)
+  {
+    for (int c=0; c<imageSize.width; c+=blockWidth)
+    {
+      cv::Rect block(c, r, blockWidth, blockHeight);
+      constrainCvRoi(block, imageSize.width, imageSize.height);
+      for (size_t i=0; i<regions.size(); ++i)
+      {
+        if ((block & regions[i]).area() > 0)
+        {
+          blocks.push_back(block);
+          break;
+        }
+      }
+    }
+  }
+  return blocks;
+}
+
+bool writeTileJournal(const std::string &tilePath, const cv::Mat &image, const std::vector<cv::Rect> &blocks)
+{
+  if (image.type() != CV_8UC3)
+  {
+    printf("Tile journals only support 8 bit RGB images!\n");
+    return false;
+  }
+  const std::string partialPath = getPartialTileJournalPath(tilePath);
+  FILE *file = fopen(partialPath.c_str(), "wb");
+  if (!file)
+  {
+    printf("Failed to create journal %s\n", partialPath.c_str());
+    return false;
+  }
+
+  int32_t header[3] = {image.cols, image.rows, static_cast<int32_t>(blocks.size())};
+  bool success = (fwrite(TILE_JOURNAL_MAGIC, sizeof(TILE_JOURNAL_MAGIC), 1, file) == 1) &&
+                 (fwrite(header, sizeof(header), 1, file) == 1);
+  for (size_t i=0; success && (i<blocks.size()); ++i)
+  {
+    const cv::Rect &block = blocks[i];
+    int32_t rect[4] = {block.x, block.y, block.width, block.height};
+    success = (fwrite(rect, sizeof(rect), 1, file) == 1);
+    for (int r=0; success && (r<block.height); ++r)
+      success = (fwrite(image.ptr<unsigned char>(block.y+r) + 3*block.x, 3, block.width, file)
+                 == static_cast<size_t>(block.width));
+  }
+  success = success && (fflush(file) == 0) && (fsync(fileno(file)) == 0);
+  fclose(file);
+
+  // The rename is the commit point of the update
+  const std::string journalPath = getTileJournalPath(tilePath);
+  if (!success || (rename(partialPath.c_str(), journalPath.c_str()) != 0))
+  {
+    printf("Failed to write journal %s\n", journalPath.c_str());
+    remove(partialPath.c_str());
+    return false;
+  }
+  syncParentFolder(journalPath);
+  return true;
+}
+
+bool applyTileJournal(const std::string &tilePath)
+{
+  const std::string journalPath = getTileJournalPath(tilePath);
+  FILE *file = fopen(journalPath.c_str(), "rb");
+  if (!file)
+  {
+    printf("Failed to open journal %s\n", journalPath.c_str());
+    return false;
+  }
+  char    magic[sizeof(TILE_JOURNAL_MAGIC)];
+  int32_t header[3];
+  if ((fread(magic, sizeof(magic), 1, file) != 1) || (fread(header, sizeof(header), 1, file) != 1) ||
+      (memcmp(magic, TILE_JOURNAL_MAGIC, sizeof(magic)) != 0))
+  {
+    printf("Invalid journal %s\n", journalPath.c_str());
+    fclose(file);
+    return false;
+  }
+
+  GDALAllRegister();
+  GDALDatasetH dataset = GDALOpen(tilePath.c_str(), GA_Update);
+  if (!dataset || (GDALGetRasterXSize(dataset) != header[0]) || (GDALGetRasterYSize(dataset) != header[1]) ||
+      (GDALGetRasterCount(dataset) != 3))
+  {
+    printf("Journal %s does not match tile %s\n", journalPath.c_str(), tilePath.c_str());
+    if (dataset)
+      GDALClose(dataset);
+    fclose(file);
+    return false;
+  }
+
+  int bandMap[3] = {3, 2, 1}; // The journal holds OpenCV BGR pixels
+  std::vector<unsigned char> buffer;
+  bool success = true;
+  for (int i=0; success && (i<header[2]); ++i)
+  {
+    int32_t rect[4];
+    success = (fread(rect, sizeof(rect), 1, file) == 1);
+    if (!success)
+      break;
+    buffer.resize(3*rect[2]*rect[3]);
+    success = (fread(&buffer[0], 1, buffer.size(), file) == buffer.size()) &&
+              (GDALDatasetRasterIO(dataset, GF_Write, rect[0], rect[1], rect[2], rect[3],
+                                   &buffer[0], rect[2], rect[3], GDT_Byte, 3, bandMap,
+                                   3, 3*rect[2], 1) == CE_None) &&
+              updateGdalOverviewRegion(dataset, cv::Rect(rect[0], rect[1], rect[2], rect[3]),
+                                       cv::Mat(rect[3], rect[2], CV_8UC3, &buffer[0]));
+  }
+  fclose(file);
+  GDALClose(dataset); // Flushes the blocks to the file
+
+  // GDAL updated the tile through the page cache, so instead of O_DIRECT it is dropped
+  //  from the cache, see getOutputTileGeoTiffOptions
+  if (success && getOutputTileGeoTiffOptions().directIo)
+    success = dropFileFromCache(tilePath);
+  // The journal can only go once the blocks are on disk, a failed update is retried from it
+  if (!success || !syncPath(tilePath))
+  {
+    printf("Failed to apply journal %s\n", journalPath.c_str());
+    return false;
+  }
+  remove(journalPath.c_str());
+  return true;
+}
+
+bool recoverTileJournal(const std::string &tilePath)
+{
+  const std::string partialPath = getPartialTileJournalPath(tilePath);
+  if (fileExists(partialPath))
+  {
+    printf("Discarding uncommitted update to %s\n", tilePath.c_str());
+    remove(partialPath.c_str());
+  }
+  if (!fileExists(getTileJournalPath(tilePath)))
+    return true;
+  printf("Finishing committed update to %s\n", tilePath.c_str());
+  return applyTileJournal(tilePath);
+}
+
+
+//=========================================================================================
+// Dirty tile lists
+
+
+bool appendDirtyTileRegions(const std::string &listPath, const std::string &tilePath,
+                            const std::vector<cv::Rect> &regions, const cv::Size &tileSize)
+{
+  std::ostringstream lines;
+  for (size_t i=0; i<regions.size(); ++i)
+  {
+    const cv::Rect region = regions[i] & cv::Rect(0, 0, tileSize.width, tileSize.height);
+    if (region.area() > 0)
+      lines << tilePath << " " << region.x << " " << region.y << " "
+            << region.width << " " << region.height << "\n";
+  }
+  const std::string text = lines.str();
+  if (text.empty())
+    return true;
+
+  const int fd = open(listPath.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd < 0)
+  {
+    printf("Failed to open dirty tile list %s\n", listPath.c_str());
+    return false;
+  }
+  flock(fd, LOCK_EX);
+  size_t written = 0;
+  bool success = true;
+  while (success && (written < text.size()))
+  {
+    const ssize_t count = write(fd, text.data()+written, text.size()-written);
+    success  = (count > 0);
+    written += (count > 0) ? count : 0;
+  }
+  flock(fd, LOCK_UN);
+  close(fd);
+  if (!success)
+    printf("Failed to write dirty tile list %s\n", listPath.c_str());
+  return success;
+}
+
+bool readDirtyTileList(const std::string &listPath, std::map<std::string, std::vector<cv::Rect> > &dirtyTiles)
+{
+  std::ifstream file(listPath.c_str());
+  if (!file)
+    return true;
+  std::string line;
+  while (std::getline(file, line))
+  {
+    if (line.empty())
+      continue;
+    std::istringstream stream(line);
+    std::string tilePath;
+    cv::Rect    region;
+    if (!(stream >> tilePath >> region.x >> region.y >> region.width >> region.height))
+    {
+      printf("Invalid line in dirty tile list %s: %s\n", listPath.c_str(), line.c_str());
+      return false;
+    }
+    dirtyTiles[tilePath].push_back(region);
+  }
+  return true;
+}
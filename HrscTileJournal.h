@@ -0,0 +1,84 @@
+#ifndef HRSC_TILE_JOURNAL_H
+#define HRSC_TILE_JOURNAL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <opencv2/opencv.hpp>
+#include <gdal.h>
+#include <cpl_string.h>
+#include <cpl_vsi.h>
+
+#include <HrscCore.h>
+#include <HrscFileIo.h>
+#include <HrscGeoTiff.h>
+
+
+//=========================================================================================
+// Tile journals
+
+// Output tiles are updated in place by rewriting only the file blocks which changed.
+// - The new pixels of those blocks are written to <tile>.journal_partial, which is synced
+//   and then renamed to <tile>.journal to commit the update.
+// - The committed blocks are then written in to the tile in place with GDAL, along with the
+//   parts of any internal overviews above them.  The tile is synced and then the journal is
+//   deleted.
+// - After a crash a committed journal is applied again and partial journals are discarded.
+//   Applying a journal rewrites every block it holds, so a tile left half updated ends up
+//   with all of the new pixels.
+// - libtiff rewrites a compressed block where it was if the new data fits, otherwise it
+//   appends it to the end of the file and the old space is lost.  Tiles can grow over many
+//   updates until they are next written whole.
+
+const char TILE_JOURNAL_MAGIC[8] = {'H','R','S','C','J','R','N','L'};
+
+std::string getTileJournalPath(const std::string &tilePath);
+
+std::string getPartialTileJournalPath(const std::string &tilePath);
+
+/// Get the size of the blocks an image file is stored in
+bool getImageBlockSize(const std::string &path, int &blockWidth, int &blockHeight);
+
+/// Get all of the file blocks which overlap any of the regions
+std::vector<cv::Rect> getOverlappingBlocks(const std::vector<cv::Rect> &regions, const cv::Size &imageSize,
+                                           const int blockWidth, const int blockHeight);
+
+/// Write and commit a journal containing the given blocks of a BGR tile image.
+bool writeTileJournal(const std::string &tilePath, const cv::Mat &image, const std::vector<cv::Rect> &blocks);
+
+/// Write the blocks from a committed journal in to the tile and then delete the journal.
+/// - This can be repeated any number of times if it is interrupted.
+bool applyTileJournal(const std::string &tilePath);
+
+/// Finish or discard an interrupted journaled update of a tile.
+bool recoverTileJournal(const std::string &tilePath);
+
+
+//=========================================================================================
+// Dirty tile lists
+
+// hrscMosaic can record which regions of which output tiles it changed so that the image
+// pyramid only has to be updated above those regions.  Each line of a dirty tile list is
+//   <output tile path> <col> <row> <width> <height>
+// - Many hrscMosaic processes append to the same list so the file is locked while writing.
+// - A tile may appear on many lines, the regions are combined when the list is read.
+
+/// Append the changed regions of one tile to a dirty tile list.
+/// - The regions are clipped to the tile and empty ones are skipped.
+bool appendDirtyTileRegions(const std::string &listPath, const std::string &tilePath,
+                            const std::vector<cv::Rect> &regions, const cv::Size &tileSize);
+
+/// Read a dirty tile list and add its regions to a map from tile path to changed regions.
+/// - A missing list has no dirty tiles.
+bool readDirtyTileList(const std::string &listPath, std::map<std::string, std::vector<cv::Rect> > &dirtyTiles);
+
+
+#endif // HRSC_TILE_JOURNAL_H
@@ -0,0 +1,88 @@
+#include <HrscTiles.h>
+
+
+//=========================================================================================
+// HRSC tiles
+
+
+std::string getHrscTilePath(const std::string &prefix, int tileRow, int tileCol)
+{
+  return prefix + itoa(tileRow) + "_" + itoa(tileCol) + ".tif";
+}
+
+bool writeTileMetadata(const std::string &tilePath, const HrscTileInfo &info)
+{
+  const std::string metadataPath = tilePath + "_metadata.json";
+  std::ofstream file(metadataPath.c_str());
+  file.precision(10);
+  file << "{\"path\": \""       << tilePath      << "\", "
+       << "\"tileRow\": "       << info.tileRow  << ", "
+       << "\"tileCol\": "       << info.tileCol  << ", "
+       << "\"pixelRow\": "      << info.pixelRow << ", "
+       << "\"pixelCol\": "      << info.pixelCol << ", "
+       << "\"heightPixels\": "  << info.height   << ", "
+       << "\"widthPixels\": "   << info.width    << ", "
+       << "\"percentValid\": "  << info.percentValid << ", "
+       << "\"prefix\": \""      << info.tileRow << "_" << info.tileCol << "\"}";
+  file.close();
+  return !file.fail();
+}
+
+
+//=========================================================================================
+// HRSC mosaic
+
+
+bool pasteMaskWeightedImage(cv::Mat &outputImage,
+                            const cv::Mat &imageToAdd, const cv::Mat &imageWeight,
+                            const int colOffset, const int rowOffset)
+{
+  const int tileHeight = imageToAdd.rows;
+  const int tileWidth  = imageToAdd.cols;
+  
+  int minCol = -colOffset;
+  int minRow = -rowOffset;
+  //std::cout << "col, row offsets = " << colOffset << ", " << rowOffset<< std::endl;
+  
+  cv::Rect outputRoi(minCol, minRow, tileWidth, tileHeight);
+  //std::cout << "output ROI = " << outputRoi << std::endl;
+  
+  cv::Rect pasteRoi(minCol+colOffset, minRow+rowOffset,
+                    tileWidth, tileHeight);
+  //std::cout << "paste ROI = " << pasteRoi << std::endl;
+  
+  
+  if (!constrainMatchedCvRois(outputRoi, outputImage.cols, outputImage.rows, pasteRoi)) {
+    printf("pasteMaskWeightedImage WARNING: No ROI match!\n");
+    return true;  // No image intersection, no need for image operations.
+  }
+  
+  //std::cout << "output ROI = " << outputRoi << std::endl;
+  cv::Mat  outputRegion = outputImage(outputRoi);
+  
+  //std::cout << "paste ROI = " << pasteRoi << std::endl;
+
+  // Make the weight apply to all three channels!
+  cv::Mat croppedWeight = imageWeight(pasteRoi);
+  cv::Mat imageWeight3; 
+  cv::Mat linker[] = {croppedWeight, croppedWeight, croppedWeight};
+  cv::merge(linker, 3, imageWeight3); 
+
+  // Get an inverse of the weight for the base image.
+  cv::Mat inverseWeight3;
+  cv::subtract(MASK_MAX, imageWeight3, inverseWeight3, cv::noArray(), CV_16UC3);
+
+  cv::Mat  pasteRegion = imageToAdd (pasteRoi);
+
+  //std::cout << "paste size  = " << pasteRegion.size() << std::endl;
+  //std::cout << "weight size = " << inverseWeight3.size() << std::endl;
+  
+  // outputImage = (outputImage * (1-weight)) + (imageToAdd * weight)
+  const double scale = 1.0 / (double)MASK_MAX; // Lets us multiply by a uint16 image
+  cv::Mat weightedPaste, weightedBase;
+  cv::multiply(outputRegion, inverseWeight3, weightedBase,  scale, CV_8UC3);
+  cv::multiply(pasteRegion,  imageWeight3,   weightedPaste, scale, CV_8UC3);
+  cv::add(weightedBase, weightedPaste, outputRegion);
+  
+  return true;
+}
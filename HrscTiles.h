@@ -0,0 +1,43 @@
+#ifndef HRSC_TILES_H
+#define HRSC_TILES_H
+
+#include <stdio.h>
+#include <string>
+#include <fstream>
+#include <unistd.h>
+#include <opencv2/opencv.hpp>
+
+#include <HrscCore.h>
+
+
+//=========================================================================================
+// HRSC tiles
+
+/// Information about one tile split from a high resolution HRSC image
+struct HrscTileInfo
+{
+  int    tileRow,  tileCol;
+  int    pixelRow, pixelCol;
+  int    height,   width;
+  double percentValid;
+};
+
+/// Return the path to a single tile, tiles are named <prefix><tile row>_<tile col>.tif
+std::string getHrscTilePath(const std::string &prefix, int tileRow, int tileCol);
+
+/// Write the tile metadata file that hrscImageManager.py reads
+bool writeTileMetadata(const std::string &tilePath, const HrscTileInfo &info);
+
+
+//=========================================================================================
+// HRSC mosaic
+
+/// A weighted simple paste of one image on to another.
+/// - The mask is a uint8 input which is both the mask and the weight of input pixels!
+/// - To increase speed, this function just takes a translation offset instead of a full transform.
+bool pasteMaskWeightedImage(cv::Mat &outputImage,
+                            const cv::Mat &imageToAdd, const cv::Mat &imageWeight,
+                            const int colOffset, const int rowOffset);
+
+
+#endif // HRSC_TILES_H
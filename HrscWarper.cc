@@ -0,0 +1,150 @@
+#include <HrscWarper.h>
+
+
+//=========================================================================================
+// HRSC warping
+
+
+bool sameGeoreference(const vw::cartography::GeoReference &a, const vw::cartography::GeoReference &b)
+{
+  if (a.overall_proj4_str() != b.overall_proj4_str())
+    return false;
+  for (int r=0; r<3; ++r)
+    for (int c=0; c<3; ++c)
+      if (a.transform()(r,c) != b.transform()(r,c))
+        return false;
+  return true;
+}
+
+double getCenterLongitude(const vw::cartography::GeoReference &georef, const vw::Vector2i &size)
+{
+  return georef.pixel_to_lonlat(vw::Vector2(size[0]/2.0, size[1]/2.0))[0];
+}
+
+vw::cartography::GeoReference computeOutputGeoref(const vw::cartography::GeoReference &inputGeoref,
+                                                  const vw::Vector2i &inputSize,
+                                                  const std::string &proj4, const double metersPerPixel,
+                                                  vw::Vector2i &outputSize)
+{
+  vw::cartography::GeoReference georef;
+  georef.set_datum(inputGeoref.datum());
+  georef.set_proj4_projection_str(proj4);
+
+  // Project points along the edge of the input image
+  const double centerLon = getCenterLongitude(inputGeoref, inputSize);
+  const double maxX = inputSize[0] - 1;
+  const double maxY = inputSize[1] - 1;
+  vw::BBox2 extent;
+  for (int s=0; s<=WARP_BOUNDARY_SAMPLES; ++s)
+  {
+    const double f = static_cast<double>(s) / WARP_BOUNDARY_SAMPLES;
+    const vw::Vector2 edgePixels[4] = {vw::Vector2(f*maxX, 0), vw::Vector2(f*maxX, maxY),
+                                       vw::Vector2(0, f*maxY), vw::Vector2(maxX, f*maxY)};
+    for (int e=0; e<4; ++e)
+    {
+      vw::Vector2 lonlat = inputGeoref.pixel_to_lonlat(edgePixels[e]);
+      lonlat[0] = unwrapLongitude(lonlat[0], centerLon);
+      extent.grow(georef.lonlat_to_point(lonlat));
+    }
+  }
+
+  // The edges miss a pole inside the footprint, which in most projections is a whole
+  //  line of points.  Points which cannot be projected are skipped.
+  for (int pole=-1; pole<=1; pole+=2)
+  {
+    try
+    {
+      const vw::Vector2 polePixel = inputGeoref.lonlat_to_pixel(vw::Vector2(centerLon, 90.0*pole));
+      if ((polePixel[0] < 0) || (polePixel[1] < 0) || (polePixel[0] > maxX) || (polePixel[1] > maxY))
+        continue;
+    }
+    catch (const vw::Exception &)
+    {
+      continue;
+    }
+    for (int s=0; s<=WARP_BOUNDARY_SAMPLES; ++s)
+    {
+      const double lon = centerLon - 180.0 + 360.0*s/WARP_BOUNDARY_SAMPLES;
+      try
+      {
+        extent.grow(georef.lonlat_to_point(vw::Vector2(lon, 90.0*pole)));
+      }
+      catch (const vw::Exception &) {}
+    }
+  }
+
+  outputSize[0] = static_cast<int>(extent.width () / metersPerPixel + 0.5);
+  outputSize[1] = static_cast<int>(extent.height() / metersPerPixel + 0.5);
+
+  vw::Matrix3x3 transform = vw::math::identity_matrix<3>();
+  transform(0,0) =  metersPerPixel;
+  transform(0,2) =  extent.min().x();
+  transform(1,1) = -metersPerPixel;
+  transform(1,2) =  extent.max().y();
+  georef.set_pixel_interpretation(vw::cartography::GeoReference::PixelAsArea);
+  georef.set_transform(transform);
+  return georef;
+}
+
+void computeOutputGeorefs(const std::vector<std::string> &inputPaths,
+                          const std::string &proj4, const double metersPerPixel,
+                          std::vector<vw::cartography::GeoReference> &inputGeorefs,
+                          std::vector<vw::cartography::GeoReference> &outputGeorefs,
+                          std::vector<vw::Vector2i> &outputSizes)
+{
+  const size_t numBands = inputPaths.size();
+  inputGeorefs.resize(numBands);
+  outputGeorefs.resize(numBands);
+  outputSizes.resize(numBands);
+  for (size_t i=0; i<numBands; ++i)
+  {
+    vw::vw_out() << "Loading: " << inputPaths[i] << "\n";
+    vw::cartography::read_georeference(inputGeorefs[i], inputPaths[i]);
+    vw::DiskImageView<HrscWarpPixelT> image(inputPaths[i]);
+    outputGeorefs[i] = computeOutputGeoref(inputGeorefs[i], vw::Vector2i(image.cols(), image.rows()),
+                                           proj4, metersPerPixel, outputSizes[i]);
+    vw::vw_out() << "Output size: " << outputSizes[i] << std::endl;
+  }
+}
+
+/// Write a warped block to its output file
+void writeWarpedBlock(std::vector<boost::shared_ptr<vw::DiskImageResourceGDAL> > &outputs,
+                      size_t band, const vw::ImageView<HrscWarpPixelT> &tile, const vw::BBox2i &block)
+{
+  outputs[band]->write(tile.buffer(), block);
+}
+
+void warpHrscChannels(const std::vector<std::string> &inputPaths,
+                      const std::vector<std::string> &outputPaths,
+                      const std::string &proj4, const double metersPerPixel,
+                      const int numThreads, const std::string &progressName)
+{
+  const size_t numBands = inputPaths.size();
+  std::vector<vw::cartography::GeoReference> inputGeorefs, outputGeorefs;
+  std::vector<vw::Vector2i> outputSizes;
+  computeOutputGeorefs(inputPaths, proj4, metersPerPixel, inputGeorefs, outputGeorefs, outputSizes);
+
+  // Set up all the output files, they are filled in one block at a time.
+  std::vector<boost::shared_ptr<vw::DiskImageResourceGDAL> > outputs(numBands);
+  for (size_t i=0; i<numBands; ++i)
+  {
+    outputs[i].reset( build_gdal_rsrc( outputPaths[i],
+                                       vw::constant_view(HrscWarpPixelT(0), outputSizes[i][0], outputSizes[i][1]) ) );
+    vw::cartography::write_georeference(*outputs[i], outputGeorefs[i]);
+  }
+
+  int maxRows = 0;
+  for (size_t i=0; i<numBands; ++i)
+    maxRows = std::max(maxRows, outputSizes[i][1]);
+  MultiBandWarper warper(inputPaths, inputGeorefs, outputGeorefs, outputSizes,
+                         boost::bind(writeWarpedBlock, boost::ref(outputs), _1, _2, _3), progressName);
+  warper.addRows(0, maxRows);
+  boost::thread_group threads;
+  for (int i=0; i<numThreads; ++i)
+    threads.create_thread(boost::ref(warper));
+  threads.join_all();
+  warper.finish();
+
+  for (size_t i=0; i<numBands; ++i)
+    outputs[i]->flush();
+}
@@ -0,0 +1,574 @@
+#ifndef HRSC_WARPER_H
+#define HRSC_WARPER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/math/special_functions/fpclassify.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <vw/Image/Algorithms.h>
+#include <vw/Image/BlockRasterize.h>
+#include <vw/Image/PixelMath.h>
+#include <vw/Image/Statistics.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/UtilityViews.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/FileIO/DiskImageResourceGDAL.h>
+#include <vw/FileIO/DiskImageUtils.h>
+#include <vw/Cartography/GeoReference.h>
+
+#include <HrscImageViews.h>
+
+
+//=========================================================================================
+// HRSC warping
+
+typedef vw::PixelGray<vw::uint8> HrscWarpPixelT;
+
+const int WARP_BLOCK_SIZE       = 1024; // Matches the tile size from build_gdal_rsrc
+const int WARP_GRID_SPACING     = 32;   // Output pixels between exactly projected grid points
+const int WARP_BOUNDARY_SAMPLES = 256;  // Samples along each input edge used to find the output extent
+const int WARP_CUBIC_BORDER     = 2;    // Extra source pixels needed around the sampled region
+const int WARP_MAX_BANDS        = 8;    // Most bands resampled together in one pass
+const int WARP_MAX_SOURCE_SIZE  = 8*WARP_BLOCK_SIZE; // Largest source region loaded for one output region
+const int WARP_MIN_SPLIT_SIZE   = 64;   // Output regions are not split below this size
+
+
+/// Compute the four cubic B-spline weights for a fractional offset in the range 0 to 1
+inline void cubicBSplineWeights(float t, float weights[4])
+{
+  const float t2 = t*t;
+  const float t3 = t2*t;
+  const float s  = 1.0f - t;
+  weights[0] = s*s*s / 6.0f;
+  weights[1] = ( 3.0f*t3 - 6.0f*t2 + 4.0f) / 6.0f;
+  weights[2] = (-3.0f*t3 + 3.0f*t2 + 3.0f*t + 1.0f) / 6.0f;
+  weights[3] = t3 / 6.0f;
+}
+
+/// Cubic B-spline interpolation of every band of an interleaved source tile at a floating point location.
+/// - The weights and neighbor locations are computed once and the innermost loop runs
+///   across the bands, so all of the bands are accumulated together.
+/// - A band is zero if its nearest source pixel is zero or outside the tile.
+/// - Zero valued neighbors are replaced with the nearest pixel value of their band.
+inline void sampleCubicBSplineBands(const unsigned char* tile, int cols, int rows, int numBands,
+                                    float x, float y, unsigned char* output)
+{
+  const int nearX = static_cast<int>(floor(x + 0.5f));
+  const int nearY = static_cast<int>(floor(y + 0.5f));
+  if ((nearX < 0) || (nearY < 0) || (nearX >= cols) || (nearY >= rows))
+  {
+    std::fill(output, output+numBands, 0);
+    return;
+  }
+  const unsigned char* nearPixel = tile + (static_cast<size_t>(nearY)*cols + nearX)*numBands;
+
+  const int baseX = static_cast<int>(floor(x));
+  const int baseY = static_cast<int>(floor(y));
+  float weightsX[4], weightsY[4];
+  cubicBSplineWeights(x - baseX, weightsX);
+  cubicBSplineWeights(y - baseY, weightsY);
+  int offsetsX[4];
+  for (int i=0; i<4; ++i)
+    offsetsX[i] = std::min(std::max(baseX-1+i, 0), cols-1)*numBands;
+
+  float sums[WARP_MAX_BANDS] = {0};
+  for (int j=0; j<4; ++j)
+  {
+    const int r = std::min(std::max(baseY-1+j, 0), rows-1);
+    const unsigned char* row = tile + static_cast<size_t>(r)*cols*numBands;
+    for (int i=0; i<4; ++i)
+    {
+      const float weight = weightsY[j]*weightsX[i];
+      const unsigned char* pixel = row + offsetsX[i];
+      for (int b=0; b<numBands; ++b)
+        sums[b] += weight * ((pixel[b] == 0) ? nearPixel[b] : pixel[b]);
+    }
+  }
+  for (int b=0; b<numBands; ++b)
+  {
+    // A zero output would be mistaken for nodata
+    if (nearPixel[b] == 0)
+      output[b] = 0;
+    else if (sums[b] < 1.0f)
+      output[b] = 1;
+    else if (sums[b] > 255.0f)
+      output[b] = 255;
+    else
+      output[b] = static_cast<unsigned char>(sums[b] + 0.5f);
+  }
+}
+
+
+/// Returns true if two georeferences map pixels to lonlat identically.
+bool sameGeoreference(const vw::cartography::GeoReference &a, const vw::cartography::GeoReference &b);
+
+/// Shift a longitude by whole turns so that it is within 180 degrees of a reference longitude.
+/// - Keeps the longitudes of a footprint which crosses the +-180 line continuous.
+inline double unwrapLongitude(double lon, double referenceLon)
+{
+  return lon + 360.0*floor((referenceLon - lon)/360.0 + 0.5);
+}
+
+/// Returns the longitude at the center of an image
+double getCenterLongitude(const vw::cartography::GeoReference &georef, const vw::Vector2i &size);
+
+
+/// Compute an output georeference in the requested projection which covers one input image.
+/// - The extent is computed the same way gdalwarp does it when only -tr is specified.
+/// - Edge longitudes are unwrapped around the image center so a footprint crossing the
+///   +-180 line does not cover the whole planet, and a footprint containing a pole is
+///   grown to include the pole.
+vw::cartography::GeoReference computeOutputGeoref(const vw::cartography::GeoReference &inputGeoref,
+                                                  const vw::Vector2i &inputSize,
+                                                  const std::string &proj4, const double metersPerPixel,
+                                                  vw::Vector2i &outputSize);
+
+
+/// Receives each warped block of one band: (band, block pixels, block location in the output)
+typedef boost::function<void (size_t, const vw::ImageView<HrscWarpPixelT>&, const vw::BBox2i&)> WarpBlockWriter;
+
+/// Warps every input image block by block using a pool of threads.
+/// - Each input is warped to its own output georeference.
+/// - The blocks to warp are queued with addRows, and each finished block is passed to
+///   the writer one at a time.
+/// - Inputs with the same georeference and size share their coordinate grid and are
+///   resampled together, up to WARP_MAX_BANDS at a time.
+/// - An output region whose source region is too large to load, which happens near a
+///   pole or a longitude wrap, is split until the source regions fit.
+class MultiBandWarper
+{
+public:
+  MultiBandWarper(const std::vector<std::string> &inputPaths,
+                  const std::vector<vw::cartography::GeoReference> &inputGeorefs,
+                  const std::vector<vw::cartography::GeoReference> &outputGeorefs,
+                  const std::vector<vw::Vector2i> &outputSizes,
+                  const WarpBlockWriter &writer,
+                  const std::string &progressName="")
+    : m_input_georefs(inputGeorefs), m_output_georefs(outputGeorefs), m_output_sizes(outputSizes),
+      m_writer(writer), m_next_block(0)
+  {
+    if (!progressName.empty())
+      m_progress.reset(new vw::TerminalProgressCallback(progressName,"Warping:"));
+
+    for (size_t i=0; i<inputPaths.size(); ++i)
+      m_inputs.push_back(vw::DiskImageView<HrscWarpPixelT>(inputPaths[i]));
+
+    // Group the bands with identical inputs
+    for (size_t i=0; i<inputGeorefs.size(); ++i)
+    {
+      size_t g = 0;
+      for (; g<m_groups.size(); ++g)
+      {
+        const size_t first = m_groups[g].bands[0];
+        if ((m_groups[g].bands.size() < static_cast<size_t>(WARP_MAX_BANDS)) &&
+            (m_inputs[first].cols() == m_inputs[i].cols()) &&
+            (m_inputs[first].rows() == m_inputs[i].rows()) &&
+            sameGeoreference(inputGeorefs[first], inputGeorefs[i]))
+          break;
+      }
+      if (g == m_groups.size())
+      {
+        m_groups.push_back(BandGroup());
+        m_groups[g].centerLon = getCenterLongitude(inputGeorefs[i],
+                                                   vw::Vector2i(m_inputs[i].cols(), m_inputs[i].rows()));
+      }
+      m_groups[g].bands.push_back(i);
+    }
+  }
+
+  /// Replace the queued blocks with the blocks covering output rows startRow to endRow.
+  /// - The rows are clipped to each output, and startRow must be a multiple of WARP_BLOCK_SIZE.
+  /// - Must not be called while threads are warping.
+  void addRows(int startRow, int endRow)
+  {
+    m_blocks.clear();
+    m_next_block = 0;
+    for (size_t g=0; g<m_groups.size(); ++g)
+    {
+      const vw::Vector2i &size = m_output_sizes[m_groups[g].bands[0]];
+      for (int r=startRow; r<std::min(endRow, size[1]); r+=WARP_BLOCK_SIZE)
+        for (int c=0; c<size[0]; c+=WARP_BLOCK_SIZE)
+          m_blocks.push_back(std::make_pair(g, vw::BBox2i(c, r, std::min(WARP_BLOCK_SIZE, size[0]-c),
+                                                                std::min(WARP_BLOCK_SIZE, size[1]-r))));
+    }
+  }
+
+  /// Thread function, keeps processing blocks until there are none left
+  void operator()()
+  {
+    std::pair<size_t, vw::BBox2i> block;
+    while (getNextBlock(block))
+      warpBlock(block.first, block.second);
+  }
+
+  void finish()
+  {
+    if (m_progress)
+      m_progress->report_finished();
+  }
+
+private:
+
+  struct BandGroup
+  {
+    std::vector<size_t> bands;
+    double              centerLon; ///< Grid longitudes are unwrapped around this
+  };
+
+  bool getNextBlock(std::pair<size_t, vw::BBox2i> &block)
+  {
+    boost::mutex::scoped_lock lock(m_block_mutex);
+    if (m_next_block >= m_blocks.size())
+      return false;
+    block = m_blocks[m_next_block++];
+    if (m_progress)
+      m_progress->report_fractional_progress(m_next_block, m_blocks.size());
+    return true;
+  }
+
+  void warpBlock(const size_t group, const vw::BBox2i &block)
+  {
+    const std::vector<size_t> &bands = m_groups[group].bands;
+    std::vector<vw::ImageView<HrscWarpPixelT> > outputTiles(bands.size());
+    for (size_t b=0; b<bands.size(); ++b)
+    {
+      outputTiles[b].set_size(block.width(), block.height());
+      vw::fill(outputTiles[b], HrscWarpPixelT(0));
+    }
+
+    warpRegion(group, block, block, outputTiles);
+
+    boost::mutex::scoped_lock lock(m_write_mutex);
+    for (size_t b=0; b<bands.size(); ++b)
+      m_writer(bands[b], outputTiles[b], block);
+  }
+
+  /// Fill in one region of the output block tiles, pixels which do not map to the input are left as zero.
+  void warpRegion(const size_t group, const vw::BBox2i &block, const vw::BBox2i &region,
+                  std::vector<vw::ImageView<HrscWarpPixelT> > &outputTiles)
+  {
+    const BandGroup &bandGroup = m_groups[group];
+    const size_t     first     = bandGroup.bands[0];
+    const int        numBands  = static_cast<int>(bandGroup.bands.size());
+
+    // Grid point locations in the region, the last point always lands on the region edge.
+    // - There are always at least two points in each direction.
+    std::vector<int> gridX, gridY;
+    for (int x=0; x<region.width()-1; x+=WARP_GRID_SPACING)
+      gridX.push_back(x);
+    gridX.push_back(std::max(region.width()-1, 1));
+    for (int y=0; y<region.height()-1; y+=WARP_GRID_SPACING)
+      gridY.push_back(y);
+    gridY.push_back(std::max(region.height()-1, 1));
+    if (gridX.size() == 1) gridX.insert(gridX.begin(), 0);
+    if (gridY.size() == 1) gridY.insert(gridY.begin(), 0);
+    const size_t numGridX = gridX.size();
+    const size_t numGridY = gridY.size();
+
+    // Find the source location of each grid point.  Points which cannot be
+    //  projected are marked invalid, along with the pixels around them.
+    std::vector<vw::Vector2> grid(numGridX*numGridY);
+    std::vector<bool>        gridValid(grid.size(), false);
+    vw::BBox2 sourceExtent;
+    bool anyValid = false;
+    for (size_t j=0; j<numGridY; ++j)
+    {
+      for (size_t i=0; i<numGridX; ++i)
+      {
+        const size_t k = j*numGridX+i;
+        try
+        {
+          vw::Vector2 lonlat = m_output_georefs[first].pixel_to_lonlat(
+                                 vw::Vector2(region.min().x()+gridX[i], region.min().y()+gridY[j]));
+          lonlat[0] = unwrapLongitude(lonlat[0], bandGroup.centerLon);
+          grid[k] = m_input_georefs[first].lonlat_to_pixel(lonlat);
+        }
+        catch (const vw::Exception &)
+        {
+          continue;
+        }
+        if (!boost::math::isfinite(grid[k][0]) || !boost::math::isfinite(grid[k][1]))
+          continue;
+        gridValid[k] = true;
+        sourceExtent.grow(grid[k]);
+        anyValid = true;
+      }
+    }
+    if (!anyValid)
+      return;
+
+    // Load the source region covered by this region, the grid hull contains every sample.
+    // - The extent is clipped to the image in floating point so that wild grid points
+    //   cannot overflow the integer region.
+    vw::BBox2 sourceBounds(-WARP_CUBIC_BORDER, -WARP_CUBIC_BORDER,
+                           m_inputs[first].cols()+2*WARP_CUBIC_BORDER, m_inputs[first].rows()+2*WARP_CUBIC_BORDER);
+    sourceExtent.expand(WARP_CUBIC_BORDER);
+    sourceExtent.crop(sourceBounds);
+    if (sourceExtent.empty())
+      return;
+    vw::BBox2i sourceRoi(static_cast<int>(floor(sourceExtent.min().x())),
+                         static_cast<int>(floor(sourceExtent.min().y())),
+                         static_cast<int>(ceil (sourceExtent.width ())) + 1,
+                         static_cast<int>(ceil (sourceExtent.height())) + 1);
+    sourceRoi.crop(vw::bounding_box(m_inputs[first]));
+    if (sourceRoi.empty())
+      return;
+
+    // A region which needs a huge source region is split, and at the smallest
+    //  size the source region is clamped around the region center.
+    if ((sourceRoi.width() > WARP_MAX_SOURCE_SIZE) || (sourceRoi.height() > WARP_MAX_SOURCE_SIZE))
+    {
+      if ((region.width() > WARP_MIN_SPLIT_SIZE) || (region.height() > WARP_MIN_SPLIT_SIZE))
+      {
+        const int halfWidth  = (region.width () > WARP_MIN_SPLIT_SIZE) ? region.width ()/2 : region.width ();
+        const int halfHeight = (region.height() > WARP_MIN_SPLIT_SIZE) ? region.height()/2 : region.height();
+        for (int r=region.min().y(); r<region.max().y(); r+=halfHeight)
+          for (int c=region.min().x(); c<region.max().x(); c+=halfWidth)
+            warpRegion(group, block, vw::BBox2i(c, r, std::min(halfWidth,  region.max().x()-c),
+                                                      std::min(halfHeight, region.max().y()-r)),
+                       outputTiles);
+        return;
+      }
+      const vw::Vector2 center = sourceExtent.center();
+      vw::BBox2i clamped(static_cast<int>(center[0]) - WARP_MAX_SOURCE_SIZE/2,
+                         static_cast<int>(center[1]) - WARP_MAX_SOURCE_SIZE/2,
+                         WARP_MAX_SOURCE_SIZE, WARP_MAX_SOURCE_SIZE);
+      sourceRoi.crop(clamped);
+      if (sourceRoi.empty())
+        return;
+    }
+
+    // Interleave the bands so each sample reads all of them from one place
+    const int sourceCols = sourceRoi.width();
+    const int sourceRows = sourceRoi.height();
+    std::vector<unsigned char> sourceTile(static_cast<size_t>(sourceCols)*sourceRows*numBands);
+    for (int b=0; b<numBands; ++b)
+    {
+      vw::ImageView<HrscWarpPixelT> bandTile = vw::crop(m_inputs[bandGroup.bands[b]], sourceRoi);
+      for (int r=0; r<sourceRows; ++r)
+        for (int c=0; c<sourceCols; ++c)
+          sourceTile[(static_cast<size_t>(r)*sourceCols + c)*numBands + b] = bandTile(c, r)[0];
+    }
+    const float offsetX = sourceRoi.min().x();
+    const float offsetY = sourceRoi.min().y();
+
+    // Bilinearly interpolate the source location of each pixel from the grid
+    unsigned char pixel[WARP_MAX_BANDS];
+    const int tileX = region.min().x() - block.min().x();
+    const int tileY = region.min().y() - block.min().y();
+    size_t gj = 0;
+    for (int r=0; r<region.height(); ++r)
+    {
+      if ((gj+2 < numGridY) && (r >= gridY[gj+1]))
+        ++gj;
+      const float fy = static_cast<float>(r - gridY[gj]) / (gridY[gj+1] - gridY[gj]);
+      size_t gi = 0;
+      for (int c=0; c<region.width(); ++c)
+      {
+        if ((gi+2 < numGridX) && (c >= gridX[gi+1]))
+          ++gi;
+        const size_t k00 =  gj   *numGridX + gi;
+        const size_t k10 = (gj+1)*numGridX + gi;
+        if (!gridValid[k00] || !gridValid[k00+1] || !gridValid[k10] || !gridValid[k10+1])
+          continue;
+        const float fx = static_cast<float>(c - gridX[gi]) / (gridX[gi+1] - gridX[gi]);
+        const vw::Vector2 &p00 = grid[k00  ];
+        const vw::Vector2 &p01 = grid[k00+1];
+        const vw::Vector2 &p10 = grid[k10  ];
+        const vw::Vector2 &p11 = grid[k10+1];
+        const float x = (1-fy)*((1-fx)*p00[0] + fx*p01[0]) + fy*((1-fx)*p10[0] + fx*p11[0]);
+        const float y = (1-fy)*((1-fx)*p00[1] + fx*p01[1]) + fy*((1-fx)*p10[1] + fx*p11[1]);
+        sampleCubicBSplineBands(&sourceTile[0], sourceCols, sourceRows, numBands,
+                                x-offsetX, y-offsetY, pixel);
+        for (int b=0; b<numBands; ++b)
+          outputTiles[b](tileX+c, tileY+r) = pixel[b];
+      }
+    }
+  }
+
+  std::vector<vw::DiskImageView<HrscWarpPixelT> >             m_inputs;
+  const std::vector<vw::cartography::GeoReference>           &m_input_georefs;
+  const std::vector<vw::cartography::GeoReference>           &m_output_georefs;
+  const std::vector<vw::Vector2i>                            &m_output_sizes;
+  std::vector<BandGroup>                                      m_groups;
+  WarpBlockWriter                                             m_writer;
+  std::vector<std::pair<size_t, vw::BBox2i> >                 m_blocks;
+  size_t                                                      m_next_block;
+  boost::mutex                                                m_block_mutex;
+  boost::mutex                                                m_write_mutex;
+  boost::shared_ptr<vw::TerminalProgressCallback>             m_progress;
+};
+
+
+/// Read the georeference of each input image and compute the output georeference and
+///  size it is warped to.
+void computeOutputGeorefs(const std::vector<std::string> &inputPaths,
+                          const std::string &proj4, const double metersPerPixel,
+                          std::vector<vw::cartography::GeoReference> &inputGeorefs,
+                          std::vector<vw::cartography::GeoReference> &outputGeorefs,
+                          std::vector<vw::Vector2i> &outputSizes);
+
+/// Warp a set of HRSC channel images into one output projection with a pool of threads.
+/// - Each output has its own georeference covering just its input image, the same
+///   as warping each channel with its own gdalwarp call.
+void warpHrscChannels(const std::vector<std::string> &inputPaths,
+                      const std::vector<std::string> &outputPaths,
+                      const std::string &proj4, const double metersPerPixel,
+                      const int numThreads, const std::string &progressName);
+
+
+/// Warps a set of HRSC channel images in memory, a strip of output rows at a time.
+/// - For tools which use the warped channels in row order, so the full size warped
+///   images never have to be written to disk.
+/// - Each channel gets the same output georeference and size as in warpHrscChannels.
+/// - Rows are warped the first time they are read and are kept until they are released.
+class HrscStripWarper
+{
+public:
+  typedef HrscWarpPixelT PixelT;
+
+  HrscStripWarper(const std::vector<std::string> &inputPaths,
+                  const std::string &proj4, const double metersPerPixel, const int numThreads)
+    : m_num_threads(numThreads), m_first_row(0), m_end_row(0)
+  {
+    computeOutputGeorefs(inputPaths, proj4, metersPerPixel,
+                         m_input_georefs, m_output_georefs, m_output_sizes);
+    m_rows.resize(inputPaths.size());
+    m_warper.reset(new MultiBandWarper(inputPaths, m_input_georefs, m_output_georefs, m_output_sizes,
+                                       boost::bind(&HrscStripWarper::storeBlock, this, _1, _2, _3)));
+  }
+
+  size_t numChannels() const { return m_output_sizes.size(); }
+
+  const vw::cartography::GeoReference& georef(size_t channel) const { return m_output_georefs[channel]; }
+
+  int cols(size_t channel) const { return m_output_sizes[channel][0]; }
+  int rows(size_t channel) const { return m_output_sizes[channel][1]; }
+
+  /// Copy a region of one warped channel, warping any rows which are not warped yet.
+  /// - The region must be inside the channel and must not start above the released rows.
+  void read(size_t channel, const vw::BBox2i &bbox, vw::ImageView<PixelT> &tile)
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    VW_ASSERT( (bbox.min().x() >= 0) && (bbox.max().x() <= cols(channel)) &&
+               (bbox.min().y() >= m_first_row) && (bbox.max().y() <= rows(channel)),
+               vw::LogicErr() << "HrscStripWarper: Region " << bbox << " is not available!" );
+    warpRows(bbox.max().y());
+
+    tile.set_size(bbox.width(), bbox.height());
+    for (int r=0; r<bbox.height(); ++r)
+    {
+      const std::vector<vw::uint8> &row = m_rows[channel][bbox.min().y() + r - m_first_row];
+      for (int c=0; c<bbox.width(); ++c)
+        tile(c, r) = row[bbox.min().x() + c];
+    }
+  }
+
+  /// Free all of the rows above startRow, they cannot be read again.
+  void releaseRows(int startRow)
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    startRow = std::min(startRow, m_end_row);
+    for (size_t b=0; b<m_rows.size(); ++b)
+    {
+      const size_t numReleased = std::min(static_cast<size_t>(std::max(startRow - m_first_row, 0)),
+                                          m_rows[b].size());
+      m_rows[b].erase(m_rows[b].begin(), m_rows[b].begin() + numReleased);
+    }
+    m_first_row = std::max(m_first_row, startRow);
+  }
+
+private:
+
+  /// Warp every channel down to endRow, a whole block row at a time.
+  void warpRows(int endRow)
+  {
+    if (endRow <= m_end_row)
+      return;
+    const int newEndRow = ((endRow + WARP_BLOCK_SIZE - 1) / WARP_BLOCK_SIZE) * WARP_BLOCK_SIZE;
+    for (size_t b=0; b<m_rows.size(); ++b)
+      for (int r=m_end_row; r<std::min(newEndRow, rows(b)); ++r)
+        m_rows[b].push_back(std::vector<vw::uint8>(cols(b), 0));
+
+    m_warper->addRows(m_end_row, newEndRow);
+    boost::thread_group threads;
+    for (int i=0; i<m_num_threads; ++i)
+      threads.create_thread(boost::ref(*m_warper));
+    threads.join_all();
+    m_end_row = newEndRow;
+  }
+
+  /// Copy a warped block in to the rows, each block is a separate region of the rows.
+  void storeBlock(size_t band, const vw::ImageView<PixelT> &tile, const vw::BBox2i &block)
+  {
+    for (int r=0; r<block.height(); ++r)
+    {
+      std::vector<vw::uint8> &row = m_rows[band][block.min().y() + r - m_first_row];
+      for (int c=0; c<block.width(); ++c)
+        row[block.min().x() + c] = tile(c, r)[0];
+    }
+  }
+
+  std::vector<vw::cartography::GeoReference>    m_input_georefs;
+  std::vector<vw::cartography::GeoReference>    m_output_georefs;
+  std::vector<vw::Vector2i>                     m_output_sizes;
+  boost::scoped_ptr<MultiBandWarper>            m_warper;
+  int                                           m_num_threads;
+  std::vector<std::deque<std::vector<vw::uint8> > > m_rows; ///< Rows m_first_row and on of each channel
+  int                                           m_first_row;
+  int                                           m_end_row;  ///< Every channel is warped down to this row
+  boost::mutex                                  m_mutex;
+};
+
+
+/// Image view of one channel of a HrscStripWarper, which must outlive the view.
+class HrscWarpedChannelView : public vw::ImageViewBase<HrscWarpedChannelView>
+{
+public:
+  typedef HrscWarpPixelT pixel_type;
+  typedef pixel_type     result_type;
+
+  HrscWarpedChannelView(HrscStripWarper &warper, size_t channel)
+    : m_warper(&warper), m_channel(channel) {}
+
+  inline vw::int32 cols  () const { return m_warper->cols(m_channel); }
+  inline vw::int32 rows  () const { return m_warper->rows(m_channel); }
+  inline vw::int32 planes() const { return 1; }
+
+  inline result_type operator()( vw::int32 i, vw::int32 j, vw::int32 p=0 ) const
+  {
+    return 0; // NOT IMPLEMENTED!
+  }
+
+  typedef vw::ProceduralPixelAccessor<HrscWarpedChannelView> pixel_accessor;
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  typedef vw::CropView<vw::ImageView<result_type> > prerasterize_type;
+  inline prerasterize_type prerasterize( vw::BBox2i const& bbox ) const
+  {
+    vw::ImageView<result_type> tile;
+    m_warper->read(m_channel, bbox, tile);
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
+  }
+
+  template <class DestT> inline void rasterize( DestT const& dest, vw::BBox2i const& bbox ) const
+  {
+    vw::rasterize( prerasterize(bbox), dest, bbox );
+  }
+
+private:
+  HrscStripWarper* m_warper;
+  size_t           m_channel;
+};
+
+
+#endif // HRSC_WARPER_H
@@ -6,6 +6,9 @@ import os
 import sys
 import copy
 import math
+import fcntl
+import socket
+import struct
 import subprocess
 
 
@@ -29,6 +32,43 @@ class CmdRunException(Exception):
     '''Exception type indicating an error with a cmd call'''
     pass
 
+# If set, this environment variable holds the socket path of a running hrscWorkerDaemon
+#  and commands are sent to the daemon instead of starting a new process.
+DAEMON_SOCKET_ENV = 'HRSC_DAEMON_SOCKET'
+
+def runDaemonJob(socketPath, cmd):
+    '''Sends a command to hrscWorkerDaemon, waits for it to finish, and returns its exit code.
+       The daemon resolves relative paths in the command from our working folder.'''
+
+    client = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    try:
+        client.connect(socketPath)
+        client.sendall(os.getcwd() + '\n' + cmd.strip() + '\n')
+        response = ''
+        while not response.endswith('\n'):
+            data = client.recv(4096)
+            if not data:
+                break
+            response += data
+    finally:
+        client.close()
+    try:
+        return int(response.split()[0])
+    except (ValueError, IndexError):
+        raise CmdRunException('Bad response from worker daemon for command: ' + cmd)
+
+def runCmd(cmd):
+    '''Executes a command, using the worker daemon if there is one, and returns its exit code'''
+
+    print cmd
+    daemonSocket = os.environ.get(DAEMON_SOCKET_ENV)
+    if daemonSocket and os.path.exists(daemonSocket):
+        return runDaemonJob(daemonSocket, cmd)
+    status = os.system(cmd)
+    if os.WIFEXITED(status):
+        return os.WEXITSTATUS(status)
+    return -1
+
 def cmdRunner(cmd, outputPath=None, force=False):
     '''Executes a command if the output file does not exist and
        throws if the output file is not created'''
@@ -36,13 +76,47 @@ def cmdRunner(cmd, outputPath=None, force=False):
     if cmd == '': # An empty task
         return
 
-    if force or (not outputPath) or (not os.path.exists(outputPath)):
-        print cmd
-        os.system(cmd)
-    if outputPath and (not os.path.exists(outputPath)):
+    if force or (not outputPath) or (not pathExists(outputPath)):
+        runCmd(cmd)
+    if outputPath and (not pathExists(outputPath)):
         raise CmdRunException('Failed to create output file: ' + outputPath)
     return True
 
+def runTaskGraph(taskList, graphPath, numThreads=None, force=False):
+    '''Runs a list of (taskId, dependencyIdList, outputPath, cmd) tasks with runTaskGraph.
+       Each task starts as soon as the tasks it depends on have finished.
+       - Tasks must come after the tasks they depend on.
+       - Tasks with an existing output path are skipped unless force is set.
+       Returns a dictionary of task id to True if the task succeeded.'''
+
+    if not taskList:
+        return {}
+    with open(graphPath, 'w') as f:
+        for (taskId, dependencies, outputPath, cmd) in taskList:
+            if not outputPath:
+                outputPath = ''
+            f.write('\t'.join([taskId, ','.join(dependencies), outputPath, cmd]) + '\n')
+
+    statusPath = graphPath + '_status.txt'
+    if os.path.exists(statusPath):
+        os.remove(statusPath)
+    cmd = './runTaskGraph ' + graphPath + ' --status-file ' + statusPath
+    if numThreads:
+        cmd += ' --threads ' + str(numThreads)
+    if force:
+        cmd += ' --force'
+    cmdRunner(cmd, None, True)
+
+    # Any task missing from the status file did not run
+    taskStatus = dict([(task[0], False) for task in taskList])
+    if os.path.exists(statusPath):
+        with open(statusPath, 'r') as f:
+            for line in f:
+                parts = line.split()
+                if len(parts) == 2:
+                    taskStatus[parts[0]] = (parts[1] == '1')
+    return taskStatus
+
 def cmdRunnerWrapper(params):
     '''Wrapper function to call cmdRunner from a tuple'''
     cmd        = params[0]
@@ -69,6 +143,226 @@ def cmdRunnerWrapper(params):
                               '\n after '+str(numRetries)+ ' attempts.')
 
 
+#----------------------------------------------------------------------------
+# File containers and binary matrices, these match the formats in HrscCommon.h
+
+# A record in a container file is addressed as <container path>::<key>
+CONTAINER_KEY_SEPARATOR = '::'
+CONTAINER_RECORD_MAGIC  = 'HRSCREC1'
+CONTAINER_RECORD_FORMAT = '<8sIIQ' # magic, key length, reserved, data length
+
+BINARY_MATRIX_EXTENSION = '.hrm'
+BINARY_MATRIX_MAGIC     = 'HRSCMAT1'
+BINARY_MATRIX_FORMAT    = '<8sIIII' # magic, kind, rows, cols, reserved
+MATRIX_KIND_TRANSFORM   = 0
+MATRIX_KIND_PROFILE     = 1
+
+def getTransformStorePath(storePath, tilePrefix, product):
+    '''Returns the path of a tile product in a transform store'''
+    return storePath + CONTAINER_KEY_SEPARATOR + tilePrefix + '/' + product + BINARY_MATRIX_EXTENSION
+
+def isBinaryMatrixPath(path):
+    return path.endswith(BINARY_MATRIX_EXTENSION)
+
+def getTileProductPath(containerPath, tilePrefix, product):
+    '''Returns the path of a tile product in a container'''
+    return containerPath + CONTAINER_KEY_SEPARATOR + tilePrefix + '/' + product
+
+def scanContainerRecords(f, fileSize):
+    '''Returns ({key: (dataOffset, dataLength)}, end of the last complete record) for an
+       open container file.  Only the latest record for each key is indexed.'''
+    headerSize = struct.calcsize(CONTAINER_RECORD_FORMAT)
+    index    = {}
+    position = 0
+    f.seek(0)
+    while position + headerSize <= fileSize:
+        magic, keyLength, reserved, dataLength = struct.unpack(CONTAINER_RECORD_FORMAT, f.read(headerSize))
+        dataStart = position + headerSize + keyLength
+        if (magic != CONTAINER_RECORD_MAGIC) or (dataStart + dataLength > fileSize):
+            break # Cut short by a crash
+        index[f.read(keyLength)] = (dataStart, dataLength)
+        position = dataStart + dataLength
+        f.seek(position)
+    return (index, position)
+
+# The record index of each container this process has read, with the file version it was
+#  built from.  Appends change the size and compaction changes the inode.
+_containerIndexCache = {}
+
+def getContainerVersion(f):
+    info = os.fstat(f.fileno())
+    return (info.st_size, info.st_mtime, info.st_ino)
+
+def readContainerIndex(containerPath, f=None):
+    '''Returns the record index of a container, which is empty if it does not exist.
+       The index is only scanned again when the container has changed.'''
+    if f is None:
+        if not os.path.exists(containerPath):
+            return {}
+        with open(containerPath, 'rb') as f:
+            return readContainerIndex(containerPath, f)
+    version = getContainerVersion(f)
+    cached  = _containerIndexCache.get(containerPath)
+    if cached and (cached[0] == version):
+        return cached[1]
+    index = scanContainerRecords(f, version[0])[0]
+    _containerIndexCache[containerPath] = (version, index)
+    return index
+
+def readContainerRecord(containerPath, key):
+    '''Returns the data of the latest record for a key in a container, or None'''
+    if not os.path.exists(containerPath):
+        return None
+    with open(containerPath, 'rb') as f:
+        index = readContainerIndex(containerPath, f)
+        if key not in index:
+            return None
+        (dataStart, dataLength) = index[key]
+        f.seek(dataStart)
+        return f.read(dataLength)
+
+def openContainerForAppend(containerPath):
+    '''Opens and locks a container with the same lock the C++ tools use, after removing
+       any partial record a crash left at the end of it'''
+    while True:
+        f = open(containerPath, 'a+b')
+        fcntl.flock(f, fcntl.LOCK_EX)
+        # A compaction may have replaced the file while we waited for the lock
+        fileInfo = os.fstat(f.fileno())
+        if (not os.path.exists(containerPath)) or (os.stat(containerPath).st_ino != fileInfo.st_ino):
+            f.close()
+            continue
+        (index, end) = scanContainerRecords(f, fileInfo.st_size)
+        if end < fileInfo.st_size:
+            print 'Removing a partial record from the end of container ' + containerPath
+            os.ftruncate(f.fileno(), end)
+        f.seek(0, os.SEEK_END)
+        return f
+
+def appendContainerRecord(containerPath, key, data):
+    '''Append a record to a container'''
+    f = openContainerForAppend(containerPath)
+    try:
+        f.write(struct.pack(CONTAINER_RECORD_FORMAT, CONTAINER_RECORD_MAGIC, len(key), 0, len(data)))
+        f.write(key)
+        f.write(data)
+        f.flush()
+    finally:
+        f.close() # Also releases the lock
+
+def compactContainer(containerPath, minWastedFraction=0.5):
+    '''Rewrites a container with only the latest record for each key, if at least
+       minWastedFraction of the file is taken up by replaced or partial records.
+       Returns True if the container was rewritten.'''
+    if not os.path.exists(containerPath):
+        return False
+    headerSize  = struct.calcsize(CONTAINER_RECORD_FORMAT)
+    compactPath = containerPath + '_compact'
+    f = openContainerForAppend(containerPath)
+    try:
+        fileSize = os.fstat(f.fileno()).st_size
+        (index, end) = scanContainerRecords(f, fileSize)
+        liveSize = sum([headerSize + len(key) + length for (key, (start, length)) in index.iteritems()])
+        if (fileSize == 0) or (fileSize - liveSize < minWastedFraction*fileSize):
+            return False
+
+        # Keep the records in their original order
+        with open(compactPath, 'wb') as out:
+            for (key, (start, length)) in sorted(index.items(), key=lambda item: item[1][0]):
+                out.write(struct.pack(CONTAINER_RECORD_FORMAT, CONTAINER_RECORD_MAGIC, len(key), 0, length))
+                out.write(key)
+                f.seek(start)
+                while length > 0:
+                    chunk = f.read(min(length, 16*1024*1024))
+                    if not chunk:
+                        raise Exception('Container changed while compacting: ' + containerPath)
+                    out.write(chunk)
+                    length -= len(chunk)
+            out.flush()
+            os.fsync(out.fileno())
+        # Appends waiting on the lock of the old file will see it was replaced
+        os.rename(compactPath, containerPath)
+        print 'Compacted container %s from %d to %d bytes' % (containerPath, fileSize, liveSize)
+        return True
+    finally:
+        f.close()
+
+# A crop of a mapped basemap is addressed as <mapped basemap>.hrb@<col>,<row>,<width>,<height>[,gray]
+# - Only the .hrb@ marker starts a crop, other paths containing '@' are plain files.
+MAPPED_BASEMAP_EXTENSION = '.hrb'
+BASEMAP_CROP_SEPARATOR   = MAPPED_BASEMAP_EXTENSION + '@'
+
+def getBasemapCropPath(basemapPath, pixelRect, isGray=False):
+    '''Returns the path to read a pixel region of a mapped basemap from'''
+    if not basemapPath.endswith(MAPPED_BASEMAP_EXTENSION):
+        raise Exception('Mapped basemaps must end with ' + MAPPED_BASEMAP_EXTENSION + ': ' + basemapPath)
+    basemapPath = basemapPath[:-len(MAPPED_BASEMAP_EXTENSION)]
+    minX = int(round(pixelRect.minX))
+    minY = int(round(pixelRect.minY))
+    path = '%s%s%d,%d,%d,%d' % (basemapPath, BASEMAP_CROP_SEPARATOR, minX, minY,
+                                int(round(pixelRect.maxX)) - minX, int(round(pixelRect.maxY)) - minY)
+    if isGray:
+        path += ',gray'
+    return path
+
+def isBasemapCropPath(path):
+    return BASEMAP_CROP_SEPARATOR in os.path.basename(path)
+
+def getCroppedBasemapPath(path):
+    '''Returns the mapped basemap a basemap crop path reads from'''
+    return path[:path.rfind(BASEMAP_CROP_SEPARATOR) + len(MAPPED_BASEMAP_EXTENSION)]
+
+def pathExists(path):
+    '''Returns True if a file, a container record, or the basemap of a basemap crop exists'''
+    if isBasemapCropPath(path):
+        return os.path.exists(getCroppedBasemapPath(path))
+    if CONTAINER_KEY_SEPARATOR in path:
+        containerPath, key = path.split(CONTAINER_KEY_SEPARATOR, 1)
+        return key in readContainerIndex(containerPath)
+    return os.path.exists(path)
+
+def readFileData(path):
+    '''Read the contents of a file or a container record'''
+    if CONTAINER_KEY_SEPARATOR in path:
+        containerPath, key = path.split(CONTAINER_KEY_SEPARATOR, 1)
+        data = readContainerRecord(containerPath, key)
+        if data is None:
+            raise Exception('Failed to read ' + path)
+        return data
+    with open(path, 'rb') as f:
+        return f.read()
+
+def writeFileData(path, data):
+    '''Write a file or append a record to a container'''
+    if CONTAINER_KEY_SEPARATOR in path:
+        containerPath, key = path.split(CONTAINER_KEY_SEPARATOR, 1)
+        appendContainerRecord(containerPath, key, data)
+    else:
+        with open(path, 'wb') as f:
+            f.write(data)
+
+def readBinaryMatrix(path):
+    '''Returns (kind, rows) from a binary matrix, where rows is a list of lists of floats'''
+    data       = readFileData(path)
+    headerSize = struct.calcsize(BINARY_MATRIX_FORMAT)
+    if len(data) < headerSize:
+        raise Exception('Invalid matrix file ' + path)
+    magic, kind, numRows, numCols, reserved = struct.unpack(BINARY_MATRIX_FORMAT, data[:headerSize])
+    if (magic != BINARY_MATRIX_MAGIC) or (len(data) != headerSize + 4*numRows*numCols):
+        raise Exception('Invalid matrix file ' + path)
+    values = struct.unpack('<%df' % (numRows*numCols), data[headerSize:])
+    return (kind, [list(values[r*numCols:(r+1)*numCols]) for r in range(numRows)])
+
+def writeBinaryMatrix(path, rows, kind=MATRIX_KIND_TRANSFORM):
+    '''Write a list of lists of floats as a binary matrix'''
+    numRows = len(rows)
+    numCols = len(rows[0]) if numRows else 0
+    values  = [float(v) for row in rows for v in row]
+    data    = (struct.pack(BINARY_MATRIX_FORMAT, BINARY_MATRIX_MAGIC, kind, numRows, numCols, 0)
+               + struct.pack('<%df' % len(values), *values))
+    writeFileData(path, data)
+
+
 def countBlackPixels(imagePath, isGray=True):
     '''Returns the number of black pixels in an image'''
     
@@ -360,6 +654,10 @@ class SpatialTransform:
     def load(self, path):
         '''Read the transform from a file'''
 
+        if isBinaryMatrixPath(path):
+            kind, rows = readBinaryMatrix(path)
+            self.values = [v for row in rows for v in row]
+            return
         with open(path, 'r') as f:
             f.readline() # Skip the header
             self.values[0], self.values[1], self.values[2] = f.readline().strip().split(',')
@@ -368,9 +666,21 @@ class SpatialTransform:
         for i in range(0,len(self.values)): # Convert the strings to floats
             self.values[i] = float(self.values[i])
 
+    def isClose(self, other, tolerance=1e-6):
+        '''Returns True if the values match to within a relative tolerance, which covers
+           the single precision values of a binary matrix'''
+        for (a, b) in zip(self.values, other.values):
+            if abs(a - b) > tolerance*max(1.0, abs(a)):
+                return False
+        return True
+
     def write(self, path):
         '''Save the transform to a file'''
         
+        if isBinaryMatrixPath(path):
+            writeBinaryMatrix(path, [self.values[0:3], self.values[3:6], self.values[6:9]])
+            return
+
         # Write the output file
         with open(path, 'w') as f:
             f.write('3, 3\n')
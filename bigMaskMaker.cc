@@ -43,6 +43,7 @@ using namespace vw;
 /**
   This program takes in a set of images and returns a uint8 image
   which is 255 in pixels where all of the input images have data.
+  If the output path ends in .pmask the mask is written in the bit packed format.
 
 */
 
@@ -50,110 +51,6 @@ using namespace vw;
 
 
 
-
-// TODO: This could be handled with a generic class + a functor.
-//      --> May it already exists somewhere?
-/// Image view class which creates a binary mask image equalling
-///  255 in locations where all of the input images are non-zero.
-/// - The output mask is equal in size to the smallest input image.
-template <class ImageT>
-class ImageAndView : public ImageViewBase<ImageAndView<ImageT> >
-{
-private:
-  std::vector<ImageT> m_image_vec;
-  int m_num_rows;
-  int m_num_cols;
-
-public:
-  typedef typename ImageT::pixel_type pixel_type;
-  typedef typename ImageT::pixel_type result_type;
-  
-  typedef PixelGray<unsigned char> Uint8;
-
-  // Constructor
-  ImageAndView( std::vector<ImageT> & imageVec ) : m_image_vec(imageVec)
-  {
-    const size_t numImages = imageVec.size();
-    VW_ASSERT( (numImages > 0), ArgumentErr() << "ImageAndView: One or more images required!." );
-
-    // Determine the minimum image size
-    m_num_rows = imageVec[0].rows();
-    m_num_cols = imageVec[0].cols();
-    for (size_t i=1; i<numImages; ++i)
-    {
-      if (imageVec[i].rows() < m_num_rows)  m_num_rows = imageVec[i].rows();
-      if (imageVec[i].cols() < m_num_cols)  m_num_cols = imageVec[i].cols();
-    }
-  }
-
-  inline int32 cols  () const { return m_num_cols; }
-  inline int32 rows  () const { return m_num_rows; }
-  inline int32 planes() const { return 1; }
-
-  inline result_type operator()( int32 i, int32 j, int32 p=0 ) const 
-  { 
-    return 0; // NOT IMPLEMENTED!
-  }
-
-  typedef ProceduralPixelAccessor<ImageAndView<ImageT> > pixel_accessor;
-  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
-
-  typedef CropView<ImageView<result_type> > prerasterize_type;
-  inline prerasterize_type prerasterize( BBox2i const& bbox ) const 
-  { 
-    // Set up the output image tile
-    ImageView<result_type> tile(bbox.width(), bbox.height());
-
-    // Set up for pixel calculations
-    size_t num_images = m_image_vec.size();
-
-    // Rasterize all the input images at this particular tile
-    std::vector<ImageView<Uint8> > input_tiles(num_images);
-    for (size_t i=0; i<num_images; ++i)
-    {
-      // Make sure we don't go outside the bounds of this image
-      BBox2i safe_bbox = bbox;
-      safe_bbox.crop(bounding_box(m_image_vec[i]));
-      input_tiles[i] = crop(m_image_vec[i], safe_bbox);
-    }
-
-
-    // Loop through each output pixel and compute each output value
-    for (int c = 0; c < bbox.width(); c++)
-    {
-      for (int r = 0; r < bbox.height(); r++)
-      {
-        // Check all of the pixels at this location and perform the AND operation
-        result_type thisPixel;
-        result_type outputPixel;
-        outputPixel[0] = 255; // UINT8 max
-        for (size_t i=0; i<num_images; ++i) 
-        {
-          thisPixel = input_tiles[i](c,r);
-          if (thisPixel[0] <= 0) {
-            outputPixel[0] = 0;
-            break; // Skip looking at the other pixels at this location
-          }
-        } // End image loop
-        tile(c, r) = outputPixel;
-      } // End row loop
-    } // End column loop
-
-  // Return the tile we created with fake borders to make it look the size of the entire output image
-  return prerasterize_type(tile,
-                           -bbox.min().x(), -bbox.min().y(),
-                           cols(), rows() );
-
-  } // End prerasterize function
-
- template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const 
- { 
-   vw::rasterize( prerasterize(bbox), dest, bbox ); 
- }
-  
-}; // End class ImageAndView
-
-
 struct Options {
   Options() : nodata(-1), feather_min(0), feather_max(255), filter("linear") {}
   // Input
@@ -164,13 +61,11 @@ struct Options {
   int feather_min, feather_max; // Currently these are always left at the defaults
   std::string filter;
   std::string output_filename;
+  int stats_tile_size;
 };
 
 
 
-
-
-
 // Handling input
 void handle_arguments( int argc, char *argv[], Options& opt ) {
 
@@ -178,6 +73,7 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   general_options.add_options()
     ("nodata-value",      po::value(&opt.nodata), "Value that is nodata in the input image. Not used if input has alpha.")
     ("output-filename,o", po::value(&opt.output_filename), "Output file name.")
+    ("stats-tile-size",   po::value(&opt.stats_tile_size)->default_value(MASK_STATS_TILE_SIZE), "Tile size used for the per-tile statistics in the sidecar file.")
     ("help,h",            "Display this help message");
 
   po::options_description positional("");
@@ -261,10 +157,14 @@ int main( int argc, char *argv[] ) {
 
 
   vw_out() << "Writing: " << output << std::endl;
-  block_write_gdal_image(output, 
-                        ImageAndView< ImageViewRef<PixelT> >(input_images),
-                        georef,
-                        TerminalProgressCallback("bigMaskMaker","Writing:"));
+  MaskStatistics stats(0, 0, opt.stats_tile_size);
+
+  // The mask is computed one strip of rows at a time, packed if requested.
+  if (!writeAndMaskImages(input_images, georef, output, "", stats,
+                          TerminalProgressCallback("bigMaskMaker","Writing:")))
+    vw_throw( IOErr() << "Failed to write packed mask " << output );
 
+  // The statistics were collected as the mask was written
+  stats.writeJson(getMaskStatisticsPath(output));
 
 }
@@ -0,0 +1,152 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2006-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NASA Vision Workbench is licensed under the Apache License,
+//  Version 2.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <vw/Core/FundamentalTypes.h>
+#include <vw/Core/Log.h>
+#include <vw/Image/Algorithms.h>
+#include <vw/Image/ImageIO.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/MaskViews.h>
+#include <vw/Image/PixelMath.h>
+#include <vw/Image/Statistics.h>
+#include <vw/Image/Filter.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/Cartography/GeoReference.h>
+
+#include <vector>
+
+#include <HrscCommon.h>
+
+#include <boost/program_options.hpp>
+#include <boost/utility/enable_if.hpp>
+#include <boost/foreach.hpp>
+namespace po = boost::program_options;
+
+using namespace vw;
+
+/**
+  This program combines bigMaskMaker and bigMaskGrassfire into a single pass.
+  The AND mask of the input images is computed one strip of rows at a time and
+  fed directly into a streaming grassfire computation which keeps a rolling buffer
+  of rows, so the full resolution binary mask never needs to be written to disk
+  and read back in.
+
+  The binary mask is only written out if --binary-mask-output is specified.
+  Valid pixel statistics are written to a .stats.json sidecar next to each output.
+*/
+
+//======================================================================================================
+
+struct Options {
+  Options() : nodata(-1), stats_tile_size(MASK_STATS_TILE_SIZE) {}
+  // Input
+  std::vector<std::string> input_files;
+
+  // Settings
+  double nodata;
+  std::string output_filename;
+  std::string binary_mask_filename;
+  int stats_tile_size;
+};
+
+
+// Handling input
+void handle_arguments( int argc, char *argv[], Options& opt ) {
+  size_t cache_size;
+
+  po::options_description general_options("");
+  general_options.add_options()
+    ("nodata-value",       po::value(&opt.nodata), "Value that is nodata in the input image. Not used if input has alpha.")
+    ("output-filename,o",  po::value(&opt.output_filename), "Output grassfire mask file name.")
+    ("binary-mask-output", po::value(&opt.binary_mask_filename), "Also write the binary mask to this file.  Use a .pmask extension for the packed format.")
+    ("cache",              po::value(&cache_size)->default_value(1024), "Source data cache size, in megabytes.")
+    ("stats-tile-size",    po::value(&opt.stats_tile_size)->default_value(MASK_STATS_TILE_SIZE), "Tile size used for the per-tile statistics in the sidecar file.")
+    ("help,h",             "Display this help message");
+
+  po::options_description positional("");
+  positional.add_options()
+    ("input-files", po::value<std::vector<std::string> >(&opt.input_files));
+
+  po::positional_options_description positional_desc;
+  positional_desc.add("input-files", -1);
+
+  po::options_description all_options;
+  all_options.add(general_options).add(positional);
+
+  po::variables_map vm;
+  try {
+    po::store( po::command_line_parser( argc, argv ).options(all_options).positional(positional_desc).run(), vm );
+    po::notify( vm );
+  } catch (const po::error& e) {
+    vw_throw( ArgumentErr() << "Error parsing input:\n\t"
+              << e.what() << general_options );
+  }
+
+  std::ostringstream usage;
+  usage << "Usage: " << argv[0] << " [options] <image-files>\n";
+
+  if ( vm.count("help") )
+    vw_throw( ArgumentErr() << usage.str() << general_options );
+  if ( opt.input_files.empty() )
+    vw_throw( ArgumentErr() << "Missing input files!\n" << usage.str() << general_options );
+  if ( opt.output_filename.empty() )
+    vw_throw( ArgumentErr() << "Missing output file!\n" << usage.str() << general_options );
+
+  // Set the system cache size
+  vw_settings().set_system_cache_size( cache_size*1024*1024 );
+
+}
+
+
+
+int main( int argc, char *argv[] ) {
+
+  Options opt;
+  handle_arguments( argc, argv, opt );
+
+  // Read the georef from the first file, they should all have the same value.
+  const std::string firstPath = opt.input_files[0];
+  cartography::GeoReference georef;
+  cartography::read_georeference(georef, firstPath);
+
+  // The input images are always 8 bit
+  typedef PixelGray<uint8> PixelT;
+
+  const size_t numInputFiles = opt.input_files.size();
+  std::vector< ImageViewRef<PixelT> > input_images(numInputFiles);
+  for (size_t i=0; i<numInputFiles; ++i)
+  {
+    vw_out() << "Loading: " << opt.input_files[i] << "\n";
+    input_images[i] = DiskImageView<PixelT>(opt.input_files[i]);
+  }
+
+  vw_out() << "Writing: " << opt.output_filename << std::endl;
+  if (!opt.binary_mask_filename.empty())
+    vw_out() << "Writing: " << opt.binary_mask_filename << std::endl;
+  MaskStatistics stats(0, 0, opt.stats_tile_size);
+  if (!writeAndMaskImages(input_images, georef, opt.binary_mask_filename, opt.output_filename, stats,
+                          TerminalProgressCallback("bigMaskMakerGrassfire","Writing:")))
+    vw_throw( IOErr() << "Failed to write packed mask " << opt.binary_mask_filename );
+
+  // Both masks have the same valid pixels so they share the statistics
+  stats.writeJson(getMaskStatisticsPath(opt.output_filename));
+  if (!opt.binary_mask_filename.empty())
+    stats.writeJson(getMaskStatisticsPath(opt.binary_mask_filename));
+
+}
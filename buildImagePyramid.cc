@@ -0,0 +1,572 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2006-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NASA Vision Workbench is licensed under the Apache License,
+//  Version 2.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <vw/Core/Log.h>
+
+#include <vector>
+#include <errno.h>
+
+#include <HrscCommon.h>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+#include <boost/thread.hpp>
+namespace po = boost::program_options;
+
+using namespace vw;
+
+/**
+  Builds the KML image pyramid of the output tiles, replacing the gdal_translate and
+  montage calls that stackImagePyramid.py made for every tile.
+
+  Each output tile is read once and reduced to a level 0 pyramid tile.  Every tile
+  above that is assembled from half size copies of its four children, which are kept
+  in memory, so no pyramid tile is read back from disk.  Each pyramid tile is a task
+  in a TaskGraphExecutor so a tile is built as soon as its children are finished.
+
+  The layout matches KmlTreeMaker in stackImagePyramid.py:
+    <output folder>/<level>/tile_<row>_<col>.<png or jpg> and .kml
+  The top level tree.kml is still written by stackImagePyramid.py.
+
+  With --dirty-list an existing pyramid is updated instead, using the dirty tile lists
+  written by hrscMosaic.  Only the dirty output tiles and their ancestors are rebuilt.
+  With the box filter only the quadrants of a level 0 tile which contain changed regions
+  are read and reduced, and each ancestor only has the quadrants below it replaced.
+*/
+
+//======================================================================================================
+
+struct Options {
+  // Input
+  std::string source_folder;
+  std::string output_folder;
+  std::vector<std::string> dirty_lists;
+
+  // Settings
+  int         tile_size;
+  int         num_tile_rows;
+  int         num_tile_cols;
+  std::string format;
+  std::string filter;
+  int         jpeg_quality;
+  int         num_threads;
+};
+
+/// One tile of the pyramid
+struct PyramidTile
+{
+  int     level;
+  int     row;
+  int     col;
+  bool    written;
+  cv::Mat half; ///< Half size copy of the tile for building its parent
+};
+
+/// Get the size of an image file without reading it.
+bool getGdalImageSize(const std::string &path, cv::Size &size)
+{
+  GDALDatasetH dataset = GDALOpen(path.c_str(), GA_ReadOnly);
+  if (!dataset)
+  {
+    printf("Failed to open %s with GDAL!\n", path.c_str());
+    return false;
+  }
+  size = cv::Size(GDALGetRasterXSize(dataset), GDALGetRasterYSize(dataset));
+  GDALClose(dataset);
+  return true;
+}
+
+/// Read one region of an RGB image file in to a BGR image.
+bool readGdalImageRegion(const std::string &path, const cv::Rect &roi, cv::Mat &image)
+{
+  GDALDatasetH dataset = GDALOpen(path.c_str(), GA_ReadOnly);
+  if (!dataset || (GDALGetRasterCount(dataset) != 3))
+  {
+    printf("Failed to open %s as an RGB image!\n", path.c_str());
+    if (dataset)
+      GDALClose(dataset);
+    return false;
+  }
+  image.create(roi.height, roi.width, CV_8UC3);
+  int bandMap[3] = {3, 2, 1}; // OpenCV BGR pixels
+  const bool success = (GDALDatasetRasterIO(dataset, GF_Read, roi.x, roi.y, roi.width, roi.height,
+                                            image.ptr<unsigned char>(), roi.width, roi.height,
+                                            GDT_Byte, 3, bandMap, 3, static_cast<int>(image.step[0]), 1)
+                        == CE_None);
+  GDALClose(dataset);
+  if (!success)
+    printf("Failed to read from %s\n", path.c_str());
+  return success;
+}
+
+/// Builds all of the tiles of the pyramid and their KML files.
+class ImagePyramidBuilder
+{
+public:
+
+  ImagePyramidBuilder(const Options &opt) : _opt(opt)
+  {
+    _interpolation = (opt.filter == "lanczos") ? cv::INTER_LANCZOS4 : cv::INTER_AREA;
+  }
+
+  /// When updating, load the dirty tile lists.
+  bool loadDirtyLists()
+  {
+    std::map<std::string, std::vector<cv::Rect> > dirtyTiles;
+    for (size_t i=0; i<_opt.dirty_lists.size(); ++i)
+      if (!readDirtyTileList(_opt.dirty_lists[i], dirtyTiles))
+        return false;
+    std::map<std::string, std::vector<cv::Rect> >::const_iterator iter;
+    for (iter=dirtyTiles.begin(); iter!=dirtyTiles.end(); ++iter)
+    {
+      const size_t slash = iter->first.rfind('/');
+      const std::string name = iter->first.substr((slash == std::string::npos) ? 0 : slash+1);
+      int row, col;
+      if ((sscanf(name.c_str(), "output_tile_%d_%d.tif", &row, &col) != 2) ||
+          (row < 0) || (col < 0) || (row >= _opt.num_tile_rows) || (col >= _opt.num_tile_cols))
+      {
+        printf("Skipping unknown dirty tile %s\n", iter->first.c_str());
+        continue;
+      }
+      std::vector<cv::Rect> &regions = _dirtyRegions[row*_opt.num_tile_cols+col];
+      regions.insert(regions.end(), iter->second.begin(), iter->second.end());
+    }
+    return true;
+  }
+
+  /// Set up one task per tile, returns the number of levels.
+  int addTasks(TaskGraphExecutor &executor)
+  {
+    // Level 0 has a tile for each output tile which exists, or each dirty one when updating
+    int numRows = _opt.num_tile_rows;
+    int numCols = _opt.num_tile_cols;
+    _levelSizes.push_back(cv::Size(numCols, numRows));
+    _tileIndices.push_back(std::vector<int>(numRows*numCols, -1));
+    for (int row=0; row<numRows; ++row)
+    {
+      for (int col=0; col<numCols; ++col)
+      {
+        if (isUpdate() && (_dirtyRegions.find(row*numCols+col) == _dirtyRegions.end()))
+          continue;
+        if (!fileExists(getSourcePath(row, col)))
+          continue;
+        _tileIndices[0][row*numCols+col] = addTile(executor, 0, row, col, std::vector<size_t>());
+      }
+    }
+
+    // Each level above has a tile wherever any of its four children exist
+    // - Stop once a level has a single tile, like KmlTreeMaker.
+    int level = 0;
+    while (numRows*numCols > 1)
+    {
+      ++level;
+      numRows = (numRows+1)/2;
+      numCols = (numCols+1)/2;
+      _levelSizes.push_back(cv::Size(numCols, numRows));
+      _tileIndices.push_back(std::vector<int>(numRows*numCols, -1));
+      for (int row=0; row<numRows; ++row)
+      {
+        for (int col=0; col<numCols; ++col)
+        {
+          std::vector<size_t> children;
+          for (int i=0; i<4; ++i)
+          {
+            const int child = getTileIndex(level-1, 2*row+i/2, 2*col+i%2);
+            if (child >= 0)
+              children.push_back(child);
+          }
+          if (!children.empty())
+            _tileIndices[level][row*numCols+col] = addTile(executor, level, row, col, children);
+        }
+      }
+    }
+    return level+1;
+  }
+
+  /// Create the output folder and a folder for each level
+  bool makeLevelFolders() const
+  {
+    std::vector<std::string> folders(1, _opt.output_folder);
+    for (size_t level=0; level<_levelSizes.size(); ++level)
+      folders.push_back(getLevelFolder(level));
+    for (size_t i=0; i<folders.size(); ++i)
+    {
+      if ((mkdir(folders[i].c_str(), 0775) != 0) && (errno != EEXIST))
+      {
+        printf("Failed to create folder %s\n", folders[i].c_str());
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+
+  const Options &_opt;
+  int _interpolation;
+  std::vector<cv::Size>         _levelSizes;
+  std::vector<std::vector<int> > _tileIndices; ///< Task index of each tile in each level, or -1
+  std::deque<PyramidTile>       _tiles;        ///< Indexed by task, a deque so entries do not move
+  std::map<int, std::vector<cv::Rect> > _dirtyRegions; ///< Changed regions of each dirty output tile
+
+  bool isUpdate() const {return !_opt.dirty_lists.empty();}
+
+  size_t addTile(TaskGraphExecutor &executor, const int level, const int row, const int col,
+                 const std::vector<size_t> &children)
+  {
+    PyramidTile tile;
+    tile.level   = level;
+    tile.row     = row;
+    tile.col     = col;
+    tile.written = false;
+    _tiles.push_back(tile);
+    return executor.addTask(boost::bind(&ImagePyramidBuilder::makeTile, this, _tiles.size()-1),
+                            children);
+  }
+
+  int getTileIndex(const int level, const int row, const int col) const
+  {
+    const cv::Size &size = _levelSizes[level];
+    if ((row >= size.height) || (col >= size.width))
+      return -1;
+    return _tileIndices[level][row*size.width+col];
+  }
+
+  std::string getSourcePath(const int row, const int col) const
+  {
+    char name[64];
+    snprintf(name, sizeof(name), "output_tile_%04d_%04d.tif", row, col);
+    return _opt.source_folder + "/" + name;
+  }
+
+  std::string getTileName(const int row, const int col, const std::string &extension) const
+  {
+    char name[64];
+    snprintf(name, sizeof(name), "tile_%04d_%04d.%s", row, col, extension.c_str());
+    return name;
+  }
+
+  std::string getLevelFolder(const int level) const
+  {
+    return _opt.output_folder + "/" + boost::lexical_cast<std::string>(level);
+  }
+
+  std::string getTileImagePath(const int level, const int row, const int col) const
+  {
+    return getLevelFolder(level) + "/" + getTileName(row, col, _opt.format);
+  }
+
+  /// Load a pyramid tile written by an earlier run.
+  bool readExistingTile(const int level, const int row, const int col, cv::Mat &image) const
+  {
+    const std::string path = getTileImagePath(level, row, col);
+    if (!fileExists(path))
+      return false;
+    image = cv::imread(path, 1);
+    return (image.rows == _opt.tile_size) && (image.cols == _opt.tile_size);
+  }
+
+  /// Returns true if a tile was built by this run or is left from an earlier one when updating.
+  bool tileExists(const int level, const int row, const int col) const
+  {
+    const int index = getTileIndex(level, row, col);
+    if ((index >= 0) && _tiles[index].written)
+      return true;
+    return isUpdate() && fileExists(getLevelFolder(level) + "/" + getTileName(row, col, "kml"));
+  }
+
+  /// Reduce an output tile to a level 0 pyramid tile.
+  /// - When updating with the box filter, only the quadrants of the existing pyramid tile
+  ///   with changed regions are recomputed and only those parts of the output tile are read.
+  ///   The box filter gives the same pixels this way, the Lanczos filter would not.
+  bool makeBaseTile(const PyramidTile &tile, cv::Mat &image) const
+  {
+    const std::string sourcePath = getSourcePath(tile.row, tile.col);
+    const int tileSize = _opt.tile_size;
+    cv::Size sourceSize;
+    if (isUpdate() && (_interpolation == cv::INTER_AREA) && getGdalImageSize(sourcePath, sourceSize) &&
+        (sourceSize.width % 2 == 0) && (sourceSize.height % 2 == 0) &&
+        readExistingTile(tile.level, tile.row, tile.col, image))
+    {
+      const std::vector<cv::Rect> &regions = _dirtyRegions.find(tile.row*_opt.num_tile_cols+tile.col)->second;
+      const int halfSize = tileSize/2;
+      for (int i=0; i<4; ++i)
+      {
+        const cv::Rect sourceQuadrant((i%2)*sourceSize.width/2, (i/2)*sourceSize.height/2,
+                                      sourceSize.width/2, sourceSize.height/2);
+        bool isDirty = false;
+        for (size_t j=0; j<regions.size(); ++j)
+          isDirty = isDirty || ((regions[j] & sourceQuadrant).area() > 0);
+        if (!isDirty)
+          continue;
+        cv::Mat source;
+        if (!readGdalImageRegion(sourcePath, sourceQuadrant, source))
+          return false;
+        cv::Mat quadrant = image(cv::Rect((i%2)*halfSize, (i/2)*halfSize, halfSize, halfSize));
+        cv::resize(source, quadrant, quadrant.size(), 0, 0, _interpolation);
+      }
+      return true;
+    }
+
+    const int LOAD_RGB = 1;
+    cv::Mat source;
+    if (!readOpenCvImage(sourcePath, source, LOAD_RGB))
+      return false;
+    cv::resize(source, image, cv::Size(tileSize, tileSize), 0, 0, _interpolation);
+    return true;
+  }
+
+  /// Create the image and KML file for one tile.
+  bool makeTile(const size_t index)
+  {
+    PyramidTile &tile = _tiles[index];
+    const int tileSize = _opt.tile_size;
+    cv::Mat image;
+    // A bad output tile is left as a hole instead of stopping the levels above it
+    if (tile.level == 0)
+    {
+      if (!makeBaseTile(tile, image))
+        return true;
+    }
+    else
+    {
+      // Paste in the half size children, missing children are left black.
+      // - When updating, only the quadrants of rebuilt children are replaced.  A tile
+      //   that did not exist yet gets its other quadrants from the existing children.
+      const bool hasExisting = isUpdate() && readExistingTile(tile.level, tile.row, tile.col, image);
+      if (!hasExisting)
+        image = cv::Mat::zeros(tileSize, tileSize, CV_8UC3);
+      const int halfSize = tileSize/2;
+      bool foundChild = false;
+      for (int i=0; i<4; ++i)
+      {
+        const int row   = 2*tile.row+i/2;
+        const int col   = 2*tile.col+i%2;
+        const int child = getTileIndex(tile.level-1, row, col);
+        cv::Mat quadrant = image(cv::Rect((i%2)*halfSize, (i/2)*halfSize, halfSize, halfSize));
+        cv::Mat existingChild;
+        if ((child >= 0) && _tiles[child].written)
+        {
+          _tiles[child].half.copyTo(quadrant);
+          _tiles[child].half.release();
+          foundChild = true;
+        }
+        else if (isUpdate() && !hasExisting && readExistingTile(tile.level-1, row, col, existingChild))
+        {
+          cv::resize(existingChild, quadrant, quadrant.size(), 0, 0, _interpolation);
+        }
+      }
+      if (!foundChild)
+        return true;
+    }
+
+    // The top tile has no parent
+    if (tile.level+1 < static_cast<int>(_levelSizes.size()))
+      cv::resize(image, tile.half, cv::Size(tileSize/2, tileSize/2), 0, 0, _interpolation);
+
+    const std::string imagePath = getTileImagePath(tile.level, tile.row, tile.col);
+    std::vector<int> params;
+    if (_opt.format == "jpg")
+    {
+      params.push_back(CV_IMWRITE_JPEG_QUALITY);
+      params.push_back(_opt.jpeg_quality);
+    }
+    if (!cv::imwrite(imagePath, image, params))
+    {
+      printf("Failed to write %s\n", imagePath.c_str());
+      return false;
+    }
+    tile.written = writeKmlFile(tile);
+    return tile.written;
+  }
+
+  /// Get the bounds of a tile in degrees, matching the Tiling class in MosaicUtilities.py
+  /// - Tile rows count down from the north, tiles are clipped to the globe.
+  void getTileBounds(const int level, const int row, const int col,
+                     double &north, double &south, double &east, double &west) const
+  {
+    const double levelScale = pow(2.0, level);
+    const double tileWidth  = 360.0 / (_opt.num_tile_cols / levelScale);
+    const double tileHeight = 180.0 / (_opt.num_tile_rows / levelScale);
+    const int    safeRow    = _levelSizes[level].height - row - 1;
+    west  = -180.0 + col*tileWidth;
+    east  = std::min(180.0, west + tileWidth);
+    south = -90.0 + safeRow*tileHeight;
+    north = std::min(90.0, south + tileHeight);
+  }
+
+  void writeLatLonBox(std::ostream &kml, const std::string &name, const int level,
+                      const int row, const int col, const std::string &indent) const
+  {
+    double north, south, east, west;
+    getTileBounds(level, row, col, north, south, east, west);
+    kml << indent << "<" << name << ">\n"
+        << indent << "  <north>" << north << "</north>\n"
+        << indent << "  <south>" << south << "</south>\n"
+        << indent << "  <east>"  << east  << "</east>\n"
+        << indent << "  <west>"  << west  << "</west>\n"
+        << indent << "</" << name << ">\n";
+  }
+
+  /// Low resolution tiles are hidden once they are shown larger than their natural size
+  void writeRegion(std::ostream &kml, const int level, const int row, const int col,
+                   const std::string &indent) const
+  {
+    const int maxLod = (level == 0) ? -1 : _opt.tile_size+128;
+    kml << indent << "<Region>\n";
+    writeLatLonBox(kml, "LatLonAltBox", level, row, col, indent+"  ");
+    kml << indent << "  <Lod>\n"
+        << indent << "    <minLodPixels>128</minLodPixels>\n"
+        << indent << "    <maxLodPixels>" << maxLod << "</maxLodPixels>\n"
+        << indent << "  </Lod>\n"
+        << indent << "</Region>\n";
+  }
+
+  /// Write the KML file which shows a tile and links to the tiles below it.
+  bool writeKmlFile(const PyramidTile &tile) const
+  {
+    std::ostringstream kml;
+    kml.precision(12);
+    kml << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        << "<kml xmlns=\"http://www.opengis.net/kml/2.2\">\n"
+        << "  <Document>\n";
+    writeRegion(kml, tile.level, tile.row, tile.col, "    ");
+
+    if (tile.level > 0)
+    {
+      const std::string levelDownFolder = "../" + boost::lexical_cast<std::string>(tile.level-1) + "/";
+      for (int i=0; i<4; ++i)
+      {
+        const int row = 2*tile.row+i/2;
+        const int col = 2*tile.col+i%2;
+        if (!tileExists(tile.level-1, row, col))
+          continue; // Don't link to non-existant tiles
+        char name[32];
+        snprintf(name, sizeof(name), "%04d_%04d", row, col);
+        kml << "    <NetworkLink>\n"
+            << "      <name>" << name << "</name>\n";
+        writeRegion(kml, tile.level-1, row, col, "      ");
+        kml << "      <Link>\n"
+            << "        <href>" << levelDownFolder << getTileName(row, col, "kml") << "</href>\n"
+            << "        <viewRefreshMode>onRequest</viewRefreshMode>\n"
+            << "      </Link>\n"
+            << "    </NetworkLink>\n";
+      }
+    }
+
+    kml << "    <GroundOverlay>\n"
+        << "      <Icon>\n"
+        << "        <href>" << getTileName(tile.row, tile.col, _opt.format) << "</href>\n"
+        << "      </Icon>\n";
+    writeLatLonBox(kml, "LatLonBox", tile.level, tile.row, tile.col, "      ");
+    kml << "    </GroundOverlay>\n"
+        << "  </Document>\n"
+        << "</kml>\n";
+
+    const std::string kmlPath = getLevelFolder(tile.level) + "/" + getTileName(tile.row, tile.col, "kml");
+    if (!writeFileData(kmlPath, kml.str()))
+    {
+      printf("Failed to write %s\n", kmlPath.c_str());
+      return false;
+    }
+    return true;
+  }
+};
+
+//--------------------------------------------------------
+
+// Handling input
+void handle_arguments( int argc, char *argv[], Options& opt ) {
+  std::vector<std::string> positional_args;
+
+  po::options_description general_options("");
+  general_options.add_options()
+    ("tile-size",     po::value(&opt.tile_size)->default_value(512), "Size of the pyramid tiles in pixels.")
+    ("num-tile-rows", po::value(&opt.num_tile_rows)->default_value(128), "Number of rows of output tiles.")
+    ("num-tile-cols", po::value(&opt.num_tile_cols)->default_value(256), "Number of columns of output tiles.")
+    ("format",        po::value(&opt.format)->default_value("png"), "Pyramid tile format, png or jpg.")
+    ("filter",        po::value(&opt.filter)->default_value("box"), "Reduction filter, box or lanczos.")
+    ("jpeg-quality",  po::value(&opt.jpeg_quality)->default_value(90), "Quality of jpg pyramid tiles.")
+    ("dirty-list",    po::value(&opt.dirty_lists)->composing(),
+                      "Update an existing pyramid using this dirty tile list from hrscMosaic.  May be repeated.")
+    ("threads",       po::value(&opt.num_threads)->default_value(boost::thread::hardware_concurrency()),
+                      "Number of tiles to build at once.")
+    ("help,h",        "Display this help message");
+
+  po::options_description positional("");
+  positional.add_options()
+    ("input-files", po::value<std::vector<std::string> >(&positional_args));
+
+  po::positional_options_description positional_desc;
+  positional_desc.add("input-files", -1);
+
+  po::options_description all_options;
+  all_options.add(general_options).add(positional);
+
+  po::variables_map vm;
+  try {
+    po::store( po::command_line_parser( argc, argv ).options(all_options).positional(positional_desc).run(), vm );
+    po::notify( vm );
+  } catch (const po::error& e) {
+    vw_throw( ArgumentErr() << "Error parsing input:\n\t"
+              << e.what() << general_options );
+  }
+
+  std::ostringstream usage;
+  usage << "Usage: " << argv[0] << " [options] <output tile folder> <pyramid folder>\n";
+
+  if ( vm.count("help") )
+    vw_throw( ArgumentErr() << usage.str() << general_options );
+  if ( positional_args.size() != 2 )
+    vw_throw( ArgumentErr() << "Wrong number of input files!\n" << usage.str() << general_options );
+  if ( ((opt.format != "png") && (opt.format != "jpg")) || ((opt.filter != "box") && (opt.filter != "lanczos")) )
+    vw_throw( ArgumentErr() << "Unknown format or filter!\n" << usage.str() << general_options );
+  if ( (opt.tile_size < 2) || (opt.tile_size % 2 != 0) || (opt.num_tile_rows < 1) || (opt.num_tile_cols < 1) )
+    vw_throw( ArgumentErr() << "Invalid tile settings!\n" << usage.str() << general_options );
+
+  opt.source_folder = positional_args[0];
+  opt.output_folder = positional_args[1];
+}
+
+
+
+int main( int argc, char *argv[] ) {
+
+  Options opt;
+  handle_arguments( argc, argv, opt );
+
+  // The tiles are built in parallel so OpenCV does not need its own threads
+  cv::setNumThreads(0);
+
+  GDALAllRegister();
+  TaskGraphExecutor executor;
+  ImagePyramidBuilder builder(opt);
+  if (!builder.loadDirtyLists())
+    return -1;
+  const int numLevels = builder.addTasks(executor);
+  if (!builder.makeLevelFolders())
+    return -1;
+
+  vw_out() << "Building " << executor.numTasks() << " pyramid tiles in " << numLevels << " levels.\n";
+  const size_t numFailed = executor.run(opt.num_threads);
+  if (numFailed > 0)
+  {
+    printf("%d pyramid tiles failed or were skipped.\n", static_cast<int>(numFailed));
+    return -1;
+  }
+  return 0;
+}
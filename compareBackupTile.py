@@ -0,0 +1,104 @@
+import os
+import sys
+import re
+import shutil
+import tempfile
+import optparse
+import subprocess
+
+import MosaicUtilities
+
+'''
+Checks one backup tile from upsampleBasemapTiles against the ImageMagick command it
+replaced:
+    convert -define filter:blur=0.88 -filter quadratic -resize 12800%
+
+ImageMagick is run on the tile plus a halo of basemap pixels, which is enough for the
+filter, and the tile is cropped out of its output.  The two images must match to within
+a small tolerance, since the native tool rounds its floating point sums differently.
+'''
+
+# Basemap pixels around the tile given to ImageMagick, more than the filter support
+HALO = 3
+
+def getImageSize(path):
+    '''Returns the (width, height) of an image using gdalinfo'''
+    text  = subprocess.check_output(['gdalinfo', path])
+    match = re.search(r'Size is (\d+), (\d+)', text)
+    if not match:
+        raise Exception('Failed to read the size of ' + path)
+    return (int(match.group(1)), int(match.group(2)))
+
+def getImageDifference(convertPath, pathA, pathB, metric):
+    '''Returns an ImageMagick compare metric scaled to 0-255'''
+    comparePath = os.path.join(os.path.dirname(convertPath), 'compare')
+    p = subprocess.Popen([comparePath, '-metric', metric, pathA, pathB, 'null:'],
+                         stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    (out, err) = p.communicate() # The metric is printed to stderr as "<value> (<normalized>)"
+    match = re.search(r'\(([0-9.e+-]+)\)', err)
+    if not match:
+        raise Exception('Failed to compare images: ' + err)
+    return float(match.group(1))*255.0
+
+def main(argsIn):
+
+    usage = 'usage: compareBackupTile.py [options] <basemap path> <tile row> <tile col>'
+    parser = optparse.OptionParser(usage=usage)
+    parser.add_option('--scale',     dest='scale',    type='int',   default=128)
+    parser.add_option('--blur',      dest='blur',     type='float', default=0.88)
+    parser.add_option('--tile-size', dest='tileSize', type='int',   default=45)
+    parser.add_option('--convert',   dest='convertPath', default='convert',
+                      help='Path to the ImageMagick convert tool.')
+    parser.add_option('--max-difference', dest='maxDifference', type='float', default=2.0,
+                      help='Largest allowed difference of any pixel value.')
+    (options, args) = parser.parse_args(argsIn)
+    if len(args) != 3:
+        parser.print_help()
+        return -1
+    basemapPath = args[0]
+    (row, col)  = (int(args[1]), int(args[2]))
+
+    # Basemap region given to ImageMagick, clipped to the basemap like the native tool
+    (width, height) = getImageSize(basemapPath)
+    tileRect = MosaicUtilities.Rectangle(col*options.tileSize, (col+1)*options.tileSize,
+                                         row*options.tileSize, (row+1)*options.tileSize)
+    cropRect = MosaicUtilities.Rectangle(tileRect.minX-HALO, tileRect.maxX+HALO,
+                                         tileRect.minY-HALO, tileRect.maxY+HALO)
+    cropRect = cropRect.getIntersection(MosaicUtilities.Rectangle(0, width, 0, height))
+
+    tempFolder = tempfile.mkdtemp()
+    try:
+        nativePath = os.path.join(tempFolder, 'output_tile_%04d_%04d.tif' % (row, col))
+        cropPath   = os.path.join(tempFolder, 'crop.tif')
+        magickPath = os.path.join(tempFolder, 'magick.tif')
+
+        cmd = ('./upsampleBasemapTiles --scale %d --blur %f --tile-size %d --tile %d,%d %s %s'
+               % (options.scale, options.blur, options.tileSize, row, col, basemapPath, tempFolder))
+        MosaicUtilities.cmdRunner(cmd, nativePath)
+
+        cmd = ('gdal_translate -srcwin %d %d %d %d %s %s'
+               % (cropRect.minX, cropRect.minY, cropRect.width(), cropRect.height(), basemapPath, cropPath))
+        MosaicUtilities.cmdRunner(cmd, cropPath)
+
+        # Upsample the crop, then cut the tile out of the result
+        cmd = ('%s %s -define filter:blur=%f -filter quadratic -resize %d%% -crop %dx%d+%d+%d +repage %s'
+               % (options.convertPath, cropPath, options.blur, options.scale*100,
+                  options.tileSize*options.scale, options.tileSize*options.scale,
+                  (tileRect.minX-cropRect.minX)*options.scale, (tileRect.minY-cropRect.minY)*options.scale,
+                  magickPath))
+        MosaicUtilities.cmdRunner(cmd, magickPath)
+
+        maxDifference  = getImageDifference(options.convertPath, nativePath, magickPath, 'PAE')
+        meanDifference = getImageDifference(options.convertPath, nativePath, magickPath, 'MAE')
+    finally:
+        shutil.rmtree(tempFolder)
+
+    print 'Tile %d,%d max difference = %.2f, mean difference = %.3f' % (row, col, maxDifference, meanDifference)
+    if maxDifference > options.maxDifference:
+        print 'The tile does not match ImageMagick!'
+        return -1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -39,7 +39,7 @@ bool loadInputImages(int argc, char** argv, cv::Mat &basemapImage, std::vector<c
   }
 
   // Load the HRSC mask
-  if (!readOpenCvImage(hrscMaskPath, hrscMask, LOAD_GRAY))
+  if (!readBinaryMask(hrscMaskPath, hrscMask, CV_8UC1, 255))
       return false;
 
   // Load the spatial transform
@@ -0,0 +1,89 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2006-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NASA Vision Workbench is licensed under the Apache License,
+//  Version 2.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <stdio.h>
+#include <opencv2/opencv.hpp>
+
+#include <HrscCommon.h>
+
+/**
+  Writes every transform and brightness profile in a transform store out as
+  the text files the tools used before the store existed.
+  - The record <tile prefix>/<product>.hrm is written to
+    <output folder>/tile_<tile prefix>_<product>.csv
+*/
+
+//=============================================================
+
+/// Export one record of the store, returns false on failure.
+bool exportRecord(const std::string &storePath, const std::string &key, const std::string &outputFolder)
+{
+  const std::string inputPath = storePath + CONTAINER_KEY_SEPARATOR + key;
+
+  std::string name = key.substr(0, key.size() - BINARY_MATRIX_EXTENSION.size());
+  std::replace(name.begin(), name.end(), '/', '_');
+  const std::string outputPath = outputFolder + "/tile_" + name + ".csv";
+
+  BinaryMatrixKind kind;
+  cv::Mat matrix;
+  if (!readBinaryMatrix(inputPath, kind, matrix))
+    return false;
+
+  if (kind == MATRIX_KIND_PROFILE)
+  {
+    cv::Mat gain   = matrix.col(0).clone();
+    cv::Mat offset = matrix.col(1).clone();
+    BrightnessCorrector corrector(gain, offset);
+    return corrector.writeProfileCorrection(outputPath);
+  }
+  return writeTransform(outputPath, matrix);
+}
+
+
+int main(int argc, char** argv)
+{
+  // Check input arguments
+  if (argc != 3)
+  {
+    printf("usage: exportTransformStore <Transform Store Path> <Output Folder>\n");
+    return -1;
+  }
+  const std::string storePath    = argv[1];
+  const std::string outputFolder = argv[2];
+
+  boost::shared_ptr<const FileContainer> store = getFileContainer(storePath);
+  if (!store)
+  {
+    printf("Failed to load transform store %s\n", storePath.c_str());
+    return -1;
+  }
+
+  std::vector<std::string> keys;
+  store->getKeys(keys);
+  int numFailed = 0;
+  for (size_t i=0; i<keys.size(); ++i)
+  {
+    if (!isBinaryMatrixPath(keys[i]))
+      continue;
+    if (!exportRecord(storePath, keys[i], outputFolder))
+    {
+      printf("Failed to export %s\n", keys[i].c_str());
+      ++numFailed;
+    }
+  }
+  return (numFailed == 0) ? 0 : -1;
+}
@@ -0,0 +1,419 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2006-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NASA Vision Workbench is licensed under the Apache License,
+//  Version 2.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <vw/Core/FundamentalTypes.h>
+#include <vw/Core/Log.h>
+#include <vw/Image/EdgeExtension.h>
+#include <vw/Image/ImageIO.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/Cartography/GeoReference.h>
+
+#include <vector>
+
+#include <HrscCommon.h>
+
+#include <boost/program_options.hpp>
+namespace po = boost::program_options;
+
+using namespace vw;
+
+/**
+  This program generates all of the high resolution products for one HRSC image
+  in a single process.  It replaces this sequence of hrscImageManager.py steps:
+
+    warpHrscImages -> bigMaskMakerGrassfire -> tileHrscImages -> writeHrscColorPairs
+      -> solveHrscColor.py -> transformHrscImageColor
+
+  - The channels are warped with the same code as warpHrscImages, but in memory
+    and only a few strips of rows ahead of where they are used.  No full size
+    intermediate files are written, everything is computed one strip of tiles at
+    a time from buffers held in memory.
+  - The grassfire mask is computed for each strip from the warped channels and
+    is never written out as a full image.
+  - The color pairs and color transform for each tile are computed in memory and
+    in parallel across the tiles in a strip.
+  - A strip is color transformed once the transforms for the strip below it are
+    solved, since every tile blends in the transforms of its neighbors.
+
+  The outputs match what the separate tools write: the mask tiles with their
+  metadata files, plus tile_<row>_<col>_color_transform.csv and
+  tile_<row>_<col>_new_color.hrt in the tile folder for each tile with valid data.
+  The new color tiles are only read by the OpenCV tools so they are written in the
+  intermediate image format.
+  With --transform-store the color transforms go in the store instead, under the
+  key <row>_<col>/color_transform.hrm, and with --tile-products the new color
+  tiles go in that container under the key <row>_<col>/new_color.hrt.
+  The output tile list has the same format as the one transformHrscImageStrip reads.
+
+  The low resolution steps (mask, brightness correction, registration) are still run
+  by hrscImageManager.py, their outputs are inputs to this program.
+*/
+
+//======================================================================================================
+
+/// Matches MIN_TILE_PERCENT_PIXELS_VALID in hrscImageManager.py
+const double DEFAULT_MIN_PERCENT_VALID = 0.0001;
+
+typedef PixelGray<uint8>          PixelT;
+typedef PixelGray<MASK_DATA_TYPE> MaskPixelT;
+
+struct Options {
+  // Input
+  std::vector<std::string> input_files;
+
+  // Settings
+  std::string proj4;
+  double      meters_per_pixel;
+  int         num_threads;
+  std::string basemap_file;
+  std::string registration_file;
+  double      basemap_scale;
+  std::string brightness_file;
+  std::string tile_folder;
+  std::string mask_prefix;
+  std::string tile_list_file;
+  std::string transform_store;
+  std::string tile_products;
+  int         tile_size;
+  double      min_percent_valid;
+};
+
+
+/// All of the in memory data for one strip of tiles
+struct TileStrip
+{
+  int startRow;
+  std::vector<ImageView<PixelT> > channels;
+  ImageView<MaskPixelT>           mask;
+  std::vector<HrscTileInfo>       tiles;
+};
+
+
+/// Return the path prefix of the per-tile output files, matching hrscImageManager.py
+std::string getTileOutputBase(const std::string &tileFolder, int tileRow, int tileCol)
+{
+  return tileFolder + "/tile_" + itoa(tileRow) + "_" + itoa(tileCol);
+}
+
+/// Return the path the color transform of a tile is written to
+std::string getColorTransformPath(const Options &opt, int tileRow, int tileCol)
+{
+  if (!opt.transform_store.empty())
+    return getTransformStorePath(opt.transform_store, itoa(tileRow) + "_" + itoa(tileCol), "color_transform");
+  return getTileOutputBase(opt.tile_folder, tileRow, tileCol) + "_color_transform.csv";
+}
+
+std::string getNewColorPath(const Options &opt, int tileRow, int tileCol)
+{
+  if (!opt.tile_products.empty())
+    return getTileProductPath(opt.tile_products, itoa(tileRow) + "_" + itoa(tileCol),
+                              "new_color" + INTERMEDIATE_IMAGE_EXTENSION);
+  return getTileOutputBase(opt.tile_folder, tileRow, tileCol) + "_new_color" + INTERMEDIATE_IMAGE_EXTENSION;
+}
+
+
+/// Computes the color transform for each tile in a strip.
+/// - Each tile only writes its own entry in the transform grid so no locking is needed.
+class TileColorSolver : public cv::ParallelLoopBody
+{
+public:
+  TileColorSolver(const TileStrip &strip, const cv::Mat &basemap, const cv::Mat &registration,
+                  const double basemapScale, const BrightnessCorrector &corrector,
+                  const Options &opt, std::vector<std::vector<HrscTileColorInfo> > &colorTiles)
+    : _strip(strip), _basemap(basemap), _registration(registration), _basemapScale(basemapScale),
+      _corrector(corrector), _opt(opt), _colorTiles(colorTiles) {}
+
+  virtual void operator()(const cv::Range &range) const
+  {
+    const int stripCols = _strip.mask.cols();
+    for (int i=range.start; i<range.end; ++i)
+    {
+      const HrscTileInfo &info = _strip.tiles[i];
+      if (info.percentValid < _opt.min_percent_valid)
+        continue;
+
+      // Wrap the strip buffers for this tile, ImageView data is stored row major.
+      const cv::Rect roi(info.pixelCol, 0, info.width, info.height);
+      std::vector<cv::Mat> channels(NUM_HRSC_CHANNELS);
+      for (size_t c=0; c<NUM_HRSC_CHANNELS; ++c)
+        channels[c] = cv::Mat(_strip.mask.rows(), stripCols, CV_8UC1,
+                              const_cast<PixelT*>(_strip.channels[c].data()))(roi);
+      cv::Mat mask = cv::Mat(_strip.mask.rows(), stripCols, CV_16UC1,
+                             const_cast<MaskPixelT*>(_strip.mask.data()))(roi);
+
+      // Transform from this tile to the low resolution basemap, as in _computeTileBoundsAndTransform
+      cv::Mat spatialTransform = _registration.clone();
+      spatialTransform.at<float>(0,0) = _basemapScale;
+      spatialTransform.at<float>(1,1) = _basemapScale;
+      spatialTransform.at<float>(0,2) = (_registration.at<float>(0,2) + info.pixelCol) * _basemapScale;
+      spatialTransform.at<float>(1,2) = (_registration.at<float>(1,2) + info.pixelRow) * _basemapScale;
+
+      std::vector<HrscColorPair> pairs;
+      if (collectColorPairs(_basemap, spatialTransform, _corrector, channels, mask,
+                            pairs, info.pixelRow) == 0)
+      {
+        printf("Failed to detect any color pairs in tile %d, %d!\n", info.tileRow, info.tileCol);
+        continue;
+      }
+
+      HrscTileColorInfo &colorInfo = _colorTiles[info.tileRow][info.tileCol];
+      if (!solveColorTransform(pairs, colorInfo.colorTransform))
+        continue;
+      if (!writeTransform(getColorTransformPath(_opt, info.tileRow, info.tileCol), colorInfo.colorTransform))
+        continue;
+      colorInfo.percentValid = info.percentValid;
+      colorInfo.valid        = true;
+    }
+  }
+
+private:
+  const TileStrip           &_strip;
+  const cv::Mat             &_basemap;
+  const cv::Mat             &_registration;
+  const double               _basemapScale;
+  const BrightnessCorrector &_corrector;
+  const Options             &_opt;
+  std::vector<std::vector<HrscTileColorInfo> > &_colorTiles;
+};
+
+
+/// Load one strip of the warped channels, compute its grassfire mask, and write the mask tiles.
+void loadStrip(const std::vector<HrscWarpedChannelView> &channels,
+               AndMaskGrassfireReader &grassfire,
+               const cartography::GeoReference &georef, const Options &opt,
+               const int tileRow, TileStrip &strip)
+{
+  const int numRows   = grassfire.rows();
+  const int numCols   = grassfire.cols();
+  const int numTilesX = (numCols + opt.tile_size - 1) / opt.tile_size;
+  strip.startRow = tileRow*opt.tile_size;
+  const BBox2i stripRoi(0, strip.startRow, numCols, std::min(opt.tile_size, numRows-strip.startRow));
+
+  // The strips are loaded in order so the grassfire rows come out in order too.
+  grassfire.readStrip(stripRoi.height(), strip.mask);
+  strip.channels.resize(NUM_HRSC_CHANNELS);
+  for (size_t c=0; c<NUM_HRSC_CHANNELS; ++c)
+    strip.channels[c] = crop(channels[c], stripRoi);
+
+  strip.tiles.resize(numTilesX);
+  for (int tileCol=0; tileCol<numTilesX; ++tileCol)
+  {
+    HrscTileInfo &info = strip.tiles[tileCol];
+    info.tileRow  = tileRow;
+    info.tileCol  = tileCol;
+    info.pixelRow = strip.startRow;
+    info.pixelCol = tileCol*opt.tile_size;
+    info.height   = stripRoi.height();
+    info.width    = std::min(opt.tile_size, numCols-info.pixelCol);
+
+    size_t validCount = 0;
+    for (int r=0; r<info.height; ++r)
+      for (int c=info.pixelCol; c<info.pixelCol+info.width; ++c)
+        if (strip.mask(c, r)[0] != 0)
+          ++validCount;
+    info.percentValid = static_cast<double>(validCount) /
+                        (static_cast<double>(info.height)*static_cast<double>(info.width));
+
+    // The mask tiles are always written, the same as tileHrscImages.
+    const std::string tilePath = getHrscTilePath(opt.mask_prefix, tileRow, tileCol);
+    block_write_gdal_image(tilePath, crop(strip.mask, info.pixelCol, 0, info.width, info.height),
+                           cartography::crop(georef, info.pixelCol, info.pixelRow));
+    writeTileMetadata(tilePath, info);
+  }
+}
+
+
+/// Write the new color image for each tile in a strip that has a color transform.
+void writeStripColorTiles(const TileStrip &strip,
+                          const BrightnessCorrector &corrector, const int numRows,
+                          const std::vector<std::vector<HrscTileColorInfo> > &colorTiles,
+                          const Options &opt, std::ofstream &tileList)
+{
+  // Place the strip buffers at their location in the full image so that the
+  //  color transform view can use full image coordinates.
+  const int numCols = strip.mask.cols();
+  const BBox2i fullRoi(0, -strip.startRow, numCols, numRows);
+  std::vector<HrscColorTransformView::ChannelViewT> channels(NUM_HRSC_CHANNELS);
+  for (size_t c=0; c<NUM_HRSC_CHANNELS; ++c)
+    channels[c] = crop(edge_extend(strip.channels[c], ZeroEdgeExtension()), fullRoi);
+  HrscColorTransformView::MaskViewT mask = crop(edge_extend(strip.mask, ZeroEdgeExtension()), fullRoi);
+
+  HrscColorTransformView colorImage(channels, mask, corrector, colorTiles, opt.tile_size);
+
+  for (size_t i=0; i<strip.tiles.size(); ++i)
+  {
+    const HrscTileInfo &info = strip.tiles[i];
+    const HrscTileColorInfo &colorInfo = colorTiles[info.tileRow][info.tileCol];
+    if (!colorInfo.valid)
+      continue;
+
+    const std::string outputPath = getNewColorPath(opt, info.tileRow, info.tileCol);
+    if (!write_opencv_rgb_image(outputPath,
+                                crop(colorImage, BBox2i(info.pixelCol, info.pixelRow, info.width, info.height))))
+      continue;
+
+    tileList << info.tileRow << ", " << info.tileCol << ", " << info.percentValid << ", "
+             << getColorTransformPath(opt, info.tileRow, info.tileCol) << ", " << outputPath << std::endl;
+  }
+}
+
+//--------------------------------------------------------
+
+// Handling input
+void handle_arguments( int argc, char *argv[], Options& opt ) {
+  size_t cache_size;
+  std::vector<std::string> positional_args;
+
+  po::options_description general_options("");
+  general_options.add_options()
+    ("t-srs",             po::value(&opt.proj4), "Output projection as a proj4 string.")
+    ("tr",                po::value(&opt.meters_per_pixel), "Output resolution in meters per pixel.")
+    ("threads",           po::value(&opt.num_threads)->default_value(boost::thread::hardware_concurrency()),
+                          "Number of threads to use for warping.")
+    ("basemap",           po::value(&opt.basemap_file), "The low resolution basemap region covering the HRSC image.")
+    ("registration",      po::value(&opt.registration_file), "Spatial transform from the HRSC image to the high resolution basemap.")
+    ("basemap-scale",     po::value(&opt.basemap_scale)->default_value(1.0),
+                          "High resolution meters per pixel divided by low resolution meters per pixel.")
+    ("brightness-gains",  po::value(&opt.brightness_file), "Brightness gains file for the whole image, at the low resolution.")
+    ("tile-folder",       po::value(&opt.tile_folder), "Folder to write the per-tile outputs to.")
+    ("mask-tile-prefix",  po::value(&opt.mask_prefix), "Path prefix for the mask tiles.")
+    ("tile-list",         po::value(&opt.tile_list_file), "Write the list of generated tiles to this file.")
+    ("transform-store",   po::value(&opt.transform_store), "Write the color transforms to this transform store instead of CSV files.")
+    ("tile-products",     po::value(&opt.tile_products),   "Write the new color tiles to this container instead of the tile folder.")
+    ("tile-size",         po::value(&opt.tile_size)->default_value(4096), "Size of the output tiles in pixels.")
+    ("min-percent-valid", po::value(&opt.min_percent_valid)->default_value(DEFAULT_MIN_PERCENT_VALID),
+                          "Tiles with a lower fraction of valid mask pixels are not color transformed.")
+    ("cache",             po::value(&cache_size)->default_value(1024), "Source data cache size, in megabytes.")
+    ("help,h",            "Display this help message");
+
+  po::options_description positional("");
+  positional.add_options()
+    ("input-files", po::value<std::vector<std::string> >(&positional_args));
+
+  po::positional_options_description positional_desc;
+  positional_desc.add("input-files", -1);
+
+  po::options_description all_options;
+  all_options.add(general_options).add(positional);
+
+  po::variables_map vm;
+  try {
+    po::store( po::command_line_parser( argc, argv ).options(all_options).positional(positional_desc).run(), vm );
+    po::notify( vm );
+  } catch (const po::error& e) {
+    vw_throw( ArgumentErr() << "Error parsing input:\n\t"
+              << e.what() << general_options );
+  }
+
+  std::ostringstream usage;
+  usage << "Usage: " << argv[0] << " [options] <HRSC channel>...\n"
+        << "  The channels must be passed in the order Red, Green, Blue, NIR, Nadir.\n";
+
+  if ( vm.count("help") )
+    vw_throw( ArgumentErr() << usage.str() << general_options );
+  if ( positional_args.size() != NUM_HRSC_CHANNELS )
+    vw_throw( ArgumentErr() << "Wrong number of input files!\n" << usage.str() << general_options );
+  if ( opt.proj4.empty() || !vm.count("tr") )
+    vw_throw( ArgumentErr() << "The output projection and resolution are required!\n" << usage.str() << general_options );
+  if ( opt.basemap_file.empty() || opt.registration_file.empty() || opt.brightness_file.empty() )
+    vw_throw( ArgumentErr() << "The basemap, registration, and brightness gains are required!\n" << usage.str() << general_options );
+  if ( opt.tile_folder.empty() || opt.mask_prefix.empty() || opt.tile_list_file.empty() )
+    vw_throw( ArgumentErr() << "The tile folder, mask tile prefix, and tile list are required!\n" << usage.str() << general_options );
+  if ( opt.num_threads < 1 )
+    opt.num_threads = 1;
+  opt.input_files = positional_args;
+
+  // Set the system cache size
+  vw_settings().set_system_cache_size( cache_size*1024*1024 );
+}
+
+
+
+int main( int argc, char *argv[] ) {
+
+  Options opt;
+  handle_arguments( argc, argv, opt );
+
+  // Load the small inputs first so that we fail before doing any work
+  const int LOAD_RGB = 1;
+  cv::Mat basemap, registration;
+  if (!readOpenCvImage(opt.basemap_file, basemap, LOAD_RGB))
+    return -1;
+  if (!readTransform(opt.registration_file, registration))
+    return -1;
+  BrightnessCorrector corrector;
+  if (!corrector.readProfileCorrection(opt.brightness_file))
+    return -1;
+
+  // The channels are warped to the output projection as their rows are read
+  HrscStripWarper warper(opt.input_files, opt.proj4, opt.meters_per_pixel, opt.num_threads);
+  const cartography::GeoReference &georef = warper.georef(0);
+  std::vector<HrscWarpedChannelView> channels;
+  std::vector<ImageViewRef<PixelT> > channelRefs;
+  for (size_t c=0; c<NUM_HRSC_CHANNELS; ++c)
+  {
+    channels.push_back(HrscWarpedChannelView(warper, c));
+    channelRefs.push_back(channels.back());
+  }
+
+  // The grassfire mask is computed one strip at a time along with the tiles
+  AndMaskGrassfireReader grassfire(channelRefs);
+
+  const int numRows   = grassfire.rows();
+  const int numCols   = grassfire.cols();
+  const int numTilesX = (numCols + opt.tile_size - 1) / opt.tile_size;
+  const int numTilesY = (numRows + opt.tile_size - 1) / opt.tile_size;
+  vw_out() << "Processing " << numTilesX*numTilesY << " tiles.\n";
+
+  corrector.resample(opt.basemap_scale, numRows);
+  std::vector<std::vector<HrscTileColorInfo> > colorTiles(numTilesY, std::vector<HrscTileColorInfo>(numTilesX));
+  std::ofstream tileList(opt.tile_list_file.c_str());
+
+  // Each strip is transformed one iteration after it is loaded, when the
+  //  color transforms of all its neighbors are available.
+  TileStrip strips[2];
+  TerminalProgressCallback progress("hrscImageEngine","Processing:");
+  for (int tileRow=0; tileRow<=numTilesY; ++tileRow)
+  {
+    if (tileRow < numTilesY)
+    {
+      TileStrip &strip = strips[tileRow % 2];
+      loadStrip(channels, grassfire, georef, opt, tileRow, strip);
+      warper.releaseRows(strip.startRow + opt.tile_size); // The strip holds its own copy
+      cv::parallel_for_(cv::Range(0, static_cast<int>(strip.tiles.size())),
+                        TileColorSolver(strip, basemap, registration, opt.basemap_scale,
+                                        corrector, opt, colorTiles));
+    }
+    if (tileRow > 0)
+    {
+      writeStripColorTiles(strips[(tileRow-1) % 2], corrector, numRows, colorTiles, opt, tileList);
+      progress.report_fractional_progress(tileRow, numTilesY);
+    }
+  }
+  progress.report_finished();
+
+  tileList.close();
+  if (tileList.fail())
+  {
+    printf("Failed to write the tile list %s\n", opt.tile_list_file.c_str());
+    return -1;
+  }
+  return 0;
+}
@@ -16,6 +16,11 @@ import MosaicUtilities
 import mosaicTileManager
 import solveHrscColor
 
+try:
+    import massupload # In-process versions of the C++ tools, built with BUILD_PYTHON_BINDINGS
+except ImportError:
+    massupload = None
+
 LOG_FORMAT_STR = '%(asctime)s %(name)s %(message)s'
 
 
@@ -38,13 +43,33 @@ def getTilePrefix(tileRow, tileCol):
     return (str(tileRow)+'_'+str(tileCol))
 
 
+def loadMaskStatistics(maskPath):
+    '''Loads the statistics sidecar file written by the C++ mask tools.
+       Returns None if the file is not present.'''
+    statsPath = maskPath + '.stats.json'
+    if not os.path.exists(statsPath):
+        return None
+    with open(statsPath, 'r') as f:
+        return json.load(f)
+
+def getTilePercentValid(maskStats, tileSize, tileRow, tileCol):
+    '''Look up the valid pixel percentage of a tile from loaded mask statistics.
+       Returns None if the statistics do not cover this tile.'''
+    if (not maskStats) or (maskStats['tileSize'] != tileSize):
+        return None
+    tileGrid = maskStats['tilePercentValid']
+    if (tileRow >= len(tileGrid)) or (tileCol >= len(tileGrid[tileRow])):
+        return None
+    return tileGrid[tileRow][tileCol]
+
 def generateTileInfoWrapper(funcParams):
     '''Simple wrapper function to pack all the inputs into one object'''
-    (fullPath, fileName, tileSize, metadataPath, force) = funcParams
-    return generateTileInfo(fullPath, fileName, tileSize, metadataPath, force)
+    (fullPath, fileName, tileSize, metadataPath, force, maskStats) = funcParams
+    return generateTileInfo(fullPath, fileName, tileSize, metadataPath, force, maskStats)
 
-def generateTileInfo(fullPath, fileName, tileSize, metadataPath, force=False):
-    '''Generates a metadata json file for an image tile'''
+def generateTileInfo(fullPath, fileName, tileSize, metadataPath, force=False, maskStats=None):
+    '''Generates a metadata json file for an image tile.
+       If mask statistics are provided they are used instead of counting pixels in the tile.'''
     
     # If the metadata is saved, just reload it.
     if (os.path.exists(metadataPath) and not force):
@@ -59,12 +84,13 @@ def generateTileInfo(fullPath, fileName, tileSize, metadataPath, force=False):
     pixelRow = tileRow * tileSize # In pixel coordinates relative to the original image
     pixelCol = tileCol * tileSize
     
-    # TODO: Counting the black pixels is a little slow, run this in parallel!
     # Get other tile information
     width, height   = IrgGeoFunctions.getImageSize(fullPath)
-    totalNumPixels  = height*width
-    blackPixelCount = MosaicUtilities.countBlackPixels(fullPath)
-    validPercentage = 1.0 - (float(blackPixelCount) / float(totalNumPixels))
+    validPercentage = getTilePercentValid(maskStats, tileSize, tileRow, tileCol)
+    if validPercentage is None: # Fall back to counting the pixels in the tile
+        totalNumPixels  = height*width
+        blackPixelCount = MosaicUtilities.countBlackPixels(fullPath)
+        validPercentage = 1.0 - (float(blackPixelCount) / float(totalNumPixels))
     
     thisTileInfo = {'path'        : fullPath,
                     'tileRow'     : tileRow,
@@ -84,71 +110,27 @@ def generateTileInfo(fullPath, fileName, tileSize, metadataPath, force=False):
     return thisTileInfo
     
 
-def splitImageGdal(imagePath, outputPrefix, tileSize, force=False, pool=None, maskList=[]):
-    '''gdal_translate based replacement for the ImageMagick convert based image split.
-       This function assumes that all relevant folders have been created.'''
+def getTileOutputPrefix(imagePath, outputFolder):
+    '''Returns the path prefix that all tiles split from an image share'''
+    filename = os.path.basename(imagePath)[:-4] # Strip extension
+    return os.path.join(outputFolder, filename + '_tile_')
 
-    # Compute the bounding box for each tile
-    inputImageSize    = IrgGeoFunctions.getImageSize(imagePath)
-    #print imagePath + ' is size ' + str(inputImageSize)
-    numTilesX = int(math.ceil(float(inputImageSize[0]) / float(tileSize)))
-    numTilesY = int(math.ceil(float(inputImageSize[1]) / float(tileSize)))
-    print 'Using gdal_translate to generate ' + str(int(numTilesX*numTilesY)) + ' tiles!'
-    
-    # Generate each of the tiles using GDAL
-    cmdList = []
-    for r in range(0,numTilesY):
-        for c in range(0,numTilesX):
-            
-            if maskList: # Make sure this tile is not completely masked out
-                # Find the info for the corresponding mask tile
-                # If the image is larger than the mask, there is a chance there will be no
-                #  mask tile for this image tile.  If so we can still skip the image tile,,
-                tilePrefix   = getTilePrefix(r, c)
-                maskTileInfo = [x for x in maskList if x['prefix'] == tilePrefix]
-                if not maskTileInfo or (maskTileInfo[0]['percentValid'] < MIN_TILE_PERCENT_PIXELS_VALID):
-                    continue
-            
-            # Get the pixel ROI for this tile
-            # - TODO: Use the Tiling class!
-            minCol = c*tileSize
-            minRow = r*tileSize
-            width  = tileSize
-            height = tileSize
-            if (minCol + width ) > inputImageSize[0]: width  = inputImageSize[0] - minCol
-            if (minRow + height) > inputImageSize[1]: height = inputImageSize[1] - minRow
-            totalNumPixels  = height*width
-            
-            # Generate the tile (console output suppressed)
-            thisPixelRoi = ('%d %d %d %d' % (minCol, minRow, width, height))
-            thisTilePath = outputPrefix + str(r) +'_'+ str(c) + '.tif'
-            cmd = MosaicUtilities.GDAL_TRANSLATE_PATH+' -q -srcwin ' + thisPixelRoi +' '+ imagePath +' '+ thisTilePath
-            if pool:
-                #print cmd
-                cmdList.append((cmd, thisTilePath, force))
-            else:
-                MosaicUtilities.cmdRunner(cmd, thisTilePath, force)
+def splitImagesNative(maskPath, maskFolder, imagePaths, imageFolders, tileSize, force=False):
+    '''Splits a mask and its matching images into tiles with a single call to the C++ tiler.
+       The tiler also writes the tile metadata files that collectTileInfo reads.'''
 
-    if pool:
-        # Pass all of these commands to a multiprocessing worker pool
-        print 'splitImageGdal is launching '+str(len(cmdList))+' gdalwarp threads...'
-        pool.map(MosaicUtilities.cmdRunnerWrapper, cmdList)
-            
-            
-            
+    maskPrefix = getTileOutputPrefix(maskPath, maskFolder)
+    cmd = ('./tileHrscImages --cache 4096 --tile-size ' + str(tileSize)
+           +' --min-percent-valid '+ str(MIN_TILE_PERCENT_PIXELS_VALID)
+           +' '+ maskPath +' '+ maskPrefix)
+    for (imagePath, imageFolder) in zip(imagePaths, imageFolders):
+        cmd += ' '+ imagePath +' '+ getTileOutputPrefix(imagePath, imageFolder)
+    MosaicUtilities.cmdRunner(cmd, maskPrefix + '0_0.tif', force)
 
-def splitImage(imagePath, outputFolder, tileSize=512, force=False, pool=None, maskList=[]):
-    '''Splits up an image into a grid of tiles and returns all the tile paths'''
-            
-    filename     = os.path.basename(imagePath)[:-4] # Strip extension
-    outputPrefix = os.path.join(outputFolder, filename + '_tile_')
+def collectTileInfo(imagePath, outputFolder, tileSize, force=False, pool=None, maskStats=None):
+    '''Returns the info for all of the tiles split from an image'''
 
-    # Skip tile creation if the first tile is present
-    # - May need to make the decision smarter later on
-    firstTilePath = outputPrefix + '0_0.tif'
-    splitImageGdal(imagePath, outputPrefix, tileSize, force, pool, maskList)
-    
-    print 'Finished splitting image, collecting tile information...'
+    filename = os.path.basename(imagePath)[:-4] # Strip extension
     
     # Build the list of output files
     outputTileInfoList = []
@@ -160,7 +142,7 @@ def splitImage(imagePath, outputFolder, tileSize=512, force=False, pool=None, ma
         thisPath = os.path.join(outputFolder, f)
         thisMetadataPath = thisPath + '_metadata.json' # Path to record the metadata to
         
-        funcParams = (thisPath, f, tileSize, thisMetadataPath, force)
+        funcParams = (thisPath, f, tileSize, thisMetadataPath, force, maskStats)
         if pool:
             cmdList.append(funcParams)
         else: # Go ahead and run the command
@@ -170,16 +152,58 @@ def splitImage(imagePath, outputFolder, tileSize=512, force=False, pool=None, ma
 
     if pool:
         # Pass all of these commands to a multiprocessing worker pool
-        print 'splitImage is launching '+str(len(cmdList))+' tile info generation threads...'
+        print 'collectTileInfo is launching '+str(len(cmdList))+' tile info generation threads...'
         outputTileInfoList = pool.map(generateTileInfoWrapper, cmdList)
 
 
     if len(outputTileInfoList) == 0:
-        raise Exception('splitImage: Failed to generate any image tiles!')
+        raise Exception('collectTileInfo: Failed to generate any image tiles!')
 
     return outputTileInfoList 
 
 
+def requireInProcessTools():
+    '''Raises an exception if USE_IN_PROCESS_TOOLS is set without the massupload module'''
+    if not massupload:
+        raise Exception('USE_IN_PROCESS_TOOLS requires the massupload module, build with BUILD_PYTHON_BINDINGS')
+
+# The basemap is shared by all the tiles of an HRSC image so each worker keeps the last one it loaded.
+inProcessBasemap = (None, None)
+
+def solveTileColorInProcess(args):
+    '''Computes the color transform of one tile with the massupload module without writing
+       out the color pairs.  args is (basemap path, tile info, force) so this can be used with a pool.'''
+    global inProcessBasemap
+    (basemapPath, tile, force) = args
+    if (MosaicUtilities.pathExists(tile['colorTransformPath'])) and not force:
+        return
+    if inProcessBasemap[0] != basemapPath:
+        inProcessBasemap = (basemapPath, massupload.read_image(basemapPath, 1))
+    channels  = [massupload.read_image(path) for path in tile['allChannelsString'].split()]
+    mask      = massupload.read_mask(tile['tileMaskPath'])
+    transform = massupload.read_transform(tile['spatialTransformToLowResBasePath'])
+    gain, offset = massupload.read_brightness_gains(tile['brightnessGainsPath'])
+    pairs = massupload.collect_color_pairs(inProcessBasemap[1], transform, gain, offset, channels, mask)
+    if len(pairs) == 0:
+        raise MosaicUtilities.CmdRunException('Failed to detect any color pairs for tile ' + tile['prefix'])
+    massupload.write_transform(tile['colorTransformPath'], massupload.solve_color_transform(pairs))
+
+def transformTileColorInProcess(args):
+    '''Writes the new color image of one tile with the massupload module.  args is
+       (tile info, main weight, [(adjacent transform path, weight, col offset, row offset),...])
+       so this can be used with a pool.'''
+    (tile, mainWeight, otherTilePaths) = args
+    otherTiles = [(massupload.read_transform(path), weight, colOffset, rowOffset)
+                  for (path, weight, colOffset, rowOffset) in otherTilePaths]
+    channels = [massupload.read_image(path) for path in tile['allChannelsString'].split()]
+    mask     = massupload.read_mask(tile['tileMaskPath'])
+    gain, offset = massupload.read_brightness_gains(tile['brightnessGainsPath'])
+    newColor = massupload.transform_hrsc_color(channels, mask, gain, offset,
+                                               massupload.read_transform(tile['colorTransformPath']),
+                                               mainWeight, otherTiles)
+    massupload.write_image(tile['newColorPath'], newColor)
+
+
 
 #=====================================================================================
 
@@ -195,8 +219,43 @@ CHANNEL_STRINGS = ['red', 'green', 'blue', 'nir', 'nadir']
 
 HRSC_HIGH_RES_TILE_SIZE = 4096
 
+# The new color tiles are only read back by the OpenCV tools, so they are written in the
+#  intermediate image format which is much faster to write and read than GeoTIFF.
+NEW_COLOR_TILE_EXTENSION = '.hrt'
+
 MIN_TILE_PERCENT_PIXELS_VALID = 0.0001 # Useful to have the tiles even with extremely few pixels!
 
+# The high resolution products are generated by exactly one of these pipelines:
+# - ENGINE:     A single call to hrscImageEngine warps, masks, and tiles the channels in memory
+#               and writes the color transform and new color image for each tile.
+# - TASK_GRAPH: warpHrscImages, bigMaskMakerGrassfire, and tileHrscImages write the warped
+#               channels and tiles, then the per-tile color steps run as a task graph with
+#               runTaskGraph so each tile moves on without waiting for the others.  The
+#               caller may defer the tile tasks and add its own tasks which depend on them.
+# - BATCH:      The same tools write the tiles, then each color step runs for every tile
+#               before the next one starts.  The new color tiles are written by one call to
+#               transformHrscImageStrip.
+HIGH_RES_PIPELINE_ENGINE     = 'engine'
+HIGH_RES_PIPELINE_TASK_GRAPH = 'taskGraph'
+HIGH_RES_PIPELINE_BATCH      = 'batch'
+# BATCH stays the default until the ENGINE tiles, masks, and metadata are shown to match it.
+HIGH_RES_PIPELINE = HIGH_RES_PIPELINE_BATCH
+
+# Run the registration and the per-tile color steps in this process with the massupload
+#  module instead of starting one C++ tool for each of them.  The module is built with
+#  BUILD_PYTHON_BINDINGS.
+# - This applies to every pipeline for the registration, but the per-tile color steps only
+#   run in this process with the BATCH pipeline, where it replaces transformHrscImageStrip.
+USE_IN_PROCESS_TOOLS = False
+
+# Store the per-tile spatial transforms, color transforms, and brightness gains for each
+#  HRSC image in one binary transform store instead of thousands of small CSV files.
+USE_TRANSFORM_STORE = True
+
+# Store the per-tile color pairs and new color images for each HRSC image in one
+#  container file instead of two files per tile.
+USE_TILE_PRODUCT_CONTAINER = True
+
 class HrscImage():
     '''
        Class to manage an input HRSC image.
@@ -229,6 +288,7 @@ class HrscImage():
         
         # Initialize some values to empty in case they are accessed prematurely
         self._tileDict = None #
+        self._tileTasks = [] # Per-tile tasks waiting to be run with runPendingTileTasks
         
         # Set up some paths
         self._setName    = setName
@@ -237,9 +297,10 @@ class HrscImage():
         self._hrscBasePathOut       = os.path.join(outputFolder, setName)
         self._tileFolder            = self._hrscBasePathOut + '_tiles'
         self._lowResMaskPath        = self._hrscBasePathOut + '_low_res_mask.tif'
-        self._highResBinaryMaskPath = self._hrscBasePathOut + '_high_res_binary_mask.tif'
         self._highResMaskPath       = self._hrscBasePathOut + '_high_res_mask.tif'
         self._brightnessGainsPath   = self._hrscBasePathOut + '_brightness_gains.csv'
+        self._transformStorePath    = self._hrscBasePathOut + '_transforms.hrc'
+        self._tileProductsPath      = self._hrscBasePathOut + '_tile_products.hrc'
         self._basemapCropPath       = self._hrscBasePathOut + '_local_cropped_basemap.tif' # A crop of the basemap used in several places
         self._basemapGrayCropPath = self._hrscBasePathOut + '_local_gray_cropped_basemap.tif'
         #self._colorPairPath       = self._hrscBasePathOut + '_low_res_color_pairs.csv'
@@ -269,7 +330,7 @@ class HrscImage():
             self._basemapInstance = basemapInstance
 
         # Record input parameters
-        self._basemapColorPath = self._basemapInstance.getColorBasemapPath() # Path to the color low res entire base map
+        self._basemapColorPath = self._basemapInstance.getColorBasemapReadPath() # Path to the color low res entire base map
         
 
 
@@ -324,10 +385,14 @@ class HrscImage():
         self._croppedRegionBoundingBoxDegrees.expand(CROP_BUFFER_LON, CROP_BUFFER_LAT)
         self._croppedRegionBoundingBoxPixels = self._basemapInstance.degreeRoiToPixelRoi(
                                                        self._croppedRegionBoundingBoxDegrees, False)
-        self._basemapInstance.makeCroppedRegionDegrees(self._croppedRegionBoundingBoxDegrees,
-                                                       self._basemapCropPath, force)
-                                                       
-        self._makeGrayscaleImage(self._basemapCropPath, self._basemapGrayCropPath)
+        if self._basemapInstance.hasMappedBasemap():
+            # Read the crops straight from the mapped basemap instead of writing them out
+            self._basemapCropPath     = self._basemapInstance.getCroppedRegionPath(self._croppedRegionBoundingBoxPixels)
+            self._basemapGrayCropPath = self._basemapInstance.getCroppedRegionPath(self._croppedRegionBoundingBoxPixels, True)
+        else:
+            self._basemapInstance.makeCroppedRegionDegrees(self._croppedRegionBoundingBoxDegrees,
+                                                           self._basemapCropPath, force)
+            self._makeGrayscaleImage(self._basemapCropPath, self._basemapGrayCropPath)
         
         # Compute the spatial registration from the HRSC image to the base map
         self._computeBaseSpatialRegistration(self._basemapInstance, lowResNadirPath, force)
@@ -370,55 +435,73 @@ class HrscImage():
         MosaicUtilities.cmdRunner(cmd, outputPath, force)
         
         
-    def prepHighResolutionProducts(self, force=False):
-        '''Generates all of the high resolution HRSC products'''
+    def prepHighResolutionProducts(self, force=False, deferTileTasks=False):
+        '''Generates all of the high resolution HRSC products.
+           If deferTileTasks is set and the TASK_GRAPH pipeline is used, the per-tile color
+           steps are not run until runPendingTileTasks is called so the caller can add tasks
+           which depend on them.  The other pipelines finish every tile before returning, so
+           hasPendingTileTasks is False afterwards.'''
         
         # TODO: Accept an input Degree region and only generate the tiles surrounding that region.
         
         # Convert each high res input image into the output format
+
+        # Drop the products replaced by earlier runs before any new ones are written
+        for containerPath in [self._transformStorePath, self._tileProductsPath]:
+            MosaicUtilities.compactContainer(containerPath)
         
-        # TODO: Could avoid this expensive step by handling the transform in the c++ programs
+        if HIGH_RES_PIPELINE not in [HIGH_RES_PIPELINE_ENGINE, HIGH_RES_PIPELINE_TASK_GRAPH,
+                                     HIGH_RES_PIPELINE_BATCH]:
+            raise Exception('Unknown high resolution pipeline: ' + str(HIGH_RES_PIPELINE))
+
+        if HIGH_RES_PIPELINE == HIGH_RES_PIPELINE_ENGINE:
+            self._runImageEngine(force)
+            print 'Finished generating high resolution content for HRSC image.'
+            return
+
         # Generate a copy of each input HRSC channel at the high output resolution
         print 'Generating high resolution warped channel images...'
         self._generateHighResWarpedPaths(force)
 
-        # Make a mask at the output resolution
-        # - This mask is actually pretty small on disk since it compresses so well.
-        print 'Generating high resolution binary mask...'
-        cmd = './bigMaskMaker -o ' + self._highResBinaryMaskPath +' '+ self._highResPathString
-        MosaicUtilities.cmdRunner(cmd, self._highResBinaryMaskPath, force)
-
-        # Now call another script to generate a mask with blending information
+        # Generate the grassfire blending mask at the output resolution
+        # - The binary mask is computed on the fly from the warped channels so it never
+        #   needs to be written to disk.
         print 'Generating high resolution grassfire mask...'
-        cmd = './bigMaskGrassfire --cache 4096 -o ' + self._highResMaskPath +' '+ self._highResBinaryMaskPath
-        MosaicUtilities.cmdRunner(cmd, self._highResMaskPath, force)        
+        cmd = ('./bigMaskMakerGrassfire --cache 4096 -o ' + self._highResMaskPath
+               +' '+ self._highResPathString)
+        MosaicUtilities.cmdRunner(cmd, self._highResMaskPath, force)
         self._highResPathStringAndMask = self._highResPathString +' '+ self._highResMaskPath
 
 
         # Split the image up into tiles at the full output resolution       
         # - There is one list of tiles per HRSC channel
         # - Each channel gets its own subfolder
-        # - Due to ImageMagick's implementation this step is already multithreaded!
         print 'Splitting warped images into tiles...'
         self._tileFolder = os.path.join(os.path.dirname(self._hrscBasePathOut), 'tiles') 
         if not os.path.exists(self._tileFolder):
                 os.mkdir(self._tileFolder)
                 
-        # Break up the mask image into tiles first
-        maskTileList = splitImage(self._highResMaskPath, self._tileFolder, HRSC_HIGH_RES_TILE_SIZE,
-                                  force=force, pool=self._threadPool)
-                
-        tileInfoLists = [[], [], [], [], []] # One list per channel
+        channelOutputFolders = []
         for c in range(NUM_HRSC_CHANNELS):
-            # Get the info for this channel
-            warpedPath    = self._highResWarpedPaths[c]
-            channelString = CHANNEL_STRINGS[c]
-            
-            # Write all the tiles to a folder and get the info list for those tiles
-            channelOutputFolder = os.path.join(self._tileFolder, channelString)
+            # - Each channel gets its own subfolder
+            channelOutputFolder = os.path.join(self._tileFolder, CHANNEL_STRINGS[c])
             if not os.path.exists(channelOutputFolder):
                 os.mkdir(channelOutputFolder)
-            tileInfoLists[c] = splitImage(warpedPath, channelOutputFolder, HRSC_HIGH_RES_TILE_SIZE, force=force, pool=self._threadPool, maskList=maskTileList)
+            channelOutputFolders.append(channelOutputFolder)
+
+        # The mask statistics are used for all the tiles since the mask is the AND of the channels.
+        maskStats = loadMaskStatistics(self._highResMaskPath)
+
+        # Write the mask and channel tiles plus their metadata in one pass
+        tileInfoLists = [[], [], [], [], []] # One list per channel
+        splitImagesNative(self._highResMaskPath, self._tileFolder, self._highResWarpedPaths,
+                          channelOutputFolders, HRSC_HIGH_RES_TILE_SIZE, force)
+        maskTileList = collectTileInfo(self._highResMaskPath, self._tileFolder, HRSC_HIGH_RES_TILE_SIZE,
+                                       pool=self._threadPool, maskStats=maskStats)
+        for c in range(NUM_HRSC_CHANNELS):
+            tileInfoLists[c] = collectTileInfo(self._highResWarpedPaths[c], channelOutputFolders[c],
+                                               HRSC_HIGH_RES_TILE_SIZE, pool=self._threadPool,
+                                               maskStats=maskStats)
 
 
         # Verify that each channel generated the same number of tiles
@@ -460,13 +543,13 @@ class HrscImage():
             # Set up paths for the files we will generate for this tile
             filePrefix       = 'tile_' + thisTileInfo['prefix']
             tileInfoBasePath = os.path.join(self._tileFolder, filePrefix)
-            thisTileInfo['colorPairPath'           ] = tileInfoBasePath+'_color_pairs.csv'
-            thisTileInfo['colorTransformPath'      ] = tileInfoBasePath+'_color_transform.csv'
-            thisTileInfo['newColorPath'            ] = tileInfoBasePath+'_new_color.tif'
-            thisTileInfo['brightnessGainsPath'     ] = tileInfoBasePath+'_brightness_gains.csv'
+            thisTileInfo['colorPairPath'           ] = self._getTileProductPath(thisTileInfo, 'color_pairs.csv')
+            thisTileInfo['colorTransformPath'      ] = self._getTileTransformPath(thisTileInfo, 'color_transform')
+            thisTileInfo['newColorPath'            ] = self._getTileProductPath(thisTileInfo, 'new_color'+NEW_COLOR_TILE_EXTENSION)
+            thisTileInfo['brightnessGainsPath'     ] = self._getTileTransformPath(thisTileInfo, 'brightness_gains')
             thisTileInfo['tileMaskPath'            ] = tileInfoBasePath+'_tile_mask.tif'
             #thisTileInfo['lonlatBounds'            ] = None # The data we have is incorrect at this point.
-            thisTileInfo['spatialTransformToLowResBasePath'   ] = tileInfoBasePath+'_spatial_transform_to_low_res_base.csv'
+            thisTileInfo['spatialTransformToLowResBasePath'   ] = self._getTileTransformPath(thisTileInfo, 'spatial_transform_to_low_res_base')
             
             thisTileInfo['stillValid'] = True # Set this to false if there is an error processing this tile
             
@@ -485,6 +568,16 @@ class HrscImage():
         # Generate a "personalized" brightness file for each tile
         self._splitScaleBrightnessGains(self._brightnessGainsPath, self._tileDict, force)
 
+        if HIGH_RES_PIPELINE == HIGH_RES_PIPELINE_TASK_GRAPH:
+            self._tileTasks = self._buildTileTasks(self._tileDict)
+            if not deferTileTasks:
+                self.runPendingTileTasks(force=force)
+                for tile in self._tileDict.itervalues():
+                    if not MosaicUtilities.pathExists(tile['newColorPath']):
+                        raise MosaicUtilities.CmdRunException('Failed to create output file: ' + tile['newColorPath'])
+            print 'Finished generating high resolution content for HRSC image.'
+            return
+
         # Generate the color transform for each tile
         print 'Generating color transforms...'
         self._generateColorTransforms(force)
@@ -496,12 +589,116 @@ class HrscImage():
         print 'Finished generating high resolution content for HRSC image.'
         
         
+    def _runImageEngine(self, force=False):
+        '''Generates the high resolution tiles and their color transforms with hrscImageEngine'''
+
+        self._tileFolder = os.path.join(os.path.dirname(self._hrscBasePathOut), 'tiles')
+        if not os.path.exists(self._tileFolder):
+            os.mkdir(self._tileFolder)
+
+        # The engine warps the channels in memory and never writes the full size
+        #  warped channels or mask, only the mask tiles.
+        metersPerPixel = self._basemapInstance.getHighResMpp()
+        scaling        = metersPerPixel / self._basemapInstance.getLowResMpp()
+        maskPrefix     = getTileOutputPrefix(self._highResMaskPath, self._tileFolder)
+        tileListPath   = self._hrscBasePathOut + '_color_tile_list.csv'
+        cmd = ('./hrscImageEngine --cache 4096 --t-srs "'+self._basemapInstance.getProj4String()+'"'
+               +' --tr '+ str(metersPerPixel) +' --tile-size '+ str(HRSC_HIGH_RES_TILE_SIZE)
+               +' --min-percent-valid '+ str(MIN_TILE_PERCENT_PIXELS_VALID)
+               +' --basemap '+ self._basemapColorPath +' --registration '+ self._highResSpatialRegistrationPath
+               +' --basemap-scale '+ str(scaling) +' --brightness-gains '+ self._brightnessGainsPath
+               +' --tile-folder '+ self._tileFolder +' --mask-tile-prefix '+ maskPrefix
+               +' --tile-list '+ tileListPath)
+        if USE_TRANSFORM_STORE:
+            cmd += ' --transform-store '+ self._transformStorePath
+        if USE_TILE_PRODUCT_CONTAINER:
+            cmd += ' --tile-products '+ self._tileProductsPath
+        for path in self._inputHrscPaths:
+            cmd += ' '+ path
+        MosaicUtilities.cmdRunner(cmd, tileListPath, force)
+
+        # Only the tiles in the list got a color transform
+        finishedTiles = set()
+        with open(tileListPath, 'r') as f:
+            for line in f:
+                parts = line.split(',')
+                finishedTiles.add(getTilePrefix(int(parts[0]), int(parts[1])))
+
+        # The engine writes the same mask tile metadata as the native tiler
+        maskTileList = collectTileInfo(self._highResMaskPath, self._tileFolder, HRSC_HIGH_RES_TILE_SIZE)
+        self._tileDict = {}
+        for thisTileInfo in maskTileList:
+            if thisTileInfo['prefix'] not in finishedTiles:
+                continue
+            thisTileInfo['tileMaskPath'      ] = thisTileInfo['path']
+            thisTileInfo['colorTransformPath'] = self._getTileTransformPath(thisTileInfo, 'color_transform')
+            thisTileInfo['newColorPath'      ] = self._getTileProductPath(thisTileInfo, 'new_color'+NEW_COLOR_TILE_EXTENSION)
+            thisTileInfo['spatialTransformToLowResBasePath'] = self._getTileTransformPath(thisTileInfo, 'spatial_transform_to_low_res_base')
+            thisTileInfo['stillValid'] = True
+            self._computeTileBoundsAndTransform(thisTileInfo, force)
+            self._tileDict[thisTileInfo['prefix']] = thisTileInfo
+        print 'Generated ' +str(len(self._tileDict))+ ' tiles.'
+        
+        
+    def hasPendingTileTasks(self):
+        '''Returns True if prepHighResolutionProducts left tile tasks for runPendingTileTasks'''
+        return len(self._tileTasks) > 0
+
+    def runPendingTileTasks(self, extraTasks=[], force=False):
+        '''Runs the deferred per-tile tasks together with tasks from the caller.
+           - extraTasks is a list of (taskId, dependencyIdList, outputPath, cmd) tuples which may
+             depend on the 'taskId' of any tile.
+           - Commands with an output path are skipped if it exists unless force is set.
+           Returns a dictionary of task id to True if the task succeeded.'''
+
+        graphPath = self._hrscBasePathOut + '_task_graph.txt'
+        numThreads = multiprocessing.cpu_count()
+        taskStatus = MosaicUtilities.runTaskGraph(self._tileTasks + extraTasks, graphPath, numThreads, force)
+        self._tileTasks = []
+        return taskStatus
+
+    def takePendingTileTasks(self):
+        '''Returns the deferred per-tile tasks so the caller can run them in its own task graph'''
+        tasks = self._tileTasks
+        self._tileTasks = []
+        return tasks
+
+    def _buildTileTasks(self, tileDict):
+        '''Builds the color pair, color solve, and color transform tasks for every tile.
+           The id of the last task for each tile is stored under 'taskId'.
+           Task ids start with the set name so several images can share one graph.'''
+
+        # The pairs and solve steps for each tile only depend on that tile
+        tasks = []
+        for tile in tileDict.itervalues():
+            pairsId = self._setName + '_pairs_' + tile['prefix']
+            cmd = ('./writeHrscColorPairs ' + self._basemapColorPath +' '+ tile['allChannelsStringAndMask']
+                   +' '+ tile['spatialTransformToLowResBasePath'] +' '+ tile['brightnessGainsPath'] +' '+ tile['colorPairPath'])
+            tasks.append((pairsId, [], tile['colorPairPath'], cmd))
+
+            cmd = 'python solveHrscColor.py ' + tile['colorTransformPath'] +' '+ tile['colorPairPath']
+            tasks.append((self._setName + '_solve_' + tile['prefix'], [pairsId], tile['colorTransformPath'], cmd))
+
+        # The color transform blends in the transforms of the adjacent tiles
+        for tile in tileDict.itervalues():
+            if not tile['stillValid']:
+                continue
+            adjacentTiles = self._getAdjacentTiles(tile, tileDict)
+            dependencies  = [self._setName + '_solve_' + t['prefix'] for t in ([tile] + adjacentTiles)]
+            tile['taskId'] = self._setName + '_color_' + tile['prefix']
+            tasks.append((tile['taskId'], dependencies, tile['newColorPath'],
+                          self._getNewColorCmd(tile, adjacentTiles)))
+        return tasks
+
     def _generateColorTransforms(self, force=False):
         '''Generate the color transform for each tile'''
         # - HRSC colors are written with the brightness correction already applied
         # - Color pairs are computed between the high resolution HRSC tile and the low resolution input basemap.
         # - This is done in two loops to enable use of the thread pool
         
+        if USE_IN_PROCESS_TOOLS:
+            return self._generateColorTransformsInProcess(force)
+
         # Generate a set of color pairs
         cmdList = []
         for tile in self._tileDict.itervalues():
@@ -519,10 +716,22 @@ class HrscImage():
         # - This is pretty fast so the thread pool is not as important
         for tile in self._tileDict.itervalues():
             
-            if (not os.path.exists(tile['colorTransformPath'])) or force:
+            if (not MosaicUtilities.pathExists(tile['colorTransformPath'])) or force:
                 solveHrscColor.solveTransform([tile['colorPairPath']], tile['colorTransformPath'])
         
         
+    def _generateColorTransformsInProcess(self, force=False):
+        '''Generate the color transform for each tile without writing out the color pairs'''
+
+        requireInProcessTools()
+        argList = [(self._basemapColorPath, tile, force) for tile in self._tileDict.itervalues()]
+        if self._threadPool:
+            self._threadPool.map(solveTileColorInProcess, argList)
+        else:
+            for args in argList:
+                solveTileColorInProcess(args)
+        
+        
     def _getWarpToProjectionCmd(self, sourcePath, outputFolder, postfix, metersPerPixel):
         '''Get the command needed by _warpToProjection'''
         
@@ -544,26 +753,19 @@ class HrscImage():
     
         
     def _generateHighResWarpedPaths(self, force):
-        '''Generate all of the high resolution warped HRSC images using multiple threads'''
+        '''Generate all of the high resolution warped HRSC images with one call to warpHrscImages'''
     
-        if self._threadPool:
-            print 'Launching multiple gdalwarp threads...'
-            
-            # For each path, make the command line call we want executed.
-            cmdList = []
-            self._highResWarpedPaths = []
-            for path in self._inputHrscPaths:
-                warpCmd, warpedPath = self._getWarpToProjectionCmd(path, self._outputFolder,
-                                                                   '_output_res', self._basemapInstance.getHighResMpp())
-                cmdList.append((warpCmd, warpedPath, force))
-                self._highResWarpedPaths.append(warpedPath)
-            # Pass all of these commands to a multiprocessing worker pool
-            self._threadPool.map(MosaicUtilities.cmdRunnerWrapper, cmdList)
-        
-        else: # No pool, run single threaded.
-            self._highResWarpedPaths = [self._warpToProjection(path, self._outputFolder, '_output_res', 
-                                                      self._basemapInstance.getHighResMpp(), force)
-                               for path in self._inputHrscPaths]        
+        # Warp all of the channels in one call, sharing the projection computations.
+        metersPerPixel = self._basemapInstance.getHighResMpp()
+        cmd = ('./warpHrscImages --cache 2048 --t-srs "'+self._basemapInstance.getProj4String()+'"'
+               +' --tr '+ str(metersPerPixel))
+        self._highResWarpedPaths = []
+        for path in self._inputHrscPaths:
+            warpCmd, warpedPath = self._getWarpToProjectionCmd(path, self._outputFolder,
+                                                               '_output_res', metersPerPixel)
+            cmd += ' '+ path +' '+ warpedPath
+            self._highResWarpedPaths.append(warpedPath)
+        MosaicUtilities.cmdRunner(cmd, self._highResWarpedPaths[-1], force)
         
         # Build up a string containing all the high res paths for convenience
         self._highResPathString = ''
@@ -655,6 +857,13 @@ class HrscImage():
         '''Writes an estimated registration transform to a file based on geo metadata.'''
         # This function assumes the images are in the same projection system!
         
+        # A crop of the mapped basemap has no metadata, use the full basemap and shift by the crop offset
+        cropOffset = (0, 0)
+        if MosaicUtilities.isBasemapCropPath(baseImage):
+            baseImage  = self._basemapInstance.getColorBasemapPath()
+            cropOffset = (int(round(self._croppedRegionBoundingBoxPixels.minX)),
+                          int(round(self._croppedRegionBoundingBoxPixels.minY)))
+
         # Get the projection bounds and size in both images
         baseGeoInfo     = IrgGeoFunctions.getImageGeoInfo(baseImage,  False)
         otherGeoInfo    = IrgGeoFunctions.getImageGeoInfo(otherImage, False)
@@ -665,6 +874,7 @@ class HrscImage():
             
         # Now estimate the bounding box of the other image in the base image
         topLeftCoord = projCoordToPixelCoord(otherProjBounds[0], otherProjBounds[3], baseGeoInfo)
+        topLeftCoord = (topLeftCoord[0] - cropOffset[0], topLeftCoord[1] - cropOffset[1])
         
         transform = MosaicUtilities.SpatialTransform()
         transform.setShift(topLeftCoord[0], topLeftCoord[1])
@@ -687,6 +897,23 @@ class HrscImage():
         tf.setShift(rectangle.minX, rectangle.minY)
         tf.write(outputPath)
     
+    def _registerInProcess(self, hrscPath, estimatedTransformPath, force=False):
+        '''Computes the same registration as RegisterHrsc with the massupload module'''
+
+        outputPath = self._lowResSpatialCroppedRegistrationPath
+        if MosaicUtilities.pathExists(outputPath) and not force:
+            return
+        requireInProcessTools()
+        basemap   = massupload.read_image(self._basemapGrayCropPath, 0)
+        hrsc      = massupload.read_image(hrscPath, 0)
+        estimated = massupload.read_transform(estimatedTransformPath)
+        (transform, numInliers) = massupload.register_hrsc(basemap, hrsc, estimated, 1.0,
+                                                           os.path.dirname(os.path.abspath(outputPath)) + '/')
+        if transform is None:
+            raise MosaicUtilities.CmdRunException('Failed to register HRSC image ' + hrscPath)
+        self._logger.info('Computed transform with ' + str(numInliers) + ' inliers.')
+        massupload.write_transform(outputPath, transform)
+
     def _computeBaseSpatialRegistration(self, basemapInstance, hrscPath, force=False):
         '''Compute the spatial registration from the HRSC image to the base image'''
     
@@ -698,17 +925,25 @@ class HrscImage():
         # TODO: Check the number of inliers!    
         # Refine the spatial transform using image data
         # - This is computed to the low resolution cropped image
-        cmd = ('./RegisterHrsc ' + self._basemapGrayCropPath +' '+ hrscPath
-               +' '+ self._lowResSpatialCroppedRegistrationPath +' '+ str(1.0) +' '+ estimatedCroppedTransformPath)
-        MosaicUtilities.cmdRunner(cmd, self._lowResSpatialCroppedRegistrationPath, force)
+        if USE_IN_PROCESS_TOOLS:
+            self._registerInProcess(hrscPath, estimatedCroppedTransformPath, force)
+        else:
+            cmd = ('./RegisterHrsc ' + self._basemapGrayCropPath +' '+ hrscPath
+                   +' '+ self._lowResSpatialCroppedRegistrationPath +' '+ str(1.0) +' '+ estimatedCroppedTransformPath)
+            MosaicUtilities.cmdRunner(cmd, self._lowResSpatialCroppedRegistrationPath, force)
 
 
         # TODO: Fix bug here, probably caused by 8 bit mask depth.
         # DEBUG - Paste the low resolution aligned images so we can evaluate the registration
         registrationDebugImagePath = self._hrscBasePathOut + '_registration_debug_mosaic.tif'
-        cmd = ('./hrscMosaic ' + self._basemapGrayCropPath +' '+ registrationDebugImagePath +' '+ hrscPath +' '+
-                                  self._lowResMaskPath +' '+ self._lowResSpatialCroppedRegistrationPath)
-        MosaicUtilities.cmdRunner(cmd, registrationDebugImagePath, force)
+        if USE_IN_PROCESS_TOOLS:
+            if force or not MosaicUtilities.pathExists(registrationDebugImagePath):
+                massupload.mosaic_tile(self._basemapGrayCropPath, registrationDebugImagePath,
+                                       [(hrscPath, self._lowResMaskPath, self._lowResSpatialCroppedRegistrationPath)])
+        else:
+            cmd = ('./hrscMosaic ' + self._basemapGrayCropPath +' '+ registrationDebugImagePath +' '+ hrscPath +' '+
+                                      self._lowResMaskPath +' '+ self._lowResSpatialCroppedRegistrationPath)
+            MosaicUtilities.cmdRunner(cmd, registrationDebugImagePath, force)
 
 
         # Load the transform we just computed and convert it to a bounding box
@@ -727,6 +962,18 @@ class HrscImage():
         self._hrscBoundingBoxDegrees = basemapInstance.pixelRoiToDegreeRoi(highResPixelRoi, True)
 
     
+    def _getTileTransformPath(self, tileInfo, product):
+        '''Returns the path of a per-tile transform or brightness gains file'''
+        if USE_TRANSFORM_STORE:
+            return MosaicUtilities.getTransformStorePath(self._transformStorePath, tileInfo['prefix'], product)
+        return os.path.join(self._tileFolder, 'tile_' + tileInfo['prefix']) + '_' + product + '.csv'
+
+    def _getTileProductPath(self, tileInfo, product):
+        '''Returns the path of a per-tile color pair file or new color image'''
+        if USE_TILE_PRODUCT_CONTAINER:
+            return MosaicUtilities.getTileProductPath(self._tileProductsPath, tileInfo['prefix'], product)
+        return os.path.join(self._tileFolder, 'tile_' + tileInfo['prefix']) + '_' + product
+
     def _computeTileBoundsAndTransform(self, tileInfo, force=False):
         '''Compute boundary and transform information for this high resolution tile'''
 
@@ -755,8 +1002,13 @@ class HrscImage():
         tf.setShift(minHighResCol*scaling,
                     minHighResRow*scaling)
         
-        # Write out the new transform
-        tf.write(tileInfo['spatialTransformToLowResBasePath'])
+        # Write out the new transform whenever it changed, such as after a new registration.
+        # - An unchanged transform is not written again since that would add another record
+        #   to the transform store.
+        outputPath = tileInfo['spatialTransformToLowResBasePath']
+        if (force or not MosaicUtilities.pathExists(outputPath) or
+                not tf.isClose(MosaicUtilities.SpatialTransform(outputPath))):
+            tf.write(outputPath)
    
 
     
@@ -776,7 +1028,7 @@ class HrscImage():
         for tile in tileDict.itervalues():
             
             outputPath = tile['brightnessGainsPath']
-            if not force and os.path.exists(outputPath):
+            if not force and MosaicUtilities.pathExists(outputPath):
                 continue
             
             # Compute the row range in the input tile
@@ -801,9 +1053,62 @@ class HrscImage():
             zeroCol      = [0 for i in thisTileVals]
                 
             # Write out the interpolated values
-            numpy.savetxt(outputPath, thisTileVals, header=str(tileHeight),  fmt='%1.6f, 0.0', comments='')  
+            if MosaicUtilities.isBinaryMatrixPath(outputPath):
+                MosaicUtilities.writeBinaryMatrix(outputPath, [[v, 0.0] for v in thisTileVals],
+                                                  MosaicUtilities.MATRIX_KIND_PROFILE)
+            else:
+                numpy.savetxt(outputPath, thisTileVals, header=str(tileHeight),  fmt='%1.6f, 0.0', comments='')
+
+
+    def _generateNewHrscColorTilesInProcess(self, tileDict, force=False):
+        '''Generate a new color image for each HRSC tile without starting a process per tile'''
+
+        requireInProcessTools()
+        argList = []
+        for tile in tileDict.itervalues():
+            if not tile['stillValid'] or (MosaicUtilities.pathExists(tile['newColorPath']) and not force):
+                continue
+
+            # Weight the adjacent tiles by their pixel count, the same as for transformHrscImageColor
+            adjacentTiles = self._getAdjacentTiles(tile, tileDict)
+            totalWeight   = 1.0
+            for adjTile in adjacentTiles:
+                totalWeight += (adjTile['percentValid'] / tile['percentValid'])
+            otherTiles = []
+            for adjTile in adjacentTiles:
+                tileWeight = (adjTile['percentValid'] / tile['percentValid']) / totalWeight
+                otherTiles.append((adjTile['colorTransformPath'], tileWeight,
+                                   adjTile['tileCol'] - tile['tileCol'], adjTile['tileRow'] - tile['tileRow']))
+            argList.append((tile, 1.0/totalWeight, otherTiles))
+
+        if self._threadPool:
+            self._threadPool.map(transformTileColorInProcess, argList)
+        else:
+            for args in argList:
+                transformTileColorInProcess(args)
 
 
+    def _getNewColorCmd(self, tile, adjacentTiles):
+        '''Returns the transformHrscImageColor command for a tile given its adjacent tiles'''
+
+        # Compute a weighting for each tile based on the pixel count
+        totalWeight = 1.0 # The main image is the reference so it has weight 1 initially
+        for adjTile in adjacentTiles:
+            totalWeight += (adjTile['percentValid'] / tile['percentValid'])
+
+        # Generate the parameter sequence for the next program call
+        adjacentTileString = ''
+        for adjTile in adjacentTiles:
+            tileWeight     = (adjTile['percentValid'] / tile['percentValid']) / totalWeight
+            thisTileString = adjTile['colorTransformPath'] +' '+ str(tileWeight) +' '+ str(adjTile['colOffset']) +' '+ str(adjTile['rowOffset'])
+            adjacentTileString += (thisTileString + ' ')
+        mainWeight = 1.0/totalWeight # Normalize the main weight too
+
+        # Transform the HRSC image color
+        # - Brightness correction is applied before color transform
+        return ('./transformHrscImageColor ' + tile['allChannelsStringAndMask'] +' '+ tile['brightnessGainsPath'] +' '+ tile['newColorPath'] +' '+
+                                               tile['colorTransformPath'] +' '+ str(mainWeight) +' '+ adjacentTileString)
+
     def _getAdjacentTiles(self, tile, tileDict):
         '''Gets a list containing all the (still valid) tiles which are adjacent to the provided tile'''
         
@@ -829,47 +1134,40 @@ class HrscImage():
         return adjacentTileList    
     
     
+    def _generateNewHrscColorTilesStrip(self, tileDict, force=False):
+        '''Generate the new color image for all the HRSC tiles with one call to transformHrscImageStrip'''
+
+        # List every valid tile so it can contribute to the blending of its neighbors,
+        #  but only request output for the tiles that still need it.
+        tileListPath = self._hrscBasePathOut + '_color_tile_list.csv'
+        numOutputTiles = 0
+        with open(tileListPath, 'w') as f:
+            for tile in tileDict.itervalues():
+                if not tile['stillValid']:
+                    continue
+                outputPath = ''
+                if force or not MosaicUtilities.pathExists(tile['newColorPath']):
+                    outputPath = tile['newColorPath']
+                    numOutputTiles += 1
+                f.write('%d, %d, %f, %s, %s\n' % (tile['tileRow'], tile['tileCol'], tile['percentValid'],
+                                                  tile['colorTransformPath'], outputPath))
+        if numOutputTiles == 0:
+            return
+
+        # - Brightness correction is applied before color transform
+        scaling = self._basemapInstance.getHighResMpp() / self._basemapInstance.getLowResMpp()
+        cmd = ('./transformHrscImageStrip --cache 4096 --tile-size ' + str(HRSC_HIGH_RES_TILE_SIZE)
+               +' --brightness-gains '+ self._brightnessGainsPath +' --brightness-scale '+ str(scaling)
+               +' --tile-list '+ tileListPath +' '+ self._highResPathStringAndMask)
+        MosaicUtilities.cmdRunner(cmd, None, force)
+        for tile in tileDict.itervalues():
+            if tile['stillValid'] and not MosaicUtilities.pathExists(tile['newColorPath']):
+                raise MosaicUtilities.CmdRunException('Failed to create output file: ' + tile['newColorPath'])
+
+
     def _generateNewHrscColorTiles(self, tileDict, force=False):
         '''Generate a new color image for each HRSC tile'''
 
-        # Make one pass through all the tiles just to generate the required commands
-        tileCommandList = []
-        for tile in self._tileDict.itervalues():
-            
-            if not tile['stillValid']: # Skip tiles which have already failed
-                return False
-
-            #try:
-            # Get a list of adjacent tiles to pass in to the color transformer
-            adjacentTiles = self._getAdjacentTiles(tile, tileDict)
-            
-            # Compute a weighting for each tile based on the pixel count
-            totalWeight = 1.0 # The main image is the reference so it has weight 1 initially
-            for adjTile in adjacentTiles:
-                totalWeight += (adjTile['percentValid'] / tile['percentValid'])
-                
-            # Generate the parameter sequence for the next program call
-            adjacentTileString = ''
-            for adjTile in adjacentTiles:
-                tileWeight     = (adjTile['percentValid'] / tile['percentValid']) / totalWeight
-                thisTileString = adjTile['colorTransformPath'] +' '+ str(tileWeight) +' '+ str(adjTile['colOffset']) +' '+ str(adjTile['rowOffset'])
-                adjacentTileString += (thisTileString + ' ')
-            mainWeight = 1.0/totalWeight # Normalize the main weight too
-            
-            # Transform the HRSC image color
-            # - Brightness correction is applied before color transform
-            cmd = ('./transformHrscImageColor ' + tile['allChannelsStringAndMask'] +' '+ tile['brightnessGainsPath'] +' '+ tile['newColorPath'] +' '+
-                                                  tile['colorTransformPath'] +' '+ str(mainWeight) +' '+ adjacentTileString
-                                                  )
-            tileCommandList.append((cmd, tile['newColorPath'], force))
-            #except CmdRunException:
-            #    tile['stillValid'] = False
-        
-        # Make a second pass to execute the commands
-        # - Doing this in two passes lets us easily utilize a thread pool.
-        
-        if self._threadPool: # Dispatch the commands to the worker pool
-            self._threadPool.map(MosaicUtilities.cmdRunnerWrapper, tileCommandList)
-        else: # Run the commands one after the other
-            for command in tileCommandList:
-                MosaicUtilities.cmdRunnerWrapper(command)
+        if USE_IN_PROCESS_TOOLS:
+            return self._generateNewHrscColorTilesInProcess(tileDict, force)
+        return self._generateNewHrscColorTilesStrip(tileDict, force)
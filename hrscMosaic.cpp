@@ -33,9 +33,6 @@
 // TODO: Increase this as we increase the resolution!
 const int BLEND_DIST_GLOBAL = 256;
 
-// Set this to use the simple, no blending mosaic method.
-const bool FORCE_SIMPLE_PASTE = false;
-
 //=============================================================
 
 
@@ -527,299 +524,60 @@ bool pasteImagesFeather(const             cv::Mat  &baseImage,
 //==================================================================================================
 
 
-
-/// Load one of the HRSC images
-bool loadInputImage(int argc, char** argv,
-                     cv::Mat &hrscImage,
-                     cv::Mat &hrscMask,
-                     cv::Mat &spatialTransform,
-                     const int imageToLoad)
-{
-  // Parse the input arguments
-  const size_t numHrscImages = (argc - 3)/3;
-  std::vector<std::string> hrscPaths(numHrscImages),
-                           hrscMaskPaths(numHrscImages),
-                           spatialTransformPaths(numHrscImages);
-
-  // Pick out the three arguments for each input image
-  for (size_t i=0; i<numHrscImages; ++i)
-  {
-    hrscPaths[i]             = argv[3 + 3*i];
-    hrscMaskPaths[i]         = argv[4 + 3*i];
-    spatialTransformPaths[i] = argv[5 + 3*i];
-  }
-
-  const int LOAD_GRAY = 0;
-  const int LOAD_RGB  = 1;
-  
-  
-  // Load all of the HRSC images and their spatial transforms
-  cv::Mat tempTransform;
-  int i = imageToLoad;
-    
-  if (!readOpenCvImage(hrscPaths[i], hrscImage, LOAD_RGB))
-    return false;
-  if (!readOpenCvImage(hrscMaskPaths[i], hrscMask, LOAD_GRAY))
-  {
-    printf("Mask read error!\n");
-    return false;
-  }
-
-  if (!readTransform(spatialTransformPaths[i], tempTransform))
-  {
-    printf("Failed to load HRSC spatial transform: %s\n", spatialTransformPaths[i].c_str());
-    return false;
-  }
-  // Each transform is read in HRSC_to_basemap but we want basemap_to_HRSC so invert.
-  double check = cv::invert(tempTransform, spatialTransform);
-
-  return true;
-}
-
-/// Load non-hrsc data
-bool loadOtherData(int argc, char** argv, cv::Mat &basemapImage, int &numHrscImages, std::string &outputPath)
-{
-  // Parse the input arguments
-  numHrscImages = (argc - 3)/3;
-  std::string baseImagePath = argv[1];
-  outputPath = argv[2];
-  
-  const int LOAD_GRAY = 0;
-  const int LOAD_RGB  = 1;
-  
-  // Load the base map
-  if (!readOpenCvImage(baseImagePath, basemapImage, LOAD_RGB))
-      return false;
-  
-  return true;
-}
-
-
-// Without supporting classes this function is a mess
-void getPasteBoundingBox(const cv::Mat &outputImage, const cv::Mat imageToAdd, const cv::Mat &spatialTransform,
-                         int &minX, int &minY, int &maxX, int &maxY)
+int main(int argc, char** argv)
 {
-  // Init the bounds
-  maxX = 0;
-  maxY = 0;
-  minX = outputImage.cols-1;
-  minY = outputImage.rows-1;
-  
-  // Compute the four corners
-  const int NUM_CORNERS = 4;
-  float interpX[NUM_CORNERS], interpY[NUM_CORNERS];
-  affineTransform(spatialTransform, 0,               0,               interpX[0], interpY[0]);
-  affineTransform(spatialTransform, 0,               imageToAdd.rows, interpX[1], interpY[1]);
-  affineTransform(spatialTransform, imageToAdd.cols, 0,               interpX[2], interpY[2]);
-  affineTransform(spatialTransform, imageToAdd.cols, imageToAdd.rows, interpX[3], interpY[3]);
-  
-  // Adjust the bounds to match the corners
-  for (int i=0; i<NUM_CORNERS; ++i)
+  // Finish or discard interrupted in-place updates, such as after a crash
+  if ((argc >= 2) && (std::string(argv[1]) == "--recover"))
   {
-    if (floor(interpX[i]) < minX) minX = interpX[i];
-    if (ceil( interpX[i]) > maxX) maxX = interpX[i];
-    if (floor(interpY[i]) < minY) minY = interpY[i];
-    if (ceil( interpY[i]) > maxY) maxY = interpY[i];
+    int result = 0;
+    for (int i=2; i<argc; ++i)
+      if (!recoverTileJournal(argv[i]))
+        result = -1;
+    return result;
   }
-}
 
-/// Just do a simple paste of one image on to another.
-/// - This is not a pretty looking as a blended image paste but it is
-///   simple, faster, and good for testing.
-bool pasteImage(cv::Mat &outputImage,
-                const cv::Mat &imageToAdd, const cv::Mat &imageMask, const cv::Mat &spatialTransform)
-{
-  // Estimate the bounds of the new image so we do not have to iterate over the entire output image
-  int minCol, minRow, maxCol, maxRow;
-  cv::Mat newToOutput;
-  cv::invert(spatialTransform, newToOutput);
-  getPasteBoundingBox(outputImage, imageToAdd, newToOutput, minCol, minRow, maxCol, maxRow);
-  
-  // Restrict the paste ROI to valid bounds --> Should use a class function!
-  if (minCol < 0)                minCol = 0;
-  if (maxCol > outputImage.cols) maxCol = outputImage.cols;
-  if (minRow < 0)                minRow = 0;
-  if (maxRow > outputImage.rows) maxRow = outputImage.rows;
-  //printf("minCol = %d, minRow = %d, maxCol = %d, maxRow = %d\n", minCol, minRow, maxCol, maxRow);
-  
-  // Iterate over the pixels of the output image
-  bool gotValue;
-  cv::Vec3b pastePixel;
-  float interpX, interpY;
-  for (int r=minRow; r<maxRow; r++)
+  // The regions that change are recorded for the image pyramid against the base path,
+  //  which is the output tile even when the new tile is written to a temporary path.
+  std::string dirtyListPath;
+  if ((argc >= 3) && (std::string(argv[1]) == "--dirty-list"))
   {
-    for (int c=minCol; c<maxCol; c++)
-    {        
-      // Compute the equivalent location in the added image
-      affineTransform(spatialTransform, c, r, interpX, interpY);
-      //printf("c = %d, r = %d, interpX = %f, interpY = %f\n", c, r, interpX, interpY);
-      
-      // Extract all of the basemap values at that location.
-      // - Call the mirror version of the function so we retain all edges.
-      pastePixel = interpPixelMirrorRgb<BINARY_MASK_DATA_TYPE>(imageToAdd, imageMask, interpX, interpY, gotValue);      
-      
-      // Skip masked pixels and out of bounds pixels
-      if (!gotValue)
-      {
-        //printf("SKIP\n");
-        continue;
-      }
-      
-      // If the interpolated pixel is good just overwrite the current value in the output image
-      outputImage.at<cv::Vec3b>(r, c) = pastePixel;
-
-    } // End col loop
-  } // End row loop
-
-  return true;
-}
-
-
-
-
-/// A weighted simple paste of one image on to another.
-/// - The mask is a uint8 input which is both the mask and the weight of input pixels!
-/// - To increase speed, this function just takes a translation offset instead of a full transform.
-bool pasteMaskWeightedImage(cv::Mat &outputImage,
-                            const cv::Mat &imageToAdd, const cv::Mat &imageWeight,
-                            const int colOffset, const int rowOffset)
-{
-  const int tileHeight = imageToAdd.rows;
-  const int tileWidth  = imageToAdd.cols;
-  
-  int minCol = -colOffset;
-  int minRow = -rowOffset;
-  //std::cout << "col, row offsets = " << colOffset << ", " << rowOffset<< std::endl;
-  
-  cv::Rect outputRoi(minCol, minRow, tileWidth, tileHeight);
-  //std::cout << "output ROI = " << outputRoi << std::endl;
-  
-  cv::Rect pasteRoi(minCol+colOffset, minRow+rowOffset,
-                    tileWidth, tileHeight);
-  //std::cout << "paste ROI = " << pasteRoi << std::endl;
-  
-  
-  if (!constrainMatchedCvRois(outputRoi, outputImage.cols, outputImage.rows, pasteRoi)) {
-    printf("hrscMosaic.cpp WARNING: No ROI match!\n");
-    return true;  // No image intersection, no need for image operations.
+    dirtyListPath = argv[2];
+    argv[2] = argv[0];
+    argv += 2;
+    argc -= 2;
   }
-  
-  //std::cout << "output ROI = " << outputRoi << std::endl;
-  cv::Mat  outputRegion = outputImage(outputRoi);
-  
-  //std::cout << "paste ROI = " << pasteRoi << std::endl;
-
-  // Make the weight apply to all three channels!
-  cv::Mat croppedWeight = imageWeight(pasteRoi);
-  cv::Mat imageWeight3; 
-  cv::Mat linker[] = {croppedWeight, croppedWeight, croppedWeight};
-  cv::merge(linker, 3, imageWeight3); 
-
-  // Get an inverse of the weight for the base image.
-  cv::Mat inverseWeight3;
-  cv::subtract(MASK_MAX, imageWeight3, inverseWeight3, cv::noArray(), CV_16UC3);
-
-  cv::Mat  pasteRegion = imageToAdd (pasteRoi);
-
-  //std::cout << "paste size  = " << pasteRegion.size() << std::endl;
-  //std::cout << "weight size = " << inverseWeight3.size() << std::endl;
-  
-  // outputImage = (outputImage * (1-weight)) + (imageToAdd * weight)
-  const double scale = 1.0 / (double)MASK_MAX; // Lets us multiply by a uint16 image
-  cv::Mat weightedPaste, weightedBase;
-  cv::multiply(outputRegion, inverseWeight3, weightedBase,  scale, CV_8UC3);
-  cv::multiply(pasteRegion,  imageWeight3,   weightedPaste, scale, CV_8UC3);
-  cv::add(weightedBase, weightedPaste, outputRegion);
-  
-  return true;
-}
-
-
 
-//============================================================================
-
-
-int main(int argc, char** argv)
-{
   // Check input arguments
-  if ((argc - 3) % 3 != 0 )
+  if ((argc < 3) || ((argc - 3) % 3 != 0))
   {
-    printf("usage: hrscMosaic <Base Image Path> <Output Path> [<Hrsc Rgb Path> <HrscMaskPath> <Spatial transform path>]... \n");
+    printf("usage: hrscMosaic [--dirty-list <List Path>] <Base Image Path> <Output Path> [<Hrsc Rgb Path> <HrscMaskPath> <Spatial transform path>]... \n");
+    printf("       hrscMosaic --recover <Tile Path>...\n");
+    printf("If the base and output paths are the same the tile is updated in place through a journal.\n");
+    printf("With --dirty-list the changed regions of the tile are appended to the list.\n");
     return -1;
   }
 
   printf("Loading input data...\n");
-  
-  // Load the input images  
-  cv::Mat basemapImage;
-  std::string outputPath;
-  cv::Mat hrscImage, hrscMask, spatialTransform;
-  
-  int numHrscImages=0;
-  if (!loadOtherData(argc, argv, basemapImage, numHrscImages, outputPath))
-  {
-    printf("Error reading input arguments!\n");
-    return -1;
-  }
-  
-  // An ugly hack to use the simple 8 bit mask paste with debug images!
-  bool isDebugImage = false;
-  if (outputPath.find("debug") != std::string::npos)
-    isDebugImage = true;
-
-  // The spatial transform is from the base map to HRSC
-
-
-  // Initialize the output image to be identical to the input basemap image
-  
-
-  //printf("Painting on HRSC images...\n");
-  cv::Mat outputImage;
 
-  // Hack to use the simple paste method
-  if ( (FORCE_SIMPLE_PASTE == false) && (isDebugImage == false) )
+  // Pick out the three arguments for each input image
+  std::vector<HrscMosaicInput> inputs((argc - 3)/3);
+  for (size_t i=0; i<inputs.size(); ++i)
   {
-    // Blending based on the weighted input masks
-    outputImage = basemapImage;
-    for (int i=0; i<numHrscImages; ++i)
-    {
-      // Load the inputs for this single image
-      if (!loadInputImage(argc, argv, hrscImage, hrscMask, spatialTransform, i))
-      {
-        printf("Error reading input arguments!\n");
-        return -1;
-      }
-    
-      // Add this image to the output tile
-      int colOffset = static_cast<int>(spatialTransform.at<float>(0, 2));
-      int rowOffset = static_cast<int>(spatialTransform.at<float>(1, 2));
-      pasteMaskWeightedImage(outputImage, hrscImage, hrscMask, colOffset, rowOffset);
-    }
+    inputs[i].imagePath     = argv[3 + 3*i];
+    inputs[i].maskPath      = argv[4 + 3*i];
+    inputs[i].transformPath = argv[5 + 3*i];
   }
-  else // Use the simple paste
-  {
+  const std::string basePath   = argv[1];
+  const std::string outputPath = argv[2];
+
+  const bool simplePaste = useSimplePaste(outputPath);
+  if (simplePaste)
     printf("Using the no-blend paste method...\n");
 
-    // For now, just dump all of the HRSC images in one at a time.
-    outputImage = basemapImage.clone();
-    for (int i=0; i<numHrscImages; ++i)
-    {
-      // Load the inputs for this single image
-      if (!loadInputImage(argc, argv, hrscImage, hrscMask, spatialTransform, i))
-      {
-        printf("Error reading input arguments!\n");
-        return -1;
-      }    
-      pasteImage(outputImage, hrscImage, hrscMask, spatialTransform);
-    }
-    
+  if (!mosaicHrscTile(basePath, outputPath, inputs, dirtyListPath, simplePaste))
+  {
+    printf("Failed to update output tile %s\n", outputPath.c_str());
+    return -1;
   }
-  printf("Writing output file %s...\n", outputPath.c_str());
-  
-  // Write the output image
-  cv::imwrite(outputPath, outputImage);
-
   return 0;
 }
-
-
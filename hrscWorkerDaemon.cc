@@ -0,0 +1,702 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2006-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NASA Vision Workbench is licensed under the Apache License,
+//  Version 2.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <vw/Core/Log.h>
+
+#include <map>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <HrscCommon.h>
+
+#include <boost/program_options.hpp>
+#include <boost/thread.hpp>
+namespace po = boost::program_options;
+
+using namespace vw;
+
+/**
+  Long running worker process which executes the pipeline commands that
+  MosaicUtilities.cmdRunner would otherwise start as separate processes.
+
+  Clients connect to a Unix domain socket and send two lines: the folder they
+  are running in, then one command line, the same text that would be passed to
+  os.system.  The daemon replies with a line containing the exit code of the
+  command once it has finished.
+
+  - The socket is in a folder which only the user running the daemon can access,
+    and connections from other users are refused.  The daemon will not start if
+    another daemon is already listening on the socket.
+
+  - These tools are run inside the daemon on a fixed pool of worker threads:
+      writeHrscColorPairs, transformHrscImageColor, hrscMosaic
+    Input images and transforms which do not change between jobs, such as the
+    basemap and the tile color transforms, are kept in a memory limited cache.
+  - All other commands are run with system() on the same worker pool.
+  - Each job is admitted against a memory budget estimated from the size of its
+    input files, so that many large jobs do not run at the same time.  A job
+    larger than the whole budget runs by itself.
+
+  Relative paths in commands are resolved from the folder the client sent.
+*/
+
+//======================================================================================================
+
+/// Rough ratio of decoded image size to file size, used for the memory estimates.
+const double FILE_SIZE_TO_MEMORY = 4.0;
+
+struct Options {
+  std::string socket_path;
+  int         num_threads;
+  size_t      memory_budget_mb;
+  size_t      cache_mb;
+};
+
+
+/// Split a command line into arguments, handling double quoted arguments
+std::vector<std::string> tokenizeCommand(const std::string &command)
+{
+  std::vector<std::string> tokens;
+  std::string current;
+  bool inQuotes = false, haveToken = false;
+  for (size_t i=0; i<command.size(); ++i)
+  {
+    const char c = command[i];
+    if (c == '"')
+    {
+      inQuotes  = !inQuotes;
+      haveToken = true;
+    }
+    else if (!inQuotes && isspace(c))
+    {
+      if (haveToken)
+        tokens.push_back(current);
+      current.clear();
+      haveToken = false;
+    }
+    else
+    {
+      current  += c;
+      haveToken = true;
+    }
+  }
+  if (haveToken)
+    tokens.push_back(current);
+  return tokens;
+}
+
+/// Returns the name of the program in a command without any leading path
+std::string getProgramName(const std::vector<std::string> &tokens)
+{
+  if (tokens.empty())
+    return "";
+  const size_t slash = tokens[0].rfind('/');
+  return (slash == std::string::npos) ? tokens[0] : tokens[0].substr(slash+1);
+}
+
+/// Returns a path relative to the client's folder as an absolute path
+std::string resolvePath(const std::string &cwd, const std::string &path)
+{
+  if (path.empty() || (path[0] == '/'))
+    return path;
+  return cwd + "/" + path;
+}
+
+/// Quote an argument for the shell
+std::string quoteShellArg(const std::string &arg)
+{
+  std::string quoted = "'";
+  for (size_t i=0; i<arg.size(); ++i)
+  {
+    if (arg[i] == '\'')
+      quoted += "'\\''";
+    else
+      quoted += arg[i];
+  }
+  return quoted + "'";
+}
+
+/// Identifies one version of a file, a file which is rewritten or replaced gets a new version.
+struct FileVersion
+{
+  FileVersion() : modSeconds(0), modNanoseconds(0), size(0), inode(0) {}
+
+  bool operator==(const FileVersion &other) const
+  {
+    return (modSeconds == other.modSeconds) && (modNanoseconds == other.modNanoseconds) &&
+           (size == other.size) && (inode == other.inode);
+  }
+
+  time_t modSeconds;
+  long   modNanoseconds;
+  off_t  size;
+  ino_t  inode;
+};
+
+/// Returns the version of a file or of the container or basemap holding it, all zero if it does not exist.
+FileVersion getFileVersion(const std::string &path)
+{
+  FileVersion version;
+  struct stat info;
+  std::string basemapPath = path;
+  cv::Rect    roi;
+  bool        isGray;
+  parseBasemapCropPath(path, basemapPath, roi, isGray);
+  if (stat(getContainerFilePath(basemapPath).c_str(), &info) != 0)
+    return version;
+  version.modSeconds     = info.st_mtim.tv_sec;
+  version.modNanoseconds = info.st_mtim.tv_nsec;
+  version.size           = info.st_size;
+  version.inode          = info.st_ino;
+  return version;
+}
+
+/// Estimate the memory needed by a job from the sizes of the files it reads
+size_t estimateJobMemory(const std::vector<std::string> &tokens, const std::string &cwd)
+{
+  double total = 0;
+  struct stat info;
+  for (size_t i=1; i<tokens.size(); ++i)
+    if ((stat(resolvePath(cwd, tokens[i]).c_str(), &info) == 0) && S_ISREG(info.st_mode))
+      total += info.st_size;
+  return static_cast<size_t>(total * FILE_SIZE_TO_MEMORY);
+}
+
+
+/// Thread safe cache of images and transforms that are read by many jobs.
+/// - Paths must be absolute since jobs come from clients in different folders.
+/// - Entries are reloaded if the file on disk changes.
+/// - The least recently used entries are dropped when the cache is full.
+/// - Callers must not modify the returned data.
+class FileCache
+{
+public:
+  FileCache(size_t maxBytes) : _maxBytes(maxBytes), _numBytes(0), _useCounter(0) {}
+
+  bool getImage(const std::string &path, const int imageType, cv::Mat &image)
+  {
+    return get(path, imageType, image);
+  }
+
+  bool getTransform(const std::string &path, cv::Mat &transform)
+  {
+    return get(path, TRANSFORM_TYPE, transform);
+  }
+
+private:
+
+  static const int TRANSFORM_TYPE = -1;
+
+  struct Entry
+  {
+    cv::Mat     data;
+    FileVersion version;
+    size_t      lastUse;
+  };
+
+  size_t getSize(const cv::Mat &data) const
+  {
+    return data.total() * data.elemSize();
+  }
+
+  bool get(const std::string &path, const int type, cv::Mat &output)
+  {
+    const std::string key     = itoa(type) + ":" + path;
+    const FileVersion version = getFileVersion(path);
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      std::map<std::string, Entry>::iterator iter = _entries.find(key);
+      if ((iter != _entries.end()) && (iter->second.version == version))
+      {
+        iter->second.lastUse = ++_useCounter;
+        output = iter->second.data;
+        return true;
+      }
+    }
+
+    // Load outside of the lock so other jobs are not held up
+    cv::Mat data;
+    const bool loaded = (type == TRANSFORM_TYPE) ? readTransform(path, data)
+                                                 : readOpenCvImage(path, data, type);
+    if (!loaded)
+      return false;
+    output = data;
+
+    boost::mutex::scoped_lock lock(_mutex);
+    std::map<std::string, Entry>::iterator iter = _entries.find(key);
+    if (iter != _entries.end())
+    {
+      _numBytes -= getSize(iter->second.data);
+      _entries.erase(iter);
+    }
+    const size_t size = getSize(data);
+    if (size > _maxBytes)
+      return true; // Too big to cache
+    while (_numBytes + size > _maxBytes)
+      evictOldest();
+    Entry &entry  = _entries[key];
+    entry.data    = data;
+    entry.version = version;
+    entry.lastUse = ++_useCounter;
+    _numBytes    += size;
+    return true;
+  }
+
+  void evictOldest()
+  {
+    std::map<std::string, Entry>::iterator oldest = _entries.begin();
+    for (std::map<std::string, Entry>::iterator iter=_entries.begin(); iter!=_entries.end(); ++iter)
+      if (iter->second.lastUse < oldest->second.lastUse)
+        oldest = iter;
+    _numBytes -= getSize(oldest->second.data);
+    _entries.erase(oldest);
+  }
+
+  boost::mutex                 _mutex;
+  std::map<std::string, Entry> _entries;
+  size_t                       _maxBytes;
+  size_t                       _numBytes;
+  size_t                       _useCounter;
+};
+
+
+/// Blocks jobs until there is room for them in the memory budget.
+class MemoryBudget
+{
+public:
+  MemoryBudget(size_t maxBytes) : _maxBytes(maxBytes), _usedBytes(0) {}
+
+  /// A job that is bigger than the whole budget is admitted once nothing else is running.
+  void acquire(size_t bytes)
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    while ((_usedBytes > 0) && (_usedBytes + bytes > _maxBytes))
+      _condition.wait(lock);
+    _usedBytes += bytes;
+  }
+
+  void release(size_t bytes)
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    _usedBytes -= bytes;
+    _condition.notify_all();
+  }
+
+private:
+  boost::mutex              _mutex;
+  boost::condition_variable _condition;
+  size_t                    _maxBytes;
+  size_t                    _usedBytes;
+};
+
+//======================================================================================================
+// In-process versions of the tools, the arguments match the tools' command lines.
+
+int runWriteHrscColorPairs(const std::vector<std::string> &args, FileCache &cache)
+{
+  if (args.size() != 11)
+  {
+    printf("writeHrscColorPairs: Wrong number of arguments!\n");
+    return -1;
+  }
+  const int LOAD_GRAY = 0;
+  const int LOAD_RGB  = 1;
+
+  cv::Mat basemapImage, hrscMask, spatialTransform;
+  std::vector<cv::Mat> hrscChannels(NUM_HRSC_CHANNELS);
+  BrightnessCorrector corrector;
+  if (!cache.getImage(args[1], LOAD_RGB, basemapImage))
+    return -1;
+  for (size_t i=0; i<NUM_HRSC_CHANNELS; ++i)
+    if (!readOpenCvImage(args[2+i], hrscChannels[i], LOAD_GRAY))
+      return -1;
+  if (!readBinaryMask(args[7], hrscMask, CV_16UC1, MASK_MAX))
+    return -1;
+  if (!cache.getTransform(args[8], spatialTransform))
+    return -1;
+  if (!corrector.readProfileCorrection(args[9]))
+    return -1;
+
+  std::vector<HrscColorPair> pairs;
+  if (collectColorPairs(basemapImage, spatialTransform, corrector, hrscChannels, hrscMask, pairs) == 0)
+  {
+    printf("Failed to detect any color pairs!!!\n");
+    return -1;
+  }
+  return writeColorPairsFile(args[10], pairs) ? 0 : -1;
+}
+
+int runTransformHrscImageColor(const std::vector<std::string> &args, FileCache &cache)
+{
+  if ((args.size() < 11) || ((args.size() - 11) % 4 != 0))
+  {
+    printf("transformHrscImageColor: Wrong number of arguments!\n");
+    return -1;
+  }
+  const int LOAD_GRAY = 0;
+
+  std::vector<cv::Mat> hrscChannels(NUM_HRSC_CHANNELS);
+  cv::Mat hrscMask, colorTransform;
+  BrightnessCorrector corrector;
+  for (size_t i=0; i<NUM_HRSC_CHANNELS; ++i)
+    if (!readOpenCvImage(args[1+i], hrscChannels[i], LOAD_GRAY))
+      return -1;
+  if (!readOpenCvImage(args[6], hrscMask, LOAD_GRAY))
+    return -1;
+  if (!corrector.readProfileCorrection(args[7]))
+    return -1;
+  const std::string outputPath = args[8];
+  if (!cache.getTransform(args[9], colorTransform))
+    return -1;
+  const double mainWeight = atof(args[10].c_str());
+
+  // The neighboring tile transforms are each read by several jobs
+  const size_t numOtherTiles = (args.size() - 11) / 4;
+  std::vector<cv::Mat>   otherTransforms(numOtherTiles);
+  std::vector<double>    otherWeights   (numOtherTiles);
+  std::vector<cv::Vec2i> otherOffsets   (numOtherTiles);
+  for (size_t i=0; i<numOtherTiles; ++i)
+  {
+    const size_t baseIndex = 11+4*i;
+    if (!cache.getTransform(args[baseIndex], otherTransforms[i]))
+      return -1;
+    otherWeights[i]    = atof(args[baseIndex+1].c_str());
+    otherOffsets[i][0] = atoi(args[baseIndex+2].c_str());
+    otherOffsets[i][1] = atoi(args[baseIndex+3].c_str());
+  }
+
+  cv::Mat newColorImage;
+  transformHrscColor(hrscChannels, hrscMask, corrector, newColorImage,
+                     colorTransform, mainWeight, otherTransforms, otherWeights, otherOffsets);
+  return writeOpenCvImage(outputPath, newColorImage) ? 0 : -1;
+}
+
+int runHrscMosaic(const std::vector<std::string> &args, const std::string &dirtyListPath, FileCache &cache)
+{
+  std::vector<HrscMosaicInput> inputs((args.size() - 3)/3);
+  for (size_t i=0; i<inputs.size(); ++i)
+  {
+    inputs[i].imagePath     = args[3 + 3*i];
+    inputs[i].maskPath      = args[4 + 3*i];
+    inputs[i].transformPath = args[5 + 3*i];
+  }
+  // The transforms are shared by all the tiles an HRSC image touches
+  return mosaicHrscTile(args[1], args[2], inputs, dirtyListPath, useSimplePaste(args[2]),
+                        boost::bind(&FileCache::getTransform, &cache, _1, _2)) ? 0 : -1;
+}
+
+
+/// Returns true if argument i of a tool that runs in-process is a path
+bool isPathArgument(const std::string &program, const std::vector<std::string> &tokens, size_t i)
+{
+  if (program == "transformHrscImageColor") // The other arguments are the tile weights and offsets
+    return (i <= 9) || ((i >= 11) && ((i - 11) % 4 == 0));
+  return (tokens[i] != "--dirty-list");
+}
+
+/// Runs one command from a client in the folder cwd, either in-process or with system()
+int runCommand(const std::string &command, const std::string &cwd, FileCache &cache)
+{
+  std::vector<std::string> tokens = tokenizeCommand(command);
+  const std::string program = getProgramName(tokens);
+  try
+  {
+    std::vector<std::string> args = tokens;
+    for (size_t i=1; i<args.size(); ++i)
+      if (isPathArgument(program, args, i))
+        args[i] = resolvePath(cwd, args[i]);
+    if (program == "writeHrscColorPairs")
+      return runWriteHrscColorPairs(args, cache);
+    if (program == "transformHrscImageColor")
+      return runTransformHrscImageColor(args, cache);
+    std::string dirtyListPath;
+    if ((program == "hrscMosaic") && (args.size() >= 3) && (tokens[1] == "--dirty-list"))
+    {
+      dirtyListPath = args[2];
+      args.erase(args.begin()+1, args.begin()+3);
+    }
+    if ((program == "hrscMosaic") && (args.size() >= 3) && ((args.size()-3) % 3 == 0))
+      return runHrscMosaic(args, dirtyListPath, cache);
+  }
+  catch (const std::exception &e)
+  {
+    printf("Error running %s: %s\n", program.c_str(), e.what());
+    return -1;
+  }
+  const std::string shellCommand = "cd " + quoteShellArg(cwd) + " && " + command;
+  const int status = system(shellCommand.c_str());
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+//======================================================================================================
+
+/// Pulls client connections off of a queue, runs their command, and sends back the result.
+class JobWorker
+{
+public:
+  JobWorker(std::deque<int> &queue, boost::mutex &queueMutex, boost::condition_variable &queueCondition,
+            FileCache &cache, MemoryBudget &budget)
+    : _queue(queue), _queueMutex(queueMutex), _queueCondition(queueCondition),
+      _cache(cache), _budget(budget) {}
+
+  void operator()()
+  {
+    while (true)
+    {
+      int connection;
+      {
+        boost::mutex::scoped_lock lock(_queueMutex);
+        while (_queue.empty())
+          _queueCondition.wait(lock);
+        connection = _queue.front();
+        _queue.pop_front();
+      }
+      handleConnection(connection);
+      close(connection);
+    }
+  }
+
+private:
+
+  void handleConnection(int connection)
+  {
+    // Read until the end of the command line, which follows the client folder line
+    std::string request;
+    char buffer[4096];
+    size_t cwdEnd;
+    while (((cwdEnd = request.find('\n')) == std::string::npos) ||
+           (request.find('\n', cwdEnd+1) == std::string::npos))
+    {
+      const ssize_t numRead = read(connection, buffer, sizeof(buffer));
+      if (numRead <= 0)
+        return;
+      request.append(buffer, numRead);
+    }
+    const std::string cwd     = request.substr(0, cwdEnd);
+    const std::string command = request.substr(cwdEnd+1, request.find('\n', cwdEnd+1) - cwdEnd - 1);
+    if (command.empty() || cwd.empty() || (cwd[0] != '/'))
+      return;
+
+    const size_t memory = estimateJobMemory(tokenizeCommand(command), cwd);
+    _budget.acquire(memory);
+    const int result = runCommand(command, cwd, _cache);
+    _budget.release(memory);
+
+    const std::string response = itoa(result) + "\n";
+    if (write(connection, response.c_str(), response.size()) < 0)
+      printf("Failed to send the result of: %s\n", command.c_str());
+  }
+
+  std::deque<int>           &_queue;
+  boost::mutex              &_queueMutex;
+  boost::condition_variable &_queueCondition;
+  FileCache                 &_cache;
+  MemoryBudget              &_budget;
+};
+
+//======================================================================================================
+// Socket setup
+
+/// Returns the default socket path, in a folder for this user
+std::string getDefaultSocketPath()
+{
+  const char* runtimeFolder = getenv("XDG_RUNTIME_DIR");
+  if (runtimeFolder && (runtimeFolder[0] == '/'))
+    return std::string(runtimeFolder) + "/hrscWorkerDaemon/daemon.sock";
+  return "/tmp/hrscWorkerDaemon-" + itoa(static_cast<int>(getuid())) + "/daemon.sock";
+}
+
+/// Create the folder holding the socket if needed, then make sure that only this user can use it.
+bool preparePrivateFolder(const std::string &folder)
+{
+  if ((mkdir(folder.c_str(), 0700) != 0) && (errno != EEXIST))
+  {
+    printf("Failed to create socket folder %s: %s\n", folder.c_str(), strerror(errno));
+    return false;
+  }
+  struct stat info;
+  if ((lstat(folder.c_str(), &info) != 0) || !S_ISDIR(info.st_mode) ||
+      (info.st_uid != getuid()) || ((info.st_mode & (S_IRWXG | S_IRWXO)) != 0))
+  {
+    printf("Socket folder %s must be a folder owned by this user with no group or other access.\n",
+           folder.c_str());
+    return false;
+  }
+  return true;
+}
+
+/// Remove a socket left behind by a daemon which is no longer running.
+/// - Returns false if a daemon is listening on the socket or the path is not a socket.
+bool removeStaleSocket(const std::string &path, const sockaddr_un &address)
+{
+  struct stat info;
+  if (lstat(path.c_str(), &info) != 0)
+    return (errno == ENOENT);
+  if (!S_ISSOCK(info.st_mode))
+  {
+    printf("%s exists and is not a socket.\n", path.c_str());
+    return false;
+  }
+
+  const int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (probe < 0)
+    return false;
+  const int result = connect(probe, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+  const int error  = errno;
+  close(probe);
+  if (result == 0)
+  {
+    printf("Another hrscWorkerDaemon is already listening on %s\n", path.c_str());
+    return false;
+  }
+  if (error != ECONNREFUSED)
+  {
+    printf("Failed to check socket %s: %s\n", path.c_str(), strerror(error));
+    return false;
+  }
+  return (unlink(path.c_str()) == 0);
+}
+
+/// Returns true if the client on a connection is the same user as the daemon
+bool isSameUser(const int connection)
+{
+  struct ucred credentials;
+  socklen_t length = sizeof(credentials);
+  if (getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0)
+    return false;
+  return (credentials.uid == getuid());
+}
+
+//--------------------------------------------------------
+
+// Handling input
+void handle_arguments( int argc, char *argv[], Options& opt ) {
+
+  po::options_description general_options("");
+  general_options.add_options()
+    ("socket",        po::value(&opt.socket_path)->default_value(getDefaultSocketPath()),
+                      "Path of the Unix domain socket to listen on, its folder may only be accessible to this user.")
+    ("threads",       po::value(&opt.num_threads)->default_value(boost::thread::hardware_concurrency()),
+                      "Number of jobs to run at once.")
+    ("memory-budget", po::value(&opt.memory_budget_mb)->default_value(16384), "Estimated memory allowed for running jobs, in megabytes.")
+    ("cache",         po::value(&opt.cache_mb)->default_value(2048), "Size of the cache of shared inputs, in megabytes.")
+    ("help,h",        "Display this help message");
+
+  po::variables_map vm;
+  try {
+    po::store( po::command_line_parser( argc, argv ).options(general_options).run(), vm );
+    po::notify( vm );
+  } catch (const po::error& e) {
+    vw_throw( ArgumentErr() << "Error parsing input:\n\t"
+              << e.what() << general_options );
+  }
+
+  std::ostringstream usage;
+  usage << "Usage: " << argv[0] << " [options]\n";
+
+  if ( vm.count("help") )
+    vw_throw( ArgumentErr() << usage.str() << general_options );
+  if ( opt.num_threads < 1 )
+    opt.num_threads = 1;
+}
+
+
+
+int main( int argc, char *argv[] ) {
+
+  Options opt;
+  handle_arguments( argc, argv, opt );
+
+  // A client that goes away should not take the daemon down with it
+  signal(SIGPIPE, SIG_IGN);
+
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (opt.socket_path.size() >= sizeof(address.sun_path))
+  {
+    printf("Socket path is too long: %s\n", opt.socket_path.c_str());
+    return -1;
+  }
+  strncpy(address.sun_path, opt.socket_path.c_str(), sizeof(address.sun_path)-1);
+
+  // Only one daemon may own a socket.  The lock is held until the daemon exits, so once
+  //  it is taken any socket left at the path belongs to a daemon that is gone.
+  const size_t slash = opt.socket_path.rfind('/');
+  const std::string folder = (slash == std::string::npos) ? "." : opt.socket_path.substr(0, std::max(slash, size_t(1)));
+  if (!preparePrivateFolder(folder))
+    return -1;
+  const std::string lockPath = opt.socket_path + ".lock";
+  const int lockFile = open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if ((lockFile < 0) || (flock(lockFile, LOCK_EX | LOCK_NB) != 0))
+  {
+    printf("Another hrscWorkerDaemon is already using %s\n", opt.socket_path.c_str());
+    return -1;
+  }
+  if (!removeStaleSocket(opt.socket_path, address))
+    return -1;
+
+  // The socket is created without group or other access
+  const int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  const mode_t oldMask = umask(0177);
+  const bool bound = (listener >= 0) &&
+                     (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+  umask(oldMask);
+  if (!bound || (chmod(opt.socket_path.c_str(), 0600) != 0) || (listen(listener, SOMAXCONN) != 0))
+  {
+    printf("Failed to listen on socket %s\n", opt.socket_path.c_str());
+    return -1;
+  }
+
+  FileCache    cache (opt.cache_mb*1024*1024);
+  MemoryBudget budget(opt.memory_budget_mb*1024*1024);
+  std::deque<int>           queue;
+  boost::mutex              queueMutex;
+  boost::condition_variable queueCondition;
+
+  boost::thread_group threads;
+  for (int i=0; i<opt.num_threads; ++i)
+    threads.create_thread(JobWorker(queue, queueMutex, queueCondition, cache, budget));
+
+  vw_out() << "Listening on " << opt.socket_path << " with " << opt.num_threads << " workers.\n";
+  while (true)
+  {
+    const int connection = accept(listener, NULL, NULL);
+    if (connection < 0)
+      continue;
+    if (!isSameUser(connection))
+    {
+      printf("Refused a connection from another user.\n");
+      close(connection);
+      continue;
+    }
+    boost::mutex::scoped_lock lock(queueMutex);
+    queue.push_back(connection);
+    queueCondition.notify_one();
+  }
+
+  return 0;
+}
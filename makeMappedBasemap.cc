@@ -0,0 +1,58 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2006-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NASA Vision Workbench is licensed under the Apache License,
+//  Version 2.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <stdio.h>
+#include <opencv2/opencv.hpp>
+
+#include <HrscCommon.h>
+
+/**
+  Converts the low resolution basemap in to a mapped basemap file so that the
+  other tools can read crops of it with paths like <output>@<col>,<row>,<width>,<height>.
+  - The output path must end with .hrb, which marks the crop paths.
+  - Put the output in /dev/shm so all the tools share one copy in memory.
+*/
+
+//=============================================================
+
+int main(int argc, char** argv)
+{
+  // Check input arguments
+  if (argc != 3)
+  {
+    printf("usage: makeMappedBasemap <Basemap Path> <Output Path>\n");
+    return -1;
+  }
+  const std::string basemapPath = argv[1];
+  const std::string outputPath  = argv[2];
+  if ((outputPath.size() <= MAPPED_BASEMAP_EXTENSION.size()) ||
+      (outputPath.compare(outputPath.size()-MAPPED_BASEMAP_EXTENSION.size(), MAPPED_BASEMAP_EXTENSION.size(),
+                          MAPPED_BASEMAP_EXTENSION) != 0))
+  {
+    printf("The output path must end with %s\n", MAPPED_BASEMAP_EXTENSION.c_str());
+    return -1;
+  }
+
+  const int LOAD_RGB = 1;
+  cv::Mat basemap;
+  if (!readOpenCvImage(basemapPath, basemap, LOAD_RGB))
+    return -1;
+
+  if (!writeMappedBasemap(outputPath, basemap))
+    return -1;
+  return 0;
+}
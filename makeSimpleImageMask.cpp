@@ -79,6 +79,28 @@ bool generateSimpleImageMask(const std::vector<cv::Mat> &inputImages, cv::Mat &o
   return true;
 }
 
+/// Make a bit packed output mask from a set of input images.
+/// - The AND across the inputs is performed a whole word at a time.
+bool generatePackedImageMask(const std::vector<cv::Mat> &inputImages, PackedBinaryMask &outputMask)
+{
+  const size_t numBands = inputImages.size();
+
+  // Same size rules as the unpacked mask
+  int numRows = inputImages[0].rows;
+  int numCols = inputImages[0].cols;
+  for (size_t i=1; i<numBands; ++i)
+  {
+    if (inputImages[i].rows < numRows) numRows = inputImages[i].rows;
+    if (inputImages[i].cols < numCols) numCols = inputImages[i].cols;
+  }
+  outputMask.create(numRows, numCols, true);
+
+  for (size_t i=0; i<numBands; ++i)
+    outputMask.andWithMat(inputImages[i]);
+
+  return true;
+}
+
 //============================================================================
 
 
@@ -100,6 +122,19 @@ int main(int argc, char** argv)
     return -1;
 
   printf("Making output mask...\n");
+
+  // Write a bit packed mask if that format was requested
+  if (isPackedMaskPath(outputPath))
+  {
+    PackedBinaryMask packedMask;
+    generatePackedImageMask(hrscChannels, packedMask);
+    if (!packedMask.write(outputPath))
+      return -1;
+    MaskStatistics stats(packedMask.rows(), packedMask.cols());
+    stats.addPackedMask(packedMask);
+    stats.writeJson(getMaskStatisticsPath(outputPath));
+    return 0;
+  }
   
   // Build the output mask
   cv::Mat outputMask;
@@ -107,7 +142,12 @@ int main(int argc, char** argv)
 
     
   // Write the output image
-  cv::imwrite(outputPath, outputMask);
+  writeOpenCvImage(outputPath, outputMask);
+
+  // Record the valid pixel statistics so they don't need to be recomputed later
+  MaskStatistics stats(outputMask.rows, outputMask.cols);
+  stats.addMat(outputMask);
+  stats.writeJson(getMaskStatisticsPath(outputPath));
 
   return 0;
 }
@@ -5,6 +5,7 @@ import re
 import subprocess
 import numpy
 import copy
+import collections
 import multiprocessing
 import threading
 import logging
@@ -57,7 +58,8 @@ Batch procedure:
 - Keep a count of how many images we have downloaded
 - Keep processing until we have downloaded COUNT images
   - TODO: Run through the DB and add all images missing URL's to the bad image list.
-- For each HRSC image, update all the tiles it overlaps.
+- Prepare each HRSC image, then update every tile covered by the batch once with all of
+  the HRSC images that overlap it.
 - Before each tile is touched for the first time, make a backup of it!
 - After a batch finishes, make the kml pyramid and send out an email.
 - MANUAL INTERVENTION
@@ -77,6 +79,22 @@ NUM_DOWNLOAD_THREADS = 5 # There are five files we download per data set
 # This limits the program to parsing this many HRSC files before stopping.
 IMAGE_BATCH_SIZE = 1 # This should be set equal to the HRSC cache size
 
+# Prepare every HRSC image in the batch first, then update each covered output tile once
+#  with all of the images instead of once per image.
+BATCH_OUTPUT_TILE_UPDATES = True
+
+# Let hrscMosaic update output tiles in place through a journal instead of writing
+#  a full temporary copy which is checked with gdalinfo and then moved over the tile.
+USE_JOURNALED_TILE_UPDATES = True
+
+# Have hrscMosaic record the output tile regions it changes so that the KML pyramid
+#  only rebuilds the tiles above them instead of the whole pyramid after every batch.
+USE_INCREMENTAL_PYRAMID = True
+
+# Refine the registration of each HRSC tile against the high res basemap tile before pasting.
+REFINE_TILE_REGISTRATION        = True
+TILE_REGISTRATION_SEARCH_RADIUS = 64 # In output resolution pixels
+
 
 
 
@@ -205,31 +223,87 @@ def getCoveredOutputTiles(basemapInstance, hrscInstance):
     return intersectTileList
     
 
-def updateTileWithHrscImage(hrscTileInfoDict, outputTilePath, tileLogPath):
-    '''Update a single output tile with the given HRSC image'''
-
-    # Write the output to a new temporary file in case we wreck it!
-    tempFilePath = outputTilePath + '_temp.tif'
+def getRefineTileRegistrationsCmd(hrscTileInfoDict, tileBackupPath):
+    '''Returns the command to refine the tile to tile transforms against the upsampled basemap
+       tile and the list of refined transform paths it writes.
+       The command is empty if there are no HRSC tiles.
+       The refined transform paths are stored under 'refinedTransformPath'.'''
+
+    # The backup tile is used since it contains only the upsampled basemap
+    cmd = './refineTileRegistration ' + tileBackupPath +' '+ str(TILE_REGISTRATION_SEARCH_RADIUS)
+    refinedPaths = []
+    for hrscTile in hrscTileInfoDict.itervalues():
+        refinedPath = hrscTile['tileToTileTransformPath'][:-4] + '_refined.csv'
+        cmd += (' '+ hrscTile['newColorPath'] +' '+ hrscTile['tileMaskPath'] +' '+
+                  hrscTile['tileToTileTransformPath'] +' '+ refinedPath)
+        hrscTile['refinedTransformPath'] = refinedPath
+        refinedPaths.append(refinedPath)
+    if not refinedPaths:
+        return ('', [])
+    return (cmd, refinedPaths)
+
+def refineTileRegistrations(hrscTileInfoDict, tileBackupPath):
+    '''Refine the tile to tile transforms against the upsampled basemap tile.
+       The refined transform paths are stored under 'refinedTransformPath'.'''
+
+    (cmd, refinedPaths) = getRefineTileRegistrationsCmd(hrscTileInfoDict, tileBackupPath)
+
+    # The tool always writes an output transform, falling back to the input transform
+    #  if it could not improve on it.
+    MosaicUtilities.cmdRunner(cmd, None, True)
+    for refinedPath in refinedPaths:
+        if not MosaicUtilities.pathExists(refinedPath):
+            raise MosaicUtilities.CmdRunException('Failed to create output file: ' + refinedPath)
+
+def getTileMosaicCmd(hrscTileInfoDict, outputTilePath, useRefinedTransforms):
+    '''Returns the hrscMosaic command to update a single output tile, the temporary
+       file it writes, and the list of HRSC tiles it uses.
+       The temporary file is None if the tile is updated in place.'''
+
+    cmd = './hrscMosaic '
+    if USE_INCREMENTAL_PYRAMID:
+        cmd += '--dirty-list ' + DIRTY_TILE_LIST_PATH +' '
+
+    if USE_JOURNALED_TILE_UPDATES:
+        # hrscMosaic journals the changes so the tile is never left half written
+        tempFilePath = None
+        cmd += outputTilePath +' '+ outputTilePath
+    else:
+        # Write the output to a new temporary file in case we wreck it!
+        tempFilePath = outputTilePath + '_temp.tif'
+        cmd += outputTilePath +' '+ tempFilePath
 
     # Append all the tiles into one big command line call
     hrscTiles = ''
-    cmd = './hrscMosaic ' + outputTilePath +' '+ tempFilePath
     for hrscTile in hrscTileInfoDict.itervalues():    
 
+        if useRefinedTransforms:
+            transformPath = hrscTile['refinedTransformPath']
+        else:
+            transformPath = hrscTile['tileToTileTransformPath']
+
         # This pastes the HRSC tile on top of the current output tile.  Another function
         #  will have made sure the correct output tile is in place.
         cmd += (' '+ hrscTile['newColorPath'] +' '+
-                  hrscTile['tileMaskPath'] +' '+ hrscTile['tileToTileTransformPath'])
+                  hrscTile['tileMaskPath'] +' '+ transformPath)
         hrscTiles += hrscTile['prefix'] + ', '
+    return (cmd, tempFilePath, hrscTiles)
 
-    # Execute the command line call
-    MosaicUtilities.cmdRunner(cmd, tempFilePath, True)
+def finishTileUpdate(cmd, tempFilePath, outputTilePath, tileLogPath, hrscTiles, succeeded=True):
+    '''Move a finished hrscMosaic output into place and return the path to log the result to'''
+
+    if not tempFilePath: # The tile was updated in place
+        if not succeeded:
+            logger = logging.getLogger('MainProgram')
+            logger.error('Failed to update tile with command:  ' + cmd)
+            return (tileLogPath, 'FAILED')
+        return (tileLogPath, hrscTiles)
 
     # Make sure that the command did not ruin the output file!
     if MosaicUtilities.isImageFileValid(tempFilePath):
-        # If we didn't ruin the output file, copy it to the proper location.
-        shutil.copyfile(tempFilePath, outputTilePath)
-        os.remove(tempFilePath)
+        # If we didn't ruin the output file, move it to the proper location.
+        # - This replaces the link to the backup tile the first time a tile is updated.
+        os.rename(tempFilePath, outputTilePath)
     else:
         # On a failure, just log the error so that we can keep going.
         logger = logging.getLogger('MainProgram')
@@ -239,6 +313,59 @@ def updateTileWithHrscImage(hrscTileInfoDict, outputTilePath, tileLogPath):
 
     # Return the path to log the success to
     return (tileLogPath, hrscTiles)
+
+def updateTileWithHrscImage(hrscTileInfoDict, outputTilePath, tileLogPath, tileBackupPath=None):
+    '''Update a single output tile with the given HRSC image'''
+
+    # Correct any registration error that was magnified by upsampling the low res transform
+    useRefinedTransforms = REFINE_TILE_REGISTRATION and tileBackupPath
+    if useRefinedTransforms:
+        refineTileRegistrations(hrscTileInfoDict, tileBackupPath)
+
+    # Execute the command line call
+    (cmd, tempFilePath, hrscTiles) = getTileMosaicCmd(hrscTileInfoDict, outputTilePath, useRefinedTransforms)
+    succeeded = (MosaicUtilities.runCmd(cmd) == 0)
+
+    return finishTileUpdate(cmd, tempFilePath, outputTilePath, tileLogPath, hrscTiles, succeeded)
+
+def getTileUpdateTasks(hrscTileInfoDict, outputTilePath, tileBackupPath, tileId):
+    '''Returns task graph entries which update a single output tile once all of
+       the HRSC tiles it uses are ready, plus the information finishTileUpdate needs'''
+
+    # Each HRSC tile is ready once its last task has finished
+    dependencies = [hrscTile['taskId'] for hrscTile in hrscTileInfoDict.itervalues()
+                    if 'taskId' in hrscTile]
+
+    tasks = []
+    useRefinedTransforms = REFINE_TILE_REGISTRATION and tileBackupPath
+    if useRefinedTransforms:
+        (refineCmd, refinedPaths) = getRefineTileRegistrationsCmd(hrscTileInfoDict, tileBackupPath)
+        if refineCmd:
+            tasks.append(('refine_' + tileId, dependencies, None, refineCmd))
+            dependencies = ['refine_' + tileId]
+
+    # The mosaic output is always regenerated so clear out any old one
+    (cmd, tempFilePath, hrscTiles) = getTileMosaicCmd(hrscTileInfoDict, outputTilePath, useRefinedTransforms)
+    if tempFilePath and os.path.exists(tempFilePath):
+        os.remove(tempFilePath)
+    tasks.append(('mosaic_' + tileId, dependencies, None, cmd))
+    return (tasks, ('mosaic_' + tileId, cmd, tempFilePath, outputTilePath, hrscTiles))
+
+def recoverInterruptedTileUpdates(outputTileFolder):
+    '''Finish or discard any journaled tile updates that were interrupted by a crash'''
+
+    tilePaths = set()
+    for fileName in os.listdir(outputTileFolder):
+        for extension in ['.journal', '.journal_partial']:
+            if fileName.endswith(extension):
+                tilePaths.add(os.path.join(outputTileFolder, fileName[:-len(extension)]))
+    if not tilePaths:
+        return
+
+    logger = logging.getLogger('MainProgram')
+    logger.info('Recovering interrupted updates to tiles: ' + str(sorted(tilePaths)))
+    if MosaicUtilities.runCmd('./hrscMosaic --recover ' + ' '.join(sorted(tilePaths))) != 0:
+        raise Exception('Failed to recover interrupted tile updates!')
     
     
 
@@ -272,6 +399,12 @@ def updateTilesContainingHrscImage(basemapInstance, hrscInstance, pool=None):
     if pool:
         logger.info('Initializing tile output tasks...')
     
+    # If the HRSC tiles are still waiting on their own tasks, each output tile is added to the
+    #  same task graph so it can be updated as soon as the HRSC tiles it uses are ready.
+    useTaskGraph = hrscInstance.hasPendingTileTasks()
+    graphTasks   = []
+    graphResults = []
+
     # Loop through all the tiles
     tileResults = []
     for tileIndex in outputTilesList:
@@ -298,18 +431,31 @@ def updateTilesContainingHrscImage(basemapInstance, hrscInstance, pool=None):
             continue
     
         # Update the selected tile with the HRSC image
-        if pool:
+        if useTaskGraph:
+            (tasks, finishInfo) = getTileUpdateTasks(hrscTileInfoDict, outputTilePath,
+                                                     tileBackupPath, tileIndex.getPostfix())
+            graphTasks += tasks
+            graphResults.append((finishInfo, tileLogPath))
+        elif pool:
             # Send the function and arguments to the thread pool
             dictCopy = copy.copy(hrscTileInfoDict)
             tileResults.append(pool.apply_async(updateTileWithHrscImage,
-                                                args=(dictCopy, outputTilePath, tileLogPath)))
+                                                args=(dictCopy, outputTilePath, tileLogPath, tileBackupPath)))
         else: # Just run the function
-            updateTileWithHrscImage(hrscTileInfoDict, outputTilePath, tileLogPath)
+            updateTileWithHrscImage(hrscTileInfoDict, outputTilePath, tileLogPath, tileBackupPath)
         
         #print 'DEBUG - only updating one tile!'
         #break
 
-    if pool: # Wait for all the tasks to complete
+    if useTaskGraph:
+        logger.info('Running the HRSC tile and output tile task graph...')
+        taskStatus = hrscInstance.runPendingTileTasks(graphTasks)
+        for ((taskId, cmd, tempFilePath, outputTilePath, hrscTiles), tileLogPath) in graphResults:
+            (tileLogPath, hrscTilePrefixList) = finishTileUpdate(cmd, tempFilePath, outputTilePath,
+                                                                 tileLogPath, hrscTiles, taskStatus[taskId])
+            basemapInstance.updateLog(tileLogPath, hrscSetName, hrscTilePrefixList)
+        logger.info('All tile writing tasks have completed')
+    elif pool: # Wait for all the tasks to complete
         logger.info('Finished initializing tile output tasks.')
         logger.info('Waiting for tile processes to complete...')
         for result in tileResults:
@@ -330,6 +476,110 @@ def updateTilesContainingHrscImage(basemapInstance, hrscInstance, pool=None):
     logger.info('Finished updating tiles for HRSC image ' + hrscSetName)
 
 
+def updateTilesContainingHrscBatch(basemapInstance, hrscInstanceList, pool=None):
+    '''Updates all output tiles containing any of the HRSC images in a batch.
+       - Each output tile is read and written once, pasting the HRSC tiles from
+         every image in batch order.
+       - The tile logs record each HRSC image separately, the same as updateTilesContainingHrscImage.'''
+
+    logger = logging.getLogger('MainProgram')
+    mainLogPath = basemapInstance.getMainLogPath()
+
+    # Skip the images we have already finished adding
+    pendingInstances = []
+    for hrscInstance in hrscInstanceList:
+        if basemapInstance.checkLog(mainLogPath, hrscInstance.getSetName()):
+            logger.info('Have already completed adding HRSC image ' + hrscInstance.getSetName() + ',  skipping it.')
+        else:
+            pendingInstances.append(hrscInstance)
+
+    # Invert the mapping to get the list of HRSC images covering each output tile
+    outputTileImages = collections.OrderedDict()
+    for hrscInstance in pendingInstances:
+        for tileIndex in getCoveredOutputTiles(basemapInstance, hrscInstance):
+            key = tileIndex.getPostfix()
+            if key not in outputTileImages:
+                outputTileImages[key] = (tileIndex, [])
+            outputTileImages[key][1].append(hrscInstance)
+    logger.info('HRSC batch covers ' + str(len(outputTileImages)) + ' output tiles.')
+
+    # Make sure all the output tiles exist before pasting on to them
+    outputTilesList = [tileIndex for (tileIndex, images) in outputTileImages.itervalues()]
+    basemapInstance.generateMultipleTileImages(outputTilesList, pool, force=False)
+
+    # The per-tile tasks of all the images are run in the same graph as the output tiles
+    graphTasks = []
+    for hrscInstance in pendingInstances:
+        graphTasks += hrscInstance.takePendingTileTasks()
+    useTaskGraph = len(graphTasks) > 0
+
+    tileUpdates = [] # (tileLogPath, HRSC tile prefixes for each set, pending result)
+    for (tileIndex, images) in outputTileImages.itervalues():
+
+        tileBounds = basemapInstance.getTileRectDegree(tileIndex)
+        (smallTilePath, largeTilePath, grayTilePath, outputTilePath, tileLogPath, tileBackupPath) = \
+            basemapInstance.getPathsForTile(tileIndex)
+
+        # Collect the HRSC tiles from every image that has not already been written to this tile
+        batchTileDict = collections.OrderedDict()
+        setPrefixes   = collections.OrderedDict()
+        for hrscInstance in images:
+            hrscSetName = hrscInstance.getSetName()
+            if basemapInstance.checkLog(tileLogPath, hrscSetName):
+                logger.info('-- Skipping already written tile: ' + str(tileIndex) + ' for ' + hrscSetName)
+                continue
+            hrscTileInfoDict = hrscInstance.getTileInfo(basemapInstance, tileBounds, tileIndex.getPostfix())
+            if not hrscTileInfoDict:
+                continue
+            prefixes = ''
+            for (key, hrscTile) in hrscTileInfoDict.iteritems():
+                batchTileDict[hrscSetName + '_' + key] = hrscTile
+                prefixes += hrscTile['prefix'] + ', '
+            setPrefixes[hrscSetName] = prefixes
+        if not batchTileDict:
+            continue
+
+        logger.info('Using HRSC images ' + str(setPrefixes.keys()) + ' to update tile: ' + str(tileIndex))
+        if useTaskGraph:
+            (tasks, finishInfo) = getTileUpdateTasks(batchTileDict, outputTilePath,
+                                                     tileBackupPath, tileIndex.getPostfix())
+            graphTasks += tasks
+            tileUpdates.append((tileLogPath, setPrefixes, finishInfo))
+        elif pool:
+            tileUpdates.append((tileLogPath, setPrefixes,
+                                pool.apply_async(updateTileWithHrscImage,
+                                                 args=(batchTileDict, outputTilePath, tileLogPath, tileBackupPath))))
+        else:
+            tileUpdates.append((tileLogPath, setPrefixes,
+                                updateTileWithHrscImage(batchTileDict, outputTilePath, tileLogPath, tileBackupPath)))
+
+    if useTaskGraph:
+        logger.info('Running the HRSC tile and output tile task graph...')
+        graphPath = os.path.join(HRSC_PROCESSING_FOLDER, 'batch_task_graph.txt')
+        taskStatus = MosaicUtilities.runTaskGraph(graphTasks, graphPath, multiprocessing.cpu_count())
+
+    # Record each HRSC image in the log of every tile it was pasted on to
+    for (tileLogPath, setPrefixes, update) in tileUpdates:
+        if useTaskGraph:
+            (taskId, cmd, tempFilePath, outputTilePath, hrscTiles) = update
+            (tileLogPath, hrscTiles) = finishTileUpdate(cmd, tempFilePath, outputTilePath, tileLogPath,
+                                                        hrscTiles, taskStatus[taskId])
+        elif pool:
+            (tileLogPath, hrscTiles) = update.get()
+        else:
+            (tileLogPath, hrscTiles) = update
+        for (hrscSetName, prefixes) in setPrefixes.iteritems():
+            if hrscTiles == 'FAILED':
+                prefixes = hrscTiles
+            basemapInstance.updateLog(tileLogPath, hrscSetName, prefixes)
+
+    # Log the fact that we have finished adding these HRSC images
+    for hrscInstance in pendingInstances:
+        basemapInstance.updateLog(mainLogPath, hrscInstance.getSetName())
+
+    logger.info('Finished updating tiles for HRSC batch ' + str([i.getSetName() for i in pendingInstances]))
+
+
 def generateAllUpsampledBasemapTiles(basemapInstance, pool):
     '''Generate all the basemap tiles from the input low-res image.
        There are 128*256 = 32,768 tiles in the full image, about 20,000 tiles
@@ -371,6 +621,7 @@ def mainProcessingFunction(options):
     logger.info('==== Initializing the base map object ====')
     basemapInstance = mosaicTileManager.MarsBasemap(FULL_BASEMAP_PATH, NEW_OUTPUT_TILE_FOLDER, BACKUP_FOLDER)
     basemapInstance.copySupportFilesFromBackupDir() # Copies the main log from the backup dir to output dir
+    recoverInterruptedTileUpdates(NEW_OUTPUT_TILE_FOLDER)
     basemapInputsUsedLog = basemapInstance.getMainLogPath()
     print 'CHECKING LOG PATH: ' + basemapInputsUsedLog
 
@@ -453,6 +704,7 @@ def mainProcessingFunction(options):
     processedDataSets = []
     failedDataSets    = []
     setProcessTimes   = []
+    batchInstances    = [] # (HRSC instance, preparation time) for the batch output tile update
     for i in range(0,numHrscDataSets): 
         
         # Get the name of this and the next data set
@@ -505,10 +757,17 @@ def mainProcessingFunction(options):
 
 
             # Complete the high resolution components
-            hrscInstance.prepHighResolutionProducts()
+            # - Any per-tile tasks are run along with the output tile updates
+            hrscInstance.prepHighResolutionProducts(deferTileTasks=True)
             
             logger.info('--- Finished initializing HRSC image ---\n')
 
+            if BATCH_OUTPUT_TILE_UPDATES:
+                # The output tiles are updated once the whole batch is ready
+                recordThumbnails(hrscSetName)
+                batchInstances.append((hrscInstance, time.time() - setStartTime))
+                continue
+
             # Call the function to update all the output images for this HRSC image
             updateTilesContainingHrscImage(basemapInstance, hrscInstance, processPool)
 
@@ -534,6 +793,26 @@ def mainProcessingFunction(options):
             failedSetsLogFile.write(hrscSetName)
                 
 
+    if batchInstances:
+        batchSetNames = [hrscInstance.getSetName() for (hrscInstance, prepTime) in batchInstances]
+        try:
+            batchStartTime = time.time()
+            updateTilesContainingHrscBatch(basemapInstance, [i for (i, t) in batchInstances], processPool)
+            logger.info('<<<<< Finished writing all tiles for this HRSC batch! >>>>>')
+
+            # Split the output tile time evenly between the images in the batch
+            batchTime = (time.time() - batchStartTime) / len(batchInstances)
+            for (hrscInstance, prepTime) in batchInstances:
+                processedDataSets.append((hrscInstance.getSetName(), hrscInstance.getBoundingBoxDegrees()))
+                setProcessTimes.append(prepTime + batchTime)
+        except Exception, e:
+            failedDataSets += batchSetNames
+            logger.error('Caught exception updating tiles for HRSC batch ' + str(batchSetNames) + '\n' +
+                         str(e) + '\n' + str(sys.exc_info()[0]) + '\n')
+            logger.error(traceback.format_exc())
+            for hrscSetName in batchSetNames:
+                failedSetsLogFile.write(hrscSetName)
+
     numHrscImagesProcessed = len(processedDataSets)
 
     failedSetsLogFile.close() # Close the failure list log file
@@ -595,7 +874,11 @@ def generateTreeAndEmail(startTime, numHrscImagesProcessed, setProcessTimes,
         if not options.skipKmlPyramid:
             try:
                 # Generate a KML pyramid of the tiles for diagnostics
-                kmlPyramidLocalPath  = stackImagePyramid.main(NEW_OUTPUT_TILE_FOLDER, KML_PYRAMID_FOLDER, processedDataSets)
+                dirtyListPath = None
+                if USE_INCREMENTAL_PYRAMID:
+                    dirtyListPath = DIRTY_TILE_LIST_PATH
+                kmlPyramidLocalPath  = stackImagePyramid.main(NEW_OUTPUT_TILE_FOLDER, KML_PYRAMID_FOLDER,
+                                                              processedDataSets, dirtyListPath)
                 pos                  = kmlPyramidLocalPath.find('/smcmich1')
                 kmlPyramidWebAddress = 'http://byss.arc.nasa.gov' + kmlPyramidLocalPath[pos:]
 
@@ -638,8 +921,8 @@ def generateTreeAndEmail(startTime, numHrscImagesProcessed, setProcessTimes,
     To undo the tile changes:
     rm  '''+NEW_OUTPUT_TILE_FOLDER+'''/*
 
-    To accept the tile changes:
-    rsync  --update --existing -avz '''+NEW_OUTPUT_TILE_FOLDER +'/ '+ BACKUP_FOLDER+'''/
+    To accept the tile changes (untouched tiles are links to the backups and are skipped):
+    rsync  --update --existing --no-links -avz '''+NEW_OUTPUT_TILE_FOLDER +'/ '+ BACKUP_FOLDER+'''/
     rm  '''+NEW_OUTPUT_TILE_FOLDER+'''/*
 
     To start the next batch, run:
@@ -688,6 +971,7 @@ def setGlobalConfigs(argsIn):
     global BAD_HRSC_FILE_PATH
     
     global NEW_OUTPUT_TILE_FOLDER
+    global DIRTY_TILE_LIST_PATH
     global HRSC_DOWNLOAD_FOLDER
     global HRSC_PROCESSING_FOLDER
     
@@ -741,6 +1025,7 @@ def setGlobalConfigs(argsIn):
     BAD_HRSC_FILE_PATH = os.path.join(REPO_FOLDER, 'MassUpload/badHrscSets.csv')
     
     NEW_OUTPUT_TILE_FOLDER = os.path.join(VOLATILE_FOLDER, 'hrscNewOutputTiles')
+    DIRTY_TILE_LIST_PATH   = os.path.join(NEW_OUTPUT_TILE_FOLDER, 'dirty_tiles.txt')
     HRSC_DOWNLOAD_FOLDER   = os.path.join(VOLATILE_FOLDER, 'hrscDownloadCache')
     HRSC_PROCESSING_FOLDER = os.path.join(VOLATILE_FOLDER, 'hrscProcessedFiles')
     
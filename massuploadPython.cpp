@@ -0,0 +1,313 @@
+
+#include <stdio.h>
+#include <opencv2/opencv.hpp>
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+
+#include <HrscCommon.h>
+
+namespace py = pybind11;
+
+/**
+  Python bindings for the HRSC processing kernels in the massupload library.
+
+  This lets hrscImageManager.py run the per-tile steps in-process instead of
+  starting one executable per tile and passing every result through a file.
+  - Images are passed as numpy arrays.  Input arrays are wrapped, not copied,
+    and output arrays share the memory of the OpenCV result.
+  - Transforms and brightness gains are float32 arrays in the same layout as
+    the CSV files the executables read.
+  - The GIL is released while the kernels run so they can be called from a
+    Python thread pool.
+*/
+
+//======================================================================================================
+
+/// Wrap a C contiguous numpy array in a cv::Mat without copying it.
+/// - Two dimensional arrays are single channel, a third dimension is the channel count.
+cv::Mat arrayToMat(py::array &array)
+{
+  if (!(array.flags() & py::array::c_style))
+    throw std::runtime_error("Input arrays must be C contiguous!");
+
+  int depth;
+  if (array.dtype().is(py::dtype::of<uint8_t>()))
+    depth = CV_8U;
+  else if (array.dtype().is(py::dtype::of<uint16_t>()))
+    depth = CV_16U;
+  else if (array.dtype().is(py::dtype::of<float>()))
+    depth = CV_32F;
+  else
+    throw std::runtime_error("Input arrays must be uint8, uint16, or float32!");
+
+  int channels = 1;
+  if (array.ndim() == 3)
+    channels = static_cast<int>(array.shape(2));
+  else if (array.ndim() == 1) // Treat as a column
+    return cv::Mat(static_cast<int>(array.shape(0)), 1, CV_MAKETYPE(depth, 1), array.mutable_data());
+  else if (array.ndim() != 2)
+    throw std::runtime_error("Input arrays must have one, two, or three dimensions!");
+
+  return cv::Mat(static_cast<int>(array.shape(0)), static_cast<int>(array.shape(1)),
+                 CV_MAKETYPE(depth, channels), array.mutable_data(), array.strides(0));
+}
+
+/// Capsule destructor which releases the cv::Mat that owns an output array's memory
+void releaseMat(void *mat)
+{
+  delete reinterpret_cast<cv::Mat*>(mat);
+}
+
+/// Wrap a cv::Mat in a numpy array without copying the pixels.
+py::array matToArray(const cv::Mat &mat)
+{
+  py::dtype dtype;
+  switch (mat.depth())
+  {
+    case CV_8U:  dtype = py::dtype::of<uint8_t >(); break;
+    case CV_16U: dtype = py::dtype::of<uint16_t>(); break;
+    case CV_32F: dtype = py::dtype::of<float   >(); break;
+    case CV_64F: dtype = py::dtype::of<double  >(); break;
+    default: throw std::runtime_error("Unsupported output image type!");
+  }
+
+  std::vector<ssize_t> shape, strides;
+  shape.push_back  (mat.rows);
+  shape.push_back  (mat.cols);
+  strides.push_back(mat.step[0]);
+  strides.push_back(mat.elemSize());
+  if (mat.channels() > 1)
+  {
+    shape.push_back  (mat.channels());
+    strides.push_back(mat.elemSize1());
+  }
+
+  // The new header holds a reference to the pixel data until the array is deleted
+  cv::Mat *owner = new cv::Mat(mat);
+  py::capsule base(owner, releaseMat);
+  return py::array(dtype, shape, strides, owner->data, base);
+}
+
+/// Convert a list of numpy arrays for the HRSC channels
+std::vector<cv::Mat> arraysToChannels(std::vector<py::array> &arrays)
+{
+  if (arrays.size() != NUM_HRSC_CHANNELS)
+    throw std::runtime_error("Wrong number of HRSC channels!");
+  std::vector<cv::Mat> channels(NUM_HRSC_CHANNELS);
+  for (size_t i=0; i<NUM_HRSC_CHANNELS; ++i)
+    channels[i] = arrayToMat(arrays[i]);
+  return channels;
+}
+
+//======================================================================================================
+// Wrapped functions
+
+py::array readImage(const std::string &path, const int imageType)
+{
+  cv::Mat image;
+  if (!readOpenCvImage(path, image, imageType))
+    throw std::runtime_error("Failed to read image " + path);
+  return matToArray(image);
+}
+
+void writeImage(const std::string &path, py::array image)
+{
+  if (!writeOpenCvImage(path, arrayToMat(image)))
+    throw std::runtime_error("Failed to write image " + path);
+}
+
+py::array readMask(const std::string &path)
+{
+  cv::Mat mask;
+  if (!readBinaryMask(path, mask, CV_16UC1, MASK_MAX))
+    throw std::runtime_error("Failed to read mask " + path);
+  return matToArray(mask);
+}
+
+py::array readTransformArray(const std::string &path)
+{
+  cv::Mat transform;
+  if (!readTransform(path, transform))
+    throw std::runtime_error("Failed to read transform " + path);
+  return matToArray(transform);
+}
+
+void writeTransformArray(const std::string &path, py::array transform)
+{
+  if (!writeTransform(path, arrayToMat(transform)))
+    throw std::runtime_error("Failed to write transform " + path);
+}
+
+py::tuple readBrightnessGains(const std::string &path)
+{
+  BrightnessCorrector corrector;
+  if (!corrector.readProfileCorrection(path))
+    throw std::runtime_error("Failed to read brightness gains " + path);
+  return py::make_tuple(matToArray(corrector.gain()), matToArray(corrector.offset()));
+}
+
+/// Returns the color pairs as an N x 8 uint8 array in the column order of the color pair files.
+py::array collectColorPairsArray(py::array basemap, py::array spatialTransform,
+                                 py::array gain, py::array offset,
+                                 std::vector<py::array> channelArrays, py::array mask,
+                                 const int rowOffset)
+{
+  cv::Mat basemapMat   = arrayToMat(basemap);
+  cv::Mat transformMat = arrayToMat(spatialTransform);
+  cv::Mat gainMat      = arrayToMat(gain);
+  cv::Mat offsetMat    = arrayToMat(offset);
+  cv::Mat maskMat      = arrayToMat(mask);
+  std::vector<cv::Mat> channels = arraysToChannels(channelArrays);
+  BrightnessCorrector corrector(gainMat, offsetMat);
+
+  std::vector<HrscColorPair> pairs;
+  {
+    py::gil_scoped_release release;
+    collectColorPairs(basemapMat, transformMat, corrector, channels, maskMat, pairs, rowOffset);
+  }
+
+  const size_t numCols = NUM_BASE_CHANNELS + NUM_HRSC_CHANNELS;
+  cv::Mat output(static_cast<int>(pairs.size()), numCols, CV_8UC1);
+  for (size_t i=0; i<pairs.size(); ++i)
+  {
+    for (size_t c=0; c<NUM_BASE_CHANNELS; ++c)
+      output.at<unsigned char>(i, c) = pairs[i].base[c];
+    for (size_t c=0; c<NUM_HRSC_CHANNELS; ++c)
+      output.at<unsigned char>(i, NUM_BASE_CHANNELS+c) = pairs[i].hrsc[c];
+  }
+  return matToArray(output);
+}
+
+py::array solveColorTransformArray(py::array pairArray)
+{
+  cv::Mat pairMat = arrayToMat(pairArray);
+  if ((pairMat.type() != CV_8UC1) || (pairMat.cols != NUM_BASE_CHANNELS + NUM_HRSC_CHANNELS))
+    throw std::runtime_error("Color pairs must be an N x 8 uint8 array!");
+
+  std::vector<HrscColorPair> pairs(pairMat.rows);
+  for (int i=0; i<pairMat.rows; ++i)
+  {
+    for (size_t c=0; c<NUM_BASE_CHANNELS; ++c)
+      pairs[i].base[c] = pairMat.at<unsigned char>(i, c);
+    for (size_t c=0; c<NUM_HRSC_CHANNELS; ++c)
+      pairs[i].hrsc[c] = pairMat.at<unsigned char>(i, NUM_BASE_CHANNELS+c);
+  }
+
+  cv::Mat transform;
+  if (!solveColorTransform(pairs, transform))
+    throw std::runtime_error("Failed to solve for the color transform!");
+  return matToArray(transform);
+}
+
+/// otherTiles is a list of (transform, weight, xOffset, yOffset) tuples for the adjacent tiles.
+py::array transformHrscColorArray(std::vector<py::array> channelArrays, py::array mask,
+                                  py::array gain, py::array offset,
+                                  py::array mainTransform, const double mainWeight,
+                                  std::vector<py::tuple> otherTiles)
+{
+  std::vector<cv::Mat> channels = arraysToChannels(channelArrays);
+  cv::Mat maskMat      = arrayToMat(mask);
+  cv::Mat gainMat      = arrayToMat(gain);
+  cv::Mat offsetMat    = arrayToMat(offset);
+  cv::Mat transformMat = arrayToMat(mainTransform);
+  BrightnessCorrector corrector(gainMat, offsetMat);
+
+  std::vector<cv::Mat>   otherTransforms(otherTiles.size());
+  std::vector<double>    otherWeights   (otherTiles.size());
+  std::vector<cv::Vec2i> otherOffsets   (otherTiles.size());
+  for (size_t i=0; i<otherTiles.size(); ++i)
+  {
+    py::array otherTransform = otherTiles[i][0].cast<py::array>();
+    otherTransforms[i] = arrayToMat(otherTransform);
+    otherWeights[i]    = otherTiles[i][1].cast<double>();
+    otherOffsets[i][0] = otherTiles[i][2].cast<int>();
+    otherOffsets[i][1] = otherTiles[i][3].cast<int>();
+  }
+
+  cv::Mat outputImage;
+  {
+    py::gil_scoped_release release;
+    transformHrscColor(channels, maskMat, corrector, outputImage, transformMat, mainWeight,
+                       otherTransforms, otherWeights, otherOffsets);
+  }
+  return matToArray(outputImage);
+}
+
+/// Returns the (transform, number of inliers) tuple, the transform is None if registration failed.
+py::tuple registerHrscArray(py::array basemap, py::array hrsc, py::array estimatedTransform,
+                            const double outputScale, const std::string &debugFolder)
+{
+  cv::Mat basemapMat   = arrayToMat(basemap);
+  cv::Mat hrscMat      = arrayToMat(hrsc);
+  cv::Mat estimatedMat = arrayToMat(estimatedTransform);
+
+  cv::Mat transform;
+  int numInliers;
+  {
+    py::gil_scoped_release release;
+    numInliers = registerHrscImage(basemapMat, hrscMat, estimatedMat, outputScale, debugFolder, transform);
+  }
+  if (!numInliers)
+    return py::make_tuple(py::none(), 0);
+  return py::make_tuple(matToArray(transform), numInliers);
+}
+
+/// inputs is a list of (HRSC image path, mask path, spatial transform path) tuples.
+void mosaicTile(const std::string &basePath, const std::string &outputPath,
+                std::vector<py::tuple> inputTuples, const std::string &dirtyListPath)
+{
+  std::vector<HrscMosaicInput> inputs(inputTuples.size());
+  for (size_t i=0; i<inputTuples.size(); ++i)
+  {
+    inputs[i].imagePath     = inputTuples[i][0].cast<std::string>();
+    inputs[i].maskPath      = inputTuples[i][1].cast<std::string>();
+    inputs[i].transformPath = inputTuples[i][2].cast<std::string>();
+  }
+
+  bool success;
+  {
+    py::gil_scoped_release release;
+    success = mosaicHrscTile(basePath, outputPath, inputs, dirtyListPath, useSimplePaste(outputPath));
+  }
+  if (!success)
+    throw std::runtime_error("Failed to update output tile " + outputPath);
+}
+
+//======================================================================================================
+
+PYBIND11_MODULE(massupload, m)
+{
+  m.doc() = "In-process versions of the HRSC processing tools.";
+
+  m.attr("NUM_HRSC_CHANNELS") = NUM_HRSC_CHANNELS;
+  m.attr("MASK_MAX")          = MASK_MAX;
+
+  m.def("read_image", &readImage, py::arg("path"), py::arg("image_type") = 0,
+        "Load an image with OpenCV or from an .hrt file, image_type is 0 for gray or 1 for BGR.");
+  m.def("write_image", &writeImage, py::arg("path"), py::arg("image"));
+  m.def("read_mask", &readMask, py::arg("path"),
+        "Load a binary mask the same way writeHrscColorPairs does, including packed masks.");
+  m.def("read_transform", &readTransformArray, py::arg("path"));
+  m.def("write_transform", &writeTransformArray, py::arg("path"), py::arg("transform"));
+  m.def("read_brightness_gains", &readBrightnessGains, py::arg("path"),
+        "Returns the (gain, offset) columns of a brightness gains file.");
+  m.def("collect_color_pairs", &collectColorPairsArray,
+        py::arg("basemap"), py::arg("spatial_transform"), py::arg("gain"), py::arg("offset"),
+        py::arg("channels"), py::arg("mask"), py::arg("row_offset") = 0,
+        "Sample basemap and HRSC color pairs the same way writeHrscColorPairs does.");
+  m.def("solve_color_transform", &solveColorTransformArray, py::arg("pairs"),
+        "Solve for the 6x3 HRSC color transform the same way solveHrscColor.py does.");
+  m.def("transform_hrsc_color", &transformHrscColorArray,
+        py::arg("channels"), py::arg("mask"), py::arg("gain"), py::arg("offset"),
+        py::arg("main_transform"), py::arg("main_weight"), py::arg("other_tiles"),
+        "Color transform an HRSC tile the same way transformHrscImageColor does.");
+  m.def("register_hrsc", &registerHrscArray,
+        py::arg("basemap"), py::arg("hrsc"), py::arg("estimated_transform"),
+        py::arg("output_scale") = 1.0, py::arg("debug_folder") = "",
+        "Register a gray HRSC image to a gray basemap the same way RegisterHrsc does.");
+  m.def("mosaic_tile", &mosaicTile,
+        py::arg("base_path"), py::arg("output_path"), py::arg("inputs"), py::arg("dirty_list_path") = "",
+        "Paste HRSC images on to an output tile the same way hrscMosaic does.");
+}
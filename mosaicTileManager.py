@@ -10,6 +10,16 @@ import logging
 import copyGeoTiffInfo
 import MosaicUtilities
 
+# Read basemap crops from a memory mapped copy of the basemap instead of writing each
+#  crop out with gdal_translate and decoding it again in every tool.
+USE_MAPPED_BASEMAP = True
+
+# The mapped basemap is kept in shared memory so every process uses the same copy
+MAPPED_BASEMAP_FOLDER = '/dev/shm'
+
+# Every backup tile is normally generated ahead of time, so a missing one is treated as an
+#  error.  Turn this on to generate missing backup tiles with upsampleBasemapTiles instead.
+ALLOW_BACKUP_TILE_GENERATION = False
 
 class MarsBasemap:
     '''
@@ -36,6 +46,7 @@ class MarsBasemap:
 
         # Derived output parameters
         self.resolutionIncrease = 128
+        self._basemapTileSize   = BASEMAP_TILE_WIDTH
         outputHeight = FULL_BASEMAP_HEIGHT*self.resolutionIncrease
         outputWidth  = FULL_BASEMAP_WIDTH *self.resolutionIncrease
         numTileRows  = FULL_BASEMAP_HEIGHT / BASEMAP_TILE_HEIGHT
@@ -56,6 +67,10 @@ class MarsBasemap:
         self.fullBasemapPath     = fullBasemapPath
         self.fullBasemapGrayPath = fullBasemapPath[:-4] + '_gray.tif'
         self._makeGrayBasemap()
+        self._lowResPixelRect = MosaicUtilities.Rectangle(0, FULL_BASEMAP_WIDTH, 0, FULL_BASEMAP_HEIGHT)
+        self.mappedBasemapPath = None
+        if USE_MAPPED_BASEMAP:
+            self._makeMappedBasemap()
         
         self._baseTileFolder = os.path.join(os.path.dirname(fullBasemapPath), 'basemap_tiles')
         if not os.path.exists(self._baseTileFolder):
@@ -89,6 +104,25 @@ class MarsBasemap:
             cmd = MosaicUtilities.GDAL_TRANSLATE_PATH+' -b 1 ' + self.fullBasemapPath +' '+ self.fullBasemapGrayPath
             MosaicUtilities.cmdRunner(cmd, self.fullBasemapGrayPath, False)
 
+    def _makeMappedBasemap(self):
+        '''Creates the memory mapped copy of the basemap if it does not already exist.
+           The size and modification time of the basemap are part of the name so a
+           changed basemap never reuses a stale copy.'''
+        prefix = os.path.splitext(os.path.basename(self.fullBasemapPath))[0] + '_mapped_'
+        info   = os.stat(self.fullBasemapPath)
+        name   = prefix + '%d_%d%s' % (info.st_size, int(info.st_mtime*1e9),
+                                       MosaicUtilities.MAPPED_BASEMAP_EXTENSION)
+        self.mappedBasemapPath = os.path.join(MAPPED_BASEMAP_FOLDER, name)
+        cmd = './makeMappedBasemap ' + self.fullBasemapPath +' '+ self.mappedBasemapPath
+        MosaicUtilities.cmdRunner(cmd, self.mappedBasemapPath, False)
+
+        # Copies of older versions of the basemap only use up shared memory.  Processes which
+        #  still have one mapped keep their mapping.
+        for oldName in os.listdir(MAPPED_BASEMAP_FOLDER):
+            if (oldName.startswith(prefix) and (oldName != name) and
+                    oldName.endswith(MosaicUtilities.MAPPED_BASEMAP_EXTENSION)):
+                os.remove(os.path.join(MAPPED_BASEMAP_FOLDER, oldName))
+
     #------------------------------------------------------------
     # Helper functions
 
@@ -99,6 +133,15 @@ class MarsBasemap:
         '''Get the path to the original full basemap image'''
         return self.fullBasemapPath
 
+    def getColorBasemapReadPath(self):
+        '''Get the path the C++ tools should read the full color basemap from'''
+        if self.mappedBasemapPath:
+            return self.getCroppedRegionPath(self._lowResPixelRect)
+        return self.fullBasemapPath
+
+    def hasMappedBasemap(self):
+        return self.mappedBasemapPath is not None
+
     #def getGrayBasemapPath(self):
     #    '''Get the path to the grayscale full basemap image'''
     #    return self.fullBasemapGrayPath
@@ -154,6 +197,11 @@ class MarsBasemap:
         '''Crops out a region of the original basemap image.'''
         boundingBoxProj = self._highResImage.degreeRectToProjectedRect(boundingBoxDegrees)
         self.makeCroppedRegionProjMeters(boundingBoxProj, outputPath, force)
+
+    def getCroppedRegionPath(self, pixelRect, isGray=False):
+        '''Returns a path the C++ tools can read a low resolution pixel region of the
+           mapped basemap from, nothing is written to disk.'''
+        return MosaicUtilities.getBasemapCropPath(self.mappedBasemapPath, pixelRect, isGray)
     
 
    
@@ -233,8 +281,13 @@ class MarsBasemap:
         if not os.path.exists(tileFolder):
             os.mkdir(tileFolder)
 
-        smallTilePath  = os.path.join(tileFolder, 'basemap_orig_res.tif')
-        grayTilePath   = os.path.join(tileFolder, 'basemap_orig_res_gray.tif')
+        if self.mappedBasemapPath: # The basemap tiles are read straight from the mapped basemap
+            tilePixelRect = self._lowResImage.getTileRectPixel(tileIndex)
+            smallTilePath = self.getCroppedRegionPath(tilePixelRect)
+            grayTilePath  = self.getCroppedRegionPath(tilePixelRect, True)
+        else:
+            smallTilePath  = os.path.join(tileFolder, 'basemap_orig_res.tif')
+            grayTilePath   = os.path.join(tileFolder, 'basemap_orig_res_gray.tif')
         largeTilePath  = os.path.join(tileFolder, 'basemap_output_res.tif') #DEFUNCT
         
         outputTileName = 'output_tile_'+tileIndex.getPostfix()+'.tif'
@@ -257,29 +310,33 @@ class MarsBasemap:
         degreeRoi = self.getTileRectDegree(tileIndex)
         self._logger.info('MosaicTileManager: Generating tile images for region: ' + str(degreeRoi))
 
-        # Crop out the section of the original base map for this tile
-        self.makeCroppedRegionDegrees(degreeRoi, smallTilePath)
+        if self.mappedBasemapPath: # The crops are read from the mapped basemap when they are used
+            cmd1 = ''
+        else:
+            # Crop out the section of the original base map for this tile
+            self.makeCroppedRegionDegrees(degreeRoi, smallTilePath)
 
-        # Generate a grayscale version of the small copy of this tile
-        cmd1 = (MosaicUtilities.GDAL_TRANSLATE_PATH+' -b 1 ' + smallTilePath +' '+ grayTilePath)
+            # Generate a grayscale version of the small copy of this tile
+            cmd1 = (MosaicUtilities.GDAL_TRANSLATE_PATH+' -b 1 ' + smallTilePath +' '+ grayTilePath)
 
         # Generate a copy of this tile at the full output resolution
         # - The image is blurred as it is upsampled so it does not look pixelated
         # - This operation is expensive and only needs to happen once per tile.
         # - All future tile updates will be pasted on top of this tile.
         if not os.path.exists(tileBackupPath):
+            if not ALLOW_BACKUP_TILE_GENERATION:
+                raise Exception('There should not be any tiles missing from the backup folder!\n'
+                                +tileBackupPath)
             self._logger.warning('MosaicTileManager: Generating missing base tile: ' + tileBackupPath)
-            raise Exception('There should not be any tiles missing from the backup folder!\n'
-                            +tileBackupPath) # Turn on to prevent unexpected tile generation!
             if os.path.exists(outputTilePath):
                 raise Exception('Output tile should never exist without backup file!')
-            cmd2 = ('/byss/smcmich1/programs/ImageMagick-6.9.1_install/bin/convert -monitor -define filter:blur=0.88 -filter quadratic -resize ' 
-                   + str(self.resolutionIncrease*100)+'% ' + smallTilePath +' '+ tileBackupPath)
+            cmd2 = self.getBackupTilesCmd([tileIndex])
         else: # Just make this a dummy command
             cmd2 = ':'
-        # If this tile does not yet exist in the output folder, copy the latest backup there
-        if not os.path.exists(outputTilePath):
-            cmd2 += ' && cp ' + tileBackupPath +' '+ outputTilePath
+        # If this tile does not yet exist in the output folder, link to the backup tile instead
+        #  of copying it.  The first update replaces the link with a new file.
+        if not os.path.lexists(outputTilePath):
+            cmd2 += ' && ln -s ' + os.path.abspath(tileBackupPath) +' '+ outputTilePath
 
         # Create the empty tile log file
         cmd = 'touch ' + tileLogPath
@@ -289,6 +346,15 @@ class MarsBasemap:
                     tileLogPath, tileBackupPath, cmd1, cmd2)
         
     
+    def getBackupTilesCmd(self, tileList):
+        '''Returns the command which generates the upsampled backup tiles for a list of tiles'''
+        cmd = ('./upsampleBasemapTiles --scale '+ str(self.resolutionIncrease)
+               +' --tile-size '+ str(self._basemapTileSize)
+               +' --read-path '+ self.getColorBasemapReadPath())
+        for tileIndex in tileList:
+            cmd += ' --tile %d,%d' % (tileIndex.row, tileIndex.col)
+        return cmd +' '+ self.fullBasemapPath +' '+ self._backupFolder
+
     def checkLog(self, logPath, name):
         '''Return True if the name exists in the log file'''
         with open(logPath, 'r') as f:
@@ -0,0 +1,413 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+
+#include <HrscCommon.h>
+
+
+
+/**
+  Program to refine the registration of high resolution HRSC tiles against
+  the upsampled basemap tile they are about to be pasted on to.
+
+  RegisterHrsc computes the registration at the low basemap resolution and the
+  translation is then scaled up to the output resolution, so any sub-pixel error
+  at low resolution becomes a multi-pixel error here.  This tool performs a small
+  radius normalized cross correlation search for each HRSC tile and writes out
+  a corrected tile to tile transform.
+
+  The search is performed coarse to fine:
+  - A grid of patches is matched at a reduced resolution over the full search radius.
+  - The most textured patches are then matched at full resolution in a window around
+    the coarse result to get the final sub-pixel offset.
+  - OpenCV's matchTemplate handles the vectorized correlation and the patches are
+    processed in parallel with cv::parallel_for_.
+  If not enough patches agree on an offset the input transform is written out unchanged.
+
+  Only the region of the base tile that the searches can reach is read, so the whole
+  upsampled tile is not decoded each time an output tile is updated.
+ */
+
+// Parameters controlling the search
+const int    DEFAULT_SEARCH_RADIUS    = 64;   // In full resolution pixels
+const int    COARSE_SCALE             = 8;    // Downsample factor for the coarse search
+const int    COARSE_PATCH_SIZE        = 64;   // In coarse pixels
+const int    FINE_PATCH_SIZE          = 256;  // In full resolution pixels
+const int    MAX_NUM_FINE_PATCHES     = 8;    // Only the most textured patches get refined
+const int    MIN_NUM_GOOD_PATCHES     = 4;    // Fewer agreeing patches than this and we give up
+const double MIN_PATCH_STDDEV         = 3.0;  // Skip patches that are too flat to match
+const double MIN_MATCH_SCORE          = 0.5;  // Minimum NCC peak value to accept a patch
+const double MAX_COARSE_DISAGREEMENT  = 1.5;  // In coarse pixels, relative to the median
+const double MAX_FINE_DISAGREEMENT    = 1.5;  // In full resolution pixels, relative to the median
+
+//=============================================================
+
+/// Match results for a single patch
+struct PatchMatch
+{
+  PatchMatch() : valid(false), score(0), stddev(0), dx(0), dy(0) {}
+  cv::Rect patchRoi; // In the HRSC tile
+  bool   valid;
+  double score;
+  double stddev;
+  double dx, dy;     // Offset from the expected position in the base tile
+};
+
+
+/// Fit a parabola to three samples and return the sub-pixel peak offset in the range -0.5 to 0.5
+double subPixelPeak(float left, float center, float right)
+{
+  const double denom = left - 2.0*center + right;
+  if (fabs(denom) < 1e-9)
+    return 0.0;
+  double offset = 0.5 * (left - right) / denom;
+  if (offset < -0.5) offset = -0.5;
+  if (offset >  0.5) offset =  0.5;
+  return offset;
+}
+
+/// Runs a NCC search for one patch and returns the offset of the best match
+/// - The search ROI must be the patch ROI expanded by radius in each direction.
+bool matchPatch(const cv::Mat &patch, const cv::Mat &baseImage, const cv::Rect &searchRoi,
+                const int radius, double &dx, double &dy, double &score)
+{
+  cv::Mat result;
+  cv::matchTemplate(baseImage(searchRoi), patch, result, cv::TM_CCOEFF_NORMED);
+
+  double    minVal, maxVal;
+  cv::Point minLoc, maxLoc;
+  cv::minMaxLoc(result, &minVal, &maxVal, &minLoc, &maxLoc);
+  score = maxVal;
+
+  // A peak on the edge of the search region is not trustworthy
+  if ((maxLoc.x == 0) || (maxLoc.y == 0) ||
+      (maxLoc.x == result.cols-1) || (maxLoc.y == result.rows-1))
+    return false;
+
+  dx = maxLoc.x - radius + subPixelPeak(result.at<float>(maxLoc.y, maxLoc.x-1),
+                                        result.at<float>(maxLoc.y, maxLoc.x  ),
+                                        result.at<float>(maxLoc.y, maxLoc.x+1));
+  dy = maxLoc.y - radius + subPixelPeak(result.at<float>(maxLoc.y-1, maxLoc.x),
+                                        result.at<float>(maxLoc.y,   maxLoc.x),
+                                        result.at<float>(maxLoc.y+1, maxLoc.x));
+  return true;
+}
+
+
+/// Parallel body which matches a list of patches against the base image
+class PatchMatcher : public cv::ParallelLoopBody
+{
+public:
+  PatchMatcher(const cv::Mat &hrscImage, const cv::Mat &hrscMask, const cv::Mat &baseImage,
+               const cv::Point &expectedOffset, const int radius, std::vector<PatchMatch> &matches)
+    : _hrscImage(hrscImage), _hrscMask(hrscMask), _baseImage(baseImage),
+      _expectedOffset(expectedOffset), _radius(radius), _matches(matches) {}
+
+  virtual void operator()(const cv::Range &range) const
+  {
+    const cv::Rect baseRoi(0, 0, _baseImage.cols, _baseImage.rows);
+    for (int i=range.start; i<range.end; ++i)
+    {
+      PatchMatch &match = _matches[i];
+      match.valid = false;
+
+      // Skip patches which are not completely covered by valid HRSC pixels
+      const cv::Rect &roi = match.patchRoi;
+      if (cv::countNonZero(_hrscMask(roi)) != roi.area())
+        continue;
+
+      // Skip patches which fall off the base image
+      cv::Rect searchRoi(roi.x + _expectedOffset.x - _radius,
+                         roi.y + _expectedOffset.y - _radius,
+                         roi.width + 2*_radius, roi.height + 2*_radius);
+      if ((searchRoi & baseRoi) != searchRoi)
+        continue;
+
+      // Skip patches with too little texture
+      cv::Scalar mean, stddev;
+      cv::meanStdDev(_hrscImage(roi), mean, stddev);
+      match.stddev = stddev[0];
+      if (match.stddev < MIN_PATCH_STDDEV)
+        continue;
+
+      if (!matchPatch(_hrscImage(roi), _baseImage, searchRoi, _radius,
+                      match.dx, match.dy, match.score))
+        continue;
+      match.valid = (match.score >= MIN_MATCH_SCORE);
+    }
+  }
+
+private:
+  const cv::Mat   &_hrscImage;
+  const cv::Mat   &_hrscMask;
+  const cv::Mat   &_baseImage;
+  const cv::Point  _expectedOffset;
+  const int        _radius;
+  std::vector<PatchMatch> &_matches;
+};
+
+
+/// Returns the median of a list of values
+double medianValue(std::vector<double> values)
+{
+  if (values.empty())
+    return 0;
+  std::sort(values.begin(), values.end());
+  return values[values.size()/2];
+}
+
+/// Keep only the valid matches which are consistent with the median offset and
+///  return the median offset of those matches.
+size_t findConsensusOffset(std::vector<PatchMatch> &matches, const double maxDisagreement,
+                           double &dx, double &dy)
+{
+  std::vector<double> xVals, yVals;
+  for (size_t i=0; i<matches.size(); ++i)
+  {
+    if (!matches[i].valid)
+      continue;
+    xVals.push_back(matches[i].dx);
+    yVals.push_back(matches[i].dy);
+  }
+  dx = medianValue(xVals);
+  dy = medianValue(yVals);
+
+  // Throw out outliers and recompute with what is left
+  xVals.clear();
+  yVals.clear();
+  for (size_t i=0; i<matches.size(); ++i)
+  {
+    if (!matches[i].valid)
+      continue;
+    if ((fabs(matches[i].dx - dx) > maxDisagreement) || (fabs(matches[i].dy - dy) > maxDisagreement))
+    {
+      matches[i].valid = false;
+      continue;
+    }
+    xVals.push_back(matches[i].dx);
+    yVals.push_back(matches[i].dy);
+  }
+  dx = medianValue(xVals);
+  dy = medianValue(yVals);
+  return xVals.size();
+}
+
+
+/// Compute the correction to the HRSC tile to base tile translation.
+/// - Returns false if a reliable correction could not be found.
+bool computeRegistrationCorrection(const cv::Mat &baseGray,     const cv::Mat &baseGrayCoarse,
+                                   const cv::Mat &hrscGray,     const cv::Mat &hrscMask,
+                                   const cv::Mat &spatialTransform, const int searchRadius,
+                                   double &dxOut, double &dyOut)
+{
+  const int colOffset = static_cast<int>(spatialTransform.at<float>(0, 2));
+  const int rowOffset = static_cast<int>(spatialTransform.at<float>(1, 2));
+
+  // Shrink the HRSC tile to the coarse search resolution
+  cv::Mat hrscCoarse, maskCoarse;
+  cv::resize(hrscGray, hrscCoarse, cv::Size(), 1.0/COARSE_SCALE, 1.0/COARSE_SCALE, cv::INTER_AREA);
+  cv::resize(hrscMask, maskCoarse, hrscCoarse.size(), 0, 0, cv::INTER_NEAREST);
+
+  // Lay out a grid of patches over the coarse HRSC tile
+  std::vector<PatchMatch> coarseMatches;
+  for (int r=0; r+COARSE_PATCH_SIZE<=hrscCoarse.rows; r+=COARSE_PATCH_SIZE)
+  {
+    for (int c=0; c+COARSE_PATCH_SIZE<=hrscCoarse.cols; c+=COARSE_PATCH_SIZE)
+    {
+      PatchMatch match;
+      match.patchRoi = cv::Rect(c, r, COARSE_PATCH_SIZE, COARSE_PATCH_SIZE);
+      coarseMatches.push_back(match);
+    }
+  }
+  if (coarseMatches.empty())
+    return false;
+
+  // Run the coarse search over the full radius
+  const int coarseRadius = std::max(1, searchRadius / COARSE_SCALE);
+  const cv::Point coarseOffset(cvRound(static_cast<double>(colOffset)/COARSE_SCALE),
+                               cvRound(static_cast<double>(rowOffset)/COARSE_SCALE));
+  cv::parallel_for_(cv::Range(0, static_cast<int>(coarseMatches.size())),
+                    PatchMatcher(hrscCoarse, maskCoarse, baseGrayCoarse, coarseOffset,
+                                 coarseRadius, coarseMatches));
+
+  double coarseDx, coarseDy;
+  size_t numGood = findConsensusOffset(coarseMatches, MAX_COARSE_DISAGREEMENT, coarseDx, coarseDy);
+  printf("Coarse search: %d of %d patches agree on offset (%lf, %lf)\n",
+         static_cast<int>(numGood), static_cast<int>(coarseMatches.size()), coarseDx, coarseDy);
+  if (numGood < MIN_NUM_GOOD_PATCHES)
+    return false;
+
+  // Pick out the most textured of the agreeing patches for the fine search
+  std::vector<PatchMatch> goodCoarse;
+  for (size_t i=0; i<coarseMatches.size(); ++i)
+    if (coarseMatches[i].valid)
+      goodCoarse.push_back(coarseMatches[i]);
+  std::sort(goodCoarse.begin(), goodCoarse.end(),
+            [](const PatchMatch &a, const PatchMatch &b) { return a.stddev > b.stddev; });
+  if (goodCoarse.size() > MAX_NUM_FINE_PATCHES)
+    goodCoarse.resize(MAX_NUM_FINE_PATCHES);
+
+  // Center a full resolution patch in each selected coarse patch
+  const cv::Rect hrscRoi(0, 0, hrscGray.cols, hrscGray.rows);
+  std::vector<PatchMatch> fineMatches;
+  for (size_t i=0; i<goodCoarse.size(); ++i)
+  {
+    const cv::Rect &coarseRoi = goodCoarse[i].patchRoi;
+    const int centerX = (coarseRoi.x + coarseRoi.width /2)*COARSE_SCALE;
+    const int centerY = (coarseRoi.y + coarseRoi.height/2)*COARSE_SCALE;
+    PatchMatch match;
+    match.patchRoi = cv::Rect(centerX - FINE_PATCH_SIZE/2, centerY - FINE_PATCH_SIZE/2,
+                              FINE_PATCH_SIZE, FINE_PATCH_SIZE);
+    if ((match.patchRoi & hrscRoi) == match.patchRoi)
+      fineMatches.push_back(match);
+  }
+
+  // The fine search only needs to cover the uncertainty left over from the coarse search
+  const int fineRadius = 2*COARSE_SCALE;
+  const cv::Point fineOffset(colOffset + cvRound(coarseDx*COARSE_SCALE),
+                             rowOffset + cvRound(coarseDy*COARSE_SCALE));
+  cv::parallel_for_(cv::Range(0, static_cast<int>(fineMatches.size())),
+                    PatchMatcher(hrscGray, hrscMask, baseGray, fineOffset,
+                                 fineRadius, fineMatches));
+
+  double fineDx, fineDy;
+  numGood = findConsensusOffset(fineMatches, MAX_FINE_DISAGREEMENT, fineDx, fineDy);
+  printf("Fine search: %d of %d patches agree on offset (%lf, %lf)\n",
+         static_cast<int>(numGood), static_cast<int>(fineMatches.size()), fineDx, fineDy);
+  if (numGood < MIN_NUM_GOOD_PATCHES/2)
+    return false;
+
+  dxOut = (fineOffset.x - colOffset) + fineDx;
+  dyOut = (fineOffset.y - rowOffset) + fineDy;
+
+  // Never move farther than the requested search radius
+  if ((fabs(dxOut) > searchRadius) || (fabs(dyOut) > searchRadius))
+    return false;
+  return true;
+}
+
+
+/// The inputs for one HRSC tile
+struct HrscTileInput
+{
+  cv::Mat gray;
+  cv::Mat mask;
+  cv::Mat spatialTransform;
+};
+
+/// Load the gray image, mask and transform of one HRSC tile
+bool loadHrscTile(const std::string &hrscPath, const std::string &hrscMaskPath,
+                  const std::string &transformPath, HrscTileInput &tile)
+{
+  const int LOAD_GRAY = 0;
+  const int LOAD_RGB  = 1;
+
+  cv::Mat hrscImage;
+  if (!readOpenCvImage(hrscPath, hrscImage, LOAD_RGB))
+    return false;
+  if (!readOpenCvImage(hrscMaskPath, tile.mask, LOAD_GRAY))
+    return false;
+  if (!readTransform(transformPath, tile.spatialTransform))
+    return false;
+  cv::cvtColor(hrscImage, tile.gray, cv::COLOR_BGR2GRAY);
+  return true;
+}
+
+/// Get the region of the base tile which the searches for an HRSC tile can touch
+cv::Rect getBaseSearchRegion(const HrscTileInput &tile, const int searchRadius)
+{
+  // Pad by a coarse pixel to cover the rounding of the coarse offset
+  const int padding = searchRadius + COARSE_SCALE;
+  const int colOffset = static_cast<int>(tile.spatialTransform.at<float>(0, 2));
+  const int rowOffset = static_cast<int>(tile.spatialTransform.at<float>(1, 2));
+  return cv::Rect(colOffset - padding, rowOffset - padding,
+                  tile.gray.cols + 2*padding, tile.gray.rows + 2*padding);
+}
+
+/// Refine the transform of one HRSC tile and write it out
+/// - The base images hold the region of the base tile starting at baseOrigin.
+bool refineTileTransform(const cv::Mat &baseGray, const cv::Mat &baseGrayCoarse,
+                         const cv::Point &baseOrigin, const HrscTileInput &tile,
+                         const std::string &hrscPath, const std::string &outputPath,
+                         const int searchRadius)
+{
+  // Search in the coordinates of the loaded base region
+  cv::Mat spatialTransform = tile.spatialTransform.clone();
+  spatialTransform.at<float>(0, 2) -= static_cast<float>(baseOrigin.x);
+  spatialTransform.at<float>(1, 2) -= static_cast<float>(baseOrigin.y);
+
+  cv::Mat outputTransform = tile.spatialTransform.clone();
+  double dx, dy;
+  if (computeRegistrationCorrection(baseGray, baseGrayCoarse, tile.gray, tile.mask,
+                                    spatialTransform, searchRadius, dx, dy))
+  {
+    printf("Applying registration correction (%lf, %lf) to %s\n", dx, dy, hrscPath.c_str());
+    outputTransform.at<float>(0, 2) += static_cast<float>(dx);
+    outputTransform.at<float>(1, 2) += static_cast<float>(dy);
+  }
+  else // Fall back to the input transform
+    printf("Unable to refine registration for %s, keeping the input transform.\n", hrscPath.c_str());
+
+  return writeTransform(outputPath, outputTransform);
+}
+
+//============================================================================
+
+
+int main(int argc, char** argv)
+{
+  // Check input arguments
+  if ((argc < 7) || ((argc - 3) % 4 != 0))
+  {
+    printf("usage: refineTileRegistration <Base Tile Path> <Search Radius> [<Hrsc Rgb Path> <Hrsc Mask Path> <Spatial Transform Path> <Output Transform Path>]...\n");
+    return -1;
+  }
+  std::string baseTilePath = argv[1];
+  int searchRadius = atoi(argv[2]);
+  if (searchRadius <= 0)
+    searchRadius = DEFAULT_SEARCH_RADIUS;
+
+  const int LOAD_GRAY = 0;
+
+  // Load all of the HRSC tiles first so that only the part of the base tile they
+  //  can be matched against has to be read.
+  const int numHrscTiles = (argc - 3) / 4;
+  std::vector<HrscTileInput> tiles(numHrscTiles);
+  cv::Rect baseRegion;
+  for (int i=0; i<numHrscTiles; ++i)
+  {
+    const int baseIndex = 3 + 4*i;
+    if (!loadHrscTile(argv[baseIndex], argv[baseIndex+1], argv[baseIndex+2], tiles[i]))
+    {
+      printf("Failed to load HRSC tile %s\n", argv[baseIndex]);
+      return -1;
+    }
+    const cv::Rect tileRegion = getBaseSearchRegion(tiles[i], searchRadius);
+    baseRegion = (i == 0) ? tileRegion : (baseRegion | tileRegion);
+  }
+
+  // Start the region on a coarse pixel so the coarse offsets line up with the full tile
+  const int alignedX = static_cast<int>(floor(static_cast<double>(baseRegion.x) / COARSE_SCALE))*COARSE_SCALE;
+  const int alignedY = static_cast<int>(floor(static_cast<double>(baseRegion.y) / COARSE_SCALE))*COARSE_SCALE;
+  baseRegion = cv::Rect(alignedX, alignedY, baseRegion.br().x - alignedX, baseRegion.br().y - alignedY);
+
+  // The base region is loaded once and shared by all of the HRSC tiles
+  cv::Mat baseGray, baseGrayCoarse;
+  if (!readOpenCvImageRegion(baseTilePath, baseRegion, baseGray, LOAD_GRAY))
+    return -1;
+  cv::resize(baseGray, baseGrayCoarse, cv::Size(), 1.0/COARSE_SCALE, 1.0/COARSE_SCALE, cv::INTER_AREA);
+
+  for (int i=0; i<numHrscTiles; ++i)
+  {
+    const int baseIndex = 3 + 4*i;
+    if (!refineTileTransform(baseGray, baseGrayCoarse, baseRegion.tl(), tiles[i],
+                             argv[baseIndex], argv[baseIndex+3], searchRadius))
+    {
+      printf("Failed to refine tile transform %s\n", argv[baseIndex+2]);
+      return -1;
+    }
+  }
+
+  return 0;
+}
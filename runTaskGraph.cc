@@ -0,0 +1,204 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2006-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NASA Vision Workbench is licensed under the Apache License,
+//  Version 2.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <vw/Core/Log.h>
+
+#include <map>
+#include <vector>
+
+#include <HrscCommon.h>
+
+#include <boost/program_options.hpp>
+#include <boost/thread.hpp>
+namespace po = boost::program_options;
+
+using namespace vw;
+
+/**
+  Runs a graph of command line tasks, starting each one as soon as the tasks it
+  depends on have finished.  This replaces running each processing stage over
+  all the tiles with pool.map, where one slow tile holds up the whole stage.
+
+  The graph file has one task per line with tab separated fields:
+    <task id>  <comma separated dependency ids>  <output path>  <command>
+  - Dependencies must be listed before the tasks that use them.
+  - The dependency and output path fields may be empty.
+  - A task with an existing output path is skipped unless --force is set, and
+    a task fails if it does not create its output path.  Output paths may be
+    "<container>::<key>" records.
+  - Tasks which depend on a failed task are not run.
+
+  --status-file writes one "<task id> <1 or 0>" line per task saying if it succeeded.
+*/
+
+//======================================================================================================
+
+struct Options {
+  std::string graph_file;
+  std::string status_file;
+  int         num_threads;
+  bool        force;
+};
+
+
+/// Run a single command from the graph
+bool runGraphCommand(const std::string &command, const std::string &outputPath, const bool force)
+{
+  if (!outputPath.empty() && !force && fileExists(outputPath))
+    return true;
+
+  const int  status    = system(command.c_str());
+  const bool succeeded = WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+  if (!succeeded)
+    printf("Task failed: %s\n", command.c_str());
+  if (outputPath.empty())
+    return succeeded;
+  if (!fileExists(outputPath))
+  {
+    printf("Task did not create output file: %s\n", outputPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+/// Load all the tasks in the graph file into the executor
+bool loadTaskGraph(const std::string &path, const bool force, TaskGraphExecutor &executor,
+                   std::vector<std::string> &taskIds)
+{
+  std::ifstream file(path.c_str());
+  if (file.fail())
+  {
+    printf("Failed to load task graph %s\n", path.c_str());
+    return false;
+  }
+
+  std::map<std::string, size_t> taskIndices;
+  std::string line;
+  while (std::getline(file, line))
+  {
+    if (line.empty())
+      continue;
+
+    // The command is everything after the third tab
+    std::vector<std::string> fields;
+    size_t start = 0;
+    for (int i=0; i<3; ++i)
+    {
+      const size_t tab = line.find('\t', start);
+      if (tab == std::string::npos)
+      {
+        printf("Bad task line: %s\n", line.c_str());
+        return false;
+      }
+      fields.push_back(line.substr(start, tab-start));
+      start = tab+1;
+    }
+    const std::string command = line.substr(start);
+
+    std::vector<size_t> dependencies;
+    std::stringstream depStream(fields[1]);
+    std::string depId;
+    while (std::getline(depStream, depId, ','))
+    {
+      if (depId.empty())
+        continue;
+      std::map<std::string, size_t>::const_iterator iter = taskIndices.find(depId);
+      if (iter == taskIndices.end())
+      {
+        printf("Task %s depends on unknown task %s\n", fields[0].c_str(), depId.c_str());
+        return false;
+      }
+      dependencies.push_back(iter->second);
+    }
+
+    taskIndices[fields[0]] = executor.addTask(boost::bind(runGraphCommand, command, fields[2], force),
+                                              dependencies);
+    taskIds.push_back(fields[0]);
+  }
+  return true;
+}
+
+//--------------------------------------------------------
+
+// Handling input
+void handle_arguments( int argc, char *argv[], Options& opt ) {
+
+  po::options_description general_options("");
+  general_options.add_options()
+    ("threads",     po::value(&opt.num_threads)->default_value(boost::thread::hardware_concurrency()),
+                    "Number of tasks to run at once.")
+    ("force",       po::bool_switch(&opt.force)->default_value(false), "Run tasks even if their output already exists.")
+    ("status-file", po::value(&opt.status_file), "Write whether each task succeeded to this file.")
+    ("help,h",      "Display this help message");
+
+  po::options_description positional("");
+  positional.add_options()
+    ("graph-file", po::value(&opt.graph_file));
+
+  po::positional_options_description positional_desc;
+  positional_desc.add("graph-file", 1);
+
+  po::options_description all_options;
+  all_options.add(general_options).add(positional);
+
+  po::variables_map vm;
+  try {
+    po::store( po::command_line_parser( argc, argv ).options(all_options).positional(positional_desc).run(), vm );
+    po::notify( vm );
+  } catch (const po::error& e) {
+    vw_throw( ArgumentErr() << "Error parsing input:\n\t"
+              << e.what() << general_options );
+  }
+
+  std::ostringstream usage;
+  usage << "Usage: " << argv[0] << " [options] <graph file>\n";
+
+  if ( vm.count("help") )
+    vw_throw( ArgumentErr() << usage.str() << general_options );
+  if ( opt.graph_file.empty() )
+    vw_throw( ArgumentErr() << "Missing graph file!\n" << usage.str() << general_options );
+}
+
+
+
+int main( int argc, char *argv[] ) {
+
+  Options opt;
+  handle_arguments( argc, argv, opt );
+
+  TaskGraphExecutor executor;
+  std::vector<std::string> taskIds;
+  if (!loadTaskGraph(opt.graph_file, opt.force, executor, taskIds))
+    return -1;
+
+  vw_out() << "Running " << executor.numTasks() << " tasks with " << opt.num_threads << " threads.\n";
+  const size_t numFailed = executor.run(opt.num_threads);
+
+  if (!opt.status_file.empty())
+  {
+    std::ofstream statusFile(opt.status_file.c_str());
+    for (size_t i=0; i<taskIds.size(); ++i)
+      statusFile << taskIds[i] << " " << (executor.taskSucceeded(i) ? 1 : 0) << std::endl;
+  }
+
+  if (numFailed > 0)
+  {
+    printf("%d tasks failed or were skipped.\n", static_cast<int>(numFailed));
+    return -1;
+  }
+  return 0;
+}
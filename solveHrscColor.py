@@ -4,6 +4,8 @@ import os
 import sys
 import numpy
 
+import MosaicUtilities
+
 '''
 This file computes an HRSC -> RGB transform given pixel pairs from
 the HRSC image and the input RGB basemap.
@@ -67,9 +69,8 @@ def solveTransform(inputPathList, outputPath):
     
     for path in inputPathList: # Loop through input files
 
-        # Loop through the lines in the file
-        fileHandle = open(path, 'r')
-        for line in fileHandle:
+        # Loop through the lines in the file, which may be in a container
+        for line in MosaicUtilities.readFileData(path).splitlines():
             # Break the line up into two seperate strings
             parts = line.strip().split(',')
             basePixel = [int(parts[0]), int(parts[1]), int(parts[2])]
@@ -85,8 +86,6 @@ def solveTransform(inputPathList, outputPath):
             # Keep a seperate list of just intensity values
             basePixelListY.append([basePixelYCC[0]]) # Y
             hrscPixelListY.append([hrscPixel[4]]) # Nadir
-            
-        fileHandle.close()
 
     targets  = numpy.matrix(basePixelList) # Strip last semicolons
     inputs   = numpy.matrix(hrscPixelList)
@@ -136,6 +135,12 @@ def solveTransform(inputPathList, outputPath):
     #print numpy.mean(abs(diff), axis=0)
 
     # Write the output transform to file
+    if MosaicUtilities.isBinaryMatrixPath(outputPath):
+        rows = [[transform[r,c] for c in range(numCols)] for r in range(numRows-1)]
+        rows.append([float(transformY), 0.0, 0.0]) # Extra row to store Y scaling
+        MosaicUtilities.writeBinaryMatrix(outputPath, rows)
+        print 'Finished writing out the transform file.'
+        return
     f = open(outputPath, 'w')
     f.write(str(numRows) +', '+ str(numCols) + '\n')
     for r in range(numRows-1):
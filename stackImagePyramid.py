@@ -18,6 +18,7 @@
 
 import os, glob, optparse, re, shutil, subprocess, sys, string
 import math
+import time
 import traceback
 import simplekml
 import MosaicUtilities
@@ -25,6 +26,10 @@ import MosaicUtilities
 ''' This tool takes a grid of image tiles that form the base of an image pyramid and
     constructs the lower resolution image tiles on top of them.
 '''
+
+# Build all of the pyramid tiles and their KML files with the buildImagePyramid tool
+#  instead of running gdal_translate or montage once per tile.
+USE_NATIVE_PYRAMID = True
 # TODO: Move this up to the Tools directory    
     
     
@@ -51,7 +56,7 @@ def getLevelFolder(outputFolder, level, isRelative=False):
 class KmlTreeMaker:
     '''Class to build a Google Earth KML tree for visualizing the output'''
     
-    def __init__(self, sourceFolder, outputFolder):
+    def __init__(self, sourceFolder, outputFolder, makeFillerTile=True):
         
         self.sourceFolder = sourceFolder
         self.outputFolder = outputFolder
@@ -69,8 +74,9 @@ class KmlTreeMaker:
         # The ImageMagick mosaic function we use requires a black image on
         #  disk to fill in for missing tiles so we make one here.
         self._fillerTilePath = os.path.join(outputFolder, 'filler.png')
-        cmd = 'convert -size 512x512 xc:black ' + self._fillerTilePath
-        MosaicUtilities.cmdRunner(cmd, self._fillerTilePath)
+        if makeFillerTile:
+            cmd = 'convert -size 512x512 xc:black ' + self._fillerTilePath
+            MosaicUtilities.cmdRunner(cmd, self._fillerTilePath)
         
         
     def makeLevel(self, level):
@@ -155,6 +161,48 @@ class KmlTreeMaker:
         
         
 
+    def getNumTiles(self, level):
+        '''Returns the number of tile positions in a level'''
+        self._addTileLayer(level)
+        return self._layerTilings[level].getTileIndexRect().area()
+
+    def makeAllLevels(self, maxNumLevels, dirtyListPath=None):
+        '''Build every level of the pyramid in one call to buildImagePyramid.
+           If a dirty tile list from hrscMosaic is provided and the pyramid already
+           exists, only the tiles above the changed output tiles are updated.'''
+        tileIndexRect = self._layerTilings[0].getTileIndexRect()
+        cmd = ('./buildImagePyramid --tile-size ' + str(self._tileSize)
+               +' --num-tile-rows '+ str(tileIndexRect.height())
+               +' --num-tile-cols '+ str(tileIndexRect.width()))
+
+        # Move the dirty list aside so new changes go to a new list.  The moved lists are
+        #  only deleted once the pyramid has been updated, so a failed update is retried.
+        buildingLists = []
+        if dirtyListPath:
+            if os.path.exists(dirtyListPath):
+                os.rename(dirtyListPath, dirtyListPath + '_building.' + str(int(time.time())))
+            buildingLists = glob.glob(dirtyListPath + '_building.*')
+
+        # Without an existing pyramid everything is built
+        pyramidExists = os.path.exists(os.path.join(self.outputFolder, 'tree.kml'))
+        if dirtyListPath and pyramidExists:
+            if not buildingLists:
+                print 'No output tiles changed, the pyramid is up to date.'
+            for path in buildingLists:
+                cmd += ' --dirty-list ' + path
+
+        if (not dirtyListPath) or (not pyramidExists) or buildingLists:
+            cmd += ' '+ self.sourceFolder +' '+ self.outputFolder
+            if MosaicUtilities.runCmd(cmd) != 0:
+                raise Exception('Failed to build the image pyramid!')
+        for path in buildingLists:
+            os.remove(path)
+
+        # Set up the same levels as the tool so finish() finds the top level
+        for level in range(0, maxNumLevels):
+            if self.getNumTiles(level) <= 1:
+                break
+
     def _hasTileLayer(self, level):
         '''Return True if a given layer of tiles has been created'''
         return len(self._layerTilings) > level
@@ -316,7 +364,7 @@ class KmlTreeMaker:
 
 def main(sourceFolder='/home/smcmich1/data/hrscMapTest/outputTiles/',
          outputFolder='/home/smcmich1/data/hrscMapTest/kmlTree/',
-         infoRects=[]):
+         infoRects=[], dirtyListPath=None):
 
     # First make a copy of each input tile in the output folder to form the base layer,
     #  but resize each of the tiles to 512 pixels to make the pyramid creation easier.
@@ -326,12 +374,15 @@ def main(sourceFolder='/home/smcmich1/data/hrscMapTest/outputTiles/',
 
     maxNumLevels = 20 # Make sure the tree does not get enormous
     
-    treeMaker = KmlTreeMaker(sourceFolder, outputFolder)
+    treeMaker = KmlTreeMaker(sourceFolder, outputFolder, not USE_NATIVE_PYRAMID)
 
-    for level in range(0, maxNumLevels):
-        tileList = treeMaker.makeLevel(level)
-        if len(tileList) <= 1:
-            break
+    if USE_NATIVE_PYRAMID:
+        treeMaker.makeAllLevels(maxNumLevels, dirtyListPath)
+    else:
+        for level in range(0, maxNumLevels):
+            tileList = treeMaker.makeLevel(level)
+            if len(tileList) <= 1:
+                break
             
     # Make a top level kml file!
     topLevelKmlPath = treeMaker.finish(infoRects)
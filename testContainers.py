@@ -0,0 +1,74 @@
+import os
+import sys
+import shutil
+import tempfile
+import unittest
+
+import MosaicUtilities
+
+'''
+Tests for the file container functions in MosaicUtilities.py, which share a
+file format with the C++ tools.  Run with "python testContainers.py".
+'''
+
+class ContainerTests(unittest.TestCase):
+
+    def setUp(self):
+        self._folder = tempfile.mkdtemp()
+        self._path   = os.path.join(self._folder, 'products.hrc')
+
+    def tearDown(self):
+        shutil.rmtree(self._folder)
+
+    def test_readBack(self):
+        '''The latest record for each key is read back'''
+        MosaicUtilities.appendContainerRecord(self._path, 'a', 'first')
+        MosaicUtilities.appendContainerRecord(self._path, 'b', 'second')
+        MosaicUtilities.appendContainerRecord(self._path, 'a', 'replaced')
+        self.assertEqual(MosaicUtilities.readContainerRecord(self._path, 'a'), 'replaced')
+        self.assertEqual(MosaicUtilities.readContainerRecord(self._path, 'b'), 'second')
+        self.assertEqual(MosaicUtilities.readContainerRecord(self._path, 'c'), None)
+        self.assertTrue (MosaicUtilities.pathExists(self._path + '::b'))
+        self.assertFalse(MosaicUtilities.pathExists(self._path + '::c'))
+
+    def test_indexCache(self):
+        '''The cached index picks up records appended after it was built'''
+        MosaicUtilities.appendContainerRecord(self._path, 'a', 'first')
+        self.assertEqual(MosaicUtilities.readContainerRecord(self._path, 'a'), 'first')
+        MosaicUtilities.appendContainerRecord(self._path, 'a', 'second')
+        MosaicUtilities.appendContainerRecord(self._path, 'b', 'other')
+        self.assertEqual(MosaicUtilities.readContainerRecord(self._path, 'a'), 'second')
+        self.assertTrue (MosaicUtilities.pathExists(self._path + '::b'))
+
+    def test_partialRecordRepair(self):
+        '''An append after a crash mid-record removes the partial record first'''
+        MosaicUtilities.appendContainerRecord(self._path, 'a', 'first')
+        MosaicUtilities.appendContainerRecord(self._path, 'b', 'second')
+        with open(self._path, 'r+b') as f: # Cut the last record short
+            f.truncate(os.path.getsize(self._path) - 3)
+        self.assertEqual(MosaicUtilities.readContainerRecord(self._path, 'b'), None)
+
+        MosaicUtilities.appendContainerRecord(self._path, 'c', 'third')
+        self.assertEqual(MosaicUtilities.readContainerRecord(self._path, 'a'), 'first')
+        self.assertEqual(MosaicUtilities.readContainerRecord(self._path, 'b'), None)
+        self.assertEqual(MosaicUtilities.readContainerRecord(self._path, 'c'), 'third')
+
+    def test_compaction(self):
+        '''Compaction keeps only the latest records and they still read back'''
+        for i in range(10):
+            MosaicUtilities.appendContainerRecord(self._path, 'a', 'version %d' % i)
+        MosaicUtilities.appendContainerRecord(self._path, 'b', 'only')
+        sizeBefore = os.path.getsize(self._path)
+        self.assertTrue(MosaicUtilities.compactContainer(self._path))
+        self.assertTrue(os.path.getsize(self._path) < sizeBefore)
+        self.assertEqual(MosaicUtilities.readContainerRecord(self._path, 'a'), 'version 9')
+        self.assertEqual(MosaicUtilities.readContainerRecord(self._path, 'b'), 'only')
+
+        # Nothing left to remove
+        self.assertFalse(MosaicUtilities.compactContainer(self._path))
+        MosaicUtilities.appendContainerRecord(self._path, 'c', 'after')
+        self.assertEqual(MosaicUtilities.readContainerRecord(self._path, 'c'), 'after')
+
+
+if __name__ == "__main__":
+    unittest.main()
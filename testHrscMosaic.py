@@ -0,0 +1,136 @@
+import os
+import sys
+import shutil
+import tempfile
+import unittest
+import subprocess
+
+'''
+Tests for hrscMosaic updating output tiles.  They need the built hrscMosaic tool in the
+current folder and the GDAL command line tools.  Run with "python testHrscMosaic.py".
+'''
+
+HRSC_MOSAIC_PATH = './hrscMosaic'
+
+TILE_SIZE     = 256
+BLOCK_SIZE    = 64
+HRSC_SIZE     = 32
+BASE_VALUE    = 50
+HRSC_VALUE    = 200
+MASK_FULL     = 1023 # MASK_MAX in HrscCore.h
+PASTE_COL     = 150 # Where the HRSC image goes in the tile
+PASTE_ROW     = 100
+
+def haveTools():
+    '''Returns true if the tools these tests run are available'''
+    if not os.path.exists(HRSC_MOSAIC_PATH):
+        return False
+    try:
+        subprocess.check_output(['gdal_translate', '--version'])
+    except (OSError, subprocess.CalledProcessError):
+        return False
+    return True
+
+def writePnm(path, width, height, channels, value, maxValue=255):
+    '''Write an image filled with one value as a PPM or PGM file'''
+    kind = 'P6' if channels == 3 else 'P5'
+    with open(path, 'wb') as f:
+        f.write('%s\n%d %d\n%d\n' % (kind, width, height, maxValue))
+        if maxValue > 255:
+            f.write((chr(value >> 8) + chr(value & 0xff)) * (width*height*channels))
+        else:
+            f.write(chr(value) * (width*height*channels))
+
+def readPpm(path):
+    '''Read an 8 bit PPM file, returns (width, height, data)'''
+    with open(path, 'rb') as f:
+        data = f.read()
+    fields = []
+    pos    = 0
+    while len(fields) < 4: # Magic, width, height, max value
+        while data[pos].isspace():
+            pos += 1
+        if data[pos] == '#':
+            pos = data.index('\n', pos)
+            continue
+        start = pos
+        while not data[pos].isspace():
+            pos += 1
+        fields.append(data[start:pos])
+    return (int(fields[1]), int(fields[2]), data[pos+1:])
+
+class HrscMosaicTests(unittest.TestCase):
+
+    def setUp(self):
+        self._folder = tempfile.mkdtemp()
+        self._tilePath      = os.path.join(self._folder, 'output_tile.tif')
+        self._hrscPath      = os.path.join(self._folder, 'hrsc.ppm')
+        self._maskPath      = os.path.join(self._folder, 'mask.pgm')
+        self._transformPath = os.path.join(self._folder, 'transform.txt')
+
+        # A tiled output tile, so only some of its blocks are rewritten
+        basePath = os.path.join(self._folder, 'base.ppm')
+        writePnm(basePath, TILE_SIZE, TILE_SIZE, 3, BASE_VALUE)
+        subprocess.check_output(['gdal_translate', '-co', 'TILED=YES', '-co', 'COMPRESS=DEFLATE',
+                                 '-co', 'BLOCKXSIZE=%d' % BLOCK_SIZE, '-co', 'BLOCKYSIZE=%d' % BLOCK_SIZE,
+                                 basePath, self._tilePath])
+
+        writePnm(self._hrscPath, HRSC_SIZE, HRSC_SIZE, 3, HRSC_VALUE)
+        writePnm(self._maskPath, HRSC_SIZE, HRSC_SIZE, 1, MASK_FULL, maxValue=65535)
+        with open(self._transformPath, 'w') as f: # HRSC to tile
+            f.write('3, 3\n1, 0, %d\n0, 1, %d\n0, 0, 1\n' % (PASTE_COL, PASTE_ROW))
+
+    def tearDown(self):
+        shutil.rmtree(self._folder)
+
+    def getTilePixel(self, col, row):
+        '''Returns the first channel of a pixel of the output tile'''
+        ppmPath = os.path.join(self._folder, 'check.ppm')
+        subprocess.check_output(['gdal_translate', '-of', 'PNM', self._tilePath, ppmPath])
+        (width, height, data) = readPpm(ppmPath)
+        return ord(data[3*(row*width + col)])
+
+    def test_journaledUpdateAtOffset(self):
+        '''An in-place update changes the pixels under an HRSC image pasted away from the origin'''
+        subprocess.check_output([HRSC_MOSAIC_PATH, self._tilePath, self._tilePath,
+                                 self._hrscPath, self._maskPath, self._transformPath])
+        self.assertEqual(self.getTilePixel(PASTE_COL+HRSC_SIZE/2, PASTE_ROW+HRSC_SIZE/2), HRSC_VALUE)
+        self.assertEqual(self.getTilePixel(PASTE_COL-1, PASTE_ROW-1), BASE_VALUE)
+        self.assertEqual(self.getTilePixel(10, 10), BASE_VALUE)
+        self.assertFalse(os.path.exists(self._tilePath + '.journal'))
+
+    def readDirtyRegions(self, listPath):
+        '''Returns the (col, row, width, height) regions recorded for the output tile'''
+        regions = []
+        with open(listPath, 'r') as f:
+            for line in f:
+                parts = line.split()
+                self.assertEqual(parts[0], self._tilePath)
+                regions.append(tuple(int(p) for p in parts[1:]))
+        return regions
+
+    def test_dirtyRegions(self):
+        '''The dirty tile list holds the region the HRSC image was pasted in to'''
+        listPath = os.path.join(self._folder, 'dirty_list.txt')
+        subprocess.check_output([HRSC_MOSAIC_PATH, '--dirty-list', listPath, self._tilePath, self._tilePath,
+                                 self._hrscPath, self._maskPath, self._transformPath])
+        self.assertEqual(self.readDirtyRegions(listPath), [(PASTE_COL, PASTE_ROW, HRSC_SIZE, HRSC_SIZE)])
+
+    def test_simplePasteDirtyRegions(self):
+        '''The no-blend paste used for debug tiles also records its dirty region'''
+        listPath  = os.path.join(self._folder, 'dirty_list.txt')
+        debugPath = os.path.join(self._folder, 'output_tile_debug.tif')
+        subprocess.check_output([HRSC_MOSAIC_PATH, '--dirty-list', listPath, self._tilePath, debugPath,
+                                 self._hrscPath, self._maskPath, self._transformPath])
+        regions = self.readDirtyRegions(listPath)
+        self.assertEqual(len(regions), 1)
+        (col, row, width, height) = regions[0]
+        self.assertTrue((col <= PASTE_COL) and (row <= PASTE_ROW))
+        self.assertTrue((col+width >= PASTE_COL+HRSC_SIZE) and (row+height >= PASTE_ROW+HRSC_SIZE))
+
+
+if __name__ == "__main__":
+    if not haveTools():
+        print 'Skipping the hrscMosaic tests, hrscMosaic or gdal_translate is missing.'
+        sys.exit(0)
+    unittest.main()
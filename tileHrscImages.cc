@@ -0,0 +1,242 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2006-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NASA Vision Workbench is licensed under the Apache License,
+//  Version 2.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <vw/Core/FundamentalTypes.h>
+#include <vw/Core/Log.h>
+#include <vw/Image/ImageIO.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/Cartography/GeoReference.h>
+
+#include <vector>
+
+#include <HrscCommon.h>
+
+#include <boost/program_options.hpp>
+namespace po = boost::program_options;
+
+using namespace vw;
+
+/**
+  This program splits the high resolution HRSC mask and channel images into
+  a grid of tiles, replacing one gdal_translate call per tile.
+
+  Each input image is read exactly once, one strip of tile rows at a time, and
+  all of the tiles in a strip are written out in parallel.  The mask is tiled
+  first and its valid pixel percentage decides which channel tiles get written.
+  A <tile>_metadata.json file is written next to every tile in the same format
+  that generateTileInfo in hrscImageManager.py produces.
+
+  Tiles are named <output prefix><tile row>_<tile col>.tif
+*/
+
+//======================================================================================================
+
+/// Matches MIN_TILE_PERCENT_PIXELS_VALID in hrscImageManager.py
+const double DEFAULT_MIN_PERCENT_VALID = 0.0001;
+
+struct Options {
+  // Input
+  std::string mask_file;
+  std::string mask_prefix;
+  std::vector<std::string> input_files;
+  std::vector<std::string> output_prefixes;
+
+  // Settings
+  int    tile_size;
+  double min_percent_valid;
+};
+
+/// Writes all of the selected tiles from one image strip to disk.
+template <class PixelT>
+class StripTileWriter : public cv::ParallelLoopBody
+{
+public:
+  StripTileWriter(const ImageView<PixelT> &strip, const std::vector<HrscTileInfo> &tiles,
+                  const cartography::GeoReference &georef, const std::string &prefix,
+                  const int stripStartRow)
+    : _strip(strip), _tiles(tiles), _georef(georef), _prefix(prefix),
+      _stripStartRow(stripStartRow) {}
+
+  virtual void operator()(const cv::Range &range) const
+  {
+    for (int i=range.start; i<range.end; ++i)
+    {
+      const HrscTileInfo &info = _tiles[i];
+      const std::string tilePath = getHrscTilePath(_prefix, info.tileRow, info.tileCol);
+
+      // The strip is already in memory so this is just a copy and a single threaded write.
+      ImageView<PixelT> tile = crop(_strip, info.pixelCol, info.pixelRow-_stripStartRow,
+                                    info.width, info.height);
+      cartography::GeoReference tileGeoref = cartography::crop(_georef, info.pixelCol, info.pixelRow);
+
+      boost::scoped_ptr<DiskImageResourceGDAL> rsrc( build_gdal_rsrc( tilePath, tile ) );
+      cartography::write_georeference(*rsrc, tileGeoref);
+      write_image( *rsrc, tile );
+
+      writeTileMetadata(tilePath, info);
+    }
+  }
+
+private:
+  const ImageView<PixelT>          &_strip;
+  const std::vector<HrscTileInfo>  &_tiles;
+  const cartography::GeoReference  &_georef;
+  const std::string                 _prefix;
+  const int                         _stripStartRow;
+};
+
+
+/// Read one strip of an image and write all of the requested tiles from it
+template <class PixelT>
+void writeStripTiles(const std::string &inputPath, const std::string &prefix,
+                     const cartography::GeoReference &georef,
+                     const BBox2i &stripRoi, const std::vector<HrscTileInfo> &tiles)
+{
+  if (tiles.empty())
+    return;
+  DiskImageView<PixelT> image(inputPath);
+  BBox2i safeRoi = stripRoi;
+  safeRoi.crop(bounding_box(image));
+  ImageView<PixelT> strip = crop(image, safeRoi);
+  cv::parallel_for_(cv::Range(0, static_cast<int>(tiles.size())),
+                    StripTileWriter<PixelT>(strip, tiles, georef, prefix, stripRoi.min().y()));
+}
+
+//--------------------------------------------------------
+
+// Handling input
+void handle_arguments( int argc, char *argv[], Options& opt ) {
+  size_t cache_size;
+  std::vector<std::string> positional_args;
+
+  po::options_description general_options("");
+  general_options.add_options()
+    ("tile-size",         po::value(&opt.tile_size)->default_value(4096), "Size of the output tiles in pixels.")
+    ("min-percent-valid", po::value(&opt.min_percent_valid)->default_value(DEFAULT_MIN_PERCENT_VALID),
+                          "Channel tiles with a lower fraction of valid mask pixels are not written.")
+    ("cache",             po::value(&cache_size)->default_value(1024), "Source data cache size, in megabytes.")
+    ("help,h",            "Display this help message");
+
+  po::options_description positional("");
+  positional.add_options()
+    ("input-files", po::value<std::vector<std::string> >(&positional_args));
+
+  po::positional_options_description positional_desc;
+  positional_desc.add("input-files", -1);
+
+  po::options_description all_options;
+  all_options.add(general_options).add(positional);
+
+  po::variables_map vm;
+  try {
+    po::store( po::command_line_parser( argc, argv ).options(all_options).positional(positional_desc).run(), vm );
+    po::notify( vm );
+  } catch (const po::error& e) {
+    vw_throw( ArgumentErr() << "Error parsing input:\n\t"
+              << e.what() << general_options );
+  }
+
+  std::ostringstream usage;
+  usage << "Usage: " << argv[0] << " [options] <mask path> <mask output prefix> "
+        << "[<image path> <image output prefix>]...\n";
+
+  if ( vm.count("help") )
+    vw_throw( ArgumentErr() << usage.str() << general_options );
+  if ( (positional_args.size() < 2) || (positional_args.size() % 2 != 0) )
+    vw_throw( ArgumentErr() << "Input paths and output prefixes must come in pairs!\n"
+                            << usage.str() << general_options );
+
+  opt.mask_file   = positional_args[0];
+  opt.mask_prefix = positional_args[1];
+  for (size_t i=2; i<positional_args.size(); i+=2)
+  {
+    opt.input_files.push_back    (positional_args[i  ]);
+    opt.output_prefixes.push_back(positional_args[i+1]);
+  }
+
+  // Set the system cache size
+  vw_settings().set_system_cache_size( cache_size*1024*1024 );
+}
+
+
+
+int main( int argc, char *argv[] ) {
+
+  Options opt;
+  handle_arguments( argc, argv, opt );
+
+  // All the images share the mask georeference
+  cartography::GeoReference georef;
+  cartography::read_georeference(georef, opt.mask_file);
+
+  typedef PixelGray<MASK_DATA_TYPE> MaskPixelT;
+  typedef PixelGray<uint8>          PixelT;
+  DiskImageView<MaskPixelT> mask(opt.mask_file);
+  const int numRows   = mask.rows();
+  const int numCols   = mask.cols();
+  const int tileSize  = opt.tile_size;
+  const int numTilesX = (numCols + tileSize - 1) / tileSize;
+  const int numTilesY = (numRows + tileSize - 1) / tileSize;
+  vw_out() << "Writing " << numTilesX*numTilesY << " tiles per image.\n";
+
+  // Process one strip of tiles at a time so that memory use stays bounded
+  TerminalProgressCallback progress("tileHrscImages","Tiling:");
+  for (int tileRow=0; tileRow<numTilesY; ++tileRow)
+  {
+    const int    pixelRow = tileRow*tileSize;
+    const int    height   = std::min(tileSize, numRows-pixelRow);
+    const BBox2i stripRoi(0, pixelRow, numCols, height);
+
+    // Load the mask strip and compute the valid percentage of each tile
+    ImageView<MaskPixelT> maskStrip = crop(mask, stripRoi);
+    std::vector<HrscTileInfo> maskTiles(numTilesX), channelTiles;
+    for (int tileCol=0; tileCol<numTilesX; ++tileCol)
+    {
+      HrscTileInfo &info = maskTiles[tileCol];
+      info.tileRow  = tileRow;
+      info.tileCol  = tileCol;
+      info.pixelRow = pixelRow;
+      info.pixelCol = tileCol*tileSize;
+      info.height   = height;
+      info.width    = std::min(tileSize, numCols-info.pixelCol);
+
+      size_t validCount = 0;
+      for (int r=0; r<info.height; ++r)
+        for (int c=info.pixelCol; c<info.pixelCol+info.width; ++c)
+          if (maskStrip(c, r)[0] != 0)
+            ++validCount;
+      info.percentValid = static_cast<double>(validCount) /
+                          (static_cast<double>(info.height)*static_cast<double>(info.width));
+      if (info.percentValid >= opt.min_percent_valid)
+        channelTiles.push_back(info);
+    }
+
+    // The mask tiles are always written, channel tiles only where there is valid data.
+    cv::parallel_for_(cv::Range(0, numTilesX),
+                      StripTileWriter<MaskPixelT>(maskStrip, maskTiles, georef, opt.mask_prefix, pixelRow));
+    for (size_t i=0; i<opt.input_files.size(); ++i)
+      writeStripTiles<PixelT>(opt.input_files[i], opt.output_prefixes[i], georef, stripRoi, channelTiles);
+
+    progress.report_fractional_progress(tileRow+1, numTilesY);
+  }
+  progress.report_finished();
+
+  return 0;
+}
@@ -0,0 +1,236 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2006-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NASA Vision Workbench is licensed under the Apache License,
+//  Version 2.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <vw/Core/FundamentalTypes.h>
+#include <vw/Core/Log.h>
+#include <vw/Image/ImageIO.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/Cartography/GeoReference.h>
+
+#include <vector>
+
+#include <HrscCommon.h>
+
+#include <boost/program_options.hpp>
+namespace po = boost::program_options;
+
+using namespace vw;
+
+/**
+  This program color transforms an entire HRSC image in one process.
+
+  The inputs are the full resolution warped channels and grassfire mask instead
+  of the split tiles.  HrscColorTransformView computes the color of each block
+  on request so Vision Workbench rasterizes the image with its own threads and
+  input cache, and no channel or mask tiles need to be read back from disk.
+
+  The tile list is a CSV file with one line per HRSC tile:
+    tileRow, tileCol, percentValid, colorTransformPath, outputPath
+  Each tile with an output path is written to that file, which is the same
+  output transformHrscImageColor produces, including the intermediate format for
+  .hrt paths.  --output-image writes the whole image.
+*/
+
+//======================================================================================================
+
+struct Options {
+  // Input
+  std::vector<std::string> input_files;
+
+  // Settings
+  std::string brightness_file;
+  double      brightness_scale;
+  std::string tile_list_file;
+  int         tile_size;
+  std::string output_image;
+};
+
+/// Output path for one of the tiles
+struct TileOutput
+{
+  int tileRow, tileCol;
+  std::string path;
+};
+
+
+/// Load the tile list and all of the color transforms it points to
+bool loadTileList(const std::string &path, const int numTileRows, const int numTileCols,
+                  std::vector<std::vector<HrscTileColorInfo> > &tiles,
+                  std::vector<TileOutput> &outputs)
+{
+  tiles.assign(numTileRows, std::vector<HrscTileColorInfo>(numTileCols));
+  std::ifstream file(path.c_str());
+  if (file.fail())
+  {
+    printf("Failed to load tile list %s\n", path.c_str());
+    return false;
+  }
+  std::string line;
+  while (std::getline(file, line))
+  {
+    // Split the line on commas
+    std::vector<std::string> parts;
+    std::stringstream lineStream(line);
+    std::string part;
+    while (std::getline(lineStream, part, ','))
+    {
+      const size_t start = part.find_first_not_of(' ');
+      parts.push_back((start == std::string::npos) ? "" : part.substr(start));
+    }
+    if (parts.size() < 4)
+      continue;
+
+    const int tileRow = atoi(parts[0].c_str());
+    const int tileCol = atoi(parts[1].c_str());
+    if ((tileRow < 0) || (tileRow >= numTileRows) || (tileCol < 0) || (tileCol >= numTileCols))
+    {
+      printf("Tile %d, %d is outside the image!\n", tileRow, tileCol);
+      return false;
+    }
+    HrscTileColorInfo &info = tiles[tileRow][tileCol];
+    info.percentValid = atof(parts[2].c_str());
+    if (!readTransform(parts[3], info.colorTransform))
+      return false;
+    info.valid = true;
+
+    if (parts.size() > 4)
+    {
+      TileOutput output;
+      output.tileRow = tileRow;
+      output.tileCol = tileCol;
+      output.path    = parts[4];
+      outputs.push_back(output);
+    }
+  }
+  return true;
+}
+
+//--------------------------------------------------------
+
+// Handling input
+void handle_arguments( int argc, char *argv[], Options& opt ) {
+  size_t cache_size;
+
+  po::options_description general_options("");
+  general_options.add_options()
+    ("brightness-gains", po::value(&opt.brightness_file), "Brightness gains file for the whole image.")
+    ("brightness-scale", po::value(&opt.brightness_scale)->default_value(1.0),
+                         "Brightness gain rows per image row, if the gains were computed at a lower resolution.")
+    ("tile-list",        po::value(&opt.tile_list_file), "CSV file listing each tile and its color transform.")
+    ("tile-size",        po::value(&opt.tile_size)->default_value(4096), "Size of the HRSC tiles in pixels.")
+    ("output-image",     po::value(&opt.output_image), "Also write the entire color transformed image to this path.")
+    ("cache",            po::value(&cache_size)->default_value(1024), "Source data cache size, in megabytes.")
+    ("help,h",           "Display this help message");
+
+  po::options_description positional("");
+  positional.add_options()
+    ("input-files", po::value<std::vector<std::string> >(&opt.input_files));
+
+  po::positional_options_description positional_desc;
+  positional_desc.add("input-files", -1);
+
+  po::options_description all_options;
+  all_options.add(general_options).add(positional);
+
+  po::variables_map vm;
+  try {
+    po::store( po::command_line_parser( argc, argv ).options(all_options).positional(positional_desc).run(), vm );
+    po::notify( vm );
+  } catch (const po::error& e) {
+    vw_throw( ArgumentErr() << "Error parsing input:\n\t"
+              << e.what() << general_options );
+  }
+
+  std::ostringstream usage;
+  usage << "Usage: " << argv[0] << " [options] <HRSC Red> <HRSC Green> <HRSC Blue> <HRSC NIR> <HRSC Nadir> <HRSC Mask>\n";
+
+  if ( vm.count("help") )
+    vw_throw( ArgumentErr() << usage.str() << general_options );
+  if ( opt.input_files.size() != NUM_HRSC_CHANNELS+1 )
+    vw_throw( ArgumentErr() << "Wrong number of input files!\n" << usage.str() << general_options );
+  if ( opt.brightness_file.empty() || opt.tile_list_file.empty() )
+    vw_throw( ArgumentErr() << "The brightness gains and tile list are required!\n" << usage.str() << general_options );
+
+  // Set the system cache size
+  vw_settings().set_system_cache_size( cache_size*1024*1024 );
+}
+
+
+
+int main( int argc, char *argv[] ) {
+
+  Options opt;
+  handle_arguments( argc, argv, opt );
+
+  // Load the full resolution input images
+  std::vector<HrscColorTransformView::ChannelViewT> channels(NUM_HRSC_CHANNELS);
+  for (size_t i=0; i<NUM_HRSC_CHANNELS; ++i)
+    channels[i] = DiskImageView<PixelGray<uint8> >(opt.input_files[i]);
+  const std::string maskPath = opt.input_files[NUM_HRSC_CHANNELS];
+  DiskImageView<PixelGray<MASK_DATA_TYPE> > mask(maskPath);
+
+  cartography::GeoReference georef;
+  cartography::read_georeference(georef, maskPath);
+
+  // Expand the brightness correction to one value per image row
+  BrightnessCorrector corrector;
+  if (!corrector.readProfileCorrection(opt.brightness_file))
+    return -1;
+  corrector.resample(opt.brightness_scale, mask.rows());
+
+  const int numTileRows = (mask.rows() + opt.tile_size - 1) / opt.tile_size;
+  const int numTileCols = (mask.cols() + opt.tile_size - 1) / opt.tile_size;
+  std::vector<std::vector<HrscTileColorInfo> > tiles;
+  std::vector<TileOutput> outputs;
+  if (!loadTileList(opt.tile_list_file, numTileRows, numTileCols, tiles, outputs))
+    return -1;
+
+  HrscColorTransformView colorImage(channels, mask, corrector, tiles, opt.tile_size);
+
+  if (!opt.output_image.empty())
+  {
+    vw_out() << "Writing: " << opt.output_image << std::endl;
+    block_write_gdal_image(opt.output_image, colorImage, georef,
+                           TerminalProgressCallback("transformHrscImageStrip","Writing:"));
+  }
+
+  // Each output tile only rasterizes its own region of the view
+  for (size_t i=0; i<outputs.size(); ++i)
+  {
+    const TileOutput &output = outputs[i];
+    const int minCol = output.tileCol*opt.tile_size;
+    const int minRow = output.tileRow*opt.tile_size;
+    BBox2i roi(minCol, minRow, opt.tile_size, opt.tile_size);
+    roi.crop(bounding_box(colorImage));
+
+    vw_out() << "Writing: " << output.path << std::endl;
+    if (isIntermediateImagePath(output.path))
+    {
+      if (!write_opencv_rgb_image(output.path, crop(colorImage, roi)))
+        return -1;
+      continue;
+    }
+    block_write_gdal_image(output.path, crop(colorImage, roi),
+                           cartography::crop(georef, minCol, minRow),
+                           TerminalProgressCallback("transformHrscImageStrip","Writing:"));
+  }
+
+  return 0;
+}
@@ -0,0 +1,419 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2006-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NASA Vision Workbench is licensed under the Apache License,
+//  Version 2.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <vw/Core/Log.h>
+#include <vw/Core/ProgressCallback.h>
+
+#include <vector>
+#include <cmath>
+
+#include <HrscCommon.h>
+
+#include <boost/program_options.hpp>
+namespace po = boost::program_options;
+
+using namespace vw;
+
+/**
+  This program generates the high resolution backup tiles from the low resolution
+  basemap, replacing the ImageMagick call:
+    convert -define filter:blur=0.88 -filter quadratic -resize 12800%
+
+  The same blurred quadratic filter is applied as two separable passes, each split
+  across threads with parallel_for_.  Each tile is computed from its own region of
+  the basemap plus a small halo, so the tiles match along their edges, and is written
+  straight to a tiled, compressed GeoTIFF with internal overviews.  Any subset of the tiles can be regenerated.
+  Only the region of the basemap each tile needs is read, so regenerating a few tiles does
+  not decode the whole basemap.  compareBackupTile.py checks a tile against ImageMagick.
+
+  Tiles are named <output folder>/output_tile_<row>_<col>.tif to match mosaicTileManager.py
+*/
+
+//======================================================================================================
+
+struct Options {
+  // Input
+  std::string basemap_file;
+  std::string read_path;
+  std::string output_folder;
+  std::vector<std::string> tiles;
+  std::string tile_list_file;
+
+  // Settings
+  double scale;
+  double blur;
+  int    tile_size;
+  int    block_size;
+  std::string compression;
+  int    compression_level;
+  bool   direct_io;
+  int    num_threads;
+};
+
+/// The ImageMagick quadratic filter, a quadratic B-spline approximation of a Gaussian.
+const double QUADRATIC_FILTER_SUPPORT = 1.5;
+double quadraticFilter(const double x)
+{
+  const double ax = fabs(x);
+  if (ax < 0.5)
+    return 0.75 - ax*ax;
+  if (ax < 1.5)
+    return 0.5*(ax-1.5)*(ax-1.5);
+  return 0.0;
+}
+
+/// The input pixels and weights used to compute each output pixel along one axis.
+/// - Every output pixel uses numTaps consecutive inputs, unused taps have zero weight.
+struct ResampleTaps
+{
+  int numTaps;
+  std::vector<int>   starts;  // First input pixel, relative to the loaded region
+  std::vector<float> weights; // numTaps weights per output pixel
+};
+
+/// Compute the resampling taps along one axis.
+/// - Coordinates are global so the filter window is clipped at the basemap edge just
+///   like ImageMagick does, but not at the edge of the tile.
+/// - outputStart and numOutputs are in output pixels, the inputs are loaded starting at inputStart.
+void computeResampleTaps(const int outputStart, const int numOutputs,
+                         const int inputStart,  const int numInputs, const int fullInputSize,
+                         const double scale, const double blur, ResampleTaps &taps)
+{
+  // When enlarging ImageMagick stretches the filter by the blur factor only
+  const double support = std::max(0.5, QUADRATIC_FILTER_SUPPORT*blur);
+  taps.numTaps = std::min(static_cast<int>(2.0*support + 3.0), numInputs);
+  taps.starts.resize(numOutputs);
+  taps.weights.assign(numOutputs*taps.numTaps, 0.0f);
+
+  const int minInput = std::max(0, inputStart);
+  const int maxInput = std::min(fullInputSize, inputStart+numInputs);
+  std::vector<double> weights;
+  for (int i=0; i<numOutputs; ++i)
+  {
+    // Input pixel centers are at +0.5
+    const double center = (outputStart + i + 0.5) / scale;
+    const int    start  = std::max(static_cast<int>(center - support + 0.5), minInput);
+    const int    stop   = std::min(static_cast<int>(center + support + 0.5), maxInput);
+
+    double density = 0.0;
+    weights.clear();
+    for (int j=start; j<stop; ++j)
+    {
+      weights.push_back(quadraticFilter((j + 0.5 - center) / blur));
+      density += weights.back();
+    }
+    if (density == 0.0)
+      density = 1.0;
+
+    // Shift the window so all of the taps stay inside the loaded region
+    const int first = std::min(start-inputStart, numInputs-taps.numTaps);
+    taps.starts[i] = first;
+    float *outWeights = &taps.weights[i*taps.numTaps];
+    for (size_t j=0; j<weights.size(); ++j)
+      outWeights[start-inputStart-first+j] = static_cast<float>(weights[j] / density);
+  }
+}
+
+/// Resample each input row horizontally in to a floating point image.
+class HorizontalResampler : public cv::ParallelLoopBody
+{
+public:
+  HorizontalResampler(const cv::Mat &input, const ResampleTaps &taps, cv::Mat &output)
+    : _input(input), _taps(taps), _output(output) {}
+
+  virtual void operator()(const cv::Range &range) const
+  {
+    const int numTaps = _taps.numTaps;
+    for (int r=range.start; r<range.end; ++r)
+    {
+      const unsigned char *inRow  = _input.ptr<unsigned char>(r);
+      float               *outRow = _output.ptr<float>(r);
+      for (int c=0; c<_output.cols; ++c)
+      {
+        const unsigned char *in = inRow + 3*_taps.starts[c];
+        const float         *w  = &_taps.weights[c*numTaps];
+        float b=0, g=0, red=0;
+        for (int t=0; t<numTaps; ++t)
+        {
+          b   += w[t]*in[3*t  ];
+          g   += w[t]*in[3*t+1];
+          red += w[t]*in[3*t+2];
+        }
+        outRow[3*c  ] = b;
+        outRow[3*c+1] = g;
+        outRow[3*c+2] = red;
+      }
+    }
+  }
+
+private:
+  const cv::Mat      &_input;
+  const ResampleTaps &_taps;
+  cv::Mat            &_output;
+};
+
+/// Resample the horizontally resampled rows vertically in to the output tile.
+/// - Each output row is a weighted sum of a few whole rows, which the compiler vectorizes.
+class VerticalResampler : public cv::ParallelLoopBody
+{
+public:
+  VerticalResampler(const cv::Mat &input, const ResampleTaps &taps, cv::Mat &output)
+    : _input(input), _taps(taps), _output(output) {}
+
+  virtual void operator()(const cv::Range &range) const
+  {
+    const int numTaps   = _taps.numTaps;
+    const int rowLength = 3*_output.cols;
+    std::vector<float> sum(rowLength);
+    for (int r=range.start; r<range.end; ++r)
+    {
+      const float *w = &_taps.weights[r*numTaps];
+      std::fill(sum.begin(), sum.end(), 0.0f);
+      for (int t=0; t<numTaps; ++t)
+      {
+        const float *in     = _input.ptr<float>(_taps.starts[r]+t);
+        const float  weight = w[t];
+        for (int i=0; i<rowLength; ++i)
+          sum[i] += weight*in[i];
+      }
+      unsigned char *outRow = _output.ptr<unsigned char>(r);
+      for (int i=0; i<rowLength; ++i)
+        outRow[i] = cv::saturate_cast<unsigned char>(sum[i]);
+    }
+  }
+
+private:
+  const cv::Mat      &_input;
+  const ResampleTaps &_taps;
+  cv::Mat            &_output;
+};
+
+/// Get the region of the basemap needed to upsample a tile, the tile plus enough of a
+/// halo to cover the filter.
+cv::Rect getTileInputRoi(const cv::Rect &tileRoi, const cv::Size &basemapSize, const Options &opt)
+{
+  const int halo = static_cast<int>(ceil(QUADRATIC_FILTER_SUPPORT*opt.blur)) + 1;
+  cv::Rect inputRoi(tileRoi.x-halo, tileRoi.y-halo, tileRoi.width+2*halo, tileRoi.height+2*halo);
+  return inputRoi & cv::Rect(0, 0, basemapSize.width, basemapSize.height);
+}
+
+/// Upsample one tile of the basemap.
+/// - tileRoi is in basemap pixels.
+/// - input holds the basemap pixels inside inputRoi, see getTileInputRoi.
+void upsampleTile(const cv::Mat &input, const cv::Rect &inputRoi, const cv::Size &basemapSize,
+                  const cv::Rect &tileRoi, const Options &opt, cv::Mat &output)
+{
+  const int outputCol    = static_cast<int>(round(tileRoi.x      * opt.scale));
+  const int outputRow    = static_cast<int>(round(tileRoi.y      * opt.scale));
+  const int outputWidth  = static_cast<int>(round(tileRoi.width  * opt.scale));
+  const int outputHeight = static_cast<int>(round(tileRoi.height * opt.scale));
+
+  ResampleTaps columnTaps, rowTaps;
+  computeResampleTaps(outputCol, outputWidth,  inputRoi.x, inputRoi.width,  basemapSize.width,
+                      opt.scale, opt.blur, columnTaps);
+  computeResampleTaps(outputRow, outputHeight, inputRoi.y, inputRoi.height, basemapSize.height,
+                      opt.scale, opt.blur, rowTaps);
+
+  // Expand the few input rows to full width first so the vertical pass does the least work
+  cv::Mat expandedRows(input.rows, outputWidth, CV_32FC3);
+  cv::parallel_for_(cv::Range(0, input.rows), HorizontalResampler(input, columnTaps, expandedRows));
+
+  output.create(outputHeight, outputWidth, CV_8UC3);
+  cv::parallel_for_(cv::Range(0, outputHeight), VerticalResampler(expandedRows, rowTaps, output));
+}
+
+/// Write a BGR tile to a GeoTIFF.
+/// - The georeference is the basemap georeference shifted to the tile and scaled up.
+bool writeGeoTiffTile(const std::string &outputPath, const cv::Mat &tile,
+                      const double basemapTransform[6], const std::string &projection,
+                      const cv::Rect &tileRoi, const Options &opt)
+{
+  double transform[6];
+  transform[0] = basemapTransform[0] + tileRoi.x*basemapTransform[1] + tileRoi.y*basemapTransform[2];
+  transform[1] = basemapTransform[1] / opt.scale;
+  transform[2] = basemapTransform[2] / opt.scale;
+  transform[3] = basemapTransform[3] + tileRoi.x*basemapTransform[4] + tileRoi.y*basemapTransform[5];
+  transform[4] = basemapTransform[4] / opt.scale;
+  transform[5] = basemapTransform[5] / opt.scale;
+
+  // The backup tiles become the output tiles, so they are stored the same way
+  const GeoTiffOptions options(opt.block_size, opt.compression, true, opt.compression_level, opt.num_threads,
+                               opt.direct_io);
+  return writeGeoTiff(outputPath, tile, options, transform, projection);
+}
+
+//--------------------------------------------------------
+
+// Handling input
+void handle_arguments( int argc, char *argv[], Options& opt ) {
+  std::vector<std::string> positional_args;
+
+  po::options_description general_options("");
+  general_options.add_options()
+    ("read-path",   po::value(&opt.read_path), "Read the basemap pixels from this path, such as a mapped basemap crop.")
+    ("tile",        po::value(&opt.tiles)->composing(), "Generate the tile at <row>,<col>.  May be repeated.")
+    ("tile-list",   po::value(&opt.tile_list_file), "Generate the tiles listed in this file, one <row>,<col> per line.")
+    ("scale",       po::value(&opt.scale)->default_value(128.0), "Output resolution divided by basemap resolution.")
+    ("blur",        po::value(&opt.blur)->default_value(0.88), "Filter blur factor, greater than one is blurrier.")
+    ("tile-size",   po::value(&opt.tile_size)->default_value(45), "Size of the tiles in basemap pixels.")
+    ("block-size",  po::value(&opt.block_size)->default_value(512), "Size of the blocks in the output GeoTIFFs.")
+    ("compression", po::value(&opt.compression)->default_value("DEFLATE"),
+                    "Compression of the output GeoTIFFs: NONE, LZW, DEFLATE, ZSTD, or JPEG.")
+    ("compression-level", po::value(&opt.compression_level)->default_value(-1),
+                    "DEFLATE or ZSTD level, or JPEG quality.  -1 uses the codec default.")
+    ("direct-io",   po::bool_switch(&opt.direct_io)->default_value(false),
+                    "Write the tiles with O_DIRECT so they do not fill the page cache.")
+    ("threads",     po::value(&opt.num_threads)->default_value(boost::thread::hardware_concurrency()),
+                    "Number of threads to use.")
+    ("help,h",      "Display this help message");
+
+  po::options_description positional("");
+  positional.add_options()
+    ("input-files", po::value<std::vector<std::string> >(&positional_args));
+
+  po::positional_options_description positional_desc;
+  positional_desc.add("input-files", -1);
+
+  po::options_description all_options;
+  all_options.add(general_options).add(positional);
+
+  po::variables_map vm;
+  try {
+    po::store( po::command_line_parser( argc, argv ).options(all_options).positional(positional_desc).run(), vm );
+    po::notify( vm );
+  } catch (const po::error& e) {
+    vw_throw( ArgumentErr() << "Error parsing input:\n\t"
+              << e.what() << general_options );
+  }
+
+  std::ostringstream usage;
+  usage << "Usage: " << argv[0] << " [options] <basemap path> <output folder>\n"
+        << "  All of the tiles are generated if none are specified.\n";
+
+  if ( vm.count("help") )
+    vw_throw( ArgumentErr() << usage.str() << general_options );
+  if ( positional_args.size() != 2 )
+    vw_throw( ArgumentErr() << "Wrong number of input files!\n" << usage.str() << general_options );
+  if ( (opt.scale < 1.0) || (opt.blur <= 0.0) || (opt.tile_size < 1) || (opt.block_size % 16 != 0) )
+    vw_throw( ArgumentErr() << "Invalid settings!\n" << usage.str() << general_options );
+  if ( opt.num_threads < 1 )
+    opt.num_threads = 1;
+
+  opt.basemap_file  = positional_args[0];
+  opt.output_folder = positional_args[1];
+  if (opt.read_path.empty())
+    opt.read_path = opt.basemap_file;
+}
+
+/// Parse the requested tiles, or select every tile if none were requested.
+bool getTileList(const Options &opt, const int numTileRows, const int numTileCols,
+                 std::vector<cv::Point> &tiles)
+{
+  std::vector<std::string> tileStrings = opt.tiles;
+  if (!opt.tile_list_file.empty())
+  {
+    std::ifstream file(opt.tile_list_file.c_str());
+    if (!file)
+    {
+      printf("Failed to open tile list %s\n", opt.tile_list_file.c_str());
+      return false;
+    }
+    std::string line;
+    while (std::getline(file, line))
+      if (!line.empty())
+        tileStrings.push_back(line);
+  }
+
+  if (tileStrings.empty())
+  {
+    for (int row=0; row<numTileRows; ++row)
+      for (int col=0; col<numTileCols; ++col)
+        tiles.push_back(cv::Point(col, row));
+    return true;
+  }
+  for (size_t i=0; i<tileStrings.size(); ++i)
+  {
+    int row, col;
+    if ((sscanf(tileStrings[i].c_str(), "%d,%d", &row, &col) != 2) ||
+        (row < 0) || (col < 0) || (row >= numTileRows) || (col >= numTileCols))
+    {
+      printf("Invalid tile: %s\n", tileStrings[i].c_str());
+      return false;
+    }
+    tiles.push_back(cv::Point(col, row));
+  }
+  return true;
+}
+
+
+int main( int argc, char *argv[] ) {
+
+  Options opt;
+  handle_arguments( argc, argv, opt );
+  cv::setNumThreads(opt.num_threads);
+
+  // The georeference always comes from the original basemap
+  GDALAllRegister();
+  GDALDatasetH basemapDataset = GDALOpen(opt.basemap_file.c_str(), GA_ReadOnly);
+  if (!basemapDataset)
+  {
+    printf("Failed to open %s with GDAL!\n", opt.basemap_file.c_str());
+    return -1;
+  }
+  double basemapTransform[6];
+  GDALGetGeoTransform(basemapDataset, basemapTransform);
+  const std::string projection = GDALGetProjectionRef(basemapDataset);
+  const cv::Size basemapSize(GDALGetRasterXSize(basemapDataset), GDALGetRasterYSize(basemapDataset));
+  GDALClose(basemapDataset);
+
+  const int numTileRows = basemapSize.height / opt.tile_size;
+  const int numTileCols = basemapSize.width  / opt.tile_size;
+  std::vector<cv::Point> tiles;
+  if (!getTileList(opt, numTileRows, numTileCols, tiles))
+    return -1;
+  vw_out() << "Generating " << tiles.size() << " tiles.\n";
+
+  TerminalProgressCallback progress("upsampleBasemapTiles","Upsampling:");
+  const int LOAD_RGB = 1;
+  cv::Mat input, output;
+  for (size_t i=0; i<tiles.size(); ++i)
+  {
+    const cv::Rect tileRoi(tiles[i].x*opt.tile_size, tiles[i].y*opt.tile_size,
+                           opt.tile_size, opt.tile_size);
+
+    // Read only the part of the basemap this tile uses
+    cv::Rect inputRoi = getTileInputRoi(tileRoi, basemapSize, opt);
+    const cv::Rect neededRoi = inputRoi;
+    if (!readOpenCvImageRegion(opt.read_path, inputRoi, input, LOAD_RGB))
+      return -1;
+    if (inputRoi != neededRoi)
+    {
+      printf("The basemap at %s is smaller than %s!\n", opt.read_path.c_str(), opt.basemap_file.c_str());
+      return -1;
+    }
+    upsampleTile(input, inputRoi, basemapSize, tileRoi, opt, output);
+
+    char name[64];
+    snprintf(name, sizeof(name), "output_tile_%04d_%04d.tif", tiles[i].y, tiles[i].x);
+    if (!writeGeoTiffTile(opt.output_folder + "/" + name, output, basemapTransform, projection, tileRoi, opt))
+      return -1;
+    progress.report_fractional_progress(i+1, tiles.size());
+  }
+  progress.report_finished();
+
+  return 0;
+}
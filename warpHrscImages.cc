@@ -0,0 +1,136 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2006-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NASA Vision Workbench is licensed under the Apache License,
+//  Version 2.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <vw/Core/FundamentalTypes.h>
+#include <vw/Core/Log.h>
+#include <vw/Image/ImageIO.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/UtilityViews.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/Cartography/GeoReference.h>
+
+#include <vector>
+
+#include <HrscCommon.h>
+
+#include <boost/program_options.hpp>
+#include <boost/thread.hpp>
+namespace po = boost::program_options;
+
+using namespace vw;
+
+/**
+  This program warps all of the HRSC channel images into the output projection
+  at once, replacing one gdalwarp -r cubicspline call per channel.
+
+  - Each output covers just its own input image, the same extent gdalwarp picks.
+  - For each output block the projection is only evaluated on a coarse grid and
+    the source coordinates of the other pixels are bilinearly interpolated from it.
+    Channels with the same georeference and size share that grid and are
+    resampled together in one pass.
+  - Each channel is resampled with a cubic B-spline kernel, which is what
+    gdalwarp's cubicspline mode uses.  Zero valued source pixels are treated as
+    nodata and are not blended into valid pixels.
+  - Blocks are processed by a pool of threads and written to tiled GeoTIFFs.
+
+  Usage: warpHrscImages --t-srs <proj4> --tr <meters per pixel> [<input> <output>]...
+*/
+
+//======================================================================================================
+
+struct Options {
+  // Input
+  std::vector<std::string> input_files;
+  std::vector<std::string> output_files;
+
+  // Settings
+  std::string proj4;
+  double      meters_per_pixel;
+  int         num_threads;
+};
+
+
+//--------------------------------------------------------
+
+// Handling input
+void handle_arguments( int argc, char *argv[], Options& opt ) {
+  size_t cache_size;
+  std::vector<std::string> positional_args;
+
+  po::options_description general_options("");
+  general_options.add_options()
+    ("t-srs",   po::value(&opt.proj4), "Output projection as a proj4 string.")
+    ("tr",      po::value(&opt.meters_per_pixel), "Output resolution in meters per pixel.")
+    ("threads", po::value(&opt.num_threads)->default_value(boost::thread::hardware_concurrency()),
+                "Number of threads to use.")
+    ("cache",   po::value(&cache_size)->default_value(1024), "Source data cache size, in megabytes.")
+    ("help,h",  "Display this help message");
+
+  po::options_description positional("");
+  positional.add_options()
+    ("input-files", po::value<std::vector<std::string> >(&positional_args));
+
+  po::positional_options_description positional_desc;
+  positional_desc.add("input-files", -1);
+
+  po::options_description all_options;
+  all_options.add(general_options).add(positional);
+
+  po::variables_map vm;
+  try {
+    po::store( po::command_line_parser( argc, argv ).options(all_options).positional(positional_desc).run(), vm );
+    po::notify( vm );
+  } catch (const po::error& e) {
+    vw_throw( ArgumentErr() << "Error parsing input:\n\t"
+              << e.what() << general_options );
+  }
+
+  std::ostringstream usage;
+  usage << "Usage: " << argv[0] << " --t-srs <proj4> --tr <meters per pixel> [<input path> <output path>]...\n";
+
+  if ( vm.count("help") )
+    vw_throw( ArgumentErr() << usage.str() << general_options );
+  if ( positional_args.empty() || (positional_args.size() % 2 != 0) )
+    vw_throw( ArgumentErr() << "Input and output paths must come in pairs!\n" << usage.str() << general_options );
+  if ( opt.proj4.empty() || !vm.count("tr") )
+    vw_throw( ArgumentErr() << "The output projection and resolution are required!\n" << usage.str() << general_options );
+  if ( opt.num_threads < 1 )
+    opt.num_threads = 1;
+
+  for (size_t i=0; i<positional_args.size(); i+=2)
+  {
+    opt.input_files.push_back (positional_args[i  ]);
+    opt.output_files.push_back(positional_args[i+1]);
+  }
+
+  // Set the system cache size
+  vw_settings().set_system_cache_size( cache_size*1024*1024 );
+}
+
+
+
+int main( int argc, char *argv[] ) {
+
+  Options opt;
+  handle_arguments( argc, argv, opt );
+
+  warpHrscChannels(opt.input_files, opt.output_files, opt.proj4, opt.meters_per_pixel,
+                   opt.num_threads, "warpHrscImages");
+
+  return 0;
+}
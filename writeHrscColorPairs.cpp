@@ -41,7 +41,7 @@ bool loadInputImages(int argc, char** argv, cv::Mat &basemapImage, std::vector<c
   }
 
   // Load the HRSC mask
-  if (!readOpenCvImage(hrscMaskPath, hrscMask, LOAD_GRAY))
+  if (!readBinaryMask(hrscMaskPath, hrscMask, CV_16UC1, MASK_MAX))
       return false;
   
   // Load the spatial transform
@@ -56,70 +56,6 @@ bool loadInputImages(int argc, char** argv, cv::Mat &basemapImage, std::vector<c
   return true;
 }
 
-/// Generate a list of matched pixels for the base map and HRSC images
-/// --> Format is "baseR, baseG, baseB, R, G, B, NIR, NADIR" 
-int writeColorPairs(const cv::Mat &basemapImage, const cv::Mat &spatialTransform,
-                     const BrightnessCorrector &corrector,
-                     const std::vector<cv::Mat> hrscChannels, const cv::Mat &hrscMask,
-                     const std::string outputPath,
-                     const int sampleDist = 25)
-{
-  // Control what percentage of the pixel pairs we use
-  const int numRows = hrscMask.rows;
-  const int numCols = hrscMask.cols;
-
-  std::ofstream outputFile;
-
-  // Iterate over the pixels of the HRSC image
-  bool gotValue;
-  cv::Vec3b baseValues;
-  size_t numPairs = 0;
-  for (int r=0; r<numRows; r+=sampleDist)
-  {
-    for (int c=0; c<numCols; c+=sampleDist)
-    {         
-      // Skip masked out HRSC pixels
-      if (hrscMask.at<MASK_DATA_TYPE>(r,c) == 0)
-        continue;
-    
-      // Compute the equivalent location in the basemap image
-      float baseX, baseY;
-      affineTransform(spatialTransform, c, r, baseX, baseY);
-      
-      // Extract all of the basemap values at that location
-      baseValues = interpPixelRgb(basemapImage, baseX, baseY, gotValue);
-      if (!gotValue) 
-        continue; // Failed to interpolate a value here
-      
-      // Write all the values to a line in the file
-      if (numPairs == 0)
-        outputFile.open(outputPath.c_str(), std::ofstream::out);
-      
-      for (size_t i=0; i<NUM_BASE_CHANNELS; ++i)
-      {
-        outputFile << static_cast<int>(baseValues[i]) <<", "; // Cast to int so we don't print ASCII
-      }
-      // The HRSC values have a brightness correction applied
-      for (size_t i=0; i<NUM_HRSC_CHANNELS-1; ++i)
-      {
-        outputFile << static_cast<int>(corrector.correctPixel(hrscChannels[i].at<unsigned char>(r,c), r))  <<", ";
-      }
-      outputFile << static_cast<int>(corrector.correctPixel(hrscChannels[NUM_HRSC_CHANNELS-1].at<unsigned char>(r,c), r)) << std::endl;
-      numPairs++;
-  
-    } // End col loop
-  } // End row loop
-  
-  if (numPairs > 0)
-    outputFile.close();
-
-  //std::cout << "numPairs = " << numPairs << std::endl;
-  return numPairs;
-}
-
-//============================================================================
-
-
 int main(int argc, char** argv)
 {
   // Check input arguments
@@ -139,24 +75,22 @@ int main(int argc, char** argv)
 
   // TODO: The spatial transform should be from HRSC to BASEMAP
 
-  // Generate the list of color pairs
+  // Generate the list of color pairs, reducing the sample distance until we get enough.
   //printf("Writing pixel pairs...\n");
-  const int MIN_PIXEL_PAIRS = 80;
-  int sampleDist = 64;
-  int numSamples = 0;
-  while (sampleDist > 0)
+  const size_t MIN_PIXEL_PAIRS = 80;
+  std::vector<HrscColorPair> pairs;
+  const size_t numSamples = collectColorPairs(basemapImage, spatialTransform, corrector,
+                                              hrscChannels, hrscMask, pairs, 0, MIN_PIXEL_PAIRS);
+  if ((numSamples > 0) && !writeColorPairsFile(outputPath, pairs))
   {
-    numSamples = writeColorPairs(basemapImage, spatialTransform, corrector, hrscChannels, hrscMask, outputPath, sampleDist);
-        
-    if (numSamples >= MIN_PIXEL_PAIRS) // We got enough samples, we are finished!
-        return 0; 
-    // Otherwise reduce the sample distance 
-    sampleDist /= 4;
-    printf("Trying again with sample distance = %d\n", sampleDist);
+    printf("Failed to write color pairs to %s\n", outputPath.c_str());
+    return -1;
   }
+  if (numSamples >= MIN_PIXEL_PAIRS) // We got enough samples, we are finished!
+    return 0;
   if (numSamples > 0) // At least we got something, for now we just use this.
   {
-    printf("Warning: Only found %d color pairs!\n", numSamples);
+    printf("Warning: Only found %d color pairs!\n", static_cast<int>(numSamples));
     return 0;
   }
   